@@ -0,0 +1,74 @@
+#include "Bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "MqttLog.h"
+
+static void logToStderr(uint8_t, const char* line) {
+  fprintf(stderr, "%s\n", line);
+}
+
+void benchLogToStderr() {
+  mqttLogSetSink(logToStderr);
+}
+
+BenchRunner::BenchRunner(const char* suite, int argc, char** argv) : _suite(suite), _minTimeMs(50), _samples(5) {
+  benchLogToStderr();
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--filter")) {
+      _filter = argv[i + 1];
+    } else if (!strcmp(argv[i], "--min-time")) {
+      _minTimeMs = static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10));
+    } else if (!strcmp(argv[i], "--samples")) {
+      _samples = std::max<uint32_t>(1, static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10)));
+    } else if (!strcmp(argv[i], "--out")) {
+      _out = argv[i + 1];
+    }
+  }
+}
+
+bool BenchRunner::selected(const char* name) const {
+  return _filter.empty() || strstr(name, _filter.c_str()) != nullptr;
+}
+
+void BenchRunner::record(const char* name, uint64_t iterations, std::vector<double>& nsPerOp, uint64_t allocs,
+                         uint64_t bytes) {
+  std::sort(nsPerOp.begin(), nsPerOp.end());
+  Result result;
+  result.name = name;
+  result.iterations = iterations;
+  result.nsPerOp = nsPerOp[nsPerOp.size() / 2];
+  result.nsPerOpMin = nsPerOp.front();
+  double ops = static_cast<double>(iterations) * nsPerOp.size();
+  result.allocsPerOp = allocs / ops;
+  result.bytesPerOp = bytes / ops;
+  _results.push_back(result);
+  fprintf(stderr, "%-32s %12.1f ns/op %8.2f allocs/op %10.1f B/op\n", name, result.nsPerOp, result.allocsPerOp,
+          result.bytesPerOp);
+}
+
+int BenchRunner::finish() {
+  FILE* out = stdout;
+  if (!_out.empty()) {
+    out = fopen(_out.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "cannot write %s\n", _out.c_str());
+      return 1;
+    }
+  }
+  fprintf(out, "{\"suite\":\"%s\",\"compiler\":\"%s\",\"min_time_ms\":%u,\"samples\":%u,\"results\":[", _suite.c_str(),
+          __VERSION__, _minTimeMs, _samples);
+  for (size_t i = 0; i < _results.size(); i++) {
+    const Result& r = _results[i];
+    fprintf(out,
+            "%s\n{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,"
+            "\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f}",
+            i ? "," : "", r.name.c_str(), static_cast<unsigned long long>(r.iterations), r.nsPerOp, r.nsPerOpMin,
+            r.allocsPerOp, r.bytesPerOp);
+  }
+  fprintf(out, "\n]}\n");
+  if (out != stdout) fclose(out);
+  return 0;
+}
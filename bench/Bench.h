@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "AllocCounter.h"
+
+// Minimal benchmark runner for the native bench environments. Each case is timed in
+// batches sized to run for at least `minTimeMs`, repeated `samples` times; the median
+// batch gives ns/op. Heap allocations made by the benchmarking thread are counted through
+// the AllocCounter hooks, so allocs/op and bytes/op are exact; like the tests they leave
+// out the esp-mqtt stand-in's own allocations.
+//
+// Command line: --filter <substring>  run only matching cases
+//               --min-time <ms>       minimum duration of one batch (default 50)
+//               --samples <n>         batches per case (default 5)
+//               --out <file>          write the JSON report to a file instead of stdout
+
+// Route client log lines to stderr; stdout carries the JSON report. BenchRunner does this
+// itself, tools without a runner call it first thing.
+void benchLogToStderr();
+
+// Keep the compiler from eliding a computation whose result is otherwise unused
+template <typename T>
+inline void benchKeep(const T& value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+class BenchRunner {
+public:
+  struct Result {
+    std::string name;
+    uint64_t iterations; // per batch
+    double nsPerOp;      // median batch
+    double nsPerOpMin;   // fastest batch
+    double allocsPerOp;
+    double bytesPerOp;
+  };
+
+  BenchRunner(const char* suite, int argc, char** argv);
+
+  // Times `fn()` (one operation per call). Skipped when it does not match --filter.
+  template <typename Fn>
+  void run(const char* name, Fn&& fn);
+
+  // False when --filter excludes `name`; lets a suite skip expensive setup
+  bool selected(const char* name) const;
+  const std::vector<Result>& results() const { return _results; }
+  // Writes the JSON report; returns the process exit code
+  int finish();
+
+private:
+  void record(const char* name, uint64_t iterations, std::vector<double>& nsPerOp, uint64_t allocs, uint64_t bytes);
+
+  std::string _suite;
+  std::string _filter;
+  std::string _out;
+  uint32_t _minTimeMs;
+  uint32_t _samples;
+  std::vector<Result> _results;
+};
+
+template <typename Fn>
+void BenchRunner::run(const char* name, Fn&& fn) {
+  typedef std::chrono::steady_clock Clock;
+  if (!selected(name)) return;
+
+  // Warm up and size the batch: double until one batch takes at least the minimum time
+  const auto minTime = std::chrono::milliseconds(_minTimeMs);
+  uint64_t iterations = 1;
+  for (;;) {
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < iterations; i++) fn();
+    auto elapsed = Clock::now() - start;
+    if (elapsed >= minTime || iterations >= (1ull << 40)) break;
+    if (elapsed < minTime / 16) {
+      iterations *= 16;
+    } else {
+      iterations *= 2;
+    }
+  }
+
+  std::vector<double> nsPerOp;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+  for (uint32_t s = 0; s < _samples; s++) {
+    AllocCounts before = allocThreadCounts();
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < iterations; i++) fn();
+    auto elapsed = Clock::now() - start;
+    AllocCounts after = allocThreadCounts();
+    allocs += after.allocs - before.allocs;
+    bytes += after.bytes - before.bytes;
+    nsPerOp.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+  }
+  record(name, iterations, nsPerOp, allocs, bytes);
+}
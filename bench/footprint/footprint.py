@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Flash, static RAM and heap footprint of MqttClient per configuration.
+
+Builds the footprint_* environments of platformio.ini (bench/footprint/footprint.cpp),
+reads the size each build wrote (footprint_size.py) and reports it against the WiFi-only
+baseline and against the last recorded row of bench/footprint/history.csv. With --port,
+each firmware is also flashed and its serial report adds peak and steady heap.
+
+    python3 bench/footprint/footprint.py                     # table on stderr, JSON on stdout
+    python3 bench/footprint/footprint.py --port /dev/ttyUSB0 --record
+
+--record appends the results to history.csv, one row per configuration, so a feature's
+cost shows up as the step between two commits.
+"""
+
+import argparse
+import csv
+import datetime
+import json
+import os
+import subprocess
+import sys
+import time
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+HISTORY = os.path.join(ROOT, "bench", "footprint", "history.csv")
+CONFIGS = ["baseline", "minimal", "full", "tls", "tls_ws"]
+FIELDS = ["date", "commit", "config", "flash", "static_ram", "flash_delta", "ram_delta", "heap_peak", "heap_steady"]
+SERIAL_TIMEOUT_S = 90
+
+
+def build(config):
+    env = "footprint_" + config
+    subprocess.check_call(["pio", "run", "-e", env], cwd=ROOT, stdout=sys.stderr)
+    with open(os.path.join(ROOT, ".pio", "build", env, "footprint.json")) as f:
+        return json.load(f)
+
+
+def measure_heap(config, port):
+    """Flashes the configuration and waits for its FOOTPRINT line; None if none came."""
+    import serial  # pyserial, only needed with --port
+
+    env = "footprint_" + config
+    subprocess.check_call(["pio", "run", "-e", env, "-t", "upload", "--upload-port", port], cwd=ROOT,
+                          stdout=sys.stderr)
+    deadline = time.time() + SERIAL_TIMEOUT_S
+    with serial.Serial(port, 115200, timeout=1) as link:
+        while time.time() < deadline:
+            line = link.readline().decode("utf-8", "replace").strip()
+            if line.startswith("FOOTPRINT "):
+                return json.loads(line[len("FOOTPRINT "):])
+    return None
+
+
+def last_recorded():
+    rows = {}
+    if os.path.exists(HISTORY):
+        with open(HISTORY, newline="") as f:
+            for row in csv.DictReader(f):
+                rows[row["config"]] = row
+    return rows
+
+
+def commit():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"], cwd=ROOT,
+                                       universal_newlines=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+
+def change(now, before):
+    if now is None or before in (None, ""):
+        return None
+    return now - int(before)
+
+
+def fmt(value):
+    return "-" if value is None else str(value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--config", action="append", choices=CONFIGS,
+                        help="configuration to build, repeatable (default: all)")
+    parser.add_argument("--port", help="serial port of an ESP32 to measure heap on")
+    parser.add_argument("--record", action="store_true", help="append the results to history.csv")
+    parser.add_argument("--out", help="also write the JSON report to this file")
+    args = parser.parse_args()
+
+    configs = args.config or CONFIGS
+    if "baseline" not in configs:
+        configs = ["baseline"] + configs  # deltas are against it
+
+    results = []
+    baseline = None
+    for config in configs:
+        result = build(config)
+        result["heap_peak"] = None
+        result["heap_steady"] = None
+        if args.port and config != "baseline":
+            heap = measure_heap(config, args.port)
+            if heap is None:
+                print("footprint: no report from %s on %s" % (config, args.port), file=sys.stderr)
+            elif not heap.get("connected"):
+                # A probe that never connected stops short of the handshake and the traffic
+                print("footprint: %s did not connect (wifi %s), heap not recorded" % (config, heap.get("wifi")),
+                      file=sys.stderr)
+            else:
+                result["heap_peak"] = heap["heap_peak"]
+                result["heap_steady"] = heap["heap_steady"]
+        if config == "baseline":
+            baseline = result
+        result["flash_delta"] = result["flash"] - baseline["flash"]
+        result["ram_delta"] = result["static_ram"] - baseline["static_ram"]
+        results.append(result)
+
+    previous = last_recorded()
+    for r in results:
+        prev = previous.get(r["config"], {})
+        r["flash_change"] = change(r["flash"], prev.get("flash"))
+        r["ram_change"] = change(r["static_ram"], prev.get("static_ram"))
+        r["heap_peak_change"] = change(r["heap_peak"], prev.get("heap_peak"))
+
+    print("%-10s %9s %8s %8s %8s %10s %11s %10s" % ("config", "flash", "+base", "ram", "+base", "heap_peak",
+                                                  "heap_steady", "vs last"), file=sys.stderr)
+    for r in results:
+        print("%-10s %9d %8d %8d %8d %10s %11s %10s" % (
+            r["config"], r["flash"], r["flash_delta"], r["static_ram"], r["ram_delta"], fmt(r["heap_peak"]),
+            fmt(r["heap_steady"]), fmt(r["flash_change"])), file=sys.stderr)
+
+    report = {"commit": commit(), "results": results}
+    text = json.dumps(report, indent=2)
+    print(text)
+    if args.out:
+        with open(args.out, "w") as f:
+            f.write(text + "\n")
+
+    if args.record:
+        date = datetime.date.today().isoformat()
+        exists = os.path.exists(HISTORY)
+        with open(HISTORY, "a", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=FIELDS, extrasaction="ignore")
+            if not exists:
+                writer.writeheader()
+            for r in results:
+                row = dict(r, date=date, commit=report["commit"])
+                row["heap_peak"] = "" if r["heap_peak"] is None else r["heap_peak"]
+                row["heap_steady"] = "" if r["heap_steady"] is None else r["heap_steady"]
+                writer.writerow(row)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,41 @@
+# PlatformIO extra script for the footprint_* environments: after linking, writes the
+# firmware's flash and static RAM use to $BUILD_DIR/footprint.json for footprint.py.
+# Sections are summed the way PlatformIO's own size check does (SIZEPROGREGEXP and
+# SIZEDATAREGEXP), so the figures match `pio run -t size`.
+import json
+import re
+import subprocess
+
+Import("env")  # noqa: F821
+
+
+# Fallbacks: the espressif32 platform's own expressions, matched against `size -A` lines
+FLASH_RE = r"^(?:\.iram0\.text|\.iram0\.vectors|\.dram0\.data|\.flash\.text|\.flash\.rodata|)\s+([0-9]+).*"
+RAM_RE = r"^(?:\.dram0\.data|\.dram0\.bss|\.noinit)\s+([0-9]+).*"
+
+
+def _sum(regexp, lines):
+    total = 0
+    for line in lines:
+        m = re.search(regexp, line)
+        if m:
+            total += int(m.group(1))
+    return total
+
+
+def _write_footprint(target, source, env):
+    out = subprocess.check_output([env.subst("$SIZETOOL"), "-A", "-d", str(target[0])], universal_newlines=True)
+    lines = out.splitlines()
+    flash = _sum(env.get("SIZEPROGREGEXP") or FLASH_RE, lines)
+    ram = _sum(env.get("SIZEDATAREGEXP") or RAM_RE, lines)
+    report = {
+        "config": env.subst("$PIOENV").replace("footprint_", "", 1),
+        "flash": flash,
+        "static_ram": ram,
+    }
+    with open(env.subst("$BUILD_DIR/footprint.json"), "w") as f:
+        json.dump(report, f)
+    print("footprint %s: flash %d, static RAM %d" % (report["config"], flash, ram))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", _write_footprint)
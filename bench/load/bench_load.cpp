@@ -0,0 +1,386 @@
+// Load generator and soak test: one publishing and one subscribing MqttClient push
+// traffic through a broker (the in-process LoopbackBroker unless --broker is given) and
+// the tool reports throughput, end-to-end latency percentiles, memory growth and drops.
+//
+//   --broker <uri>        external broker, e.g. mqtt://127.0.0.1:1883 (default: loopback)
+//   --size <n>|<min-max>  payload bytes, fixed or uniformly distributed (default 64, min 16)
+//   --rate <n>            messages per second, 0 = as fast as the window allows (default 1000)
+//   --topics <n>          distinct topics load/0 .. load/<n-1> (default 16)
+//   --qos <mix>           QoS weights, e.g. 0=70,1=20,2=10 (default 1=1)
+//   --window <n>          max unacknowledged QoS>0 publishes before the publisher waits (default 1000)
+//   --duration <s>        run time, 0 = until interrupted (default 10)
+//   --interval <s>        report period (default 1)
+//   --capture <file>      record the traffic of both clients for bench_replay (TrafficCapture.h)
+//   --impair <spec>       impair both clients' links, e.g. cellular or latency=150,loss=20
+//                         (see parseImpairment() in ImpairedTransport.h)
+//   --trace <prefix>      MQTT_TRACE builds (env native_trace): write the newest traced messages
+//                         as Chrome trace JSON to <prefix>-publisher.json and <prefix>-subscriber.json
+//   --trace-sampling <n>  trace one in n messages (default 1)
+//
+// Output is one JSON object per line on stdout: an interval report every --interval
+// seconds and a final {"summary":true,...} line. Latency is publish() to onMessage() in
+// microseconds, measured on one clock since both clients live in this process.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Arduino.h>
+#include "AllocCounter.h"
+#include "Bench.h"
+#include "ImpairedTransport.h"
+#include "LatencyHistogram.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "TrafficCapture.h"
+
+namespace {
+
+struct Options {
+  std::string broker;
+  uint32_t sizeMin = 64;
+  uint32_t sizeMax = 64;
+  uint32_t rate = 1000;
+  uint32_t topics = 16;
+  uint32_t qosWeight[3] = {0, 1, 0};
+  uint32_t window = 1000;
+  uint32_t durationS = 10;
+  uint32_t intervalS = 1;
+  std::string capture;
+  bool impaired = false;
+  ImpairmentProfile impairment;
+  std::string trace;
+  uint16_t traceSampling = 1;
+};
+
+// Payload header written by the publisher, followed by filler up to the message size
+struct Stamp {
+  uint32_t seq;
+  uint64_t sentUs;
+} __attribute__((packed));
+
+const uint32_t kMinSize = sizeof(Stamp) + 4;
+// Sequence numbers seen recently, to tell duplicates (QoS 1 redelivery) from new messages
+const size_t kSeenSlots = 1 << 16;
+
+std::atomic<bool> sStop(false);
+
+void onSignal(int) {
+  sStop = true;
+}
+
+uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+long rssKb() {
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (!f) return -1;
+  long pages = 0;
+  long resident = 0;
+  int n = fscanf(f, "%ld %ld", &pages, &resident);
+  fclose(f);
+  return n == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+bool parseQosMix(const char* spec, uint32_t weight[3]) {
+  weight[0] = weight[1] = weight[2] = 0;
+  while (*spec) {
+    char* end;
+    unsigned long qos = strtoul(spec, &end, 10);
+    if (end == spec || *end != '=' || qos > 2) return false;
+    spec = end + 1;
+    weight[qos] = static_cast<uint32_t>(strtoul(spec, &end, 10));
+    if (end == spec) return false;
+    spec = *end == ',' ? end + 1 : end;
+  }
+  return weight[0] + weight[1] + weight[2] > 0;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char* key = argv[i];
+    const char* value = argv[i + 1];
+    if (!strcmp(key, "--broker")) {
+      opt.broker = value;
+    } else if (!strcmp(key, "--size")) {
+      char* end;
+      opt.sizeMin = opt.sizeMax = static_cast<uint32_t>(strtoul(value, &end, 10));
+      if (*end == '-') opt.sizeMax = static_cast<uint32_t>(strtoul(end + 1, nullptr, 10));
+    } else if (!strcmp(key, "--rate")) {
+      opt.rate = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    } else if (!strcmp(key, "--topics")) {
+      opt.topics = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    } else if (!strcmp(key, "--qos")) {
+      if (!parseQosMix(value, opt.qosWeight)) return false;
+    } else if (!strcmp(key, "--window")) {
+      opt.window = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    } else if (!strcmp(key, "--duration")) {
+      opt.durationS = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    } else if (!strcmp(key, "--interval")) {
+      opt.intervalS = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    } else if (!strcmp(key, "--capture")) {
+      opt.capture = value;
+    } else if (!strcmp(key, "--impair")) {
+      if (!parseImpairment(value, opt.impairment)) return false;
+      opt.impaired = true;
+#ifdef MQTT_TRACE
+    } else if (!strcmp(key, "--trace")) {
+      opt.trace = value;
+    } else if (!strcmp(key, "--trace-sampling")) {
+      opt.traceSampling = static_cast<uint16_t>(strtoul(value, nullptr, 10));
+#endif
+    } else {
+      return false;
+    }
+  }
+  if (opt.sizeMin < kMinSize) opt.sizeMin = kMinSize;
+  if (opt.sizeMax < opt.sizeMin) opt.sizeMax = opt.sizeMin;
+  if (!opt.topics) opt.topics = 1;
+  if (!opt.intervalS) opt.intervalS = 1;
+  return true;
+}
+
+// Receive side, fed from the subscriber's esp-mqtt thread
+struct Receiver {
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> duplicates{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> corrupt{0};
+  std::vector<uint32_t> seen = std::vector<uint32_t>(kSeenSlots, UINT32_MAX);
+  LatencyHistogram total;
+  LatencyHistogram interval;
+
+  void onMessage(const char* payload, size_t length) {
+    uint64_t now = nowUs();
+    Stamp stamp;
+    if (length < sizeof(Stamp)) {
+      corrupt++;
+      return;
+    }
+    memcpy(&stamp, payload, sizeof(stamp));
+    uint32_t& slot = seen[stamp.seq & (kSeenSlots - 1)];
+    if (slot == stamp.seq) {
+      duplicates++;
+      return;
+    }
+    slot = stamp.seq;
+    uint64_t latency = now - stamp.sentUs;
+    total.record(latency > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(latency));
+    interval.record(latency > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(latency));
+    bytes += length;
+    received++;
+  }
+};
+
+bool waitConnected(MqttClient& client, uint32_t timeoutMs) {
+  for (uint32_t waited = 0; waited < timeoutMs && !client.isConnected(); waited += 10) delay(10);
+  return client.isConnected();
+}
+
+bool connectClient(MqttClient& client, const Options& opt, const char* clientId) {
+  if (opt.broker.empty()) {
+    client.setServer("load-broker", 1883);
+  } else {
+    client.begin(opt.broker.c_str());
+  }
+  client.setKeepalive(30);
+  return client.connect(clientId) && waitConnected(client, 5000);
+}
+
+uint32_t counter(const MqttMetricsSnapshot& snap, MqttCounter c) {
+  return snap.counters[static_cast<size_t>(c)];
+}
+
+#ifdef MQTT_TRACE
+bool writeTrace(MqttClient& client, const std::string& path) {
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) return false;
+  bool ok = client.trace().writeChromeTrace(f);
+  return fclose(f) == 0 && ok;
+}
+#endif
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--broker uri] [--size n|min-max] [--rate n] [--topics n] [--qos 0=w,1=w,2=w] "
+                    "[--window n] [--duration s] [--interval s] [--capture file] [--impair spec] "
+                    "[--trace prefix] [--trace-sampling n]\n", argv[0]);
+    return 2;
+  }
+  benchLogToStderr();
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  LoopbackBroker broker;
+  if (opt.broker.empty() && !broker.listenPipe("load-broker")) {
+    fprintf(stderr, "cannot start the loopback broker\n");
+    return 1;
+  }
+
+  ImpairedNetwork network(opt.impairment);
+  if (opt.impaired) network.install();
+
+  Receiver receiver;
+  MqttClient subscriber;
+  subscriber.onMessage([&](const char*, const char* payload, size_t length) { receiver.onMessage(payload, length); });
+  subscriber.subscribe("load/#", 2);
+  MqttClient publisher;
+#ifdef MQTT_TRACE
+  subscriber.setTraceSampling(opt.trace.empty() ? 0 : opt.traceSampling);
+  publisher.setTraceSampling(opt.trace.empty() ? 0 : opt.traceSampling);
+#endif
+  if (!connectClient(subscriber, opt, "load-subscriber") || !connectClient(publisher, opt, "load-publisher")) {
+    fprintf(stderr, "cannot connect to %s\n", opt.broker.empty() ? "the loopback broker" : opt.broker.c_str());
+    return 1;
+  }
+  delay(100); // let the SUBACK land before the first publish
+
+  // Large ring: the main loop flushes it every few milliseconds at full rate
+  TrafficCapture capture(1 << 22);
+  FILE* captureFile = nullptr;
+  if (!opt.capture.empty()) {
+    captureFile = fopen(opt.capture.c_str(), "wb");
+    if (!captureFile) {
+      fprintf(stderr, "cannot write %s\n", opt.capture.c_str());
+      return 1;
+    }
+    capture.setMaxPayload(opt.sizeMax);
+    capture.setSink([&](const uint8_t* data, size_t len) { fwrite(data, 1, len, captureFile); });
+    publisher.setCapture(&capture);
+    subscriber.setCapture(&capture);
+    capture.start(micros());
+  }
+
+  std::vector<std::string> topics;
+  for (uint32_t i = 0; i < opt.topics; i++) topics.push_back("load/" + std::to_string(i));
+  std::vector<char> payload(opt.sizeMax, 'x');
+  std::mt19937 rng(12345);
+  std::uniform_int_distribution<uint32_t> sizeDist(opt.sizeMin, opt.sizeMax);
+  uint32_t qosTotal = opt.qosWeight[0] + opt.qosWeight[1] + opt.qosWeight[2];
+  std::uniform_int_distribution<uint32_t> qosDist(0, qosTotal - 1);
+
+  uint64_t sent = 0;
+  uint64_t failed = 0;
+  uint64_t throttled = 0; // times the publisher waited for the in-flight window
+  uint32_t seq = 0;
+  const int64_t heapStart = allocLiveBytes();
+  const long rssStart = rssKb();
+  const uint64_t startUs = nowUs();
+  const uint64_t periodUs = opt.rate ? 1000000 / opt.rate : 0;
+  uint64_t nextSendUs = startUs;
+  uint64_t nextReportUs = startUs + opt.intervalS * 1000000ull;
+  uint64_t lastSent = 0;
+  uint64_t lastReceived = 0;
+
+  for (;;) {
+    uint64_t now = nowUs();
+    bool done = sStop || (opt.durationS && now - startUs >= opt.durationS * 1000000ull);
+    if (now >= nextReportUs || done) {
+      MqttMetricsSnapshot snap;
+      publisher.metrics(snap);
+      LatencyHistogram interval(receiver.interval);
+      receiver.interval.reset();
+      uint64_t received = receiver.received.load();
+      double seconds = opt.intervalS;
+      printf("{\"t\":%.1f,\"sent\":%llu,\"received\":%llu,\"send_rate\":%.0f,\"recv_rate\":%.0f,\"p50\":%u,"
+             "\"p99\":%u,\"p999\":%u,\"max\":%u,\"in_flight\":%d,\"outbox_bytes\":%d,\"failed\":%llu,"
+             "\"heap_growth\":%lld,\"rss_kb\":%ld}\n",
+             (now - startUs) / 1e6, static_cast<unsigned long long>(sent), static_cast<unsigned long long>(received),
+             (sent - lastSent) / seconds, (received - lastReceived) / seconds, interval.percentile(50),
+             interval.percentile(99), interval.percentile(99.9), interval.max(), snap.inFlight, snap.outboxBytes,
+             static_cast<unsigned long long>(failed), static_cast<long long>(allocLiveBytes() - heapStart), rssKb());
+      fflush(stdout);
+      lastSent = sent;
+      lastReceived = received;
+      nextReportUs += opt.intervalS * 1000000ull;
+    }
+    if (done) break;
+    if (captureFile && capture.pending() > (1 << 20)) capture.flush();
+
+    if (periodUs && now < nextSendUs) {
+      uint64_t ahead = nextSendUs - now;
+      if (ahead > 200) std::this_thread::sleep_for(std::chrono::microseconds(ahead - 100));
+      continue;
+    }
+    MqttMetricsSnapshot snap;
+    publisher.metrics(snap);
+    if (snap.inFlight >= static_cast<int32_t>(opt.window)) {
+      throttled++;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+
+    uint32_t pick = qosDist(rng);
+    int qos = pick < opt.qosWeight[0] ? 0 : pick < opt.qosWeight[0] + opt.qosWeight[1] ? 1 : 2;
+    uint32_t size = sizeDist(rng);
+    Stamp stamp = {seq, nowUs()};
+    memcpy(payload.data(), &stamp, sizeof(stamp));
+    const std::string& topic = topics[seq % topics.size()];
+    if (publisher.publishQos(topic.c_str(), static_cast<const void*>(payload.data()), size, qos) < 0) {
+      failed++;
+    } else {
+      sent++;
+    }
+    seq++;
+    nextSendUs += periodUs;
+    // Fell far behind (e.g. the window was full): do not burst to catch up
+    if (periodUs && now > nextSendUs + 100 * periodUs) nextSendUs = now;
+  }
+
+  // Drain: wait for in-flight messages before counting drops. Rates are over the run only.
+  uint64_t elapsedUs = nowUs() - startUs;
+  MqttMetricsSnapshot pub;
+  MqttMetricsSnapshot sub;
+  for (int i = 0; i < 500; i++) {
+    subscriber.metrics(sub);
+    if (receiver.received.load() + counter(sub, MqttCounter::DropOversize) >= sent) break;
+    delay(10);
+  }
+  uint64_t received = receiver.received.load();
+  publisher.metrics(pub);
+  subscriber.metrics(sub);
+  double seconds = elapsedUs / 1e6;
+  printf("{\"summary\":true,\"seconds\":%.1f,\"sent\":%llu,\"received\":%llu,\"dropped\":%llu,\"duplicates\":%llu,"
+         "\"failed\":%llu,\"throttled\":%llu,\"msgs_per_s\":%.0f,\"mbytes_per_s\":%.3f,\"p50\":%u,\"p99\":%u,"
+         "\"p999\":%u,\"max\":%u,\"reconnects\":%u,\"receive_drops\":%u,\"link_resets\":%u,\"link_stalls\":%u,"
+         "\"heap_growth\":%lld,\"rss_growth_kb\":%ld}\n",
+         seconds, static_cast<unsigned long long>(sent), static_cast<unsigned long long>(received),
+         static_cast<unsigned long long>(sent > received ? sent - received : 0),
+         static_cast<unsigned long long>(receiver.duplicates.load()), static_cast<unsigned long long>(failed),
+         static_cast<unsigned long long>(throttled), received / seconds, receiver.bytes.load() / seconds / 1e6,
+         receiver.total.percentile(50), receiver.total.percentile(99), receiver.total.percentile(99.9),
+         receiver.total.max(),
+         counter(pub, MqttCounter::Connects) + counter(sub, MqttCounter::Connects) - 2,
+         counter(sub, MqttCounter::DropOversize) + counter(sub, MqttCounter::DropFiltered), network.stats().resets,
+         network.stats().stalls,
+         static_cast<long long>(allocLiveBytes() - heapStart), rssKb() - rssStart);
+  publisher.disconnect();
+  subscriber.disconnect();
+  if (captureFile) {
+    publisher.setCapture(nullptr);
+    subscriber.setCapture(nullptr);
+    capture.flush();
+    if (capture.lost()) fprintf(stderr, "capture: %u records lost\n", (unsigned)capture.lost());
+    fclose(captureFile);
+  }
+#ifdef MQTT_TRACE
+  if (!opt.trace.empty() &&
+      (!writeTrace(publisher, opt.trace + "-publisher.json") || !writeTrace(subscriber, opt.trace + "-subscriber.json"))) {
+    fprintf(stderr, "cannot write the trace to %s-*.json\n", opt.trace.c_str());
+    return 1;
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,191 @@
+// Microbenchmarks for the client's hot paths: URI handling, topic filter matching,
+// topic accounting, inbound dispatch, payload encoding and publish enqueue. Prints a
+// table on stderr and a JSON report (see Bench.h) on stdout or to --out.
+
+#include <stdio.h>
+#include <string.h>
+#include <Arduino.h>
+#include "Bench.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "MqttCodec.h"
+#include "StatsReport.h"
+#include "SubscriptionRegistry.h"
+#include "TopicSketch.h"
+#include "UriUtils.h"
+
+static void benchUri(BenchRunner& bench) {
+  UriParts parts;
+  bench.run("uri.parse.mqtt", [&] {
+    parseMqttUri("mqtt://broker.example.com:1883", parts);
+    benchKeep(parts);
+  });
+  bench.run("uri.parse.wss_path", [&] {
+    parseMqttUri("wss://broker.example.com:8884/mqtt/ws", parts);
+    benchKeep(parts);
+  });
+  parseMqttUri("wss://broker.example.com:8884/mqtt/ws", parts);
+  bench.run("uri.build.wss_path", [&] {
+    std::string uri = buildMqttUri(parts);
+    benchKeep(uri);
+  });
+}
+
+static void benchTopics(BenchRunner& bench) {
+  const char* topic = "site/building-7/floor/3/room/12/sensor/temperature";
+  bench.run("topic.match.exact", [&] {
+    bool m = topicMatchesFilter("site/building-7/floor/3/room/12/sensor/temperature", topic);
+    benchKeep(m);
+  });
+  bench.run("topic.match.plus", [&] {
+    bool m = topicMatchesFilter("site/+/floor/+/room/+/sensor/+", topic);
+    benchKeep(m);
+  });
+  bench.run("topic.match.hash", [&] {
+    bool m = topicMatchesFilter("site/building-7/#", topic);
+    benchKeep(m);
+  });
+  bench.run("topic.match.miss", [&] {
+    bool m = topicMatchesFilter("site/building-8/#", topic);
+    benchKeep(m);
+  });
+
+  // The matching filter is registered last, so every lookup walks the whole registry
+  SubscriptionRegistry registry;
+  char filter[64];
+  for (int i = 0; i < 63; i++) {
+    snprintf(filter, sizeof(filter), "site/building-%d/+/sensor/#", i + 100);
+    registry.add(filter, 1);
+  }
+  registry.add("site/building-7/#", 1);
+  bench.run("registry.match.64_filters", [&] {
+    const Subscription* sub = registry.match(topic);
+    benchKeep(sub);
+  });
+}
+
+static void benchTopicSketch(BenchRunner& bench) {
+  // A full sketch; the hit is the last entry, so the lookup scans every slot
+  TopicSketch sketch;
+  char topic[64];
+  for (size_t i = 0; i < TopicSketch::kCapacity; i++) {
+    snprintf(topic, sizeof(topic), "site/building-7/floor/3/room/%u/sensor", (unsigned)i);
+    sketch.add(topic, 100);
+  }
+  bench.run("sketch.add.hit", [&] { sketch.add(topic, 24); });
+
+  // Cycling through many more topics than the sketch holds: every add misses, scans for
+  // the lightest entry and replaces it
+  static const size_t kTopics = 256;
+  static char topics[kTopics][64];
+  for (size_t i = 0; i < kTopics; i++) {
+    snprintf(topics[i], sizeof(topics[i]), "site/building-7/floor/3/device/%u/telemetry", (unsigned)i);
+  }
+  size_t next = 0;
+  bench.run("sketch.add.evict", [&] {
+    sketch.add(topics[next], 24);
+    next = (next + 1) % kTopics;
+  });
+  benchKeep(sketch);
+}
+
+static void benchDispatch(BenchRunner& bench) {
+  // Not connected: subscribe() only fills the registry, onDataInternal() runs the
+  // whole receive path (metrics, filter lookup, callback, profiler, latency)
+  MqttClient client;
+  char filter[64];
+  for (int i = 0; i < 16; i++) {
+    snprintf(filter, sizeof(filter), "devices/%d/cmd/#", i);
+    client.subscribe(filter, 1);
+  }
+  size_t delivered = 0;
+  client.onMessage([&](const char*, const char*, size_t length) { delivered += length; });
+  const char payload[] = "{\"on\":true,\"level\":42}";
+  bench.run("dispatch.on_data.16_filters", [&] {
+    client.onDataInternal("devices/15/cmd/light", payload, sizeof(payload) - 1);
+  });
+  client.setTopicAccounting(true);
+  bench.run("dispatch.on_data.16_filters.topic_accounting", [&] {
+    client.onDataInternal("devices/15/cmd/light", payload, sizeof(payload) - 1);
+  });
+  client.setTopicAccounting(false);
+  client.setSubscriptionAggregation(true);
+  bench.run("dispatch.on_data.filtered_out", [&] {
+    client.onDataInternal("devices/99/cmd/light", payload, sizeof(payload) - 1);
+  });
+  benchKeep(delivered);
+}
+
+static void benchEncoding(BenchRunner& bench) {
+  std::vector<uint8_t> packet;
+  packet.reserve(512);
+  char payload[64];
+  memset(payload, 'x', sizeof(payload));
+  bench.run("encode.publish_packet.64B", [&] {
+    packet.clear();
+    mqttEncodePublish(packet, kMqttLevel5, "devices/15/telemetry", payload, sizeof(payload), 1, false, false, 7);
+    benchKeep(packet);
+  });
+
+  LatencyHistogram histogram;
+  for (uint32_t i = 1; i < 10000; i++) histogram.record(i * 37 % 5000);
+  char json[512];
+  bench.run("encode.latency_json", [&] {
+    int n = histogram.formatJson(json, sizeof(json));
+    benchKeep(n);
+  });
+
+  MqttMetricsSnapshot current = {};
+  MqttMetricsSnapshot previous = {};
+  current.counters[static_cast<size_t>(MqttCounter::MessagesOut)] = 1200;
+  current.counters[static_cast<size_t>(MqttCounter::BytesOut)] = 96000;
+  MqttStatsReport report;
+  report.current = &current;
+  report.previous = &previous;
+  report.intervalMs = 60000;
+  report.uptimeS = 3600;
+  for (size_t i = 0; i < MqttStatsReport::kLatencyKinds; i++) report.latency[i] = &histogram;
+  char stats[1024];
+  bench.run("encode.stats_report", [&] {
+    int n = formatStatsReport(report, stats, sizeof(stats));
+    benchKeep(n);
+  });
+}
+
+static void benchPublish(BenchRunner& bench) {
+  // publish() at QoS 1 through the esp-mqtt shim to the loopback broker: encode, outbox
+  // insert and the pipe write, with PUBACKs handled on the client thread meanwhile
+  if (!bench.selected("publish.enqueue.qos1") && !bench.selected("publish.enqueue.qos1.topic_accounting")) return;
+  LoopbackBroker broker;
+  if (!broker.listenPipe("bench-broker")) return;
+  MqttClient client;
+  client.setServer("bench-broker", 1883);
+  if (!client.connect("bench-publisher")) return;
+  for (int i = 0; i < 200 && !client.isConnected(); i++) delay(5);
+  if (!client.isConnected()) {
+    fprintf(stderr, "publish benchmarks skipped: no connection to the loopback broker\n");
+    return;
+  }
+  const char payload[] = "{\"t\":21.5,\"h\":40}";
+  bench.run("publish.enqueue.qos1", [&] {
+    int id = client.publish("devices/15/telemetry", payload);
+    benchKeep(id);
+  });
+  client.setTopicAccounting(true);
+  bench.run("publish.enqueue.qos1.topic_accounting", [&] {
+    int id = client.publish("devices/15/telemetry", payload);
+    benchKeep(id);
+  });
+  client.disconnect();
+}
+
+int main(int argc, char** argv) {
+  BenchRunner bench("micro", argc, argv);
+  benchUri(bench);
+  benchTopics(bench);
+  benchTopicSketch(bench);
+  benchDispatch(bench);
+  benchEncoding(bench);
+  benchPublish(bench);
+  return bench.finish();
+}
@@ -0,0 +1,285 @@
+// Large-payload benchmark: one MqttClient publishes messages of growing size to a topic it
+// subscribes itself, through the in-process LoopbackBroker, and the tool reports for each
+// size and direction the throughput, the heap the client allocated and the payload bytes
+// it copied. Messages up to --max-message arrive whole through onMessage() (one copy into
+// the receive buffer), larger ones are streamed through onMessageChunk() (no copy).
+//
+//   --sizes <list>        payload sizes in bytes, K and M suffixes allowed
+//                         (default 1K,4K,16K,64K,256K,1M,4M,16M)
+//   --repeat <n>          round trips per size; the median is reported (default 3)
+//   --buffer <n>          esp-mqtt buffer size, the largest fragment (default 4096)
+//   --max-message <n>     setMaxMessageSize() (default 64K)
+//   --out <file>          write the JSON report to a file instead of stdout
+//
+// The client is stepped on the benchmark thread (mqttHostSetManualStep), so the thread's
+// allocation counts cover MqttClient and nothing else. "out" runs from publish() until the
+// broker has the whole message, "in" from there until the last byte reached the callback,
+// including the broker's forwarding. Memory is the client's receive buffer plus what it
+// allocated during the transfer; the broker and the esp-mqtt stand-in hold whole packets
+// and are not counted, as on a device the broker is elsewhere and esp-mqtt streams.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include "AllocCounter.h"
+#include "Bench.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "MqttHost.h"
+
+namespace {
+
+struct Options {
+  std::vector<size_t> sizes;
+  uint32_t repeat = 3;
+  size_t buffer = 4096;
+  size_t maxMessage = 64 * 1024;
+  std::string out;
+};
+
+// One direction of one round trip
+struct Transfer {
+  double us;
+  uint64_t allocs;
+  uint64_t allocBytes;
+  uint32_t copied;
+};
+
+struct Result {
+  size_t size;
+  const char* direction;
+  bool streamed;
+  Transfer median;
+  double mbPerS;
+};
+
+uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t parseSize(const char* text) {
+  char* end;
+  size_t value = static_cast<size_t>(strtoull(text, &end, 10));
+  if (*end == 'K' || *end == 'k') value *= 1024;
+  if (*end == 'M' || *end == 'm') value *= 1024 * 1024;
+  return value;
+}
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char* key = argv[i];
+    const char* value = argv[i + 1];
+    if (!strcmp(key, "--sizes")) {
+      opt.sizes.clear();
+      std::string list = value;
+      for (size_t pos = 0; pos <= list.size();) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos) comma = list.size();
+        size_t size = parseSize(list.substr(pos, comma - pos).c_str());
+        if (!size) return false;
+        opt.sizes.push_back(size);
+        pos = comma + 1;
+      }
+    } else if (!strcmp(key, "--repeat")) {
+      opt.repeat = std::max<uint32_t>(1, static_cast<uint32_t>(strtoul(value, nullptr, 10)));
+    } else if (!strcmp(key, "--buffer")) {
+      opt.buffer = parseSize(value);
+    } else if (!strcmp(key, "--max-message")) {
+      opt.maxMessage = parseSize(value);
+    } else if (!strcmp(key, "--out")) {
+      opt.out = value;
+    } else {
+      return false;
+    }
+  }
+  if (opt.sizes.empty()) {
+    for (size_t size = 1024; size <= 16 * 1024 * 1024; size *= 4) opt.sizes.push_back(size);
+  }
+  return opt.buffer > 0;
+}
+
+uint32_t counter(const MqttClient& client, MqttCounter c) {
+  MqttMetricsSnapshot snap;
+  client.metrics(snap);
+  return snap.counters[static_cast<size_t>(c)];
+}
+
+// Receive side: checks every byte against the pattern the payload was filled with
+struct Receiver {
+  size_t size = 0;
+  size_t received = 0;
+  size_t maxChunk = 0;
+  uint32_t messages = 0;
+  uint64_t corrupt = 0;
+
+  static uint8_t expected(size_t size, size_t i) { return static_cast<uint8_t>((i * 131 + size) & 0xFF); }
+
+  void check(const char* data, size_t length, size_t offset) {
+    for (size_t i = 0; i < length; i++) {
+      if (static_cast<uint8_t>(data[i]) != expected(size, offset + i)) corrupt++;
+    }
+  }
+};
+
+Transfer medianOf(std::vector<Transfer>& runs) {
+  std::sort(runs.begin(), runs.end(), [](const Transfer& a, const Transfer& b) { return a.us < b.us; });
+  return runs[runs.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--sizes 1K,64K,16M] [--repeat n] [--buffer n] [--max-message n] [--out file]\n",
+            argv[0]);
+    return 2;
+  }
+  benchLogToStderr();
+  mqttHostSetManualStep(true);
+
+  LoopbackBroker broker;
+  if (!broker.listenPipe("payload-broker")) {
+    fprintf(stderr, "cannot start the loopback broker\n");
+    return 1;
+  }
+  MqttClient client;
+  client.setServer("payload-broker", 1883);
+  client.setBufferSize(static_cast<int>(opt.buffer));
+  client.setMaxMessageSize(opt.maxMessage);
+  Receiver rx;
+  client.onMessage([&](const char*, const char* payload, size_t length) {
+    rx.check(payload, length, 0);
+    rx.received = length;
+    rx.messages++;
+  });
+  client.onMessageChunk([&](const char*, const char* chunk, size_t length, size_t offset, size_t total) {
+    rx.check(chunk, length, offset);
+    rx.received += length;
+    rx.maxChunk = std::max(rx.maxChunk, length);
+    if (offset + length == total) rx.messages++;
+  });
+  client.subscribe("bench/payload", 0);
+  client.connect("payload-bench");
+  for (int i = 0; i < 1000 && !client.isConnected(); i++) mqttHostStep(5);
+  if (!client.isConnected()) {
+    fprintf(stderr, "cannot connect to the loopback broker\n");
+    return 1;
+  }
+
+  size_t largest = *std::max_element(opt.sizes.begin(), opt.sizes.end());
+  std::vector<char> payload(largest);
+  bool failed = false;
+
+  // One round trip of `size` bytes; false when it did not come back intact
+  auto roundTrip = [&](size_t size, Transfer& out, Transfer& in) -> bool {
+    for (size_t i = 0; i < size; i++) payload[i] = static_cast<char>(Receiver::expected(size, i));
+    rx.size = size;
+    rx.received = 0;
+    uint32_t messagesBefore = rx.messages;
+    uint32_t brokerBefore = broker.stats().publishesIn;
+    uint32_t copiedBefore = counter(client, MqttCounter::BytesCopied);
+    AllocCounts a0 = allocThreadCounts();
+    uint64_t t0 = nowNs();
+    if (client.publishQos("bench/payload", static_cast<const void*>(payload.data()), size, 0) < 0) return false;
+    uint32_t copiedAfterPublish = counter(client, MqttCounter::BytesCopied);
+    uint64_t t1 = 0;
+    AllocCounts aBroker = allocThreadCounts();
+    uint64_t deadline = t0 + 60ull * 1000 * 1000 * 1000;
+    // Polled without waiting, so the broker's receipt is seen as soon as it happens
+    while (rx.messages == messagesBefore && nowNs() < deadline) {
+      mqttHostStep(0);
+      if (!t1 && broker.stats().publishesIn != brokerBefore) {
+        t1 = nowNs();
+        aBroker = allocThreadCounts();
+      }
+    }
+    uint64_t t2 = nowNs();
+    AllocCounts a2 = allocThreadCounts();
+    if (!t1) t1 = t2;
+    out = Transfer{(t1 - t0) / 1000.0, aBroker.allocs - a0.allocs, aBroker.bytes - a0.bytes,
+                   copiedAfterPublish - copiedBefore};
+    in = Transfer{(t2 - t1) / 1000.0, a2.allocs - aBroker.allocs, a2.bytes - aBroker.bytes,
+                  counter(client, MqttCounter::BytesCopied) - copiedAfterPublish};
+    return rx.messages == messagesBefore + 1 && rx.received == size;
+  };
+
+  // Warm-up: lazily created client state (profiler slot, histogram buckets) on both paths
+  Transfer ignoreOut, ignoreIn;
+  roundTrip(std::min<size_t>(1024, largest), ignoreOut, ignoreIn);
+  if (largest > opt.maxMessage) roundTrip(opt.maxMessage + 1, ignoreOut, ignoreIn);
+
+  std::vector<Result> results;
+  fprintf(stderr, "%10s %4s %6s %10s %10s %8s %10s %8s\n", "size", "dir", "path", "ms", "MB/s", "allocs", "alloc B",
+          "copies");
+  for (size_t size : opt.sizes) {
+    std::vector<Transfer> outs, ins;
+    for (uint32_t r = 0; r < opt.repeat; r++) {
+      Transfer out, in;
+      if (!roundTrip(size, out, in)) {
+        fprintf(stderr, "%zu bytes: message lost or incomplete\n", size);
+        failed = true;
+        break;
+      }
+      outs.push_back(out);
+      ins.push_back(in);
+    }
+    if (outs.empty()) continue;
+    bool streamed = size > opt.maxMessage;
+    Transfer medians[2] = {medianOf(outs), medianOf(ins)};
+    const char* directions[2] = {"out", "in"};
+    for (int d = 0; d < 2; d++) {
+      Result result{size, directions[d], streamed, medians[d], 0};
+      result.mbPerS = medians[d].us > 0 ? size / medians[d].us : 0; // bytes per us = MB/s
+      results.push_back(result);
+      fprintf(stderr, "%10zu %4s %6s %10.2f %10.1f %8llu %10llu %8.2f\n", size, directions[d],
+              d == 0 ? "-" : (streamed ? "stream" : "whole"), medians[d].us / 1000, result.mbPerS,
+              static_cast<unsigned long long>(medians[d].allocs), static_cast<unsigned long long>(medians[d].allocBytes),
+              static_cast<double>(medians[d].copied) / size);
+    }
+  }
+  if (rx.corrupt) {
+    fprintf(stderr, "%llu payload bytes arrived corrupted\n", static_cast<unsigned long long>(rx.corrupt));
+    failed = true;
+  }
+  client.disconnect();
+  mqttHostStep(1);
+
+  FILE* out = stdout;
+  if (!opt.out.empty()) {
+    out = fopen(opt.out.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "cannot write %s\n", opt.out.c_str());
+      return 1;
+    }
+  }
+  // The client's memory: its receive buffer plus the largest allocation total of any transfer
+  uint64_t allocPeak = 0;
+  for (const Result& r : results) allocPeak = std::max(allocPeak, r.median.allocBytes);
+  fprintf(out,
+          "{\"suite\":\"payload\",\"compiler\":\"%s\",\"buffer\":%zu,\"max_message\":%zu,\"repeat\":%u,"
+          "\"receive_buffer_bytes\":%zu,\"client_memory_peak\":%llu,\"max_chunk\":%zu,\"corrupt_bytes\":%llu,"
+          "\"results\":[",
+          __VERSION__, opt.buffer, opt.maxMessage, opt.repeat, opt.maxMessage + 1,
+          static_cast<unsigned long long>(opt.maxMessage + 1 + allocPeak), rx.maxChunk,
+          static_cast<unsigned long long>(rx.corrupt));
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    fprintf(out,
+            "%s\n{\"size\":%zu,\"direction\":\"%s\",\"path\":\"%s\",\"us\":%.1f,\"mb_per_s\":%.2f,\"allocs\":%llu,"
+            "\"alloc_bytes\":%llu,\"copies_per_byte\":%.3f}",
+            i ? "," : "", r.size, r.direction, r.direction[0] == 'o' ? "publish" : (r.streamed ? "stream" : "whole"),
+            r.median.us, r.mbPerS, static_cast<unsigned long long>(r.median.allocs),
+            static_cast<unsigned long long>(r.median.allocBytes), static_cast<double>(r.median.copied) / r.size);
+  }
+  fprintf(out, "\n]}\n");
+  if (out != stdout) fclose(out);
+  mqttHostSetManualStep(false);
+  return failed ? 1 : 0;
+}
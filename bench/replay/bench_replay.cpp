@@ -0,0 +1,194 @@
+// Replays a traffic capture (see TrafficCapture.h) through MqttClient: inbound messages
+// go through onDataInternal(), the whole receive path up to the message callback, and
+// outbound messages through publish() to a broker (the in-process LoopbackBroker unless
+// --broker is given). Connection events and acks in the capture are counted, not replayed.
+//
+//   bench_replay <capture> [options]
+//   --speed <x>      replay speed relative to the capture, 0 = as fast as possible (default 1)
+//   --loops <n>      play the capture n times back to back (default 1)
+//   --broker <uri>   external broker for the outbound side (default: loopback)
+//
+// Truncated payloads are padded with zeros to their original length, so message sizes
+// match the capture. Output is one JSON line on stdout with throughput, dispatch and
+// publish->ack latency, and how far the replay fell behind the capture's timing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Arduino.h>
+#include "Bench.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "TrafficCapture.h"
+
+namespace {
+
+struct Options {
+  const char* path = nullptr;
+  double speed = 1;
+  uint32_t loops = 1;
+  std::string broker;
+};
+
+bool parseOptions(int argc, char** argv, Options& opt) {
+  if (argc < 2) return false;
+  opt.path = argv[1];
+  for (int i = 2; i + 1 < argc; i += 2) {
+    const char* key = argv[i];
+    const char* value = argv[i + 1];
+    if (!strcmp(key, "--speed")) {
+      opt.speed = strtod(value, nullptr);
+    } else if (!strcmp(key, "--loops")) {
+      opt.loops = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    } else if (!strcmp(key, "--broker")) {
+      opt.broker = value;
+    } else {
+      return false;
+    }
+  }
+  if (opt.speed < 0) opt.speed = 0;
+  if (!opt.loops) opt.loops = 1;
+  return true;
+}
+
+bool readFile(const char* path, std::vector<uint8_t>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s <capture> [--speed x] [--loops n] [--broker uri]\n", argv[0]);
+    return 2;
+  }
+  benchLogToStderr();
+  std::vector<uint8_t> data;
+  if (!readFile(opt.path, data)) {
+    fprintf(stderr, "cannot read %s\n", opt.path);
+    return 1;
+  }
+  if (!CaptureReader(data.data(), data.size()).valid()) {
+    fprintf(stderr, "%s is not a traffic capture\n", opt.path);
+    return 1;
+  }
+
+  LoopbackBroker broker;
+  MqttClient client;
+  if (opt.broker.empty()) {
+    if (!broker.listenPipe("replay-broker")) {
+      fprintf(stderr, "cannot start the loopback broker\n");
+      return 1;
+    }
+    client.setServer("replay-broker", 1883);
+  } else {
+    client.begin(opt.broker.c_str());
+  }
+  size_t delivered = 0;
+  client.onMessage([&](const char*, const char* payload, size_t length) {
+    delivered++;
+    benchKeep(payload[length ? length - 1 : 0]);
+  });
+  client.connect("replay-client");
+  for (int i = 0; i < 500 && !client.isConnected(); i++) delay(10);
+  if (!client.isConnected()) {
+    fprintf(stderr, "cannot connect to %s\n", opt.broker.empty() ? "the loopback broker" : opt.broker.c_str());
+    return 1;
+  }
+
+  uint64_t counts[static_cast<size_t>(CaptureEvent::Count)] = {};
+  uint64_t bytes = 0;
+  uint64_t truncated = 0;
+  uint64_t failed = 0;
+  uint64_t maxLagUs = 0;
+  uint64_t captureUs = 0;
+  std::string topic;
+  std::vector<char> payload;
+  const uint64_t startUs = nowUs();
+  bool corrupt = false;
+
+  for (uint32_t loop = 0; loop < opt.loops; loop++) {
+    CaptureReader reader(data.data(), data.size());
+    const uint64_t loopStartUs = nowUs();
+    CaptureRecord r;
+    while (reader.next(r)) {
+      counts[static_cast<size_t>(r.event)]++;
+      captureUs = r.timeUs;
+      if (opt.speed > 0) {
+        uint64_t dueUs = loopStartUs + static_cast<uint64_t>(r.timeUs / opt.speed);
+        uint64_t now = nowUs();
+        if (now + 200 < dueUs) {
+          std::this_thread::sleep_for(std::chrono::microseconds(dueUs - now - 100));
+        }
+        while ((now = nowUs()) < dueUs) {
+        }
+        if (now - dueUs > maxLagUs) maxLagUs = now - dueUs;
+      }
+      if (r.event != CaptureEvent::Inbound && r.event != CaptureEvent::Outbound) continue;
+
+      topic.assign(r.topic, r.topicLen);
+      payload.assign(r.payload, r.payload + r.storedLen);
+      payload.resize(r.payloadLen, '\0');
+      truncated += r.truncated;
+      bytes += r.payloadLen;
+      if (r.event == CaptureEvent::Inbound) {
+        client.onDataInternal(topic.c_str(), payload.data(), static_cast<int>(payload.size()));
+      } else if (client.publishQos(topic.c_str(), static_cast<const void*>(payload.data()), payload.size(), r.qos,
+                                r.retain) < 0) {
+        failed++;
+      }
+      client.loop();
+    }
+    corrupt = corrupt || reader.corrupt();
+  }
+  uint64_t elapsedUs = nowUs() - startUs;
+
+  // Let outstanding acks arrive before reading the publish->ack latency
+  MqttMetricsSnapshot snap;
+  for (int i = 0; i < 500; i++) {
+    client.metrics(snap);
+    if (snap.inFlight <= 0) break;
+    delay(10);
+  }
+  client.metrics(snap);
+  if (corrupt) fprintf(stderr, "capture ends with a truncated or corrupt record\n");
+
+  const LatencyHistogram& dispatch = client.latency(MqttLatency::Dispatch);
+  const LatencyHistogram& ack = client.latency(MqttLatency::PublishAck);
+  uint64_t messages = counts[static_cast<size_t>(CaptureEvent::Inbound)] +
+                      counts[static_cast<size_t>(CaptureEvent::Outbound)];
+  double seconds = elapsedUs / 1e6;
+  printf("{\"capture\":\"%s\",\"speed\":%g,\"loops\":%u,\"capture_s\":%.3f,\"seconds\":%.3f,\"inbound\":%llu,"
+         "\"outbound\":%llu,\"delivered\":%zu,\"failed\":%llu,\"truncated\":%llu,\"other_events\":%llu,"
+         "\"msgs_per_s\":%.0f,\"mbytes_per_s\":%.3f,\"max_lag_us\":%llu,\"dispatch_p50\":%u,\"dispatch_p99\":%u,"
+         "\"dispatch_max\":%u,\"ack_p50\":%u,\"ack_p99\":%u,\"ack_max\":%u,\"in_flight\":%d}\n",
+         opt.path, opt.speed, opt.loops, captureUs / 1e6, seconds,
+         static_cast<unsigned long long>(counts[static_cast<size_t>(CaptureEvent::Inbound)]),
+         static_cast<unsigned long long>(counts[static_cast<size_t>(CaptureEvent::Outbound)]), delivered,
+         static_cast<unsigned long long>(failed), static_cast<unsigned long long>(truncated),
+         static_cast<unsigned long long>(counts[static_cast<size_t>(CaptureEvent::Acked)] +
+                                         counts[static_cast<size_t>(CaptureEvent::Connected)] +
+                                         counts[static_cast<size_t>(CaptureEvent::Disconnected)] +
+                                         counts[static_cast<size_t>(CaptureEvent::Dropped)]),
+         messages / seconds, bytes / seconds / 1e6, static_cast<unsigned long long>(maxLagUs), dispatch.percentile(50),
+         dispatch.percentile(99), dispatch.max(), ack.percentile(50), ack.percentile(99), ack.max(), snap.inFlight);
+  client.disconnect();
+  return corrupt ? 1 : 0;
+}
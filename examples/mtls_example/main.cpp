@@ -120,10 +120,11 @@ void setup()
   mqtt->setCredentials(mqtt_username, mqtt_password);
   
   // Configure mTLS certificates
+  // The PEM strings above are literals in flash, so borrow them instead of copying to RAM
   Serial.println("\n[Setup] Configuring mTLS certificates...");
-  mqtt->setCACert(ca_cert);           // Verify server's certificate
-  mqtt->setClientCert(client_cert);   // Present client certificate
-  mqtt->setClientKey(client_key);     // Client private key
+  mqtt->setCACertRef(ca_cert);           // Verify server's certificate
+  mqtt->setClientCertRef(client_cert);   // Present client certificate
+  mqtt->setClientKeyRef(client_key);     // Client private key
   
   // Optional: Enable protocol fallback to MQTT 3.1.1 if v5 fails
   mqtt->setProtocolFallback(true);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Ordered/weighted list of broker URIs with latency-based selection and failover.
+// Latency is the measured time from the start of a connection attempt to CONNACK.
+
+struct BrokerEntry {
+  std::string uri;
+  uint8_t weight = 1;               // divides measured latency when ranking brokers
+  uint32_t latencyMs = 0;           // smoothed connect->CONNACK latency, 0 = not measured yet
+  uint8_t consecutiveFailures = 0;  // failed attempts since the last success
+  uint32_t lastFailureMs = 0;
+
+  bool measured() const { return latencyMs != 0; }
+};
+
+class BrokerList {
+public:
+  void clear();
+  // Append a broker. Returns false if the URI cannot be parsed.
+  bool add(const char* uri, uint8_t weight = 1);
+  size_t size() const { return _brokers.size(); }
+  bool empty() const { return _brokers.empty(); }
+  const BrokerEntry& at(size_t index) const { return _brokers[index]; }
+
+  // Index of the broker currently in use, -1 if none was selected yet
+  int current() const { return _current; }
+
+  // Pick the broker for the next connection attempt and make it current.
+  // Among healthy brokers the lowest latency/weight wins; unmeasured brokers are only
+  // used, in list order, while none is measured. Returns -1 if empty.
+  int select(uint32_t nowMs);
+
+  // Probe pass: nextProbe() walks the healthy, unmeasured brokers in list order and makes
+  // each one current in turn, so every broker gets a measured attempt before select()
+  // ranks them. Returns -1 once the pass is done.
+  void beginProbe() { _probeNext = 0; }
+  int nextProbe(uint32_t nowMs);
+
+  void recordSuccess(size_t index, uint32_t latencyMs);
+  // Returns true when the broker reached the failover threshold
+  bool recordFailure(size_t index, uint32_t nowMs);
+
+  // Consecutive failures after which a broker is considered unhealthy (default 3)
+  void setFailoverThreshold(uint8_t failures) { _failoverThreshold = failures ? failures : 1; }
+  // How long an unhealthy broker is skipped before it is tried again (default 60 s)
+  void setRetryHoldoff(uint32_t ms) { _retryHoldoffMs = ms; }
+
+  bool isHealthy(size_t index, uint32_t nowMs) const;
+
+private:
+  std::vector<BrokerEntry> _brokers;
+  int _current = -1;
+  size_t _probeNext = SIZE_MAX; // no pass running
+  uint8_t _failoverThreshold = 3;
+  uint32_t _retryHoldoffMs = 60000;
+};
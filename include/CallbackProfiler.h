@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Per-handler wall time accounting for application callbacks. Callbacks run on the
+// esp-mqtt task, so a slow one delays keepalive and all other traffic. Time is attributed
+// to a key (the topic filter a message matched, or the callback name) in a fixed table;
+// when the table is full the entry with the least accumulated time is replaced.
+// Not thread-safe, the client serializes access.
+
+struct CallbackStats {
+  char key[48];        // topic filter or callback name, truncated
+  uint32_t calls;
+  uint32_t totalUs;
+  uint32_t maxUs;
+  uint32_t overBudget; // calls that exceeded the budget
+};
+
+// A slot remembered by the caller, e.g. on the subscription a message matched, so the next
+// lookup for the same key skips the key scan. Recycling the slot or clearing the profiler
+// invalidates it.
+struct CallbackSlotRef {
+  uint8_t slot = 0;
+  uint32_t generation = 0; // 0: not resolved yet
+};
+
+class CallbackProfiler {
+public:
+  static const size_t kCapacity = 16;
+
+  CallbackProfiler() { clear(); }
+
+  // Calls longer than this count as over budget (default 50 ms, 0 disables the check)
+  void setBudget(uint32_t budgetUs) { _budgetUs = budgetUs; }
+  uint32_t budget() const { return _budgetUs; }
+
+  // Slot for a key, created (or recycled) on first use. The index stays valid until the
+  // next slotFor() call, so it can be resolved before running the callback.
+  size_t slotFor(const char* key);
+  // Same, through `ref`: its slot while that still holds the key, otherwise the key is
+  // looked up and `ref` updated
+  size_t slotFor(const char* key, CallbackSlotRef& ref);
+  // Returns true when the call exceeded the budget
+  bool record(size_t slot, uint32_t elapsedUs);
+  // Over-budget warnings are limited to one per slot per kWarnIntervalMs; overBudget still
+  // counts every overrun. Call after record() returned true: returns true when this overrun
+  // should be logged, with the overruns left unlogged since the last warning in `suppressed`.
+  bool warnDue(size_t slot, uint32_t nowMs, uint32_t& suppressed);
+  static const uint32_t kWarnIntervalMs = 10000;
+  const CallbackStats& at(size_t slot) const { return _stats[slot]; }
+
+  // Copy the entries with the most accumulated time, highest first. Returns the count.
+  size_t top(CallbackStats* out, size_t max) const;
+  void clear();
+
+private:
+  struct WarnState {
+    bool warned;
+    uint32_t atMs;       // millis() of the last warning
+    uint32_t overBudget; // overBudget count at the last warning
+  };
+
+  CallbackStats _stats[kCapacity];
+  WarnState _warn[kCapacity];
+  uint32_t _generation[kCapacity]; // changes whenever the slot gets a new key
+  uint32_t _nextGeneration = 0;    // not reset by clear(), so older refs never match again
+  size_t _used;
+  uint32_t _budgetUs = 50000;
+};
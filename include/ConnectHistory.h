@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Per-attempt connection timing kept in a small ring.
+// esp-mqtt exposes no DNS/TCP/TLS hooks. From ESP-IDF 5.0 the client connects through a
+// transport of its own that reports when the transport is up, splitting the handshake into
+// transport connect (DNS + TCP + TLS) and CONNECT to CONNACK; DNS, TCP and TLS stay one
+// phase. A failed attempt records the phase it failed in, classified from the esp-tls
+// error code.
+
+enum class ConnectPhase : uint8_t {
+  None,    // no failure (connected or still pending)
+  Init,    // esp_mqtt_client_init/start failed
+  Dns,     // hostname resolution
+  Tcp,     // socket connect/timeout, or an unclassified transport error
+  Tls,     // TLS handshake or certificate verification
+  Connack  // broker refused the CONNECT
+};
+
+enum class ConnectOutcome : uint8_t { Pending, Connected, Failed };
+
+struct ConnectAttempt {
+  uint32_t startMs = 0;    // millis() when the attempt began
+  int8_t broker = -1;      // BrokerList index, -1 without a broker list
+  uint8_t protocol = 0;    // 5 or 4 (v3.1.1)
+  bool fallback = false;   // v3.1.1 attempt after v5 failed
+  bool automatic = false;  // reconnect started by esp-mqtt rather than connect()
+  ConnectOutcome outcome = ConnectOutcome::Pending;
+  ConnectPhase failedPhase = ConnectPhase::None;
+  int errorCode = 0;       // esp-tls error or CONNACK return/reason code of the failure
+
+  uint32_t waitUs = 0;      // fallback delay or reconnect backoff before the attempt
+  uint32_t initUs = 0;      // config build, esp_mqtt_client_init and start
+  uint32_t scheduleUs = 0;  // start to MQTT_EVENT_BEFORE_CONNECT (task startup)
+  // BEFORE_CONNECT to transport up or failure (DNS + TCP + TLS). Without the transport
+  // hook (ESP-IDF < 5.0) this runs until CONNACK and connackUs stays 0.
+  uint32_t transportUs = 0;
+  uint32_t connackUs = 0;   // transport up to CONNACK or failure (CONNECT round trip)
+
+  uint32_t handshakeUs() const { return transportUs + connackUs; }
+  uint32_t totalUs() const { return waitUs + initUs + scheduleUs + handshakeUs(); }
+};
+
+class ConnectHistory {
+public:
+  static const size_t kCapacity = 8;
+
+  // Open a new record; an attempt still pending is closed as failed first
+  void begin(uint32_t nowUs, uint32_t nowMs, int8_t broker, uint8_t protocol, bool fallback, bool automatic,
+             uint32_t waitUs = 0);
+  // esp_mqtt_client_start returned, the client task takes over
+  void started(uint32_t nowUs);
+  // MQTT_EVENT_BEFORE_CONNECT: the transport handshake begins
+  void beforeConnect(uint32_t nowUs);
+  // The transport is connected and CONNECT goes out
+  void transportUp(uint32_t nowUs);
+  // Remember why the pending attempt is failing; the record is closed by failed().
+  // The first report wins: the transport sees the esp-tls error before esp-mqtt posts
+  // its less specific MQTT_EVENT_ERROR.
+  void error(ConnectPhase phase, int code);
+
+  void connected(uint32_t nowUs);
+  // Close the pending attempt as failed. Returns the phase it failed in.
+  ConnectPhase failed(uint32_t nowUs);
+
+  bool pending() const { return _stage != Stage::Idle; }
+  size_t size() const { return _count; }
+  // 0 is the oldest record
+  const ConnectAttempt& at(size_t index) const;
+  const ConnectAttempt* last() const { return _count ? &at(_count - 1) : nullptr; }
+  void clear();
+
+private:
+  enum class Stage : uint8_t { Idle, Init, Scheduled, Transport, Connack };
+
+  ConnectAttempt _ring[kCapacity];
+  size_t _head = 0; // next slot to write
+  size_t _count = 0;
+  Stage _stage = Stage::Idle;
+  uint32_t _stageStartUs = 0;
+
+  ConnectAttempt& current() { return _ring[(_head + kCapacity - 1) % kCapacity]; }
+  void closeStage(uint32_t nowUs);
+};
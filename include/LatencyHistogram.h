@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// HDR-style log-linear histogram with a fixed footprint (832 bytes of counts).
+// Values below 8 are exact; above that every power of two is split into 8 linear
+// sub-buckets, so any recorded value is reported within 12.5% of its true value.
+// Values up to 2^28 (about 268 s in microseconds) are resolved, larger ones clamp.
+// Recording uses relaxed atomics, so one task can record while another reads. All of
+// them are 32-bit, which Xtensa handles lock-free: the sum is kept as a low word plus a
+// count of its wraps and widened when read.
+class LatencyHistogram {
+public:
+  static const uint8_t kSubBucketBits = 3;
+  static const uint8_t kMaxValueBits = 28;
+  static const size_t kSubBuckets = 1u << kSubBucketBits;
+  static const size_t kBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() { reset(); }
+  LatencyHistogram(const LatencyHistogram &other) { reset(); merge(other); }
+  LatencyHistogram &operator=(const LatencyHistogram &other);
+
+  void record(uint32_t value);
+  void merge(const LatencyHistogram &other);
+  void reset();
+
+  uint32_t count() const { return _count.load(std::memory_order_relaxed); }
+  uint32_t min() const;
+  uint32_t max() const { return _max.load(std::memory_order_relaxed); }
+  uint32_t mean() const;
+  // Value at or below which `percentile` percent of the samples fall (0..100).
+  // Returns the upper bound of the matching bucket, capped at the recorded maximum.
+  uint32_t percentile(double percentile) const;
+
+  // Compact JSON summary: {"n":..,"min":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..}
+  // Returns the number of characters written (snprintf semantics).
+  int formatJson(char *buf, size_t len) const;
+
+  static size_t bucketIndex(uint32_t value);
+  static uint32_t bucketLow(size_t index);
+  static uint32_t bucketHigh(size_t index);
+
+private:
+  std::atomic<uint32_t> _counts[kBuckets];
+  std::atomic<uint32_t> _count;
+  std::atomic<uint32_t> _min;
+  std::atomic<uint32_t> _max;
+  std::atomic<uint32_t> _sum;      // low 32 bits of the sum of recorded values
+  std::atomic<uint32_t> _sumWraps; // times _sum wrapped
+
+  void addSum(uint64_t value);
+  uint64_t sum() const;
+};
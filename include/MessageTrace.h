@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#ifndef ARDUINO
+#include <stdio.h>
+#endif
+
+// Per-message lifecycle tracing. Each sampled message gets a trace id and a timestamp at
+// every pipeline stage it crosses; events go into a bounded lock-free ring that keeps
+// the newest MQTT_TRACE_CAPACITY events. Native builds can dump the ring as Chrome /
+// Perfetto trace JSON (chrome://tracing, ui.perfetto.dev).
+
+#ifndef MQTT_TRACE_CAPACITY
+#define MQTT_TRACE_CAPACITY 256 // events, power of two
+#endif
+
+enum class TraceStage : uint8_t {
+  // Outbound
+  Enqueue,     // publish() called
+  WireWrite,   // esp-mqtt accepted/wrote the PUBLISH
+  Ack,         // PUBACK/PUBCOMP received
+  // Inbound
+  Receive,     // MQTT_EVENT_DATA delivered
+  Reassembled, // payload complete in the receive buffer
+  Dispatch,    // message callback entered
+  HandlerDone, // message callback returned
+  Count
+};
+
+const char* traceStageName(TraceStage stage);
+inline bool traceStageInbound(TraceStage stage) { return stage >= TraceStage::Receive; }
+
+struct TraceEvent {
+  uint32_t timestampUs;
+  uint32_t traceId;
+  TraceStage stage;
+};
+
+class MessageTrace {
+public:
+  static const size_t kCapacity = MQTT_TRACE_CAPACITY;
+
+  MessageTrace();
+
+  // Trace one in `oneIn` messages, 0 disables tracing (default 1: every message)
+  void setSampling(uint16_t oneIn) { _sampling.store(oneIn, std::memory_order_relaxed); }
+  uint16_t sampling() const { return _sampling.load(std::memory_order_relaxed); }
+
+  // Sampling decision for a new message. Returns its trace id, 0 if it is not traced.
+  uint32_t begin();
+  // No-op for traceId 0, so call sites need no sampling checks
+  void record(uint32_t traceId, TraceStage stage, uint32_t timestampUs) {
+    if (traceId) push(traceId, stage, timestampUs);
+  }
+
+  // Copies the retained events, sampling and id counter, for moving a client; not while
+  // either side records
+  MessageTrace& operator=(const MessageTrace& other);
+
+  // Copy the retained events, oldest first. Returns the number copied.
+  size_t snapshot(TraceEvent* out, size_t maxEvents) const;
+  void clear();
+
+#ifndef ARDUINO
+  // Write the retained events as Chrome trace JSON: one async track per message with a
+  // slice for each stage-to-stage interval. Returns false on a write error.
+  bool writeChromeTrace(FILE* out) const;
+#endif
+
+private:
+  // Fields are relaxed atomics so a snapshot racing a writer reads stale values, never a data race
+  struct Slot {
+    std::atomic<uint32_t> seq; // index + 1 once written, 0 while being written
+    std::atomic<uint32_t> timestampUs;
+    std::atomic<uint32_t> traceId;
+    std::atomic<uint8_t> stage;
+  };
+
+  Slot _ring[kCapacity];
+  std::atomic<uint32_t> _head;
+  std::atomic<uint32_t> _nextId;
+  std::atomic<uint16_t> _sampling;
+
+  void push(uint32_t traceId, TraceStage stage, uint32_t timestampUs);
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <mutex>
 
 // Forward declarations for ESP-IDF types to avoid hard dependencies in header
 #ifdef ESP_IDF_VERSION_MAJOR
@@ -15,15 +17,57 @@
 
 #include "esp_event.h"
 #include "UriUtils.h"
+#include "BrokerList.h"
+#include "SubscriptionRegistry.h"
+#include "MqttMetrics.h"
+#include "LatencyHistogram.h"
+#include "ConnectHistory.h"
+#include "MessageTrace.h"
+#include "StatsReport.h"
+#include "CallbackProfiler.h"
+#include "TopicSketch.h"
+#include "TrafficCapture.h"
 
 typedef std::function<void(const char* topic, const char* payload, size_t length)> MessageCallback;
+// One fragment of a streamed message: `length` bytes at `offset` of a `total`-byte payload
+typedef std::function<void(const char* topic, const char* chunk, size_t length, size_t offset, size_t total)>
+    MessageChunkCallback;
 typedef std::function<void()> SimpleCallback;
 
+enum class TopicDirection : uint8_t { Inbound, Outbound };
+
+struct TimedTransport; // transport wrapper handed to esp-mqtt (ESP-IDF 5.0+)
+
+// Latency histograms kept by the client (microseconds)
+enum class MqttLatency : uint8_t {
+  Connect,    // connect() (or the start of an automatic reconnect) to CONNACK
+  PublishAck, // publish() to PUBACK
+  Dispatch,   // message received to message callback completion
+  ProbeRtt,   // link probe round trip through the broker
+  Count
+};
+
 class MqttClient {
 public:
+  // Each instance owns its own esp-mqtt handle, configuration and callbacks, so several
+  // connections (e.g. telemetry and command brokers) can run side by side.
+  MqttClient();
+  MqttClient(MqttClient&& other) noexcept;
+  MqttClient& operator=(MqttClient&& other) noexcept;
+  MqttClient(const MqttClient&) = delete;
+  MqttClient& operator=(const MqttClient&) = delete;
+
+  // Process-wide default instance, kept for existing single-connection sketches
   static MqttClient* getInstance();
 
   void begin(const char* brokerUri);
+  // Multi-broker failover: brokers are tried in list order until their connect->CONNACK
+  // latency is known, then the fastest healthy one (latency divided by weight) is used.
+  // After setFailoverThreshold() consecutive failed attempts the client switches broker.
+  void begin(const char* const* brokerUris, size_t count);
+  bool addBroker(const char* brokerUri, uint8_t weight = 1);
+  void setFailoverThreshold(uint8_t failures);
+  const BrokerList& brokers() const { return _brokers; }
   void setServer(const char* host, uint16_t port);
   // Enable/disable WebSocket transport. When enabled, a path can be set.
   void setWebSocket(bool enable);
@@ -32,6 +76,14 @@ public:
   void setCredentials(const char* username, const char* password);
   void setKeepalive(uint16_t keepalive);
   void setProtocolFallback(bool enableFallback); // Enable v3.1.1 fallback if v5 fails
+  // esp-mqtt task and buffer sizing per instance (0 keeps the esp-mqtt default).
+  // Lets secondary connections run with a smaller footprint than the primary one.
+  void setTaskConfig(uint8_t priority, uint32_t stackSize);
+  void setBufferSize(int size);
+  // Largest inbound payload delivered whole to onMessage() (default 1024 bytes). esp-mqtt
+  // hands over messages in fragments of up to the buffer size; the client reassembles them
+  // in one buffer of this size, allocated here and by connect(). Set before connect().
+  void setMaxMessageSize(size_t bytes);
   
   // mTLS / Certificate configuration
   void setCACert(const char* ca_cert);           // Set CA certificate for server verification
@@ -39,27 +91,107 @@ public:
   void setClientKey(const char* client_key);     // Set client private key for mTLS
   void setInsecure(bool insecure);               // Skip certificate verification (for testing only)
 
+  // Borrowed certificate storage: only a pointer is kept, no heap copy is made.
+  // The caller guarantees the buffer outlives the client (e.g. string literals in flash).
+  void setCACertRef(const char* ca_cert);
+  void setClientCertRef(const char* client_cert);
+  void setClientKeyRef(const char* client_key);
+  // DER-encoded certificate/key input (borrowed), avoids PEM decoding at every handshake
+  void setCACertDer(const uint8_t* der, size_t len);
+  void setClientCertDer(const uint8_t* der, size_t len);
+  void setClientKeyDer(const uint8_t* der, size_t len);
+
   bool connect(const char* clientId);
   void disconnect();
   bool isConnected() const;
 
   // Communication
-  int publish(const char* topic, const char* payload, bool retain = false);
+  int publish(const char* topic, const char* payload, bool retain = false); // QoS 1
+  // Explicit QoS 0..2. A separate name so that publish(topic, payload, 1) keeps meaning
+  // "retained, QoS 1". Returns the msg_id, 0 for QoS 0, -1 on error.
+  int publishQos(const char* topic, const char* payload, int qos, bool retain = false);
+  // Binary payload of `length` bytes (no terminator needed); pass a uint8_t* or const void*.
+  int publishQos(const char* topic, const void* payload, size_t length, int qos, bool retain = false);
+  // Subscriptions are kept in a registry and restored automatically after every
+  // reconnect (skipped when the broker resumes the session). subscribe() returns the
+  // msg_id, 0 if the filter is already active or queued until connected, -1 on error
+  // (including a QoS outside 0..2).
   int subscribe(const char* topic, int qos = 0);
   int unsubscribe(const char* topic);
+  const SubscriptionRegistry& subscriptions() const { return _subscriptions; }
+  // Collapse related filters into wildcard subscriptions on the wire (see AggregationPolicy).
+  // Inbound messages are filtered locally against the subscribed filters.
+  void setSubscriptionAggregation(bool enable, uint8_t minSiblings = 4);
 
   // Event callbacks
   void onMessage(MessageCallback cb);
+  // Messages larger than the max message size, streamed: one call per esp-mqtt fragment, in
+  // order, straight from esp-mqtt's receive buffer. Memory use does not depend on the
+  // payload size. Without it such messages are dropped (MqttCounter::DropOversize).
+  void onMessageChunk(MessageChunkCallback cb);
   void onConnect(SimpleCallback cb);
   void onDisconnect(SimpleCallback cb);
 
+  // Metrics: lock-free counters and gauges, cheap enough to poll every second
+  void metrics(MqttMetricsSnapshot& out) const;
+  void resetMetrics();
+
+  // Latency percentiles (HDR-style histograms, fixed memory)
+  const LatencyHistogram& latency(MqttLatency kind) const { return _latency[static_cast<size_t>(kind)]; }
+  void resetLatency();
+
+  // Timing of the last ConnectHistory::kCapacity connection attempts, oldest first.
+  // Returns the number of records copied into `out`.
+  size_t connectHistory(ConnectAttempt* out, size_t max) const;
+
+#ifdef MQTT_TRACE
+  // Per-message lifecycle tracing (build with -D MQTT_TRACE). Traces one in `oneIn`
+  // messages, 0 turns tracing off.
+  void setTraceSampling(uint16_t oneIn) { _trace.setSampling(oneIn); }
+  MessageTrace& trace() { return _trace; }
+#endif
+  // Publish a JSON summary of all latency histograms at QoS 0; returns msg_id or -1.
+  // Call it from a timer to get field percentiles on a dashboard.
+  int publishLatencyReport(const char* topic);
+
+  // Periodic health report (traffic, drops, reconnects, queue watermarks, heap and latency
+  // percentiles) published at QoS 0 from loop(). The topic defaults to
+  // "device/<clientId>/mqtt/stats"; intervals below 1 s are raised to 1 s, 0 disables.
+  void setStatsReport(uint32_t intervalMs, const char* topic = nullptr);
+
+  // Active link probe, driven from loop(): publishes a QoS 0 probe to a topic the client
+  // subscribes itself (default "device/<clientId>/mqtt/probe") every intervalMs and times
+  // the echo (MqttLatency::ProbeRtt). After maxMissed unanswered probes the link is declared
+  // dead and the client reconnects, long before keepalive would notice a half-open
+  // connection. 0 disables.
+  void setLinkProbe(uint32_t intervalMs, uint8_t maxMissed = 3, const char* topic = nullptr);
+
+  // Callbacks run on the esp-mqtt task and hold up all traffic while they run. Calls longer
+  // than the budget (default 50 ms, 0 disables) count as CallbackOverBudget and log a
+  // warning, at most once per handler every 10 s.
+  void setCallbackBudget(uint32_t budgetUs);
+  // Callbacks with the most accumulated time, keyed by the topic filter a message matched
+  // or "onConnect"/"onDisconnect". Returns the number of entries copied.
+  size_t slowestCallbacks(CallbackStats* out, size_t max) const;
+
+  // Per-topic message and byte accounting for the heaviest topics in each direction.
+  // Fixed memory (about 1 KB per direction, allocated when enabled) whatever the number
+  // of topics; counts are upper bounds, see TopicSketch.
+  void setTopicAccounting(bool enable);
+  size_t topTopics(TopicDirection direction, TopicCount* out, size_t max) const;
+
+  // Record inbound and outbound messages and connection events into `capture` (borrowed,
+  // must outlive the client or be detached with nullptr). Recording starts with
+  // capture->start(); loop() flushes the capture to its sink.
+  void setCapture(TrafficCapture* capture) { _capture.store(capture, std::memory_order_release); }
+  TrafficCapture* capture() const { return _capture.load(std::memory_order_acquire); }
+
   // Processing
-  void loop(); // No-op for event-driven esp-mqtt
+  void loop(); // Renders deferred log entries and runs the stats reporter; esp-mqtt itself is event-driven
 
   ~MqttClient();
 
 private:
-  MqttClient();
   static MqttClient* _instance;
 
   void* _client; // esp_mqtt_client_handle_t
@@ -69,35 +201,194 @@ private:
   bool _useWebSocket; // Transport over WebSocket
   bool _secure;       // mqtts/wss
   char* _uri;         // full URI if using URI-based config
+  // Buffer sizes of _host, _path and _uri: reconnects and failovers between known brokers
+  // rewrite them in place instead of reallocating
+  size_t _hostCapacity;
+  size_t _pathCapacity;
+  size_t _uriCapacity;
+  static void assignString(char*& dst, size_t& capacity, const char* src, size_t len);
   char* _username;
   char* _password;
   char* _clientId;
   uint16_t _keepalive;
-  bool _connected;
+  std::atomic<bool> _connected; // written on the esp-mqtt task, read by the application
+  uint8_t _taskPriority;
+  uint32_t _taskStackSize;
+  int _bufferSize;
   
+  // Certificate/key buffer, either a heap copy (owned) or caller storage (borrowed)
+  struct CertBlob {
+    const char* data = nullptr;
+    size_t len = 0;      // 0 for NUL-terminated PEM, byte length for DER
+    bool owned = false;
+  };
+
   // TLS/mTLS certificate configuration
-  char* _caCert;           // CA certificate for server verification
-  char* _clientCert;       // Client certificate for mTLS
-  char* _clientKey;        // Client private key for mTLS
+  CertBlob _caCert;        // CA certificate for server verification
+  CertBlob _clientCert;    // Client certificate for mTLS
+  CertBlob _clientKey;     // Client private key for mTLS
   bool _skipCertVerify;    // Skip certificate verification (insecure mode)
 
+  static void assignCert(CertBlob& blob, const char* data, size_t len, bool copy);
+  static void releaseCert(CertBlob& blob);
+
   // Fallback configuration
   bool _enableFallback;
   bool _usingFallback;
+  esp_mqtt_protocol_ver_t _protocol; // protocol of the running esp-mqtt handle
+
+  // Broker failover
+  BrokerList _brokers;
+  uint32_t _attemptStartMs;
+  std::atomic<bool> _brokerProbing;      // connect() is measuring unmeasured brokers first
+  std::atomic<bool> _brokerProbeLeaving; // disconnecting after a probe's CONNACK
+  void selectBroker();
+  void failoverBroker();
+  bool advanceBrokerProbe(bool connected);
+  void applyBrokerConfig();
 
-  bool connectWithProtocol(esp_mqtt_protocol_ver_t protocol);
+  // Subscription restore. _subscriptionsLock guards the registry; it is never held
+  // while the application task calls into esp-mqtt, to avoid lock inversion with
+  // the esp-mqtt API lock held during event dispatch.
+  SubscriptionRegistry _subscriptions;
+  std::mutex _subscriptionsLock;
+  AggregationPolicy _aggregation;
+  std::vector<Subscription> _wireFilters; // filters actually subscribed on the broker
+  std::vector<Subscription> _wirePending; // restore scratch, reused across reconnects
+  std::atomic<bool> _subscribeDeferred;   // onConnect is running, the restore follows it
+  void restoreSubscriptions(bool sessionPresent);
+  bool wireServes(const Subscription& wire, const char* filter) const;
+  bool wireCovers(const char* topic, uint8_t qos) const;
+  bool wireNeeded(const Subscription& wire) const;
+
+  bool connectWithProtocol(esp_mqtt_protocol_ver_t protocol, uint32_t waitUs = 0);
+  void buildConfig(esp_mqtt_client_config_t& mqtt_cfg, esp_mqtt_protocol_ver_t protocol);
   void reconnectWithFallback();
 
   MessageCallback _messageCallback;
+  MessageChunkCallback _chunkCallback;
   SimpleCallback _connectCallback;
   SimpleCallback _disconnectCallback;
+  void invokeCallback(const SimpleCallback& cb, const char* name);
+
+  // Callback accounting, written by the event task
+  CallbackProfiler _profiler;
+  mutable std::mutex _profilerLock;
+  size_t profilerSlot(const char* key);
+  size_t profilerSlot(const char* key, CallbackSlotRef& ref);
+  CallbackSlotRef _unmatchedSlot; // messages no subscription matched, under _subscriptionsLock
+  void finishCallback(size_t slot, uint32_t elapsedUs);
+
+  MqttMetrics _metrics;
+  int _lastErrorType; // esp_mqtt_error_type_t of the last MQTT_EVENT_ERROR
+
+  // Latency instrumentation
+  LatencyHistogram _latency[static_cast<size_t>(MqttLatency::Count)];
+  uint32_t _connectStartUs; // 0 when no connection attempt is pending
+  // Publish->PUBACK start times indexed by msg_id. With more than kAckSlots publishes
+  // in flight a slot is reused and that sample is lost.
+  static const size_t kAckSlots = 16;
+  struct AckSlot {
+    std::atomic<int> msgId;
+    std::atomic<uint32_t> startUs; // relaxed; a slot is rewritten while an old ack may be reading it
+    std::atomic<uint32_t> traceId;
+  };
+  AckSlot _ackSlots[kAckSlots];
+  void resyncInFlight();
+
+  // Connection phase timing, written by connect() and the event task
+  ConnectHistory _connectHistory;
+  mutable std::mutex _connectHistoryLock;
+  uint32_t _lastDisconnectUs; // start of the reconnect backoff
+  void connectFailed(uint32_t nowUs);
+  TimedTransport* _timedTransport; // owned by the esp-mqtt handle
+  void applyTransportTls(void* transport); // esp_transport_handle_t of an SSL transport
+
+#ifdef MQTT_TRACE
+  MessageTrace _trace;
+#endif
+
+  // Stats reporter, driven from loop() on the application task
+  static const uint32_t kStatsMinIntervalMs = 1000;
+  static const int32_t kStatsMaxBacklogBytes = 4096; // skip a report while the outbox is this full
+  uint32_t _statsIntervalMs; // 0 = disabled
+  char* _statsTopic;         // nullptr = default topic
+  uint32_t _statsLastMs;
+  uint32_t _statsSampleMs;
+  int32_t _outboxPeak;
+  MqttMetricsSnapshot _statsPrev;
+  void serviceStatsReport(uint32_t nowMs);
+
+  // Topic accounting; the flag keeps the disabled hot path lock-free
+  std::atomic<bool> _topicAccounting;
+  std::unique_ptr<TopicSketch> _topicSketches[2]; // indexed by TopicDirection
+  mutable std::mutex _topicLock;
+  void accountTopic(TopicDirection direction, const char* topic, uint32_t bytes);
+
+  // Inbound fragments, event task only. _rxPayload holds _rxCapacity bytes plus a NUL.
+  static const size_t kRxTopicSize = 256;
+  static const size_t kDefaultMaxMessageSize = 1024;
+  enum class RxMode : uint8_t { Idle, Reassemble, Stream, Drop };
+  char _rxTopic[kRxTopicSize];
+  char* _rxPayload;
+  size_t _rxCapacity;
+  size_t _maxMessageSize;
+  RxMode _rxMode;
+  size_t _rxNext; // offset of the next expected fragment
+  size_t _rxTotal;
+  size_t _rxSlot; // profiler slot of a streamed message
+  uint32_t _rxReceivedUs;
+  void reserveReceiveBuffer();
+  void beginMessage(esp_mqtt_event_handle_t event, size_t total, uint32_t receivedUs);
+  void onDataChunkInternal(const char* data, size_t len, size_t offset);
+
+  std::atomic<TrafficCapture*> _capture;
+  void captureEvent(CaptureEvent event, int msgId = 0);
+
+  // Stack and heap watermarks
+  uint32_t _connectHeapBefore; // free heap at BEFORE_CONNECT, 0 when no attempt is measured
+  uint32_t _connectHeapMinBefore;
+  uint32_t _stackSampleCount;
+  uint32_t _appStackSampleMs;
+  void sampleEventTaskStack();
+  void finishConnectHeap();
+  void dumpWatermarks();
+
+  // Link probe. The loop() task sends, the event task receives: _probeAwaitSeq is the
+  // handoff (0 = nothing outstanding) and publishes _probeSentUs.
+  uint32_t _probeIntervalMs; // 0 = disabled
+  uint8_t _probeMaxMissed;
+  uint8_t _probeMissed;
+  char* _probeTopic;
+  bool _probeDefaultTopic; // _probeTopic derived from the client id
+  uint32_t _probeLastMs;
+  uint32_t _probeSeq;
+  uint32_t _probeSentUs;
+  std::atomic<uint32_t> _probeAwaitSeq;
+  std::atomic<bool> _probeTimedOut;
+  void resolveProbeTopic();
+  void serviceLinkProbe(uint32_t nowMs);
+  bool handleProbeEcho(const char* topic, const char* data, int data_len);
+
+  void release();
+  void moveFrom(MqttClient& other);
 
   void parseUriComponents(const char* uri);
   void handleMessage(const char* topic, const char* payload);
   void buildUriIfNeeded();
 
 public:
-  void onConnectedInternal();
+  void onBeforeConnectInternal();
+  void onConnectedInternal(bool sessionPresent);
   void onDisconnectedInternal();
-  void onDataInternal(const char* topic, const char* data, int data_len);
+  void onDataInternal(const char* topic, const char* data, int data_len, uint32_t receivedUs = 0);
+  // One MQTT_EVENT_DATA: reassembles, streams or drops the message it belongs to
+  void onDataFragmentInternal(esp_mqtt_event_handle_t event, uint32_t receivedUs);
+  void onDataDroppedInternal();
+  void onPublishedInternal(int msgId);
+  void onDeletedInternal(int msgId);
+  void onErrorInternal(int errorType, int espTlsError = 0, int connectReturnCode = 0);
+  // Transport wrapper: connects the current broker's transport and marks it up
+  int connectTransportInternal(TimedTransport* transport, const char* host, int port, int timeoutMs);
+  void onTransportDestroyedInternal(TimedTransport* transport);
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Logging facade for the client. Levels above MQTT_LOG_LEVEL compile out entirely,
+// including their arguments. Hot-path call sites use MQTT_LOG*_HOT, which records the
+// format pointer and up to three integer arguments into a lock-free ring instead of
+// formatting on the spot when MQTT_LOG_DEFERRED is defined. The ring is rendered later
+// by mqttLogFlush() (called from MqttClient::loop()) or exported raw for host decoding.
+
+#define MQTT_LOG_LEVEL_NONE 0
+#define MQTT_LOG_LEVEL_ERROR 1
+#define MQTT_LOG_LEVEL_WARN 2
+#define MQTT_LOG_LEVEL_INFO 3
+#define MQTT_LOG_LEVEL_DEBUG 4
+#define MQTT_LOG_LEVEL_VERBOSE 5
+
+#ifndef MQTT_LOG_LEVEL
+#define MQTT_LOG_LEVEL MQTT_LOG_LEVEL_INFO
+#endif
+
+#ifndef MQTT_LOG_RING_SIZE
+#define MQTT_LOG_RING_SIZE 64 // entries, power of two
+#endif
+
+// Output sink for rendered lines (without trailing newline). Defaults to Serial on
+// Arduino and stdout elsewhere.
+typedef void (*MqttLogSink)(uint8_t level, const char *line);
+void mqttLogSetSink(MqttLogSink sink);
+
+void mqttLogPrintf(uint8_t level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void mqttLogDeferred(uint8_t level, const char *fmt, uint32_t a0, uint32_t a1, uint32_t a2);
+
+// Render up to maxEntries pending ring entries through the sink. Returns the number rendered.
+// Safe to call from several tasks at once (every client's loop() does): each entry is
+// rendered by exactly one of them.
+size_t mqttLogFlush(size_t maxEntries = MQTT_LOG_RING_SIZE);
+// Entries overwritten before they could be rendered
+uint32_t mqttLogLost();
+
+// Raw ring record for host-side decoding. fmt is the address of the format literal in
+// the firmware image; a host tool resolves it against the ELF to render the line.
+struct MqttLogRecord {
+  uint32_t timestampUs;
+  uint32_t fmt;
+  uint32_t args[3];
+  uint8_t level;
+};
+// Drain pending entries as raw records instead of rendering them
+size_t mqttLogExport(MqttLogRecord *out, size_t maxRecords);
+
+#define MQTT_LOG_AT(level, fmt, ...)                                                                              \
+  do {                                                                                                            \
+    if ((level) <= MQTT_LOG_LEVEL) mqttLogPrintf((level), fmt, ##__VA_ARGS__);                                   \
+  } while (0)
+
+#define MQTT_LOGE(fmt, ...) MQTT_LOG_AT(MQTT_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define MQTT_LOGW(fmt, ...) MQTT_LOG_AT(MQTT_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define MQTT_LOGI(fmt, ...) MQTT_LOG_AT(MQTT_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define MQTT_LOGD(fmt, ...) MQTT_LOG_AT(MQTT_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define MQTT_LOGV(fmt, ...) MQTT_LOG_AT(MQTT_LOG_LEVEL_VERBOSE, fmt, ##__VA_ARGS__)
+
+// Hot-path variants: one to three integer arguments
+#define MQTT_LOG_HOT_ARGS(a0, a1, a2, ...) (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2)
+#ifdef MQTT_LOG_DEFERRED
+#define MQTT_LOG_HOT_AT(level, fmt, ...)                                                                         \
+  do {                                                                                                            \
+    if ((level) <= MQTT_LOG_LEVEL) mqttLogDeferred((level), fmt, MQTT_LOG_HOT_ARGS(__VA_ARGS__, 0, 0, 0));        \
+  } while (0)
+#else
+#define MQTT_LOG_HOT_AT(level, fmt, ...) MQTT_LOG_AT(level, fmt, __VA_ARGS__)
+#endif
+
+#define MQTT_LOGD_HOT(fmt, ...) MQTT_LOG_HOT_AT(MQTT_LOG_LEVEL_DEBUG, fmt, __VA_ARGS__)
+#define MQTT_LOGV_HOT(fmt, ...) MQTT_LOG_HOT_AT(MQTT_LOG_LEVEL_VERBOSE, fmt, __VA_ARGS__)
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free counters and gauges for the client hot paths.
+// Counters are kept per CPU core so the esp-mqtt task and the application task rarely
+// contend on the same cache line; a snapshot sums the per-core slots. Tasks are not
+// pinned, so two of them can still add to the same slot: every add is atomic. Counters are
+// 32-bit and wrap, consumers should work with deltas between snapshots.
+
+enum class MqttCounter : uint8_t {
+  MessagesIn,
+  MessagesOut,
+  BytesIn,
+  BytesOut,
+  BytesCopied, // payload bytes copied by the client (inbound reassembly; publish() copies nothing)
+  PublishQos0,
+  PublishQos1,
+  PublishQos2,
+  PublishAcked,
+  Connects,
+  ConnectAttempts,
+  CallbackCalls,
+  CallbackTimeUs,
+  CallbackOverBudget, // callbacks that ran longer than the configured budget
+  // Drops by reason
+  DropNotConnected,   // publish without a connection
+  DropPublishFailed,  // esp-mqtt rejected the publish (outbox full, ...)
+  DropExpired,        // esp-mqtt deleted an unacknowledged message from its outbox
+  DropFiltered,       // inbound message not matching any subscribed filter
+  DropOversize,       // inbound message larger than the receive buffer
+  // Disconnects (reasons for reconnecting)
+  DisconnectClean,
+  DisconnectTransport, // TCP/TLS transport error
+  DisconnectRefused,   // CONNACK with an error return/reason code
+  DisconnectTimeout,   // keepalive or probe timeout
+  // Failed connection attempts by phase (see ConnectPhase)
+  ConnectFailInit,
+  ConnectFailDns,
+  ConnectFailTcp,
+  ConnectFailTls,
+  ConnectFailConnack,
+  Count
+};
+
+struct MqttMetricsSnapshot {
+  uint32_t counters[static_cast<size_t>(MqttCounter::Count)];
+  // Gauges
+  int32_t inFlight;       // QoS>0 publishes waiting for their acknowledgement
+  int32_t outboxBytes;    // esp-mqtt outbox size, -1 if unavailable
+  uint32_t callbackMaxUs; // longest callback since the last reset
+  // Memory watermarks in bytes, -1 until sampled or where unavailable (host builds)
+  int32_t eventStackFree;  // least free stack ever seen on the esp-mqtt task (callbacks run here)
+  int32_t appStackFree;    // same for the task calling loop()
+  int32_t heapFreeMin;     // lowest free heap since boot
+  int32_t connectHeapLow;  // lowest free heap seen across connects (transport + TLS handshake)
+  int32_t connectHeapUsed; // largest heap drop during a single connect
+
+  uint32_t get(MqttCounter counter) const { return counters[static_cast<size_t>(counter)]; }
+};
+
+class MqttMetrics {
+public:
+  static const size_t kCores = 2;
+
+  MqttMetrics() : _inFlight(0), _eventStackFree(-1), _appStackFree(-1), _connectHeapLow(-1), _connectHeapUsed(-1) {
+    reset();
+  }
+
+  void add(MqttCounter counter, uint32_t value = 1) {
+    slot(currentCore())[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void inFlightAdd(int32_t delta) { _inFlight.fetch_add(delta, std::memory_order_relaxed); }
+  void inFlightSet(int32_t value) { _inFlight.store(value, std::memory_order_relaxed); }
+  void recordCallback(uint32_t elapsedUs);
+
+  // Watermarks survive reset(): they describe the lifetime of the tasks and the heap
+  void recordEventStackFree(int32_t bytes) { lower(_eventStackFree, bytes); }
+  void recordAppStackFree(int32_t bytes) { lower(_appStackFree, bytes); }
+  void recordConnectHeap(int32_t lowBytes, int32_t usedBytes);
+
+  // Copies every counter and gauge, for moving a client; not while either side records
+  MqttMetrics &operator=(const MqttMetrics &other);
+
+  // Fills everything except outboxBytes and heapFreeMin, which the client queries
+  void snapshot(MqttMetricsSnapshot &out) const;
+  void reset();
+
+#ifndef ESP_PLATFORM
+  // Host builds have no cores: the calling thread's slot is 0 unless set here, so tests
+  // can stand in for tasks on either core
+  static void setHostCore(size_t core);
+#endif
+
+private:
+  struct alignas(32) CoreSlot {
+    std::atomic<uint32_t> values[static_cast<size_t>(MqttCounter::Count)];
+  };
+
+  CoreSlot _cores[kCores];
+  std::atomic<int32_t> _inFlight;
+  std::atomic<uint32_t> _callbackMaxUs;
+  std::atomic<int32_t> _eventStackFree;
+  std::atomic<int32_t> _appStackFree;
+  std::atomic<int32_t> _connectHeapLow;
+  std::atomic<int32_t> _connectHeapUsed;
+
+  // Keep the smallest non-negative value, -1 meaning "not sampled"
+  static void lower(std::atomic<int32_t> &gauge, int32_t value);
+
+  std::atomic<uint32_t> *slot(size_t core) { return _cores[core].values; }
+  static size_t currentCore();
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MqttMetrics.h"
+#include "LatencyHistogram.h"
+
+// Compact JSON health report published by the client's stats reporter.
+// Traffic and drop counters are deltas against the previous report so dashboards can
+// plot rates directly; connection counters are running totals.
+
+struct MqttStatsReport {
+  const MqttMetricsSnapshot* current = nullptr;
+  const MqttMetricsSnapshot* previous = nullptr; // nullptr: report totals
+  uint32_t intervalMs = 0;                       // time covered by the deltas
+  uint32_t uptimeS = 0;
+  int32_t outboxPeak = -1;                       // highest outbox size seen, -1 if unavailable
+  uint32_t heapFree = 0;                         // 0 when unknown
+  uint32_t heapMin = 0;
+  // Connect, publish-ack, dispatch and link-probe RTT latency; nullptr entries are left out
+  static const size_t kLatencyKinds = 4;
+  const LatencyHistogram* latency[kLatencyKinds] = {nullptr, nullptr, nullptr, nullptr};
+};
+
+// Returns the length written, or -1 if the report does not fit `len`
+int formatStatsReport(const MqttStatsReport& report, char* buf, size_t len);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "CallbackProfiler.h"
+
+// Client-side record of active subscriptions, used to restore them after reconnect.
+
+// MQTT topic filter matching ('+' single level, '#' multi level). Topics starting
+// with '$' are not matched by a wildcard in the first level, as required by the spec.
+bool topicMatchesFilter(const char *filter, const char *topic);
+
+// Validate wildcard placement: '#' only as the last level, '+' only as a whole level.
+bool isValidTopicFilter(const char *filter);
+
+// True if every topic matched by `specific` is also matched by `general`.
+bool filterCovers(const char *general, const char *specific);
+
+struct Subscription {
+  std::string filter;
+  uint8_t qos = 0;
+  bool active = false; // SUBSCRIBE sent on the current connection
+  // Profiler slot for the callback time of messages this filter matched, resolved on the
+  // first one; updated through match() results, under the client's subscription lock
+  mutable CallbackSlotRef callbackSlot;
+};
+
+class SubscriptionRegistry {
+public:
+  // Add a filter or update the QoS of an existing one. Returns nullptr for invalid filters.
+  Subscription *add(const char *filter, uint8_t qos);
+  bool remove(const char *filter);
+  Subscription *find(const char *filter);
+
+  size_t size() const { return _subs.size(); }
+  bool empty() const { return _subs.empty(); }
+  Subscription &at(size_t index) { return _subs[index]; }
+  const Subscription &at(size_t index) const { return _subs[index]; }
+  void clear() { _subs.clear(); }
+
+  // Connection lost: nothing is subscribed on the broker side anymore
+  void markAllInactive();
+  // Broker resumed the session (session_present): everything is still subscribed
+  void markAllActive();
+
+  // True if any registered filter matches the topic
+  bool matches(const char *topic) const { return match(topic) != nullptr; }
+  // First registered filter matching the topic, nullptr if none
+  const Subscription *match(const char *topic) const;
+
+private:
+  std::vector<Subscription> _subs;
+};
+
+// Wildcard aggregation: trade broker-side precision for fewer SUBSCRIBEs and less broker state.
+// Filters that differ in exactly one literal level are collapsed into a '+' filter once at
+// least minSiblings of them exist; filters covered by another one are dropped. The client
+// filters inbound messages locally, so callbacks still only see what was subscribed.
+struct AggregationPolicy {
+  bool enabled = false;
+  uint8_t minSiblings = 4; // smallest group collapsed into a '+' filter
+};
+
+// Compute a covering set of wire filters for the registry. Each wire filter gets the
+// highest QoS of the filters it covers. O(n^2) in the registry size: run on connect and
+// by subscribe() calls made while connected, not per message.
+void aggregateFilters(const SubscriptionRegistry &registry, const AggregationPolicy &policy,
+                      std::vector<Subscription> &out);
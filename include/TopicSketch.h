@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Heavy-hitter topic accounting in fixed memory (weighted Space-Saving).
+// Monitors kCapacity topics weighted by bytes. A topic not being monitored takes over
+// the entry with the fewest bytes and inherits its counts, recorded as `errorBytes` and
+// `errorMessages`. `bytes` is an upper bound and any topic carrying more than 1/kCapacity
+// of the bytes is guaranteed to be present. `messages` is approximate: eviction picks the
+// fewest bytes, not the fewest messages, so a topic can have lost more messages than it
+// inherits. `messages - errorMessages` is a lower bound. Topics are identified by a
+// 32-bit hash and stored truncated. Not thread-safe, the client serializes access.
+
+struct TopicCount {
+  char topic[48];         // truncated for display
+  uint32_t hash;
+  uint32_t messages;      // approximate, see above
+  uint32_t bytes;         // upper bound, payload bytes
+  uint32_t errorBytes;    // overestimation inherited from the replaced entry
+  uint32_t errorMessages; // messages inherited from the replaced entry
+};
+
+class TopicSketch {
+public:
+  static const size_t kCapacity = 16;
+
+  TopicSketch() { clear(); }
+
+  void add(const char* topic, uint32_t bytes);
+  // Monitored topics by bytes, highest first. Returns the number copied.
+  size_t top(TopicCount* out, size_t max) const;
+  size_t size() const { return _used; }
+  void clear();
+
+  static uint32_t hash(const char* topic);
+
+private:
+  TopicCount _entries[kCapacity];
+  size_t _used;
+};
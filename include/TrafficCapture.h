@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Traffic capture for offline analysis and replay. The client records inbound and
+// outbound messages and connection events into a fixed byte ring; loop() drains the ring
+// through a sink (a file on flash, a spare UART, a host pipe) so the esp-mqtt task never
+// waits on slow storage. When the ring is full, records are dropped whole and counted.
+//
+// Stream format, little endian: an 8-byte header ("MQTC", version, 3 reserved bytes),
+// then one record per event:
+//   u8      event (low 4 bits) | retain 0x10 | truncated 0x20 | qos << 6
+//   varint  microseconds since the previous record (since start() for the first)
+//   varint  msg_id
+//   varint  topic length, topic bytes
+//   varint  payload length as sent or received
+//   varint  stored payload length (only when truncated), payload bytes
+
+#ifndef MQTT_CAPTURE_BUFFER
+#define MQTT_CAPTURE_BUFFER 4096 // bytes
+#endif
+
+enum class CaptureEvent : uint8_t {
+  Inbound,      // message delivered by esp-mqtt
+  Outbound,     // publish() accepted
+  Acked,        // PUBACK/PUBCOMP for msg_id
+  Connected,
+  Disconnected,
+  Dropped,      // inbound message discarded (too large for the receive buffer)
+  Count
+};
+
+const char* captureEventName(CaptureEvent event);
+
+struct CaptureRecord {
+  CaptureEvent event;
+  uint8_t qos;
+  bool retain;
+  bool truncated;
+  uint64_t timeUs; // since the start of the capture
+  int msgId;
+  const char* topic; // not NUL-terminated, points into the decoded buffer
+  size_t topicLen;
+  const uint8_t* payload;
+  size_t storedLen;  // bytes at `payload`
+  size_t payloadLen; // original length
+};
+
+class TrafficCapture {
+public:
+  static const size_t kHeaderSize = 8;
+  static const uint8_t kVersion = 1;
+
+  // Receives the encoded stream in order; called from flush()
+  typedef std::function<void(const uint8_t* data, size_t len)> Sink;
+
+  explicit TrafficCapture(size_t bufferSize = MQTT_CAPTURE_BUFFER);
+  ~TrafficCapture();
+  TrafficCapture(const TrafficCapture&) = delete;
+  TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+  void setSink(Sink sink) { _sink = sink; }
+  // Payloads longer than this are stored truncated, keeping their original length
+  // (default 256 bytes, 0 stores no payload at all)
+  void setMaxPayload(size_t bytes) { _maxPayload = bytes; }
+
+  // Discards anything pending and begins a new stream with its header. Timestamps are
+  // micros(); records that arrive with an earlier time than their predecessor (another
+  // task won the lock) are stored with a zero delta.
+  void start(uint32_t nowUs);
+  void stop();
+  bool active() const { return _active.load(std::memory_order_relaxed); }
+
+  void record(uint32_t nowUs, CaptureEvent event, const char* topic, size_t topicLen, const void* payload,
+              size_t length, int qos = 0, bool retain = false, int msgId = 0);
+  // record() for a message of which only the first `headLen` bytes are at hand, such as the
+  // first fragment of a streamed message; at most those are stored
+  void recordHead(uint32_t nowUs, CaptureEvent event, const char* topic, size_t topicLen, const void* head,
+                  size_t headLen, size_t length, int qos = 0, bool retain = false, int msgId = 0);
+  // Writes pending bytes through the sink. Returns the number of bytes written.
+  size_t flush();
+
+  size_t pending() const;
+  // Records dropped because the ring was full
+  uint32_t lost() const { return _lost.load(std::memory_order_relaxed); }
+
+private:
+  uint8_t* _ring;
+  size_t _size;
+  size_t _head; // next write position
+  size_t _used;
+  size_t _maxPayload;
+  std::atomic<bool> _active; // checked without the lock on the hot path
+  uint32_t _lastUs;
+  std::atomic<uint32_t> _lost;
+  Sink _sink;
+  mutable std::mutex _lock;
+
+  void put(const uint8_t* data, size_t len);
+};
+
+// Decodes a captured stream held in memory. Records point into the buffer.
+class CaptureReader {
+public:
+  CaptureReader(const uint8_t* data, size_t len);
+
+  // False when the buffer does not start with a capture header of a known version
+  bool valid() const { return _valid; }
+  // Next record; false at the end of the data or on a truncated or corrupt record
+  bool next(CaptureRecord& out);
+  // True when next() stopped before the end of the data
+  bool corrupt() const { return _pos < _len; }
+
+private:
+  const uint8_t* _data;
+  size_t _len;
+  size_t _pos;
+  uint64_t _timeUs;
+  bool _valid;
+
+  bool readVarint(uint64_t& out);
+};
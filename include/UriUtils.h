@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <string>
 
 // Lightweight URI parsing/building focused on MQTT and WebSocket transports
@@ -16,8 +17,29 @@ struct UriParts {
   bool isSecure() const { return scheme == "mqtts" || scheme == "wss"; }
 };
 
+// Allocation-free form of UriParts: the fields point into the parsed string (the path
+// may point at a static "/"), so it is only valid while that string is. The scheme keeps
+// its original case.
+struct UriView {
+  const char* scheme = nullptr;
+  size_t schemeLen = 0;
+  const char* host = nullptr;
+  size_t hostLen = 0;
+  uint16_t port = 0;
+  const char* path = nullptr; // ws/wss only, otherwise empty
+  size_t pathLen = 0;
+
+  bool isWebSocket() const;
+  bool isSecure() const;
+};
+
 // Parse a URI into parts. Returns true on success.
 bool parseMqttUri(const std::string &uri, UriParts &out);
+// Same without heap allocation. Also rejects ports that are not a number in 1..65535.
+bool parseMqttUri(const char *uri, UriView &out);
 
 // Build a URI string from parts. If path is set for ws/wss, it's appended.
 std::string buildMqttUri(const UriParts &parts);
+// Same into a caller buffer with snprintf semantics: returns the full length, and the
+// output is only complete when that is below `len`. `path` may be nullptr.
+int formatMqttUri(char *buf, size_t len, const char *scheme, const char *host, uint16_t port, const char *path);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Heap allocation accounting for native tests and benchmarks. On glibc the malloc family
+// is interposed, which also sees operator new, strdup and C library allocations. Under
+// the sanitizers (which own malloc) and on other C libraries the hooks are off.
+//
+// Counts are per thread. The esp-mqtt stand-in marks its own work with AllocExempt and
+// event handlers with AllocCounted, so a thread's counts cover MqttClient and the
+// application but not the shim, whose allocations say nothing about esp-mqtt's.
+
+struct AllocCounts {
+  uint64_t allocs;
+  uint64_t bytes;
+};
+
+// True when allocations are actually being counted in this build
+bool allocHooksActive();
+// Allocations made by the calling thread outside AllocExempt scopes, since thread start
+AllocCounts allocThreadCounts();
+// Bytes currently allocated through the hooks, all threads
+int64_t allocLiveBytes();
+
+// Allocations by this thread inside the scope are not counted. Nests.
+class AllocExempt {
+public:
+  AllocExempt();
+  ~AllocExempt();
+  AllocExempt(const AllocExempt&) = delete;
+  AllocExempt& operator=(const AllocExempt&) = delete;
+};
+
+// Counts again inside an AllocExempt scope, e.g. around a call back into the client
+class AllocCounted {
+public:
+  AllocCounted();
+  ~AllocCounted();
+  AllocCounted(const AllocCounted&) = delete;
+  AllocCounted& operator=(const AllocCounted&) = delete;
+
+private:
+  uint32_t _savedDepth;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+// The parts of the Arduino core the library uses, for host (Linux) builds
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_idf_version.h"
+
+// Monotonic since process start, wrapping at 32 bits like the ESP32 core
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+class HostSerial {
+public:
+  void begin(unsigned long) {}
+  size_t print(const char* s);
+  size_t print(long v);
+  size_t println(const char* s = "");
+  size_t println(long v);
+  int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HostSerial Serial;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Time source of the host Arduino core. millis(), micros() and delay() read and sleep on
+// the installed clock, and with them every timer in the esp-mqtt stand-in (keepalive,
+// retransmit, reconnect, network timeout), in MqttClient (link probe, stats reports,
+// broker back-off, the fallback delay), in LoopbackBroker and in ImpairedNetwork.
+//
+// While a clock is installed, timed waits on in-memory pipes (reads and accepts) do not
+// block: they look once and, when nothing is there, sleep the clock for their timeout.
+// With a VirtualClock that makes every wait instant, so simulations must run on one
+// thread, with mqttHostSetManualStep() clients and a manually stepped LoopbackBroker:
+// nothing else can move data while the clock stands still. TCP is not virtualized.
+class HostClock {
+public:
+  virtual ~HostClock() {}
+  // Monotonic, in microseconds since an arbitrary start; millis() and micros() wrap it
+  // at 32 bits like the ESP32 core
+  virtual uint64_t nowUs() = 0;
+  virtual void sleepUs(uint64_t us) = 0;
+};
+
+// nullptr restores the system clock
+void mqttHostSetClock(HostClock* clock);
+// The installed clock, nullptr while the system clock is in use
+HostClock* mqttHostClock();
+
+// Simulated time: stands still until advanced, and sleeping advances it
+class VirtualClock : public HostClock {
+public:
+  // Start close to 2^32 ms or 2^32 us to run code across a millis() or micros() wrap
+  explicit VirtualClock(uint64_t startUs = 0) : _nowUs(startUs) {}
+
+  uint64_t nowUs() override { return _nowUs.load(std::memory_order_relaxed); }
+  void sleepUs(uint64_t us) override { _nowUs.fetch_add(us, std::memory_order_relaxed); }
+  void advanceMs(uint64_t ms) { sleepUs(ms * 1000); }
+
+private:
+  std::atomic<uint64_t> _nowUs;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+
+#include "MqttHost.h"
+
+// Network impairment for native tests and benchmarks: a HostTransport wrapper that delays,
+// throttles, stalls and resets the byte stream between MqttClient and a broker. The link
+// is a stream like TCP, so nothing is lost or reordered: packet loss shows up as a
+// retransmission delay that holds back everything behind the lost segment.
+//
+// Time comes from millis(), and all the work happens in the caller's read() and write(),
+// with no threads of its own, so manually stepped clients stay single-threaded. Random
+// choices come from a generator seeded per connection, so a run is reproducible as far as
+// the timing of the code under test allows.
+
+struct ImpairmentProfile {
+  uint32_t latencyMs = 0;      // one-way delay, each direction
+  uint32_t jitterMs = 0;       // extra one-way delay, uniform in 0..jitterMs
+  uint32_t bandwidthBps = 0;   // bytes per second, each direction; 0 = unlimited
+  uint16_t lossPermille = 0;   // chance per segment (write or read chunk) of needing a retransmission
+  uint32_t retransmitMs = 200; // delay added by a loss
+  uint32_t stallEveryMs = 0;   // mean time between stalls (exponential); 0 = none
+  uint32_t stallMs = 0;        // stall duration, nothing moves in either direction
+  uint32_t resetEveryMs = 0;   // mean time between connection resets (exponential); 0 = none
+  uint32_t seed = 1;
+
+  // Roughly a poor cellular link: 150 +-100 ms, 32 KB/s, 2% loss, a 3 s stall every
+  // 30 s and a reset every 5 minutes on average
+  static ImpairmentProfile cellular();
+};
+
+// Parses "latency=150,jitter=100,bandwidth=32000,loss=20,retransmit=200,stall_every=30000,
+// stall=3000,reset_every=300000,seed=7" (any subset, values as in ImpairmentProfile; loss
+// in permille), or "cellular" optionally followed by overrides ("cellular,reset_every=0").
+bool parseImpairment(const char* spec, ImpairmentProfile& out);
+
+struct ImpairmentStats {
+  uint32_t connections;
+  uint32_t resets;    // connections reset by the impairment (not by either end)
+  uint32_t stalls;
+  uint32_t losses;
+  uint64_t bytesUp;   // client to broker, delivered
+  uint64_t bytesDown; // broker to client, delivered
+};
+
+// Applies one profile to every connection it wraps. install() makes it the shim's
+// transport factory, so each MqttClient connection attempt is impaired; the profile can
+// be changed while connections are live.
+class ImpairedNetwork {
+public:
+  explicit ImpairedNetwork(const ImpairmentProfile& profile = ImpairmentProfile());
+  ~ImpairedNetwork(); // uninstalls
+  ImpairedNetwork(const ImpairedNetwork&) = delete;
+  ImpairedNetwork& operator=(const ImpairedNetwork&) = delete;
+
+  void install();
+  void uninstall();
+
+  void setProfile(const ImpairmentProfile& profile);
+  ImpairmentProfile profile() const;
+  // Reset every live connection now, as if the carrier dropped it
+  void resetConnections();
+  ImpairmentStats stats() const;
+
+  // Impair an already created transport, e.g. one end of hostPipePair()
+  std::unique_ptr<HostTransport> wrap(std::unique_ptr<HostTransport> inner);
+
+  struct State;
+
+private:
+  std::shared_ptr<State> _state;
+  bool _installed;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MqttCodec.h"
+#include "MqttHost.h"
+
+// Embeddable MQTT broker for native tests and benchmarks. Speaks 3.1.1 and 5.0 (v5
+// properties are ignored), QoS 0/1/2 in both directions, retained messages, wildcard
+// filters, last will, client id takeover, keepalive enforcement and persistent sessions
+// (subscriptions only; nothing is queued for offline clients). One thread per listener
+// and per connection, or none in manual step mode.
+class LoopbackBroker {
+public:
+  struct Stats {
+    uint32_t connects;
+    uint32_t refused;
+    uint32_t publishesIn;  // PUBLISH packets received (duplicates of in-flight QoS 2 excluded)
+    uint32_t deliveries;   // PUBLISH packets sent to subscribers
+    uint64_t bytesIn;      // payload bytes received
+    uint64_t bytesOut;     // payload bytes delivered
+  };
+
+  LoopbackBroker();
+  ~LoopbackBroker();
+  LoopbackBroker(const LoopbackBroker&) = delete;
+  LoopbackBroker& operator=(const LoopbackBroker&) = delete;
+
+  // Accept in-memory connections under `name` (mem://name, or mqtt://name through the shim)
+  bool listenPipe(const char* name);
+  // Accept TCP connections on 127.0.0.1. Port 0 picks a free port. Returns the port or 0.
+  uint16_t listenTcp(uint16_t port = 0);
+  // Close every listener and connection and join all threads
+  void stop();
+
+  // Manual stepping, for single-threaded simulations (see HostClock.h): set before
+  // listenPipe(), which then starts no threads; connections are served only in step().
+  // TCP listeners are not available in this mode.
+  void setManualStep(bool enable) { _manualStep = enable; }
+  // Accepts pending pipe connections and handles everything they have sent so far, on
+  // the calling thread. Returns false when there was nothing to do.
+  bool step();
+
+  // Answer the next CONNECTs with this return/reason code (0 accepts again)
+  void setConnackCode(uint8_t code) { _connackCode = code; }
+  // Drop the connection of `clientId` (every connection for nullptr) without DISCONNECT,
+  // as if the network failed: wills are published and persistent sessions kept
+  void dropConnections(const char* clientId = nullptr);
+
+  size_t connectionCount() const;
+  size_t retainedCount() const;
+  Stats stats() const;
+
+private:
+  struct Connection;
+  struct Session {
+    std::map<std::string, uint8_t> subscriptions; // filter -> granted QoS
+  };
+
+  void acceptLoop(int listenFd);
+  void pipeAcceptLoop();
+  void startConnection(std::unique_ptr<HostTransport> transport);
+  void serve(std::shared_ptr<Connection> conn);
+  int service(const std::shared_ptr<Connection>& conn, uint32_t timeoutMs);
+  bool handle(const std::shared_ptr<Connection>& conn, MqttPacket& packet);
+  bool handleConnect(const std::shared_ptr<Connection>& conn, MqttPacket& packet);
+  void route(const std::string& topic, const std::string& payload, uint8_t qos, bool retain);
+  void deliver(Connection& conn, const std::string& topic, const std::string& payload, uint8_t qos, bool retain);
+  void closeConnection(const std::shared_ptr<Connection>& conn, bool graceful);
+  void reapFinished();
+
+  mutable std::mutex _lock; // sessions, connections, retained messages, stats
+  std::vector<std::shared_ptr<Connection>> _connections;
+  std::map<std::string, Session> _sessions; // persistent sessions by client id
+  std::map<std::string, std::pair<std::string, uint8_t>> _retained; // topic -> payload, QoS
+  Stats _stats;
+
+  std::atomic<bool> _running;
+  std::atomic<uint8_t> _connackCode;
+  bool _manualStep;
+  std::vector<int> _listenFds;
+  std::unique_ptr<HostPipeListener> _pipeListener;
+  std::vector<std::thread> _listenThreads;
+};
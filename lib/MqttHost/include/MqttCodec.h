@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// MQTT 3.1.1 / 5.0 packet encoder and incremental decoder for the host shim and the
+// loopback broker. v5 properties are written empty and skipped when read; v5 reason
+// codes are carried where a packet has them.
+
+enum class MqttPacketType : uint8_t {
+  Connect = 1,
+  Connack,
+  Publish,
+  Puback,
+  Pubrec,
+  Pubrel,
+  Pubcomp,
+  Subscribe,
+  Suback,
+  Unsubscribe,
+  Unsuback,
+  Pingreq,
+  Pingresp,
+  Disconnect,
+  Auth
+};
+
+static const uint8_t kMqttLevel311 = 4;
+static const uint8_t kMqttLevel5 = 5;
+
+struct MqttPacket {
+  MqttPacketType type = MqttPacketType::Pingreq;
+  uint8_t flags = 0; // low nibble of the fixed header
+
+  // CONNECT
+  uint8_t protocolLevel = kMqttLevel311;
+  bool cleanSession = true;
+  uint16_t keepalive = 0;
+  std::string clientId;
+  bool hasUsername = false;
+  std::string username;
+  bool hasPassword = false;
+  std::string password;
+  bool hasWill = false;
+  std::string willTopic;
+  std::string willPayload;
+  uint8_t willQos = 0;
+  bool willRetain = false;
+
+  // CONNACK
+  bool sessionPresent = false;
+  uint8_t reasonCode = 0; // CONNACK return/reason code, v5 ack reason code
+
+  // PUBLISH
+  std::string topic;
+  std::string payload;
+  uint8_t qos = 0;
+  bool retain = false;
+  bool dup = false;
+
+  // Packet identifier (PUBLISH QoS>0, acks, SUBSCRIBE, UNSUBSCRIBE)
+  uint16_t packetId = 0;
+
+  // SUBSCRIBE (filter, options: QoS in the low bits), UNSUBSCRIBE (filter only)
+  std::vector<std::pair<std::string, uint8_t>> filters;
+  // SUBACK / UNSUBACK (v5) reason codes
+  std::vector<uint8_t> codes;
+};
+
+struct MqttConnectOptions {
+  uint8_t protocolLevel = kMqttLevel311;
+  const char* clientId = "";
+  const char* username = nullptr;
+  const char* password = nullptr;
+  uint16_t keepalive = 60;
+  bool cleanSession = true;
+  const char* willTopic = nullptr; // last will, sent when set
+  std::string willPayload;
+  uint8_t willQos = 0;
+  bool willRetain = false;
+};
+
+// Encoders append one complete packet to `out`
+void mqttEncodeConnect(std::vector<uint8_t>& out, const MqttConnectOptions& options);
+void mqttEncodeConnack(std::vector<uint8_t>& out, uint8_t level, bool sessionPresent, uint8_t code);
+void mqttEncodePublish(std::vector<uint8_t>& out, uint8_t level, const char* topic, const void* payload, size_t len,
+                       uint8_t qos, bool retain, bool dup, uint16_t packetId);
+// PUBACK, PUBREC, PUBREL, PUBCOMP
+void mqttEncodeAck(std::vector<uint8_t>& out, MqttPacketType type, uint8_t level, uint16_t packetId,
+                   uint8_t reasonCode = 0);
+void mqttEncodeSubscribe(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId,
+                         const std::vector<std::pair<std::string, uint8_t>>& filters);
+void mqttEncodeSuback(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId, const std::vector<uint8_t>& codes);
+void mqttEncodeUnsubscribe(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId,
+                           const std::vector<std::string>& filters);
+void mqttEncodeUnsuback(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId, size_t count);
+// PINGREQ, PINGRESP, DISCONNECT
+void mqttEncodeEmpty(std::vector<uint8_t>& out, MqttPacketType type);
+
+// Largest remaining length the fixed header can encode (256 MB)
+const size_t kMqttMaxPacketSize = 268435455;
+
+// Accumulates stream bytes and splits them into packets
+class MqttFrameReader {
+public:
+  enum class Result { NeedMore, Packet, Malformed };
+
+  explicit MqttFrameReader(size_t maxPacketSize = kMqttMaxPacketSize) : _maxPacketSize(maxPacketSize) {}
+
+  void feed(const uint8_t* data, size_t len) { _buf.insert(_buf.end(), data, data + len); }
+  // Decode the next packet. `level` selects the v5 layout for everything but CONNECT,
+  // which carries its own level.
+  Result next(MqttPacket& packet, uint8_t level);
+  void clear() { _buf.clear(); }
+  size_t buffered() const { return _buf.size(); }
+
+private:
+  std::vector<uint8_t> _buf;
+  size_t _maxPacketSize;
+};
+
+const char* mqttPacketTypeName(MqttPacketType type);
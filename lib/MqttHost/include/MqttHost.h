@@ -0,0 +1,105 @@
+#pragma once
+
+// Host side of the esp-mqtt shim: the byte transports the shim client connects
+// through, and control over how the client is driven.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+
+#include "mqtt_client.h"
+
+struct HostEndpoint {
+  std::string scheme; // "mqtt", "tcp", "mem", ...
+  std::string host;   // host name, or the listener name for mem://
+  std::string path;
+  uint16_t port = 0;
+};
+
+// Parse an mqtt URI into an endpoint. Returns false on malformed input.
+bool hostParseUri(const char* uri, HostEndpoint& out);
+
+// A connected byte stream. write() and read() may be called from different threads;
+// concurrent writers are serialized by the caller.
+class HostTransport {
+public:
+  virtual ~HostTransport() {}
+  virtual bool connect(const HostEndpoint& endpoint, uint32_t timeoutMs) = 0;
+  // Returns bytes written (all of them unless the stream failed) or -1
+  virtual int write(const uint8_t* data, size_t len) = 0;
+  // Returns bytes read, 0 on timeout, -1 once the stream is closed or failed
+  virtual int read(uint8_t* buf, size_t len, uint32_t timeoutMs) = 0;
+  virtual void close() = 0;
+  // errno of the last failure, reported as esp_transport_sock_errno
+  virtual int lastError() const { return 0; }
+};
+
+// TCP stream over POSIX sockets (TCP_NODELAY set)
+std::unique_ptr<HostTransport> hostTcpTransport();
+// Wraps an already connected socket, e.g. one returned by accept()
+std::unique_ptr<HostTransport> hostTcpTransport(int fd);
+
+// In-memory stream pair: what one end writes the other reads
+void hostPipePair(std::unique_ptr<HostTransport>& a, std::unique_ptr<HostTransport>& b);
+
+// Accepts in-memory connections. While a listener is registered under a name, a client
+// connecting to mem://<name>, or to mqtt://<name> with any port, gets one end of a fresh
+// pipe and the listener queues the other. A registered name shadows the DNS name, so
+// code that only knows mqtt:// URIs (MqttClient) can reach an in-process broker. Connecting
+// to an unregistered mem:// name is refused like a closed TCP port.
+class HostPipeListener {
+public:
+  explicit HostPipeListener(const char* name);
+  ~HostPipeListener();
+  HostPipeListener(const HostPipeListener&) = delete;
+  HostPipeListener& operator=(const HostPipeListener&) = delete;
+
+  // Next connected server end, or nullptr after timeoutMs
+  std::unique_ptr<HostTransport> accept(uint32_t timeoutMs);
+  const std::string& name() const { return _name; }
+
+  struct State;
+
+private:
+  std::string _name;
+  std::shared_ptr<State> _state;
+};
+
+// Transport factory used for each connection attempt. The default picks a pipe for
+// mem:// and registered listener names and TCP otherwise; tests install their own to
+// wrap or replace it. nullptr restores the default.
+typedef std::unique_ptr<HostTransport> (*HostTransportFactory)(const HostEndpoint& endpoint, void* ctx);
+void mqttHostSetTransportFactory(HostTransportFactory factory, void* ctx = nullptr);
+std::unique_ptr<HostTransport> mqttHostDefaultTransport(const HostEndpoint& endpoint);
+
+// Manual stepping: clients started while enabled get no thread of their own and only
+// make progress in mqttHostStep(), which runs one iteration of each such client's loop
+// (connect, read for up to timeoutMs, dispatch, keepalive and retransmit timers) on the
+// calling thread. Used for deterministic single-threaded tests; start, stop and destroy
+// those clients from the same thread.
+void mqttHostSetManualStep(bool enable);
+void mqttHostStep(uint32_t timeoutMs);
+// How long the manually stepped clients can go without a step before one of their timers
+// (reconnect, network timeout, retransmit, keepalive) is due; UINT32_MAX when none is
+// running. Input waiting to be read is not taken into account. Lets simulations on
+// virtual time (HostClock.h) jump from one timer to the next.
+uint32_t mqttHostIdleMs();
+
+// TLS material given to the most recent esp_mqtt_client_init() or esp_mqtt_set_config().
+// There is no TLS on the host, so tests check here what would reach the handshake: the
+// caller's pointers and lengths, which esp-mqtt borrows without copying.
+struct HostTlsConfig {
+  const char* caCert = nullptr;
+  size_t caCertLen = 0;
+  const char* clientCert = nullptr;
+  size_t clientCertLen = 0;
+  const char* clientKey = nullptr;
+  size_t clientKeyLen = 0;
+  bool skipCommonNameCheck = false;
+};
+HostTlsConfig mqttHostLastTlsConfig();
+
+// Automatic reconnect delay for clients whose config leaves reconnect_timeout_ms at 0
+// (esp-mqtt's default is 10 s). Applies to clients configured afterwards; 0 restores it.
+void mqttHostSetDefaultReconnectMs(uint32_t ms);
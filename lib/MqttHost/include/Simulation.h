@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "HostClock.h"
+#include "LoopbackBroker.h"
+#include "MqttHost.h"
+
+// Deterministic simulation on virtual time. The esp-mqtt stand-in's clients, a manually
+// stepped LoopbackBroker and the clock all run on the calling thread, and the clock jumps
+// from one timer to the next, so keepalive, reconnect and back-off behaviour over
+// thousands of simulated hours runs in seconds and comes out the same on every run.
+//
+//   Simulation sim;                       // broker on mqtt://sim-broker
+//   MqttClient client;                    // after sim: destroyed first
+//   client.setServer("sim-broker", 1883);
+//   sim.onTick([&] { client.loop(); });
+//   client.connect("device");
+//   sim.run(3600 * 1000, 100);            // one simulated hour, loop() at least every 100 ms
+class Simulation {
+public:
+  // Installs the clock and manual stepping for clients started from now on
+  explicit Simulation(const char* brokerName = "sim-broker", uint64_t startUs = 0);
+  // Restores the system clock and threaded clients; destroy the clients before
+  ~Simulation();
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+
+  VirtualClock& clock() { return _clock; }
+  LoopbackBroker& broker() { return _broker; }
+  uint64_t nowMs() { return _clock.nowUs() / 1000; }
+
+  // Application code to run on every tick, e.g. MqttClient::loop()
+  void onTick(std::function<void()> fn) { _onTick.push_back(std::move(fn)); }
+
+  // Runs the tick hooks, lets clients and broker exchange everything that is ready (a
+  // request and its answer take no simulated time), then advances the clock to the next
+  // client timer (mqttHostIdleMs()), by at least 1 and at most maxMs. maxMs stands in for
+  // timers the shim does not know about: MqttClient::loop() work, ImpairedNetwork, the
+  // test's own events. Returns the ms advanced.
+  uint32_t tick(uint32_t maxMs);
+  // Ticks through `durationMs` of simulated time
+  void run(uint64_t durationMs, uint32_t maxTickMs);
+  // Ticks until cond() holds, for at most timeoutMs of simulated time; returns cond()
+  bool runUntil(const std::function<bool()>& cond, uint64_t timeoutMs, uint32_t maxTickMs);
+
+private:
+  VirtualClock _clock;
+  LoopbackBroker _broker;
+  std::vector<std::function<void()>> _onTick;
+};
@@ -0,0 +1,4 @@
+#pragma once
+
+// Networking on the host goes through the MqttHost transports; nothing to configure here
+#include "Arduino.h"
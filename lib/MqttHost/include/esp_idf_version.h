@@ -0,0 +1,11 @@
+#pragma once
+
+// The host shim implements the esp-mqtt API of this ESP-IDF release, so every
+// version-gated path in the client (enqueue, outbox size, SUBSCRIBE with several
+// filters, the nested v5 config layout) is compiled and exercised natively.
+#define ESP_IDF_VERSION_MAJOR 5
+#define ESP_IDF_VERSION_MINOR 1
+#define ESP_IDF_VERSION_PATCH 0
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR, ESP_IDF_VERSION_PATCH)
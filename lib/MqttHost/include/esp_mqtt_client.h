@@ -0,0 +1,4 @@
+#pragma once
+
+// Pre-4.0 header name, kept so either include path resolves to the shim
+#include "mqtt_client.h"
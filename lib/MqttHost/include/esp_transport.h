@@ -0,0 +1,48 @@
+#pragma once
+
+// Host implementation of the ESP-IDF tcp_transport API (5.1 layout), enough for a
+// transport handed to esp-mqtt through network.transport: generic transports built
+// with esp_transport_set_func() and TCP transports over the MqttHost transport factory.
+// SSL and WebSocket transports exist so client code compiles; they fail to connect.
+//
+// Return values follow IDF: connect 0 or -1, read/write the byte count, 0 on timeout
+// and -1 once the stream failed or was closed.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_event.h"
+
+typedef struct esp_transport_item_t* esp_transport_handle_t;
+
+typedef int (*connect_func)(esp_transport_handle_t t, const char* host, int port, int timeout_ms);
+typedef int (*io_func)(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms);
+typedef int (*io_read_func)(esp_transport_handle_t t, char* buffer, int len, int timeout_ms);
+typedef int (*trans_func)(esp_transport_handle_t t);
+typedef int (*poll_func)(esp_transport_handle_t t, int timeout_ms);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_transport_handle_t esp_transport_init(void);
+esp_err_t esp_transport_destroy(esp_transport_handle_t t);
+int esp_transport_connect(esp_transport_handle_t t, const char* host, int port, int timeout_ms);
+int esp_transport_read(esp_transport_handle_t t, char* buffer, int len, int timeout_ms);
+int esp_transport_write(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms);
+int esp_transport_poll_read(esp_transport_handle_t t, int timeout_ms);
+int esp_transport_poll_write(esp_transport_handle_t t, int timeout_ms);
+int esp_transport_close(esp_transport_handle_t t);
+void* esp_transport_get_context_data(esp_transport_handle_t t);
+esp_err_t esp_transport_set_context_data(esp_transport_handle_t t, void* data);
+esp_err_t esp_transport_set_func(esp_transport_handle_t t, connect_func _connect, io_read_func _read,
+                                 io_func _write, trans_func _close, poll_func _poll_read, poll_func _poll_write,
+                                 trans_func _destroy);
+int esp_transport_get_default_port(esp_transport_handle_t t);
+esp_err_t esp_transport_set_default_port(esp_transport_handle_t t, int port);
+// errno of the last socket failure; -1 for transports without a socket of their own
+int esp_transport_get_errno(esp_transport_handle_t t);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "esp_transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// No TLS on the host: the transport takes its settings and refuses to connect
+esp_transport_handle_t esp_transport_ssl_init(void);
+void esp_transport_ssl_set_cert_data(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_set_cert_data_der(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_set_client_cert_data(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_set_client_cert_data_der(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_set_client_key_data(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_set_client_key_data_der(esp_transport_handle_t t, const char* data, int len);
+void esp_transport_ssl_skip_common_name_check(esp_transport_handle_t t);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "esp_transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Connects through the MqttHost transport factory, so registered pipe listeners and
+// installed factories (impairment, fault injection) apply as for the shim client
+esp_transport_handle_t esp_transport_tcp_init(void);
+
+#ifdef __cplusplus
+}
+#endif
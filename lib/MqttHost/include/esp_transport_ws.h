@@ -0,0 +1,17 @@
+#pragma once
+
+#include "esp_transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// No WebSocket on the host: the transport takes its settings and refuses to connect.
+// As in IDF, destroying it leaves the parent transport to the caller.
+esp_transport_handle_t esp_transport_ws_init(esp_transport_handle_t parent_handle);
+esp_err_t esp_transport_ws_set_path(esp_transport_handle_t t, const char* path);
+esp_err_t esp_transport_ws_set_subprotocol(esp_transport_handle_t t, const char* sub_protocol);
+
+#ifdef __cplusplus
+}
+#endif
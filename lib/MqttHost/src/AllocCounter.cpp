@@ -0,0 +1,113 @@
+#include "AllocCounter.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace {
+// Trivial thread_locals: static TLS, safe to touch from inside malloc
+thread_local uint64_t tAllocs = 0;
+thread_local uint64_t tBytes = 0;
+thread_local uint32_t tExemptDepth = 0;
+std::atomic<int64_t> sLiveBytes(0);
+
+inline void noteAlloc(size_t size) {
+  sLiveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+  if (tExemptDepth) return;
+  tAllocs++;
+  tBytes += size;
+}
+
+inline void noteFree(size_t size) {
+  sLiveBytes.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+}
+} // namespace
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#include <malloc.h>
+
+#define ALLOC_HOOKS_ACTIVE 1
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  if (ptr) noteAlloc(malloc_usable_size(ptr));
+  return ptr;
+}
+
+void* calloc(size_t count, size_t size) {
+  void* ptr = __libc_calloc(count, size);
+  if (ptr) noteAlloc(malloc_usable_size(ptr));
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  size_t old = ptr ? malloc_usable_size(ptr) : 0;
+  void* grown = __libc_realloc(ptr, size);
+  if (grown || size == 0) {
+    if (ptr) noteFree(old);
+    if (grown) noteAlloc(malloc_usable_size(grown));
+  }
+  return grown;
+}
+
+void* memalign(size_t alignment, size_t size) {
+  void* ptr = __libc_memalign(alignment, size);
+  if (ptr) noteAlloc(malloc_usable_size(ptr));
+  return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+  void* ptr = memalign(alignment, size);
+  if (!ptr) return ENOMEM;
+  *out = ptr;
+  return 0;
+}
+
+void free(void* ptr) {
+  if (!ptr) return;
+  noteFree(malloc_usable_size(ptr));
+  __libc_free(ptr);
+}
+}
+#else
+#define ALLOC_HOOKS_ACTIVE 0
+#endif
+
+bool allocHooksActive() {
+  return ALLOC_HOOKS_ACTIVE;
+}
+
+AllocCounts allocThreadCounts() {
+  return AllocCounts{tAllocs, tBytes};
+}
+
+int64_t allocLiveBytes() {
+  return sLiveBytes.load(std::memory_order_relaxed);
+}
+
+AllocExempt::AllocExempt() {
+  tExemptDepth++;
+}
+
+AllocExempt::~AllocExempt() {
+  tExemptDepth--;
+}
+
+AllocCounted::AllocCounted() : _savedDepth(tExemptDepth) {
+  tExemptDepth = 0;
+}
+
+AllocCounted::~AllocCounted() {
+  tExemptDepth = _savedDepth;
+}
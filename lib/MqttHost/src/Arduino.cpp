@@ -0,0 +1,71 @@
+#include "Arduino.h"
+#include "HostClock.h"
+
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+
+static const std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+static std::atomic<HostClock*> s_clock(nullptr);
+
+void mqttHostSetClock(HostClock* clock) {
+  s_clock = clock;
+}
+
+HostClock* mqttHostClock() {
+  return s_clock;
+}
+
+static uint64_t nowUs() {
+  if (HostClock* clock = s_clock.load()) return clock->nowUs();
+  auto elapsed = std::chrono::steady_clock::now() - s_start;
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+unsigned long millis() {
+  return static_cast<uint32_t>(nowUs() / 1000);
+}
+
+unsigned long micros() {
+  return static_cast<uint32_t>(nowUs());
+}
+
+void delay(unsigned long ms) {
+  if (HostClock* clock = s_clock.load()) {
+    clock->sleepUs(ms * 1000ull);
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+size_t HostSerial::print(const char* s) {
+  return fwrite(s, 1, strlen(s), stdout);
+}
+
+size_t HostSerial::print(long v) {
+  int n = ::printf("%ld", v);
+  return n > 0 ? n : 0;
+}
+
+size_t HostSerial::println(const char* s) {
+  size_t n = print(s);
+  fputc('\n', stdout);
+  return n + 1;
+}
+
+size_t HostSerial::println(long v) {
+  size_t n = print(v);
+  fputc('\n', stdout);
+  return n + 1;
+}
+
+int HostSerial::printf(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vprintf(fmt, args);
+  va_end(args);
+  return n;
+}
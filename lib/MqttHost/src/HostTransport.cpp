@@ -0,0 +1,341 @@
+#include "MqttHost.h"
+#include "HostClock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+bool hostParseUri(const char* uri, HostEndpoint& out) {
+  if (!uri) return false;
+  const char* sep = strstr(uri, "://");
+  if (!sep || sep == uri) return false;
+  out = HostEndpoint();
+  out.scheme.assign(uri, sep - uri);
+
+  const char* p = sep + 3;
+  const char* pathStart = strchr(p, '/');
+  std::string authority = pathStart ? std::string(p, pathStart - p) : std::string(p);
+  if (pathStart) out.path = pathStart;
+
+  size_t at = authority.rfind('@');
+  if (at != std::string::npos) authority.erase(0, at + 1);
+
+  std::string port;
+  if (!authority.empty() && authority[0] == '[') {
+    size_t close = authority.find(']');
+    if (close == std::string::npos) return false;
+    out.host = authority.substr(1, close - 1);
+    if (close + 1 < authority.size() && authority[close + 1] == ':') port = authority.substr(close + 2);
+  } else {
+    size_t colon = authority.rfind(':');
+    out.host = authority.substr(0, colon);
+    if (colon != std::string::npos) port = authority.substr(colon + 1);
+  }
+  if (out.host.empty()) return false;
+
+  if (!port.empty()) {
+    char* end = nullptr;
+    long value = strtol(port.c_str(), &end, 10);
+    if (*end || value <= 0 || value > 65535) return false;
+    out.port = static_cast<uint16_t>(value);
+  } else if (out.scheme == "mqtt" || out.scheme == "tcp") {
+    out.port = 1883;
+  } else if (out.scheme == "mqtts" || out.scheme == "ssl") {
+    out.port = 8883;
+  } else if (out.scheme == "ws") {
+    out.port = 80;
+  } else if (out.scheme == "wss") {
+    out.port = 443;
+  }
+  return true;
+}
+
+// ---- TCP ----
+
+namespace {
+class TcpTransport : public HostTransport {
+public:
+  explicit TcpTransport(int fd = -1) : _fd(fd) {}
+  ~TcpTransport() override { close(); }
+
+  bool connect(const HostEndpoint& endpoint, uint32_t timeoutMs) override {
+    close();
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", endpoint.port);
+    addrinfo* results = nullptr;
+    if (getaddrinfo(endpoint.host.c_str(), port, &hints, &results) != 0) {
+      _error = EHOSTUNREACH;
+      return false;
+    }
+    for (addrinfo* ai = results; ai && _fd < 0; ai = ai->ai_next) {
+      int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) continue;
+      if (connectWithTimeout(fd, ai->ai_addr, ai->ai_addrlen, timeoutMs)) {
+        _fd = fd;
+      } else {
+        ::close(fd);
+      }
+    }
+    freeaddrinfo(results);
+    if (_fd < 0) return false;
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+  }
+
+  int write(const uint8_t* data, size_t len) override {
+    if (_fd < 0) return -1;
+    size_t sent = 0;
+    while (sent < len) {
+      ssize_t n = send(_fd, data + sent, len - sent, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        _error = errno;
+        return -1;
+      }
+      sent += static_cast<size_t>(n);
+    }
+    return static_cast<int>(sent);
+  }
+
+  int read(uint8_t* buf, size_t len, uint32_t timeoutMs) override {
+    if (_fd < 0) return -1;
+    pollfd pfd = {_fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, static_cast<int>(timeoutMs));
+    if (ready == 0 || (ready < 0 && errno == EINTR)) return 0;
+    if (ready < 0) {
+      _error = errno;
+      return -1;
+    }
+    ssize_t n = recv(_fd, buf, len, 0);
+    if (n > 0) return static_cast<int>(n);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    _error = n < 0 ? errno : ECONNRESET;
+    return -1;
+  }
+
+  void close() override {
+    if (_fd >= 0) {
+      shutdown(_fd, SHUT_RDWR);
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+
+  int lastError() const override { return _error; }
+
+private:
+  bool connectWithTimeout(int fd, const sockaddr* addr, socklen_t addrLen, uint32_t timeoutMs) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int rc = ::connect(fd, addr, addrLen);
+    if (rc < 0 && errno != EINPROGRESS) {
+      _error = errno;
+      return false;
+    }
+    if (rc < 0) {
+      pollfd pfd = {fd, POLLOUT, 0};
+      if (poll(&pfd, 1, static_cast<int>(timeoutMs)) <= 0) {
+        _error = ETIMEDOUT;
+        return false;
+      }
+      int err = 0;
+      socklen_t errLen = sizeof(err);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+      if (err) {
+        _error = err;
+        return false;
+      }
+    }
+    fcntl(fd, F_SETFL, flags);
+    return true;
+  }
+
+  int _fd;
+  int _error = 0;
+};
+} // namespace
+
+std::unique_ptr<HostTransport> hostTcpTransport() {
+  return std::unique_ptr<HostTransport>(new TcpTransport());
+}
+
+std::unique_ptr<HostTransport> hostTcpTransport(int fd) {
+  return std::unique_ptr<HostTransport>(new TcpTransport(fd));
+}
+
+// ---- In-memory pipes ----
+
+namespace {
+struct PipeShared {
+  std::mutex lock;
+  std::condition_variable readable;
+  std::deque<uint8_t> buf[2]; // bytes waiting to be read by side 0 / side 1
+  bool closed[2] = {false, false};
+};
+
+class PipeEnd : public HostTransport {
+public:
+  PipeEnd() : _side(0) {}
+  PipeEnd(std::shared_ptr<PipeShared> shared, int side) : _shared(std::move(shared)), _side(side) {}
+  ~PipeEnd() override { close(); }
+
+  bool connect(const HostEndpoint& endpoint, uint32_t timeoutMs) override;
+
+  int write(const uint8_t* data, size_t len) override {
+    if (!_shared) return -1;
+    std::lock_guard<std::mutex> lock(_shared->lock);
+    if (_shared->closed[0] || _shared->closed[1]) return -1;
+    std::deque<uint8_t>& peer = _shared->buf[1 - _side];
+    peer.insert(peer.end(), data, data + len);
+    _shared->readable.notify_all();
+    return static_cast<int>(len);
+  }
+
+  int read(uint8_t* buf, size_t len, uint32_t timeoutMs) override {
+    if (!_shared) return -1;
+    std::unique_lock<std::mutex> lock(_shared->lock);
+    std::deque<uint8_t>& mine = _shared->buf[_side];
+    auto ready = [&] { return !mine.empty() || _shared->closed[0] || _shared->closed[1]; };
+    if (!ready() && timeoutMs) {
+      if (HostClock* clock = mqttHostClock()) {
+        lock.unlock();
+        clock->sleepUs(timeoutMs * 1000ull); // see HostClock.h: nothing arrives meanwhile
+        return 0;
+      }
+      _shared->readable.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+    }
+    if (mine.empty()) return (_shared->closed[0] || _shared->closed[1]) ? -1 : 0;
+    size_t n = len < mine.size() ? len : mine.size();
+    std::copy(mine.begin(), mine.begin() + n, buf);
+    mine.erase(mine.begin(), mine.begin() + n);
+    return static_cast<int>(n);
+  }
+
+  void close() override {
+    if (!_shared) return;
+    std::lock_guard<std::mutex> lock(_shared->lock);
+    _shared->closed[_side] = true;
+    _shared->readable.notify_all();
+  }
+
+  int lastError() const override { return _shared ? 0 : ECONNREFUSED; }
+
+private:
+  std::shared_ptr<PipeShared> _shared;
+  int _side;
+};
+} // namespace
+
+void hostPipePair(std::unique_ptr<HostTransport>& a, std::unique_ptr<HostTransport>& b) {
+  std::shared_ptr<PipeShared> shared = std::make_shared<PipeShared>();
+  a.reset(new PipeEnd(shared, 0));
+  b.reset(new PipeEnd(shared, 1));
+}
+
+struct HostPipeListener::State {
+  std::mutex lock;
+  std::condition_variable pending;
+  std::deque<std::unique_ptr<HostTransport>> accepted;
+};
+
+static std::mutex s_listenersLock;
+static std::map<std::string, std::weak_ptr<HostPipeListener::State>> s_listeners;
+
+HostPipeListener::HostPipeListener(const char* name) : _name(name), _state(std::make_shared<State>()) {
+  std::lock_guard<std::mutex> lock(s_listenersLock);
+  s_listeners[_name] = _state;
+}
+
+HostPipeListener::~HostPipeListener() {
+  std::lock_guard<std::mutex> lock(s_listenersLock);
+  auto it = s_listeners.find(_name);
+  if (it != s_listeners.end() && it->second.lock() == _state) s_listeners.erase(it);
+}
+
+std::unique_ptr<HostTransport> HostPipeListener::accept(uint32_t timeoutMs) {
+  std::unique_lock<std::mutex> lock(_state->lock);
+  if (_state->accepted.empty() && timeoutMs) {
+    if (HostClock* clock = mqttHostClock()) {
+      lock.unlock();
+      clock->sleepUs(timeoutMs * 1000ull);
+      return nullptr;
+    }
+    _state->pending.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&] { return !_state->accepted.empty(); });
+  }
+  if (_state->accepted.empty()) return nullptr;
+  std::unique_ptr<HostTransport> t = std::move(_state->accepted.front());
+  _state->accepted.pop_front();
+  return t;
+}
+
+bool PipeEnd::connect(const HostEndpoint& endpoint, uint32_t) {
+  std::shared_ptr<HostPipeListener::State> listener;
+  {
+    std::lock_guard<std::mutex> lock(s_listenersLock);
+    auto it = s_listeners.find(endpoint.host);
+    if (it != s_listeners.end()) listener = it->second.lock();
+  }
+  if (!listener) return false;
+  _shared = std::make_shared<PipeShared>();
+  _side = 0;
+  std::lock_guard<std::mutex> lock(listener->lock);
+  listener->accepted.emplace_back(new PipeEnd(_shared, 1));
+  listener->pending.notify_all();
+  return true;
+}
+
+// ---- Factory ----
+
+static std::mutex s_factoryLock;
+static HostTransportFactory s_factory = nullptr;
+static void* s_factoryCtx = nullptr;
+
+void mqttHostSetTransportFactory(HostTransportFactory factory, void* ctx) {
+  std::lock_guard<std::mutex> lock(s_factoryLock);
+  s_factory = factory;
+  s_factoryCtx = ctx;
+}
+
+static bool pipeListening(const std::string& name) {
+  std::lock_guard<std::mutex> lock(s_listenersLock);
+  auto it = s_listeners.find(name);
+  return it != s_listeners.end() && !it->second.expired();
+}
+
+std::unique_ptr<HostTransport> mqttHostDefaultTransport(const HostEndpoint& endpoint) {
+  bool plain = endpoint.scheme == "mqtt" || endpoint.scheme == "tcp";
+  if (endpoint.scheme == "mem" || (plain && pipeListening(endpoint.host))) {
+    return std::unique_ptr<HostTransport>(new PipeEnd());
+  }
+  if (plain) return hostTcpTransport();
+  return nullptr; // mqtts, ws, wss: no TLS or WebSocket on the host
+}
+
+// Used by the shim client
+std::unique_ptr<HostTransport> hostCreateTransport(const HostEndpoint& endpoint) {
+  HostTransportFactory factory;
+  void* ctx;
+  {
+    std::lock_guard<std::mutex> lock(s_factoryLock);
+    factory = s_factory;
+    ctx = s_factoryCtx;
+  }
+  return factory ? factory(endpoint, ctx) : mqttHostDefaultTransport(endpoint);
+}
@@ -0,0 +1,357 @@
+#include "ImpairedTransport.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include <Arduino.h>
+
+ImpairmentProfile ImpairmentProfile::cellular() {
+  ImpairmentProfile p;
+  p.latencyMs = 150;
+  p.jitterMs = 100;
+  p.bandwidthBps = 32000;
+  p.lossPermille = 20;
+  p.retransmitMs = 300;
+  p.stallEveryMs = 30000;
+  p.stallMs = 3000;
+  p.resetEveryMs = 300000;
+  return p;
+}
+
+bool parseImpairment(const char* spec, ImpairmentProfile& out) {
+  ImpairmentProfile p;
+  if (!strncmp(spec, "cellular", 8) && (spec[8] == '\0' || spec[8] == ',')) {
+    p = ImpairmentProfile::cellular();
+    spec += spec[8] ? 9 : 8;
+  }
+  while (*spec) {
+    const char* eq = strchr(spec, '=');
+    if (!eq) return false;
+    std::string key(spec, eq - spec);
+    char* end;
+    unsigned long value = strtoul(eq + 1, &end, 10);
+    if (end == eq + 1 || (*end && *end != ',')) return false;
+    if (key == "latency") {
+      p.latencyMs = value;
+    } else if (key == "jitter") {
+      p.jitterMs = value;
+    } else if (key == "bandwidth") {
+      p.bandwidthBps = value;
+    } else if (key == "loss") {
+      if (value > 1000) return false;
+      p.lossPermille = static_cast<uint16_t>(value);
+    } else if (key == "retransmit") {
+      p.retransmitMs = value;
+    } else if (key == "stall_every") {
+      p.stallEveryMs = value;
+    } else if (key == "stall") {
+      p.stallMs = value;
+    } else if (key == "reset_every") {
+      p.resetEveryMs = value;
+    } else if (key == "seed") {
+      p.seed = value;
+    } else {
+      return false;
+    }
+    spec = *end ? end + 1 : end;
+  }
+  out = p;
+  return true;
+}
+
+struct ImpairedNetwork::State {
+  mutable std::mutex lock;
+  ImpairmentProfile profile;
+  ImpairmentStats stats = {};
+  uint32_t resetGeneration = 0;
+};
+
+namespace {
+
+// Bytes in flight in one direction, leaving in order at dueUs
+struct Segment {
+  uint64_t dueUs;
+  std::vector<uint8_t> bytes;
+  size_t offset;
+};
+
+struct Lane {
+  std::deque<Segment> queue;
+  uint64_t linkFreeUs = 0; // the previous segment is serialized onto the link by then
+  uint64_t lastDueUs = 0;
+};
+
+class ImpairedTransport : public HostTransport {
+public:
+  // Starts out connected, for wrapping a live stream; connect() starts over
+  ImpairedTransport(std::unique_ptr<HostTransport> inner, std::shared_ptr<ImpairedNetwork::State> net)
+      : _inner(std::move(inner)), _net(std::move(net)) {
+    uint32_t index;
+    {
+      std::lock_guard<std::mutex> lock(_net->lock);
+      index = _net->stats.connections++;
+      _generation = _net->resetGeneration;
+    }
+    _rng.seed(profile().seed * 2654435761u + index);
+    scheduleEvents(nowUs());
+  }
+  ~ImpairedTransport() override { close(); }
+
+  bool connect(const HostEndpoint& endpoint, uint32_t timeoutMs) override {
+    ImpairmentProfile p = profile();
+    // The TCP handshake takes a round trip
+    uint32_t handshakeMs = 2 * p.latencyMs + (p.jitterMs ? _rng() % (p.jitterMs + 1) : 0);
+    if (handshakeMs > timeoutMs) {
+      delay(timeoutMs);
+      _connected = false;
+      _error = ETIMEDOUT;
+      return false;
+    }
+    delay(handshakeMs);
+    if (!_inner->connect(endpoint, timeoutMs - handshakeMs)) {
+      _connected = false;
+      _error = _inner->lastError();
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(_lock);
+    scheduleEvents(nowUs());
+    return true;
+  }
+
+  int write(const uint8_t* data, size_t len) override {
+    std::lock_guard<std::mutex> lock(_lock);
+    uint64_t now = nowUs();
+    if (!alive(now)) return -1;
+    schedule(_up, data, len, now);
+    if (!flushUp(now)) return -1;
+    return static_cast<int>(len);
+  }
+
+  int read(uint8_t* buf, size_t len, uint32_t timeoutMs) override {
+    const uint64_t deadline = nowUs() + timeoutMs * 1000ull;
+    uint8_t chunk[4096];
+    bool polled = false; // the inner stream was read at least once
+    for (;;) {
+      uint32_t waitMs;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        uint64_t now = nowUs();
+        if (!alive(now) || !flushUp(now)) return -1;
+        bool stalled = now < _stallUntilUs;
+        if (!stalled && !_down.queue.empty() && _down.queue.front().dueUs <= now) {
+          return deliverDown(buf, len);
+        }
+        if (_innerClosed && _down.queue.empty()) {
+          _error = _inner->lastError();
+          return -1;
+        }
+        if (now >= deadline) {
+          // A zero timeout (manual stepping polls with one) still takes what the peer sent
+          if (polled || _innerClosed) return 0;
+          waitMs = 0;
+        } else {
+          // Wake for the next due segment or event; short slices pick up profile changes
+          uint64_t wake = deadline;
+          if (!_down.queue.empty()) wake = std::min(wake, _down.queue.front().dueUs);
+          if (!_up.queue.empty()) wake = std::min(wake, _up.queue.front().dueUs);
+          if (stalled) wake = std::max(wake, std::min(deadline, _stallUntilUs));
+          if (_nextStallUs) wake = std::min(wake, std::max(now, _nextStallUs));
+          if (_nextResetUs) wake = std::min(wake, std::max(now, _nextResetUs));
+          waitMs = static_cast<uint32_t>((wake > now ? wake - now + 999 : 0) / 1000);
+          if (waitMs < 1) waitMs = 1;
+          if (waitMs > 20) waitMs = 20;
+        }
+      }
+      polled = true;
+      if (_innerClosed) {
+        delay(waitMs);
+        continue;
+      }
+      int n = _inner->read(chunk, sizeof(chunk), waitMs);
+      std::lock_guard<std::mutex> lock(_lock);
+      if (n > 0) {
+        schedule(_down, chunk, static_cast<size_t>(n), nowUs());
+      } else if (n < 0) {
+        _innerClosed = true; // what is still in flight arrives before the close
+      }
+    }
+  }
+
+  void close() override {
+    std::lock_guard<std::mutex> lock(_lock);
+    _connected = false;
+    _inner->close();
+  }
+
+  int lastError() const override { return _error; }
+
+private:
+  std::unique_ptr<HostTransport> _inner;
+  std::shared_ptr<ImpairedNetwork::State> _net;
+  std::mutex _lock; // queues and link state; read() and write() run on different threads
+  std::mt19937 _rng;
+  Lane _up;
+  Lane _down;
+  bool _connected = true;
+  bool _innerClosed = false;
+  int _error = 0;
+  uint32_t _generation = 0;
+  uint64_t _stallUntilUs = 0;
+  uint64_t _nextStallUs = 0;
+  uint64_t _nextResetUs = 0;
+  uint32_t _lastMicros = 0;
+  uint64_t _clockHigh = 0;
+
+  // micros() widened to 64 bits; called often enough to see every wrap
+  uint64_t nowUs() {
+    uint32_t now = static_cast<uint32_t>(micros());
+    if (now < _lastMicros) _clockHigh += 1ull << 32;
+    _lastMicros = now;
+    return _clockHigh | now;
+  }
+
+  void scheduleEvents(uint64_t now) {
+    ImpairmentProfile p = profile();
+    _nextStallUs = p.stallEveryMs ? now + draw(p.stallEveryMs) : 0;
+    _nextResetUs = p.resetEveryMs ? now + draw(p.resetEveryMs) : 0;
+  }
+
+  uint64_t draw(uint32_t meanMs) {
+    std::exponential_distribution<double> dist(1.0 / meanMs);
+    return static_cast<uint64_t>(dist(_rng) * 1000) + 1000;
+  }
+
+  ImpairmentProfile profile() {
+    std::lock_guard<std::mutex> lock(_net->lock);
+    return _net->profile;
+  }
+
+  // Applies scheduled stalls and resets; false once the connection is gone
+  bool alive(uint64_t now) {
+    if (!_connected) return false;
+    bool reset;
+    {
+      std::lock_guard<std::mutex> lock(_net->lock);
+      reset = _generation != _net->resetGeneration || (_nextResetUs && now >= _nextResetUs);
+      if (reset) _net->stats.resets++;
+    }
+    if (reset) {
+      _connected = false;
+      _error = ECONNRESET;
+      _inner->close();
+      return false;
+    }
+    if (_nextStallUs && now >= _nextStallUs) {
+      ImpairmentProfile p = profile();
+      _stallUntilUs = now + p.stallMs * 1000ull;
+      _nextStallUs = p.stallEveryMs ? _stallUntilUs + draw(p.stallEveryMs) : 0;
+      std::lock_guard<std::mutex> lock(_net->lock);
+      _net->stats.stalls++;
+    }
+    return true;
+  }
+
+  void schedule(Lane& lane, const uint8_t* data, size_t len, uint64_t now) {
+    ImpairmentProfile p = profile();
+    uint64_t start = std::max(now, lane.linkFreeUs);
+    lane.linkFreeUs = start + (p.bandwidthBps ? len * 1000000ull / p.bandwidthBps : 0);
+    uint64_t due = lane.linkFreeUs + p.latencyMs * 1000ull;
+    if (p.jitterMs) due += (_rng() % (p.jitterMs + 1)) * 1000ull;
+    if (p.lossPermille && _rng() % 1000 < p.lossPermille) {
+      due += p.retransmitMs * 1000ull;
+      std::lock_guard<std::mutex> lock(_net->lock);
+      _net->stats.losses++;
+    }
+    // A stream: a segment never overtakes the one before it
+    due = std::max(due, lane.lastDueUs);
+    lane.lastDueUs = due;
+    lane.queue.push_back(Segment{due, std::vector<uint8_t>(data, data + len), 0});
+  }
+
+  bool flushUp(uint64_t now) {
+    if (now < _stallUntilUs) return true;
+    while (!_up.queue.empty() && _up.queue.front().dueUs <= now) {
+      Segment& s = _up.queue.front();
+      if (_inner->write(s.bytes.data(), s.bytes.size()) < 0) {
+        _error = _inner->lastError();
+        return false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(_net->lock);
+        _net->stats.bytesUp += s.bytes.size();
+      }
+      _up.queue.pop_front();
+    }
+    return true;
+  }
+
+  int deliverDown(uint8_t* buf, size_t len) {
+    Segment& s = _down.queue.front();
+    size_t n = std::min(len, s.bytes.size() - s.offset);
+    memcpy(buf, s.bytes.data() + s.offset, n);
+    s.offset += n;
+    if (s.offset == s.bytes.size()) _down.queue.pop_front();
+    std::lock_guard<std::mutex> lock(_net->lock);
+    _net->stats.bytesDown += n;
+    return static_cast<int>(n);
+  }
+};
+
+std::unique_ptr<HostTransport> impairedFactory(const HostEndpoint& endpoint, void* ctx) {
+  std::unique_ptr<HostTransport> inner = mqttHostDefaultTransport(endpoint);
+  if (!inner) return nullptr;
+  return static_cast<ImpairedNetwork*>(ctx)->wrap(std::move(inner));
+}
+
+} // namespace
+
+ImpairedNetwork::ImpairedNetwork(const ImpairmentProfile& profile)
+    : _state(std::make_shared<State>()), _installed(false) {
+  _state->profile = profile;
+}
+
+ImpairedNetwork::~ImpairedNetwork() {
+  uninstall();
+}
+
+void ImpairedNetwork::install() {
+  mqttHostSetTransportFactory(impairedFactory, this);
+  _installed = true;
+}
+
+void ImpairedNetwork::uninstall() {
+  if (_installed) {
+    mqttHostSetTransportFactory(nullptr);
+    _installed = false;
+  }
+}
+
+void ImpairedNetwork::setProfile(const ImpairmentProfile& profile) {
+  std::lock_guard<std::mutex> lock(_state->lock);
+  _state->profile = profile;
+}
+
+ImpairmentProfile ImpairedNetwork::profile() const {
+  std::lock_guard<std::mutex> lock(_state->lock);
+  return _state->profile;
+}
+
+void ImpairedNetwork::resetConnections() {
+  std::lock_guard<std::mutex> lock(_state->lock);
+  _state->resetGeneration++;
+}
+
+ImpairmentStats ImpairedNetwork::stats() const {
+  std::lock_guard<std::mutex> lock(_state->lock);
+  return _state->stats;
+}
+
+std::unique_ptr<HostTransport> ImpairedNetwork::wrap(std::unique_ptr<HostTransport> inner) {
+  return std::unique_ptr<HostTransport>(new ImpairedTransport(std::move(inner), _state));
+}
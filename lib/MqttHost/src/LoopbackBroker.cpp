@@ -0,0 +1,497 @@
+#include "LoopbackBroker.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+namespace {
+// Read wait of connection threads; bounds how long stop() and dropConnections() take
+const uint32_t kPollMs = 20;
+
+// MQTT filter matching; wildcards in the first level do not match $-topics
+bool topicMatch(const std::string& filter, const std::string& topic) {
+  if (!topic.empty() && topic[0] == '$' && !filter.empty() && (filter[0] == '+' || filter[0] == '#')) return false;
+  size_t f = 0, t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') return true;
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') t++;
+      f++;
+      continue;
+    }
+    if (t >= topic.size()) return filter.compare(f, std::string::npos, "/#") == 0; // "a/#" matches "a"
+    if (filter[f] != topic[t]) return false;
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+bool validFilter(const std::string& filter) {
+  if (filter.empty()) return false;
+  for (size_t i = 0; i < filter.size(); i++) {
+    char c = filter[i];
+    bool levelStart = i == 0 || filter[i - 1] == '/';
+    bool levelEnd = i + 1 == filter.size() || filter[i + 1] == '/';
+    if (c == '+' && !(levelStart && levelEnd)) return false;
+    if (c == '#' && !(levelStart && i + 1 == filter.size())) return false;
+  }
+  return true;
+}
+} // namespace
+
+struct LoopbackBroker::Connection {
+  std::unique_ptr<HostTransport> transport;
+  std::thread thread;
+  std::atomic<bool> finished{false};
+  std::atomic<bool> kill{false}; // close from the connection thread without DISCONNECT
+
+  // Serializes writes from the connection thread and from publishers' threads
+  std::mutex writeLock;
+  bool closed = false;
+  uint16_t lastPacketId = 0;
+
+  // Guarded by the broker lock
+  bool connected = false;
+  std::string clientId;
+  uint8_t level = kMqttLevel311;
+  bool cleanSession = true;
+  uint16_t keepalive = 0;
+  std::map<std::string, uint8_t> subscriptions;
+  bool hasWill = false;
+  std::string willTopic;
+  std::string willPayload;
+  uint8_t willQos = 0;
+  bool willRetain = false;
+
+  // Connection thread only
+  std::set<uint16_t> inboundQos2;
+  MqttFrameReader reader;
+  uint32_t lastRxMs = 0;
+  bool graceful = false;
+
+  void send(const std::vector<uint8_t>& bytes) {
+    std::lock_guard<std::mutex> lock(writeLock);
+    if (!closed) transport->write(bytes.data(), bytes.size());
+  }
+};
+
+LoopbackBroker::LoopbackBroker() : _stats(), _running(false), _connackCode(0), _manualStep(false) {}
+
+LoopbackBroker::~LoopbackBroker() {
+  stop();
+}
+
+bool LoopbackBroker::listenPipe(const char* name) {
+  if (_pipeListener) return false;
+  _pipeListener.reset(new HostPipeListener(name));
+  _running = true;
+  if (!_manualStep) _listenThreads.emplace_back(&LoopbackBroker::pipeAcceptLoop, this);
+  return true;
+}
+
+uint16_t LoopbackBroker::listenTcp(uint16_t port) {
+  if (_manualStep) return 0;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return 0;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  socklen_t len = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 64) < 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+    close(fd);
+    return 0;
+  }
+  _running = true;
+  _listenFds.push_back(fd);
+  _listenThreads.emplace_back(&LoopbackBroker::acceptLoop, this, fd);
+  return ntohs(addr.sin_port);
+}
+
+void LoopbackBroker::stop() {
+  _running = false;
+  for (std::thread& t : _listenThreads) t.join();
+  _listenThreads.clear();
+  for (int fd : _listenFds) close(fd);
+  _listenFds.clear();
+  _pipeListener.reset();
+
+  std::vector<std::shared_ptr<Connection>> connections;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    connections.swap(_connections);
+  }
+  for (auto& conn : connections) {
+    if (conn->thread.joinable()) {
+      conn->thread.join();
+    } else if (!conn->finished) {
+      closeConnection(conn, false);
+    }
+  }
+}
+
+bool LoopbackBroker::step() {
+  if (!_running || !_pipeListener) return false;
+  reapFinished();
+  bool busy = false;
+  while (std::unique_ptr<HostTransport> transport = _pipeListener->accept(0)) {
+    startConnection(std::move(transport));
+    busy = true;
+  }
+  std::vector<std::shared_ptr<Connection>> connections;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    connections = _connections;
+  }
+  for (auto& conn : connections) {
+    if (conn->finished) continue;
+    int n;
+    while ((n = service(conn, 0)) > 0) busy = true;
+    if (n < 0) {
+      closeConnection(conn, conn->graceful);
+      conn->finished = true;
+      busy = true;
+    }
+  }
+  return busy;
+}
+
+void LoopbackBroker::dropConnections(const char* clientId) {
+  std::lock_guard<std::mutex> lock(_lock);
+  for (auto& conn : _connections) {
+    if (!clientId || conn->clientId == clientId) conn->kill = true;
+  }
+}
+
+size_t LoopbackBroker::connectionCount() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  size_t n = 0;
+  for (const auto& conn : _connections) n += conn->connected ? 1 : 0;
+  return n;
+}
+
+size_t LoopbackBroker::retainedCount() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _retained.size();
+}
+
+LoopbackBroker::Stats LoopbackBroker::stats() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _stats;
+}
+
+void LoopbackBroker::acceptLoop(int listenFd) {
+  while (_running) {
+    reapFinished();
+    pollfd pfd = {listenFd, POLLIN, 0};
+    if (poll(&pfd, 1, kPollMs) <= 0) continue;
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) continue;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    startConnection(hostTcpTransport(fd));
+  }
+}
+
+void LoopbackBroker::pipeAcceptLoop() {
+  while (_running) {
+    reapFinished();
+    std::unique_ptr<HostTransport> transport = _pipeListener->accept(kPollMs);
+    if (transport) startConnection(std::move(transport));
+  }
+}
+
+void LoopbackBroker::startConnection(std::unique_ptr<HostTransport> transport) {
+  std::shared_ptr<Connection> conn = std::make_shared<Connection>();
+  conn->transport = std::move(transport);
+  conn->lastRxMs = millis();
+  std::lock_guard<std::mutex> lock(_lock);
+  _connections.push_back(conn);
+  if (!_manualStep) conn->thread = std::thread(&LoopbackBroker::serve, this, conn);
+}
+
+void LoopbackBroker::reapFinished() {
+  std::vector<std::shared_ptr<Connection>> done;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    for (auto it = _connections.begin(); it != _connections.end();) {
+      if ((*it)->finished) {
+        done.push_back(*it);
+        it = _connections.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (auto& conn : done) {
+    if (conn->thread.joinable()) conn->thread.join();
+  }
+}
+
+void LoopbackBroker::serve(std::shared_ptr<Connection> conn) {
+  while (service(conn, kPollMs) >= 0) {
+  }
+  closeConnection(conn, conn->graceful);
+  conn->finished = true;
+}
+
+// Reads once, waiting up to timeoutMs, and handles the complete packets. Returns the bytes
+// read, 0 when there were none, or -1 once the connection is over.
+int LoopbackBroker::service(const std::shared_ptr<Connection>& conn, uint32_t timeoutMs) {
+  if (!_running || conn->kill) return -1;
+  uint8_t buf[4096];
+  int n = conn->transport->read(buf, sizeof(buf), timeoutMs);
+  if (n < 0) return -1;
+  if (n == 0) {
+    // Keepalive: nothing for one and a half periods closes the connection
+    uint32_t keepaliveMs;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      keepaliveMs = conn->connected ? conn->keepalive * 1500u : 0;
+    }
+    if (keepaliveMs && millis() - conn->lastRxMs > keepaliveMs) return -1;
+    return 0;
+  }
+  conn->lastRxMs = millis();
+  conn->reader.feed(buf, static_cast<size_t>(n));
+  MqttPacket packet;
+  for (;;) {
+    uint8_t level;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      level = conn->level;
+    }
+    MqttFrameReader::Result result = conn->reader.next(packet, level);
+    if (result == MqttFrameReader::Result::NeedMore) break;
+    if (result == MqttFrameReader::Result::Malformed) return -1;
+    if (packet.type == MqttPacketType::Disconnect) {
+      conn->graceful = true;
+      return -1;
+    }
+    if (!handle(conn, packet)) return -1;
+  }
+  return n;
+}
+
+bool LoopbackBroker::handle(const std::shared_ptr<Connection>& conn, MqttPacket& packet) {
+  bool connected;
+  uint8_t level;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    connected = conn->connected;
+    level = conn->level;
+  }
+  if (packet.type == MqttPacketType::Connect) return !connected && handleConnect(conn, packet);
+  if (!connected) return false; // the first packet must be CONNECT
+
+  std::vector<uint8_t> out;
+  switch (packet.type) {
+    case MqttPacketType::Publish: {
+      if (packet.topic.empty() || packet.topic.find_first_of("+#") != std::string::npos) return false;
+      bool fresh = packet.qos < 2 || conn->inboundQos2.insert(packet.packetId).second;
+      if (fresh) {
+        {
+          std::lock_guard<std::mutex> lock(_lock);
+          _stats.publishesIn++;
+          _stats.bytesIn += packet.payload.size();
+        }
+        route(packet.topic, packet.payload, packet.qos, packet.retain);
+      }
+      if (packet.qos == 1) mqttEncodeAck(out, MqttPacketType::Puback, level, packet.packetId);
+      if (packet.qos == 2) mqttEncodeAck(out, MqttPacketType::Pubrec, level, packet.packetId);
+      break;
+    }
+    case MqttPacketType::Pubrel:
+      conn->inboundQos2.erase(packet.packetId);
+      mqttEncodeAck(out, MqttPacketType::Pubcomp, level, packet.packetId);
+      break;
+    case MqttPacketType::Pubrec:
+      mqttEncodeAck(out, MqttPacketType::Pubrel, level, packet.packetId);
+      break;
+    case MqttPacketType::Puback:
+    case MqttPacketType::Pubcomp:
+      break; // deliveries are not retransmitted, so there is nothing to release
+    case MqttPacketType::Subscribe: {
+      std::vector<uint8_t> codes;
+      std::vector<std::pair<std::string, uint8_t>> granted;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        for (const auto& f : packet.filters) {
+          uint8_t qos = f.second & 3;
+          if (!validFilter(f.first) || qos > 2) {
+            codes.push_back(0x80);
+            continue;
+          }
+          conn->subscriptions[f.first] = qos;
+          codes.push_back(qos);
+          granted.emplace_back(f.first, qos);
+        }
+      }
+      mqttEncodeSuback(out, level, packet.packetId, codes);
+      conn->send(out);
+      out.clear();
+
+      // Retained messages for the new filters, after the SUBACK
+      std::vector<std::pair<std::string, std::pair<std::string, uint8_t>>> retained;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        for (const auto& r : _retained) {
+          for (const auto& g : granted) {
+            if (!topicMatch(g.first, r.first)) continue;
+            uint8_t qos = r.second.second < g.second ? r.second.second : g.second;
+            retained.emplace_back(r.first, std::make_pair(r.second.first, qos));
+            break;
+          }
+        }
+      }
+      for (const auto& r : retained) deliver(*conn, r.first, r.second.first, r.second.second, true);
+      break;
+    }
+    case MqttPacketType::Unsubscribe: {
+      std::lock_guard<std::mutex> lock(_lock);
+      for (const auto& f : packet.filters) conn->subscriptions.erase(f.first);
+      mqttEncodeUnsuback(out, level, packet.packetId, packet.filters.size());
+      break;
+    }
+    case MqttPacketType::Pingreq:
+      mqttEncodeEmpty(out, MqttPacketType::Pingresp);
+      break;
+    default:
+      return false;
+  }
+  if (!out.empty()) conn->send(out);
+  return true;
+}
+
+bool LoopbackBroker::handleConnect(const std::shared_ptr<Connection>& conn, MqttPacket& packet) {
+  std::vector<uint8_t> out;
+  uint8_t level = packet.protocolLevel;
+  if (level != kMqttLevel311 && level != kMqttLevel5) {
+    mqttEncodeConnack(out, kMqttLevel311, false, 0x01); // unacceptable protocol version
+    conn->send(out);
+    return false;
+  }
+  uint8_t code = _connackCode;
+  if (!code && packet.clientId.empty() && !packet.cleanSession) code = level == kMqttLevel5 ? 0x85 : 0x02;
+  if (code) {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _stats.refused++;
+    }
+    mqttEncodeConnack(out, level, false, code);
+    conn->send(out);
+    return false;
+  }
+
+  bool sessionPresent = false;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (packet.clientId.empty()) {
+      char id[24];
+      snprintf(id, sizeof(id), "loopback-%u", static_cast<unsigned>(_stats.connects));
+      packet.clientId = id;
+    }
+    // Client id takeover: the older connection is closed, its session carries over
+    for (auto& other : _connections) {
+      if (other != conn && other->connected && other->clientId == packet.clientId) {
+        if (!other->cleanSession) _sessions[other->clientId].subscriptions = other->subscriptions;
+        other->connected = false;
+        other->kill = true;
+      }
+    }
+    conn->connected = true;
+    conn->clientId = packet.clientId;
+    conn->level = level;
+    conn->cleanSession = packet.cleanSession;
+    conn->keepalive = packet.keepalive;
+    conn->hasWill = packet.hasWill;
+    conn->willTopic = packet.willTopic;
+    conn->willPayload = packet.willPayload;
+    conn->willQos = packet.willQos;
+    conn->willRetain = packet.willRetain;
+    auto session = _sessions.find(packet.clientId);
+    if (packet.cleanSession) {
+      if (session != _sessions.end()) _sessions.erase(session);
+    } else if (session != _sessions.end()) {
+      conn->subscriptions = session->second.subscriptions;
+      sessionPresent = true;
+    }
+    _stats.connects++;
+  }
+  mqttEncodeConnack(out, level, sessionPresent, 0);
+  conn->send(out);
+  return true;
+}
+
+void LoopbackBroker::route(const std::string& topic, const std::string& payload, uint8_t qos, bool retain) {
+  std::vector<std::pair<std::shared_ptr<Connection>, uint8_t>> targets;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (retain) {
+      if (payload.empty()) {
+        _retained.erase(topic);
+      } else {
+        _retained[topic] = std::make_pair(payload, qos);
+      }
+    }
+    for (auto& conn : _connections) {
+      if (!conn->connected) continue;
+      int granted = -1; // overlapping filters: one copy at the highest granted QoS
+      for (const auto& sub : conn->subscriptions) {
+        if (sub.second > granted && topicMatch(sub.first, topic)) granted = sub.second;
+      }
+      if (granted >= 0) targets.emplace_back(conn, qos < granted ? qos : static_cast<uint8_t>(granted));
+    }
+  }
+  for (auto& target : targets) deliver(*target.first, topic, payload, target.second, false);
+}
+
+void LoopbackBroker::deliver(Connection& conn, const std::string& topic, const std::string& payload, uint8_t qos,
+                             bool retain) {
+  uint8_t level;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    level = conn.level;
+    _stats.deliveries++;
+    _stats.bytesOut += payload.size();
+  }
+  std::vector<uint8_t> out;
+  std::lock_guard<std::mutex> lock(conn.writeLock);
+  if (conn.closed) return;
+  uint16_t packetId = 0;
+  if (qos) {
+    if (++conn.lastPacketId == 0) conn.lastPacketId = 1;
+    packetId = conn.lastPacketId;
+  }
+  mqttEncodePublish(out, level, topic.c_str(), payload.data(), payload.size(), qos, retain, false, packetId);
+  conn.transport->write(out.data(), out.size());
+}
+
+void LoopbackBroker::closeConnection(const std::shared_ptr<Connection>& conn, bool graceful) {
+  bool publishWill = false;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (conn->connected) {
+      if (!conn->cleanSession) _sessions[conn->clientId].subscriptions = conn->subscriptions;
+      publishWill = !graceful && conn->hasWill;
+      conn->connected = false;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(conn->writeLock);
+    conn->closed = true;
+    conn->transport->close();
+  }
+  if (publishWill) route(conn->willTopic, conn->willPayload, conn->willQos, conn->willRetain);
+}
@@ -0,0 +1,322 @@
+#include "MqttCodec.h"
+
+#include <string.h>
+
+namespace {
+void putU8(std::vector<uint8_t>& b, uint8_t v) { b.push_back(v); }
+
+void putU16(std::vector<uint8_t>& b, uint16_t v) {
+  b.push_back((uint8_t)(v >> 8));
+  b.push_back((uint8_t)v);
+}
+
+void putBytes(std::vector<uint8_t>& b, const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  b.insert(b.end(), p, p + len);
+}
+
+void putString(std::vector<uint8_t>& b, const char* s, size_t len) {
+  putU16(b, (uint16_t)len);
+  putBytes(b, s, len);
+}
+
+void putString(std::vector<uint8_t>& b, const char* s) { putString(b, s ? s : "", s ? strlen(s) : 0); }
+
+void putVarInt(std::vector<uint8_t>& b, uint32_t v) {
+  do {
+    uint8_t byte = v & 0x7F;
+    v >>= 7;
+    if (v) byte |= 0x80;
+    b.push_back(byte);
+  } while (v);
+}
+
+// Empty v5 property block
+void putNoProperties(std::vector<uint8_t>& b, uint8_t level) {
+  if (level >= kMqttLevel5) putU8(b, 0);
+}
+
+void finish(std::vector<uint8_t>& out, uint8_t firstByte, const std::vector<uint8_t>& body) {
+  out.push_back(firstByte);
+  putVarInt(out, (uint32_t)body.size());
+  out.insert(out.end(), body.begin(), body.end());
+}
+
+uint8_t header(MqttPacketType type, uint8_t flags = 0) { return (uint8_t)(((uint8_t)type << 4) | flags); }
+
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok = true;
+
+  size_t left() const { return ok ? (size_t)(end - p) : 0; }
+
+  uint8_t u8() {
+    if (left() < 1) {
+      ok = false;
+      return 0;
+    }
+    return *p++;
+  }
+
+  uint16_t u16() {
+    if (left() < 2) {
+      ok = false;
+      return 0;
+    }
+    uint16_t v = (uint16_t)((p[0] << 8) | p[1]);
+    p += 2;
+    return v;
+  }
+
+  uint32_t varInt() {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+      uint8_t byte = u8();
+      value |= (uint32_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return value;
+    }
+    ok = false;
+    return 0;
+  }
+
+  std::string bytes(size_t len) {
+    if (left() < len) {
+      ok = false;
+      return std::string();
+    }
+    std::string s(reinterpret_cast<const char*>(p), len);
+    p += len;
+    return s;
+  }
+
+  std::string string() { return bytes(u16()); }
+
+  void skip(size_t len) {
+    if (left() < len) {
+      ok = false;
+      return;
+    }
+    p += len;
+  }
+
+  void skipProperties(uint8_t level) {
+    if (level >= kMqttLevel5) skip(varInt());
+  }
+};
+} // namespace
+
+void mqttEncodeConnect(std::vector<uint8_t>& out, const MqttConnectOptions& o) {
+  std::vector<uint8_t> body;
+  putString(body, "MQTT");
+  putU8(body, o.protocolLevel);
+  uint8_t flags = 0;
+  if (o.cleanSession) flags |= 0x02;
+  if (o.willTopic) flags |= (uint8_t)(0x04 | ((o.willQos & 3) << 3) | (o.willRetain ? 0x20 : 0));
+  if (o.password) flags |= 0x40;
+  if (o.username) flags |= 0x80;
+  putU8(body, flags);
+  putU16(body, o.keepalive);
+  putNoProperties(body, o.protocolLevel);
+  putString(body, o.clientId);
+  if (o.willTopic) {
+    putNoProperties(body, o.protocolLevel);
+    putString(body, o.willTopic);
+    putString(body, o.willPayload.data(), o.willPayload.size());
+  }
+  if (o.username) putString(body, o.username);
+  if (o.password) putString(body, o.password);
+  finish(out, header(MqttPacketType::Connect), body);
+}
+
+void mqttEncodeConnack(std::vector<uint8_t>& out, uint8_t level, bool sessionPresent, uint8_t code) {
+  std::vector<uint8_t> body;
+  putU8(body, sessionPresent ? 1 : 0);
+  putU8(body, code);
+  putNoProperties(body, level);
+  finish(out, header(MqttPacketType::Connack), body);
+}
+
+void mqttEncodePublish(std::vector<uint8_t>& out, uint8_t level, const char* topic, const void* payload, size_t len,
+                       uint8_t qos, bool retain, bool dup, uint16_t packetId) {
+  std::vector<uint8_t> body;
+  body.reserve(strlen(topic) + len + 8);
+  putString(body, topic);
+  if (qos) putU16(body, packetId);
+  putNoProperties(body, level);
+  if (len) putBytes(body, payload, len);
+  uint8_t flags = (uint8_t)((dup ? 0x08 : 0) | ((qos & 3) << 1) | (retain ? 1 : 0));
+  finish(out, header(MqttPacketType::Publish, flags), body);
+}
+
+void mqttEncodeAck(std::vector<uint8_t>& out, MqttPacketType type, uint8_t level, uint16_t packetId,
+                   uint8_t reasonCode) {
+  std::vector<uint8_t> body;
+  putU16(body, packetId);
+  // v5 allows leaving out a success reason code and empty properties
+  if (level >= kMqttLevel5 && reasonCode) {
+    putU8(body, reasonCode);
+    putU8(body, 0);
+  }
+  finish(out, header(type, type == MqttPacketType::Pubrel ? 0x02 : 0), body);
+}
+
+void mqttEncodeSubscribe(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId,
+                         const std::vector<std::pair<std::string, uint8_t>>& filters) {
+  std::vector<uint8_t> body;
+  putU16(body, packetId);
+  putNoProperties(body, level);
+  for (const auto& f : filters) {
+    putString(body, f.first.c_str(), f.first.size());
+    putU8(body, f.second);
+  }
+  finish(out, header(MqttPacketType::Subscribe, 0x02), body);
+}
+
+void mqttEncodeSuback(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId, const std::vector<uint8_t>& codes) {
+  std::vector<uint8_t> body;
+  putU16(body, packetId);
+  putNoProperties(body, level);
+  putBytes(body, codes.data(), codes.size());
+  finish(out, header(MqttPacketType::Suback), body);
+}
+
+void mqttEncodeUnsubscribe(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId,
+                           const std::vector<std::string>& filters) {
+  std::vector<uint8_t> body;
+  putU16(body, packetId);
+  putNoProperties(body, level);
+  for (const auto& f : filters) putString(body, f.c_str(), f.size());
+  finish(out, header(MqttPacketType::Unsubscribe, 0x02), body);
+}
+
+void mqttEncodeUnsuback(std::vector<uint8_t>& out, uint8_t level, uint16_t packetId, size_t count) {
+  std::vector<uint8_t> body;
+  putU16(body, packetId);
+  if (level >= kMqttLevel5) {
+    putU8(body, 0);
+    for (size_t i = 0; i < count; i++) putU8(body, 0);
+  }
+  finish(out, header(MqttPacketType::Unsuback), body);
+}
+
+void mqttEncodeEmpty(std::vector<uint8_t>& out, MqttPacketType type) {
+  out.push_back(header(type));
+  out.push_back(0);
+}
+
+MqttFrameReader::Result MqttFrameReader::next(MqttPacket& packet, uint8_t level) {
+  if (_buf.size() < 2) return Result::NeedMore;
+
+  // Fixed header: type/flags byte and the variable-length remaining length
+  uint32_t remaining = 0;
+  size_t pos = 1;
+  for (int shift = 0;; shift += 7) {
+    if (pos >= _buf.size()) return Result::NeedMore;
+    if (shift > 21) return Result::Malformed;
+    uint8_t byte = _buf[pos++];
+    remaining |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) break;
+  }
+  if (remaining > _maxPacketSize) return Result::Malformed;
+  if (_buf.size() < pos + remaining) return Result::NeedMore;
+
+  packet = MqttPacket();
+  uint8_t first = _buf[0];
+  packet.type = static_cast<MqttPacketType>(first >> 4);
+  packet.flags = first & 0x0F;
+  Cursor c = {_buf.data() + pos, _buf.data() + pos + remaining};
+
+  switch (packet.type) {
+    case MqttPacketType::Connect: {
+      if (c.string() != "MQTT") return Result::Malformed;
+      packet.protocolLevel = c.u8();
+      uint8_t flags = c.u8();
+      packet.keepalive = c.u16();
+      c.skipProperties(packet.protocolLevel);
+      packet.cleanSession = flags & 0x02;
+      packet.clientId = c.string();
+      if (flags & 0x04) {
+        packet.hasWill = true;
+        packet.willQos = (flags >> 3) & 3;
+        packet.willRetain = flags & 0x20;
+        c.skipProperties(packet.protocolLevel);
+        packet.willTopic = c.string();
+        packet.willPayload = c.string();
+      }
+      if (flags & 0x80) {
+        packet.hasUsername = true;
+        packet.username = c.string();
+      }
+      if (flags & 0x40) {
+        packet.hasPassword = true;
+        packet.password = c.string();
+      }
+      break;
+    }
+    case MqttPacketType::Connack:
+      packet.sessionPresent = c.u8() & 1;
+      packet.reasonCode = c.u8();
+      break;
+    case MqttPacketType::Publish: {
+      packet.qos = (packet.flags >> 1) & 3;
+      packet.retain = packet.flags & 1;
+      packet.dup = packet.flags & 8;
+      if (packet.qos == 3) return Result::Malformed;
+      packet.topic = c.string();
+      if (packet.qos) packet.packetId = c.u16();
+      c.skipProperties(level);
+      packet.payload = c.bytes(c.left());
+      break;
+    }
+    case MqttPacketType::Puback:
+    case MqttPacketType::Pubrec:
+    case MqttPacketType::Pubrel:
+    case MqttPacketType::Pubcomp:
+      packet.packetId = c.u16();
+      if (c.left()) packet.reasonCode = c.u8();
+      break;
+    case MqttPacketType::Subscribe:
+      packet.packetId = c.u16();
+      c.skipProperties(level);
+      while (c.ok && c.left()) {
+        std::string filter = c.string();
+        uint8_t options = c.u8();
+        packet.filters.emplace_back(filter, options);
+      }
+      break;
+    case MqttPacketType::Suback:
+    case MqttPacketType::Unsuback:
+      packet.packetId = c.u16();
+      c.skipProperties(level);
+      while (c.ok && c.left()) packet.codes.push_back(c.u8());
+      break;
+    case MqttPacketType::Unsubscribe:
+      packet.packetId = c.u16();
+      c.skipProperties(level);
+      while (c.ok && c.left()) packet.filters.emplace_back(c.string(), 0);
+      break;
+    case MqttPacketType::Pingreq:
+    case MqttPacketType::Pingresp:
+      break;
+    case MqttPacketType::Disconnect:
+    case MqttPacketType::Auth:
+      if (c.left()) packet.reasonCode = c.u8();
+      c.p = c.end;
+      break;
+    default:
+      return Result::Malformed;
+  }
+  if (!c.ok) return Result::Malformed;
+
+  _buf.erase(_buf.begin(), _buf.begin() + pos + remaining);
+  return Result::Packet;
+}
+
+const char* mqttPacketTypeName(MqttPacketType type) {
+  static const char* const kNames[] = {"RESERVED", "CONNECT",  "CONNACK", "PUBLISH",     "PUBACK",
+                                       "PUBREC",   "PUBREL",   "PUBCOMP", "SUBSCRIBE",   "SUBACK",
+                                       "UNSUBSCRIBE", "UNSUBACK", "PINGREQ", "PINGRESP", "DISCONNECT",
+                                       "AUTH"};
+  return kNames[(uint8_t)type & 0x0F];
+}
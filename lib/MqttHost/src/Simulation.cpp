@@ -0,0 +1,49 @@
+#include "Simulation.h"
+
+#include <algorithm>
+
+namespace {
+// Exchanges per tick; each round moves every packet one hop
+const int kMaxRounds = 16;
+} // namespace
+
+Simulation::Simulation(const char* brokerName, uint64_t startUs) : _clock(startUs) {
+  mqttHostSetClock(&_clock);
+  mqttHostSetManualStep(true);
+  _broker.setManualStep(true);
+  _broker.listenPipe(brokerName);
+}
+
+Simulation::~Simulation() {
+  _broker.stop();
+  mqttHostSetManualStep(false);
+  mqttHostSetClock(nullptr);
+}
+
+uint32_t Simulation::tick(uint32_t maxMs) {
+  for (auto& fn : _onTick) fn();
+  // Until the broker has nothing left to do, which means the clients had every answer
+  // and every close in the step before
+  for (int round = 0; round < kMaxRounds; round++) {
+    mqttHostStep(0);
+    if (!_broker.step()) break;
+  }
+  uint32_t ms = std::min(mqttHostIdleMs(), maxMs);
+  if (ms < 1) ms = 1;
+  _clock.advanceMs(ms);
+  return ms;
+}
+
+void Simulation::run(uint64_t durationMs, uint32_t maxTickMs) {
+  uint64_t end = nowMs() + durationMs;
+  while (nowMs() < end) tick(static_cast<uint32_t>(std::min<uint64_t>(maxTickMs, end - nowMs())));
+}
+
+bool Simulation::runUntil(const std::function<bool()>& cond, uint64_t timeoutMs, uint32_t maxTickMs) {
+  uint64_t end = nowMs() + timeoutMs;
+  while (!cond()) {
+    if (nowMs() >= end) return false;
+    tick(static_cast<uint32_t>(std::min<uint64_t>(maxTickMs, end - nowMs())));
+  }
+  return true;
+}
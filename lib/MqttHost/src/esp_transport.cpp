@@ -0,0 +1,251 @@
+#include "esp_transport.h"
+#include "esp_transport_ssl.h"
+#include "esp_transport_tcp.h"
+#include "esp_transport_ws.h"
+
+#include <errno.h>
+
+#include <memory>
+#include <string>
+
+#include "MqttHost.h"
+
+std::unique_ptr<HostTransport> hostCreateTransport(const HostEndpoint& endpoint);
+
+struct esp_transport_item_t {
+  connect_func connect = nullptr;
+  io_read_func read = nullptr;
+  io_func write = nullptr;
+  trans_func close = nullptr;
+  poll_func pollRead = nullptr;
+  poll_func pollWrite = nullptr;
+  trans_func destroy = nullptr;
+  void* context = nullptr;
+  int defaultPort = 0;
+  // Transports with a socket of their own report its errno; generic ones report -1
+  // like IDF transports without a foundation
+  bool hasSocket = false;
+  int sockErrno = 0;
+};
+
+namespace {
+// ---- TCP over the MqttHost factory ----
+
+struct TcpContext {
+  std::unique_ptr<HostTransport> stream;
+};
+
+TcpContext* tcpContext(esp_transport_handle_t t) {
+  return static_cast<TcpContext*>(t->context);
+}
+
+int tcpConnect(esp_transport_handle_t t, const char* host, int port, int timeoutMs) {
+  TcpContext* ctx = tcpContext(t);
+  HostEndpoint endpoint;
+  endpoint.scheme = "mqtt";
+  endpoint.host = host ? host : "";
+  endpoint.port = static_cast<uint16_t>(port ? port : t->defaultPort);
+  ctx->stream = hostCreateTransport(endpoint);
+  if (!ctx->stream) {
+    t->sockErrno = EPROTONOSUPPORT;
+    return -1;
+  }
+  if (!ctx->stream->connect(endpoint, static_cast<uint32_t>(timeoutMs))) {
+    t->sockErrno = ctx->stream->lastError() ? ctx->stream->lastError() : ECONNREFUSED;
+    ctx->stream.reset();
+    return -1;
+  }
+  return 0;
+}
+
+int tcpRead(esp_transport_handle_t t, char* buffer, int len, int timeoutMs) {
+  TcpContext* ctx = tcpContext(t);
+  if (!ctx->stream) return -1;
+  int n = ctx->stream->read(reinterpret_cast<uint8_t*>(buffer), static_cast<size_t>(len),
+                            static_cast<uint32_t>(timeoutMs));
+  if (n < 0) t->sockErrno = ctx->stream->lastError();
+  return n;
+}
+
+int tcpWrite(esp_transport_handle_t t, const char* buffer, int len, int timeoutMs) {
+  (void)timeoutMs;
+  TcpContext* ctx = tcpContext(t);
+  if (!ctx->stream) return -1;
+  int n = ctx->stream->write(reinterpret_cast<const uint8_t*>(buffer), static_cast<size_t>(len));
+  if (n < 0) t->sockErrno = ctx->stream->lastError();
+  return n;
+}
+
+int tcpClose(esp_transport_handle_t t) {
+  TcpContext* ctx = tcpContext(t);
+  if (ctx->stream) ctx->stream->close();
+  ctx->stream.reset();
+  return 0;
+}
+
+int tcpDestroy(esp_transport_handle_t t) {
+  delete tcpContext(t);
+  return 0;
+}
+
+// ---- SSL and WebSocket: settings only ----
+
+int refuseConnect(esp_transport_handle_t t, const char*, int, int) {
+  t->sockErrno = EPROTONOSUPPORT;
+  return -1;
+}
+
+int failRead(esp_transport_handle_t, char*, int, int) {
+  return -1;
+}
+
+int failWrite(esp_transport_handle_t, const char*, int, int) {
+  return -1;
+}
+
+int closeNothing(esp_transport_handle_t) {
+  return 0;
+}
+
+struct WsContext {
+  std::string path;
+  std::string subprotocol;
+};
+
+int wsDestroy(esp_transport_handle_t t) {
+  delete static_cast<WsContext*>(t->context);
+  return 0;
+}
+
+esp_transport_handle_t refusingTransport(int defaultPort) {
+  esp_transport_handle_t t = esp_transport_init();
+  esp_transport_set_func(t, refuseConnect, failRead, failWrite, closeNothing, nullptr, nullptr, nullptr);
+  t->defaultPort = defaultPort;
+  t->hasSocket = true;
+  return t;
+}
+} // namespace
+
+extern "C" {
+
+esp_transport_handle_t esp_transport_init(void) {
+  return new esp_transport_item_t();
+}
+
+esp_err_t esp_transport_destroy(esp_transport_handle_t t) {
+  if (!t) return ESP_ERR_INVALID_ARG;
+  if (t->destroy) t->destroy(t);
+  delete t;
+  return ESP_OK;
+}
+
+int esp_transport_connect(esp_transport_handle_t t, const char* host, int port, int timeout_ms) {
+  if (!t || !t->connect) return -1;
+  return t->connect(t, host, port, timeout_ms);
+}
+
+int esp_transport_read(esp_transport_handle_t t, char* buffer, int len, int timeout_ms) {
+  if (!t || !t->read) return -1;
+  return t->read(t, buffer, len, timeout_ms);
+}
+
+int esp_transport_write(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms) {
+  if (!t || !t->write) return -1;
+  return t->write(t, buffer, len, timeout_ms);
+}
+
+int esp_transport_poll_read(esp_transport_handle_t t, int timeout_ms) {
+  if (!t || !t->pollRead) return -1;
+  return t->pollRead(t, timeout_ms);
+}
+
+int esp_transport_poll_write(esp_transport_handle_t t, int timeout_ms) {
+  if (!t || !t->pollWrite) return -1;
+  return t->pollWrite(t, timeout_ms);
+}
+
+int esp_transport_close(esp_transport_handle_t t) {
+  if (!t) return -1;
+  return t->close ? t->close(t) : 0;
+}
+
+void* esp_transport_get_context_data(esp_transport_handle_t t) {
+  return t ? t->context : nullptr;
+}
+
+esp_err_t esp_transport_set_context_data(esp_transport_handle_t t, void* data) {
+  if (!t) return ESP_FAIL;
+  t->context = data;
+  return ESP_OK;
+}
+
+esp_err_t esp_transport_set_func(esp_transport_handle_t t, connect_func _connect, io_read_func _read,
+                                 io_func _write, trans_func _close, poll_func _poll_read, poll_func _poll_write,
+                                 trans_func _destroy) {
+  if (!t) return ESP_FAIL;
+  t->connect = _connect;
+  t->read = _read;
+  t->write = _write;
+  t->close = _close;
+  t->pollRead = _poll_read;
+  t->pollWrite = _poll_write;
+  t->destroy = _destroy;
+  return ESP_OK;
+}
+
+int esp_transport_get_default_port(esp_transport_handle_t t) {
+  return t ? t->defaultPort : -1;
+}
+
+esp_err_t esp_transport_set_default_port(esp_transport_handle_t t, int port) {
+  if (!t) return ESP_FAIL;
+  t->defaultPort = port;
+  return ESP_OK;
+}
+
+int esp_transport_get_errno(esp_transport_handle_t t) {
+  return t && t->hasSocket ? t->sockErrno : -1;
+}
+
+esp_transport_handle_t esp_transport_tcp_init(void) {
+  esp_transport_handle_t t = esp_transport_init();
+  esp_transport_set_func(t, tcpConnect, tcpRead, tcpWrite, tcpClose, nullptr, nullptr, tcpDestroy);
+  esp_transport_set_context_data(t, new TcpContext());
+  t->defaultPort = 1883;
+  t->hasSocket = true;
+  return t;
+}
+
+esp_transport_handle_t esp_transport_ssl_init(void) {
+  return refusingTransport(8883);
+}
+
+void esp_transport_ssl_set_cert_data(esp_transport_handle_t, const char*, int) {}
+void esp_transport_ssl_set_cert_data_der(esp_transport_handle_t, const char*, int) {}
+void esp_transport_ssl_set_client_cert_data(esp_transport_handle_t, const char*, int) {}
+void esp_transport_ssl_set_client_cert_data_der(esp_transport_handle_t, const char*, int) {}
+void esp_transport_ssl_set_client_key_data(esp_transport_handle_t, const char*, int) {}
+void esp_transport_ssl_set_client_key_data_der(esp_transport_handle_t, const char*, int) {}
+void esp_transport_ssl_skip_common_name_check(esp_transport_handle_t) {}
+
+esp_transport_handle_t esp_transport_ws_init(esp_transport_handle_t parent_handle) {
+  if (!parent_handle) return nullptr;
+  esp_transport_handle_t t = refusingTransport(80);
+  t->destroy = wsDestroy;
+  esp_transport_set_context_data(t, new WsContext());
+  return t;
+}
+
+esp_err_t esp_transport_ws_set_path(esp_transport_handle_t t, const char* path) {
+  if (!t || !path) return ESP_ERR_INVALID_ARG;
+  static_cast<WsContext*>(t->context)->path = path;
+  return ESP_OK;
+}
+
+esp_err_t esp_transport_ws_set_subprotocol(esp_transport_handle_t t, const char* sub_protocol) {
+  if (!t) return ESP_ERR_INVALID_ARG;
+  static_cast<WsContext*>(t->context)->subprotocol = sub_protocol ? sub_protocol : "";
+  return ESP_OK;
+}
+
+} // extern "C"
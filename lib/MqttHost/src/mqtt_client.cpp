@@ -0,0 +1,877 @@
+#include "mqtt_client.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AllocCounter.h"
+#include "Arduino.h"
+#include "MqttCodec.h"
+#include "MqttHost.h"
+
+std::unique_ptr<HostTransport> hostCreateTransport(const HostEndpoint& endpoint);
+
+namespace {
+const char* const kEventBase = "MQTT_EVENTS";
+
+// esp-mqtt defaults for zero config fields
+const int kDefaultReconnectMs = 10000;
+const int kDefaultNetworkTimeoutMs = 10000;
+const int kDefaultRetransmitMs = 1000;
+const int kDefaultKeepalive = 120;
+const int kDefaultBufferSize = 1024;
+// Read wait of the client thread; bounds how long an enqueued message waits to be sent
+const uint32_t kLoopWaitMs = 5;
+
+enum class State { Init, Connecting, Connected, WaitReconnect, Disconnected, Stopped };
+
+struct Handler {
+  esp_mqtt_event_id_t event;
+  esp_event_handler_t fn;
+  void* arg;
+};
+
+struct OutboxItem {
+  uint16_t msgId;
+  MqttPacketType type; // Publish, Pubrel, Subscribe or Unsubscribe
+  uint8_t qos;
+  std::vector<uint8_t> bytes;
+  bool sent;
+  uint32_t sentMs;
+};
+
+std::atomic<bool> s_manualStep(false);
+std::mutex s_steppedLock;
+std::vector<esp_mqtt_client*> s_stepped; // started clients without a thread
+std::atomic<uint32_t> s_defaultReconnectMs(0);
+std::mutex s_tlsLock;
+HostTlsConfig s_lastTls;
+} // namespace
+
+struct esp_mqtt_client {
+  // Configuration, copied like esp-mqtt does
+  std::string uri;
+  std::string hostname;
+  std::string path;
+  uint32_t port = 0;
+  esp_mqtt_transport_t transportKind = MQTT_TRANSPORT_UNKNOWN;
+  std::string clientId;
+  std::string username;
+  std::string password;
+  bool hasUsername = false;
+  bool hasPassword = false;
+  bool cleanSession = true;
+  int keepalive = kDefaultKeepalive;
+  bool disableKeepalive = false;
+  esp_mqtt_protocol_ver_t protocolVer = MQTT_PROTOCOL_UNDEFINED;
+  int retransmitMs = kDefaultRetransmitMs;
+  int reconnectMs = kDefaultReconnectMs;
+  int networkTimeoutMs = kDefaultNetworkTimeoutMs;
+  bool autoReconnect = true;
+  int bufferSize = kDefaultBufferSize;
+  uint64_t outboxLimit = 0;
+  bool hasWill = false;
+  std::string willTopic;
+  std::string willPayload;
+  uint8_t willQos = 0;
+  bool willRetain = false;
+  esp_transport_handle_t customTransport = nullptr; // network.transport, owned like esp-mqtt does
+
+  // Held while processing and dispatching, never across a blocking read or connect
+  std::recursive_mutex lock;
+  std::vector<Handler> handlers;
+  State state = State::Stopped;
+  std::unique_ptr<HostTransport> transport;
+  MqttFrameReader reader;
+  uint8_t level = kMqttLevel311;
+  std::deque<OutboxItem> outbox;
+  size_t outboxBytes = 0;
+  std::set<uint16_t> inboundQos2; // PUBREC sent, PUBREL not yet received
+  uint16_t lastMsgId = 0;
+  esp_mqtt_error_codes_t error = {};
+
+  uint32_t attemptStartMs = 0;
+  uint32_t reconnectAtMs = 0;
+  uint32_t lastTxMs = 0;
+  uint32_t pingSentMs = 0;
+  bool awaitingPing = false;
+  bool writeFailed = false;
+
+  bool running = false;
+  std::atomic<bool> run{false};
+  std::atomic<bool> disconnectRequested{false};
+  std::atomic<bool> reconnectRequested{false};
+  bool destroyPending = false;
+  std::thread thread;
+  std::thread::id loopThread; // client thread, or the thread inside mqttHostClientStep()
+
+  ~esp_mqtt_client() {
+    if (customTransport) esp_transport_destroy(customTransport);
+  }
+};
+
+namespace {
+// Drives a transport given in network.transport like the factory's streams. It does not
+// own the esp_transport; the client destroys that with itself.
+class CustomStream : public HostTransport {
+public:
+  CustomStream(esp_transport_handle_t t, int timeoutMs) : _t(t), _timeoutMs(timeoutMs) {}
+
+  bool connect(const HostEndpoint& endpoint, uint32_t timeoutMs) override {
+    return esp_transport_connect(_t, endpoint.host.c_str(), endpoint.port, static_cast<int>(timeoutMs)) >= 0;
+  }
+  int write(const uint8_t* data, size_t len) override {
+    int n = esp_transport_write(_t, reinterpret_cast<const char*>(data), static_cast<int>(len), _timeoutMs);
+    return n < 0 ? -1 : n;
+  }
+  int read(uint8_t* buf, size_t len, uint32_t timeoutMs) override {
+    int n = esp_transport_read(_t, reinterpret_cast<char*>(buf), static_cast<int>(len), static_cast<int>(timeoutMs));
+    return n < 0 ? -1 : n;
+  }
+  void close() override { esp_transport_close(_t); }
+  int lastError() const override {
+    int err = esp_transport_get_errno(_t);
+    return err > 0 ? err : 0;
+  }
+
+private:
+  esp_transport_handle_t _t;
+  int _timeoutMs;
+};
+
+uint16_t nextMsgId(esp_mqtt_client* c) {
+  if (++c->lastMsgId == 0) c->lastMsgId = 1;
+  return c->lastMsgId;
+}
+
+void applyConfig(esp_mqtt_client* c, const esp_mqtt_client_config_t* cfg) {
+  const esp_mqtt_client_config_t::broker_t::address_t& addr = cfg->broker.address;
+  if (addr.uri) {
+    c->uri = addr.uri;
+    c->hostname.clear();
+  } else if (addr.hostname) {
+    c->uri.clear();
+    c->hostname = addr.hostname;
+  }
+  if (addr.path) c->path = addr.path;
+  if (addr.port) c->port = addr.port;
+  if (addr.transport) c->transportKind = addr.transport;
+
+  const esp_mqtt_client_config_t::credentials_t& cred = cfg->credentials;
+  if (cred.client_id) {
+    c->clientId = cred.client_id;
+  } else if (cred.set_null_client_id) {
+    c->clientId.clear();
+  } else if (c->clientId.empty()) {
+    char id[24];
+    snprintf(id, sizeof(id), "ESP32_%06X", static_cast<unsigned>(reinterpret_cast<uintptr_t>(c) & 0xFFFFFF));
+    c->clientId = id;
+  }
+  c->hasUsername = cred.username != nullptr;
+  c->username = cred.username ? cred.username : "";
+  c->hasPassword = cred.authentication.password != nullptr;
+  c->password = cred.authentication.password ? cred.authentication.password : "";
+
+  const esp_mqtt_client_config_t::session_t& session = cfg->session;
+  c->cleanSession = !session.disable_clean_session;
+  c->keepalive = session.keepalive ? session.keepalive : kDefaultKeepalive;
+  c->disableKeepalive = session.disable_keepalive;
+  c->protocolVer = session.protocol_ver;
+  c->retransmitMs = session.message_retransmit_timeout ? session.message_retransmit_timeout : kDefaultRetransmitMs;
+  c->hasWill = session.last_will.topic != nullptr;
+  if (c->hasWill) {
+    c->willTopic = session.last_will.topic;
+    const char* msg = session.last_will.msg ? session.last_will.msg : "";
+    c->willPayload.assign(msg, session.last_will.msg_len > 0 ? session.last_will.msg_len : strlen(msg));
+    c->willQos = static_cast<uint8_t>(session.last_will.qos);
+    c->willRetain = session.last_will.retain != 0;
+  }
+
+  c->reconnectMs = cfg->network.reconnect_timeout_ms;
+  if (!c->reconnectMs) c->reconnectMs = s_defaultReconnectMs ? static_cast<int>(s_defaultReconnectMs) : kDefaultReconnectMs;
+  c->networkTimeoutMs = cfg->network.timeout_ms ? cfg->network.timeout_ms : kDefaultNetworkTimeoutMs;
+  c->autoReconnect = !cfg->network.disable_auto_reconnect;
+  // esp_mqtt_set_config() without a transport keeps the one given before
+  if (cfg->network.transport && cfg->network.transport != c->customTransport) {
+    if (c->customTransport) esp_transport_destroy(c->customTransport);
+    c->customTransport = cfg->network.transport;
+  }
+  c->bufferSize = cfg->buffer.size > 0 ? cfg->buffer.size : kDefaultBufferSize;
+  c->outboxLimit = cfg->outbox.limit;
+
+  HostTlsConfig tls;
+  tls.caCert = cfg->broker.verification.certificate;
+  tls.caCertLen = cfg->broker.verification.certificate_len;
+  tls.skipCommonNameCheck = cfg->broker.verification.skip_cert_common_name_check;
+  tls.clientCert = cred.authentication.certificate;
+  tls.clientCertLen = cred.authentication.certificate_len;
+  tls.clientKey = cred.authentication.key;
+  tls.clientKeyLen = cred.authentication.key_len;
+  std::lock_guard<std::mutex> tlsLock(s_tlsLock);
+  s_lastTls = tls;
+}
+
+bool resolveEndpoint(esp_mqtt_client* c, HostEndpoint& endpoint) {
+  if (!c->uri.empty()) return hostParseUri(c->uri.c_str(), endpoint);
+  if (c->hostname.empty()) return false;
+  switch (c->transportKind) {
+    case MQTT_TRANSPORT_OVER_SSL:
+      endpoint.scheme = "mqtts";
+      break;
+    case MQTT_TRANSPORT_OVER_WS:
+      endpoint.scheme = "ws";
+      break;
+    case MQTT_TRANSPORT_OVER_WSS:
+      endpoint.scheme = "wss";
+      break;
+    default:
+      endpoint.scheme = "mqtt";
+      break;
+  }
+  endpoint.host = c->hostname;
+  endpoint.path = c->path;
+  endpoint.port = static_cast<uint16_t>(c->port ? c->port : 1883);
+  return true;
+}
+
+void dispatch(esp_mqtt_client* c, esp_mqtt_event_t& event) {
+  event.client = c;
+  if (!event.error_handle) event.error_handle = &c->error;
+  event.protocol_ver = c->level == kMqttLevel5 ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1;
+  // Handlers may register or unregister while being called
+  std::vector<Handler> handlers = c->handlers;
+  for (const Handler& h : handlers) {
+    if (h.event == MQTT_EVENT_ANY || h.event == event.event_id) {
+      AllocCounted counted; // the handler is client code; the shim around it is exempt
+      h.fn(h.arg, kEventBase, event.event_id, &event);
+    }
+  }
+}
+
+void post(esp_mqtt_client* c, esp_mqtt_event_id_t id, int msgId = 0) {
+  esp_mqtt_event_t event = {};
+  event.event_id = id;
+  event.msg_id = msgId;
+  dispatch(c, event);
+}
+
+bool send(esp_mqtt_client* c, const std::vector<uint8_t>& bytes) {
+  if (!c->transport || c->writeFailed) return false;
+  if (c->transport->write(bytes.data(), bytes.size()) != static_cast<int>(bytes.size())) {
+    c->writeFailed = true;
+    return false;
+  }
+  c->lastTxMs = millis();
+  return true;
+}
+
+void closeTransport(esp_mqtt_client* c) {
+  if (c->transport) c->transport->close();
+  c->transport.reset();
+  c->reader.clear();
+  c->awaitingPing = false;
+  c->writeFailed = false;
+}
+
+// esp_mqtt_abort_connection: ERROR (if any) then DISCONNECTED, then wait to reconnect
+void abortConnection(esp_mqtt_client* c, esp_mqtt_error_type_t type, int sockErrno = 0, int returnCode = 0) {
+  if (type != MQTT_ERROR_TYPE_NONE) {
+    c->error = esp_mqtt_error_codes_t();
+    c->error.error_type = type;
+    c->error.esp_tls_last_esp_err = type == MQTT_ERROR_TYPE_TCP_TRANSPORT ? ESP_FAIL : ESP_OK;
+    c->error.connect_return_code = static_cast<esp_mqtt_connect_return_code_t>(returnCode);
+    c->error.esp_transport_sock_errno = sockErrno;
+    post(c, MQTT_EVENT_ERROR);
+  }
+  closeTransport(c);
+  c->state = c->autoReconnect ? State::WaitReconnect : State::Disconnected;
+  c->reconnectAtMs = millis() + c->reconnectMs;
+  post(c, MQTT_EVENT_DISCONNECTED);
+  c->error = esp_mqtt_error_codes_t();
+}
+
+void outboxErase(esp_mqtt_client* c, std::deque<OutboxItem>::iterator it) {
+  c->outboxBytes -= it->bytes.size();
+  c->outbox.erase(it);
+}
+
+std::deque<OutboxItem>::iterator outboxFind(esp_mqtt_client* c, uint16_t msgId, MqttPacketType type) {
+  for (auto it = c->outbox.begin(); it != c->outbox.end(); ++it) {
+    if (it->msgId == msgId && it->type == type) return it;
+  }
+  return c->outbox.end();
+}
+
+void outboxAdd(esp_mqtt_client* c, uint16_t msgId, MqttPacketType type, uint8_t qos, std::vector<uint8_t>&& bytes,
+               bool sent) {
+  c->outboxBytes += bytes.size();
+  c->outbox.push_back(OutboxItem{msgId, type, qos, std::move(bytes), sent, static_cast<uint32_t>(millis())});
+}
+
+void deliver(esp_mqtt_client* c, MqttPacket& packet) {
+  size_t total = packet.payload.size();
+  size_t chunk = static_cast<size_t>(c->bufferSize);
+  size_t offset = 0;
+  do {
+    size_t len = total - offset < chunk ? total - offset : chunk;
+    esp_mqtt_event_t event = {};
+    event.event_id = MQTT_EVENT_DATA;
+    event.msg_id = packet.packetId;
+    if (offset == 0) {
+      event.topic = &packet.topic[0];
+      event.topic_len = static_cast<int>(packet.topic.size());
+    }
+    event.data = total ? &packet.payload[offset] : nullptr;
+    event.data_len = static_cast<int>(len);
+    event.total_data_len = static_cast<int>(total);
+    event.current_data_offset = static_cast<int>(offset);
+    event.qos = packet.qos;
+    event.retain = packet.retain;
+    event.dup = packet.dup;
+    dispatch(c, event);
+    offset += len;
+  } while (offset < total);
+}
+
+void handlePacket(esp_mqtt_client* c, MqttPacket& packet) {
+  std::vector<uint8_t> out;
+  switch (packet.type) {
+    case MqttPacketType::Connack:
+      if (c->state != State::Connecting) break;
+      if (packet.reasonCode != 0) {
+        abortConnection(c, MQTT_ERROR_TYPE_CONNECTION_REFUSED, 0, packet.reasonCode);
+        break;
+      }
+      c->state = State::Connected;
+      c->lastTxMs = millis();
+      // Queued and unacknowledged messages go out again on the new connection
+      for (OutboxItem& item : c->outbox) item.sent = false;
+      {
+        esp_mqtt_event_t event = {};
+        event.event_id = MQTT_EVENT_CONNECTED;
+        event.session_present = packet.sessionPresent ? 1 : 0;
+        dispatch(c, event);
+      }
+      break;
+    case MqttPacketType::Publish:
+      if (packet.qos == 1) {
+        mqttEncodeAck(out, MqttPacketType::Puback, c->level, packet.packetId);
+        send(c, out);
+      } else if (packet.qos == 2) {
+        mqttEncodeAck(out, MqttPacketType::Pubrec, c->level, packet.packetId);
+        send(c, out);
+        if (!c->inboundQos2.insert(packet.packetId).second) break; // redelivery before PUBREL
+      }
+      deliver(c, packet);
+      break;
+    case MqttPacketType::Puback: {
+      auto it = outboxFind(c, packet.packetId, MqttPacketType::Publish);
+      if (it == c->outbox.end()) break;
+      outboxErase(c, it);
+      post(c, MQTT_EVENT_PUBLISHED, packet.packetId);
+      break;
+    }
+    case MqttPacketType::Pubrec: {
+      auto it = outboxFind(c, packet.packetId, MqttPacketType::Publish);
+      if (it != c->outbox.end()) outboxErase(c, it);
+      if (outboxFind(c, packet.packetId, MqttPacketType::Pubrel) == c->outbox.end()) {
+        mqttEncodeAck(out, MqttPacketType::Pubrel, c->level, packet.packetId);
+        send(c, out);
+        outboxAdd(c, packet.packetId, MqttPacketType::Pubrel, 1, std::move(out), true);
+      }
+      break;
+    }
+    case MqttPacketType::Pubrel:
+      c->inboundQos2.erase(packet.packetId);
+      mqttEncodeAck(out, MqttPacketType::Pubcomp, c->level, packet.packetId);
+      send(c, out);
+      break;
+    case MqttPacketType::Pubcomp: {
+      auto it = outboxFind(c, packet.packetId, MqttPacketType::Pubrel);
+      if (it == c->outbox.end()) break;
+      outboxErase(c, it);
+      post(c, MQTT_EVENT_PUBLISHED, packet.packetId);
+      break;
+    }
+    case MqttPacketType::Suback: {
+      auto it = outboxFind(c, packet.packetId, MqttPacketType::Subscribe);
+      if (it == c->outbox.end()) break;
+      outboxErase(c, it);
+      esp_mqtt_event_t event = {};
+      event.event_id = MQTT_EVENT_SUBSCRIBED;
+      event.msg_id = packet.packetId;
+      event.data = reinterpret_cast<char*>(packet.codes.data());
+      event.data_len = static_cast<int>(packet.codes.size());
+      for (uint8_t code : packet.codes) {
+        if (code >= 0x80) c->error.error_type = MQTT_ERROR_TYPE_SUBSCRIBE_FAILED;
+      }
+      dispatch(c, event);
+      c->error.error_type = MQTT_ERROR_TYPE_NONE;
+      break;
+    }
+    case MqttPacketType::Unsuback: {
+      auto it = outboxFind(c, packet.packetId, MqttPacketType::Unsubscribe);
+      if (it == c->outbox.end()) break;
+      outboxErase(c, it);
+      post(c, MQTT_EVENT_UNSUBSCRIBED, packet.packetId);
+      break;
+    }
+    case MqttPacketType::Pingresp:
+      c->awaitingPing = false;
+      break;
+    case MqttPacketType::Disconnect:
+      abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT);
+      break;
+    default:
+      break;
+  }
+}
+
+void startAttempt(esp_mqtt_client* c, std::unique_lock<std::recursive_mutex>& lock) {
+  post(c, MQTT_EVENT_BEFORE_CONNECT);
+  if (c->state != State::Init) return; // stopped or reconfigured from the handler
+
+  c->level = c->protocolVer == MQTT_PROTOCOL_V_5 ? kMqttLevel5 : kMqttLevel311;
+  c->attemptStartMs = millis();
+  HostEndpoint endpoint;
+  std::unique_ptr<HostTransport> transport;
+  if (resolveEndpoint(c, endpoint)) {
+    if (c->customTransport) {
+      transport.reset(new CustomStream(c->customTransport, c->networkTimeoutMs));
+    } else {
+      transport = hostCreateTransport(endpoint);
+    }
+  }
+  if (!transport) {
+    abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, EPROTONOSUPPORT);
+    return;
+  }
+
+  // Connecting blocks; publishes from other threads see a client that is not connected
+  c->state = State::Connecting;
+  uint32_t timeoutMs = static_cast<uint32_t>(c->networkTimeoutMs);
+  lock.unlock();
+  bool connected = transport->connect(endpoint, timeoutMs);
+  lock.lock();
+  if (c->state != State::Connecting) return;
+  if (!connected) {
+    abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, transport->lastError() ? transport->lastError() : ECONNREFUSED);
+    return;
+  }
+
+  c->transport = std::move(transport);
+  MqttConnectOptions options;
+  options.protocolLevel = c->level;
+  options.clientId = c->clientId.c_str();
+  options.username = c->hasUsername ? c->username.c_str() : nullptr;
+  options.password = c->hasPassword ? c->password.c_str() : nullptr;
+  options.keepalive = c->disableKeepalive ? 0 : static_cast<uint16_t>(c->keepalive);
+  options.cleanSession = c->cleanSession;
+  if (c->hasWill) {
+    options.willTopic = c->willTopic.c_str();
+    options.willPayload = c->willPayload;
+    options.willQos = c->willQos;
+    options.willRetain = c->willRetain;
+  }
+  std::vector<uint8_t> out;
+  mqttEncodeConnect(out, options);
+  send(c, out);
+}
+
+void serviceConnected(esp_mqtt_client* c) {
+  uint32_t now = millis();
+  for (auto it = c->outbox.begin(); it != c->outbox.end() && !c->writeFailed;) {
+    if (!it->sent || (it->qos > 0 && now - it->sentMs >= static_cast<uint32_t>(c->retransmitMs))) {
+      if (it->sent && it->type == MqttPacketType::Publish) it->bytes[0] |= 0x08; // DUP
+      send(c, it->bytes);
+      it->sent = true;
+      it->sentMs = now;
+      if (it->qos == 0) {
+        c->outboxBytes -= it->bytes.size();
+        it = c->outbox.erase(it);
+        continue;
+      }
+    }
+    ++it;
+  }
+
+  if (c->disableKeepalive || c->keepalive <= 0) return;
+  uint32_t keepaliveMs = static_cast<uint32_t>(c->keepalive) * 1000;
+  if (c->awaitingPing && now - c->pingSentMs > keepaliveMs) {
+    abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, ETIMEDOUT); // no PINGRESP
+    return;
+  }
+  if (!c->awaitingPing && now - c->lastTxMs >= keepaliveMs / 2) {
+    std::vector<uint8_t> out;
+    mqttEncodeEmpty(out, MqttPacketType::Pingreq);
+    send(c, out);
+    c->awaitingPing = true;
+    c->pingSentMs = now;
+  }
+}
+
+// One iteration of the client task loop
+void iterate(esp_mqtt_client* c, uint32_t waitMs) {
+  AllocExempt exempt;
+  std::unique_lock<std::recursive_mutex> lock(c->lock);
+  if (!c->run) return;
+
+  if (c->disconnectRequested.exchange(false) &&
+      (c->state == State::Connected || c->state == State::Connecting)) {
+    std::vector<uint8_t> out;
+    mqttEncodeEmpty(out, MqttPacketType::Disconnect);
+    send(c, out);
+    closeTransport(c);
+    c->state = State::Disconnected;
+    post(c, MQTT_EVENT_DISCONNECTED);
+  }
+  if (c->reconnectRequested.exchange(false) &&
+      (c->state == State::WaitReconnect || c->state == State::Disconnected)) {
+    c->state = State::Init;
+  }
+  if (c->state == State::WaitReconnect && static_cast<int32_t>(millis() - c->reconnectAtMs) >= 0) {
+    c->state = State::Init;
+  }
+  if (c->state == State::Init) startAttempt(c, lock);
+  if (c->state == State::Connecting &&
+      millis() - c->attemptStartMs > static_cast<uint32_t>(c->networkTimeoutMs)) {
+    abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, ETIMEDOUT); // no CONNACK
+  }
+  if (c->state == State::Connected) serviceConnected(c);
+  if (c->writeFailed) {
+    abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, c->transport ? c->transport->lastError() : 0);
+  }
+
+  if (!c->transport || !c->run) {
+    lock.unlock();
+    if (waitMs) delay(waitMs);
+    return;
+  }
+
+  // Only this loop replaces or closes the transport, so it stays valid unlocked
+  HostTransport* transport = c->transport.get();
+  uint8_t buf[4096];
+  lock.unlock();
+  int n = transport->read(buf, sizeof(buf), waitMs);
+  lock.lock();
+  if (n < 0) {
+    abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, transport->lastError());
+    return;
+  }
+  if (n == 0) return;
+  c->reader.feed(buf, static_cast<size_t>(n));
+  MqttPacket packet;
+  while (c->transport.get() == transport) {
+    MqttFrameReader::Result result = c->reader.next(packet, c->level);
+    if (result == MqttFrameReader::Result::NeedMore) break;
+    if (result == MqttFrameReader::Result::Malformed) {
+      abortConnection(c, MQTT_ERROR_TYPE_TCP_TRANSPORT, EPROTO);
+      break;
+    }
+    handlePacket(c, packet);
+  }
+}
+
+// Time until the next timer of the client is due, UINT32_MAX when none is running
+uint32_t idleMs(esp_mqtt_client* c) {
+  uint32_t now = millis();
+  auto until = [now](uint32_t atMs) -> uint32_t {
+    int32_t left = static_cast<int32_t>(atMs - now);
+    return left > 0 ? static_cast<uint32_t>(left) : 0;
+  };
+  if (!c->run) return UINT32_MAX;
+  if (c->disconnectRequested || c->reconnectRequested || c->writeFailed) return 0;
+  switch (c->state) {
+    case State::Init:
+      return 0;
+    case State::WaitReconnect:
+      return until(c->reconnectAtMs);
+    case State::Connecting:
+      return until(c->attemptStartMs + static_cast<uint32_t>(c->networkTimeoutMs) + 1);
+    case State::Connected:
+      break;
+    default:
+      return UINT32_MAX;
+  }
+  uint32_t idle = UINT32_MAX;
+  for (const OutboxItem& item : c->outbox) {
+    if (!item.sent) return 0;
+    if (item.qos) idle = std::min(idle, until(item.sentMs + static_cast<uint32_t>(c->retransmitMs)));
+  }
+  if (!c->disableKeepalive && c->keepalive > 0) {
+    uint32_t keepaliveMs = static_cast<uint32_t>(c->keepalive) * 1000;
+    idle = std::min(idle, c->awaitingPing ? until(c->pingSentMs + keepaliveMs + 1) : until(c->lastTxMs + keepaliveMs / 2));
+  }
+  return idle;
+}
+
+void runLoop(esp_mqtt_client* c) {
+  while (c->run) iterate(c, kLoopWaitMs);
+  bool destroy;
+  {
+    std::lock_guard<std::recursive_mutex> lock(c->lock);
+    destroy = c->destroyPending;
+  }
+  // Destroyed from one of its own event handlers: nobody is left to join this thread
+  if (destroy) {
+    c->thread.detach();
+    closeTransport(c);
+    delete c;
+  }
+}
+
+void unstep(esp_mqtt_client* c) {
+  std::lock_guard<std::mutex> lock(s_steppedLock);
+  for (auto it = s_stepped.begin(); it != s_stepped.end(); ++it) {
+    if (*it == c) {
+      s_stepped.erase(it);
+      break;
+    }
+  }
+}
+
+bool onLoopThread(esp_mqtt_client* c) {
+  return c->running && c->loopThread == std::this_thread::get_id();
+}
+
+int publishInternal(esp_mqtt_client* c, const char* topic, const char* data, int len, int qos, int retain,
+                    bool enqueue, bool store) {
+  if (!c || !topic || qos < 0 || qos > 2) return -1;
+  AllocExempt exempt; // esp-mqtt allocates its outbox entries too
+  if (len <= 0 && data) len = static_cast<int>(strlen(data));
+  std::lock_guard<std::recursive_mutex> lock(c->lock);
+  bool connected = c->state == State::Connected;
+  if (!enqueue && !connected && qos == 0) return -1;
+  if (enqueue && qos == 0 && !store) return 0; // esp-mqtt only keeps QoS 0 with store set
+
+  uint16_t msgId = qos ? nextMsgId(c) : 0;
+  std::vector<uint8_t> out;
+  mqttEncodePublish(out, c->level, topic, data, data ? static_cast<size_t>(len) : 0, static_cast<uint8_t>(qos),
+                    retain != 0, false, msgId);
+  if (!enqueue && connected) {
+    bool sent = send(c, out);
+    if (qos == 0) return sent ? 0 : -1;
+    outboxAdd(c, msgId, MqttPacketType::Publish, static_cast<uint8_t>(qos), std::move(out), sent);
+    return msgId;
+  }
+  if (c->outboxLimit && c->outboxBytes + out.size() > c->outboxLimit) return -2;
+  outboxAdd(c, msgId, MqttPacketType::Publish, static_cast<uint8_t>(qos), std::move(out), false);
+  return msgId;
+}
+} // namespace
+
+extern "C" {
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config) {
+  if (!config) return nullptr;
+  esp_mqtt_client* c = new esp_mqtt_client();
+  applyConfig(c, config);
+  return c;
+}
+
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t* config) {
+  if (!client || !config) return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  applyConfig(client, config);
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t client, const char* uri) {
+  if (!client || !uri) return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  client->uri = uri;
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+  if (!client) return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  if (client->running) return ESP_FAIL;
+  client->state = State::Init;
+  client->running = true;
+  client->run = true;
+  if (s_manualStep) {
+    std::lock_guard<std::mutex> steppedLock(s_steppedLock);
+    s_stepped.push_back(client);
+  } else {
+    // The loop blocks on the lock until loopThread is set
+    client->thread = std::thread(runLoop, client);
+    client->loopThread = client->thread.get_id();
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+  if (!client) return ESP_ERR_INVALID_ARG;
+  if (!client->running || onLoopThread(client)) return ESP_FAIL; // cannot stop from the client task
+  client->run = false;
+  if (client->thread.joinable()) client->thread.join();
+  unstep(client);
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  if (client->state == State::Connected) {
+    std::vector<uint8_t> out;
+    mqttEncodeEmpty(out, MqttPacketType::Disconnect);
+    send(client, out);
+  }
+  closeTransport(client);
+  client->state = State::Stopped;
+  client->running = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+  if (!client) return ESP_ERR_INVALID_ARG;
+  if (onLoopThread(client)) {
+    std::lock_guard<std::recursive_mutex> lock(client->lock);
+    client->destroyPending = true;
+    client->run = false;
+    return ESP_OK;
+  }
+  esp_mqtt_client_stop(client);
+  delete client;
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client) {
+  if (!client || !client->running) return ESP_FAIL;
+  client->disconnectRequested = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client) {
+  if (!client || !client->running) return ESP_FAIL;
+  client->reconnectRequested = true;
+  return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t* topic_list,
+                                       int size) {
+  if (!client || !topic_list || size <= 0) return -1;
+  AllocExempt exempt;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  if (client->state != State::Connected) return -1;
+  std::vector<std::pair<std::string, uint8_t>> filters;
+  for (int i = 0; i < size; i++) filters.emplace_back(topic_list[i].filter, static_cast<uint8_t>(topic_list[i].qos));
+  uint16_t msgId = nextMsgId(client);
+  std::vector<uint8_t> out;
+  mqttEncodeSubscribe(out, client->level, msgId, filters);
+  bool sent = send(client, out);
+  outboxAdd(client, msgId, MqttPacketType::Subscribe, 1, std::move(out), sent);
+  return msgId;
+}
+
+int esp_mqtt_client_subscribe_single(esp_mqtt_client_handle_t client, const char* topic, int qos) {
+  esp_mqtt_topic_t t = {topic, qos};
+  return esp_mqtt_client_subscribe_multiple(client, &t, 1);
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char* topic) {
+  if (!client || !topic) return -1;
+  AllocExempt exempt;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  if (client->state != State::Connected) return -1;
+  uint16_t msgId = nextMsgId(client);
+  std::vector<uint8_t> out;
+  mqttEncodeUnsubscribe(out, client->level, msgId, std::vector<std::string>(1, topic));
+  bool sent = send(client, out);
+  outboxAdd(client, msgId, MqttPacketType::Unsubscribe, 1, std::move(out), sent);
+  return msgId;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+                            int retain) {
+  return publishInternal(client, topic, data, len, qos, retain, false, false);
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+                            int retain, bool store) {
+  return publishInternal(client, topic, data, len, qos, retain, true, store);
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void* event_handler_arg) {
+  if (!client || !event_handler) return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  client->handlers.push_back(Handler{event, event_handler, event_handler_arg});
+  return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_unregister_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                           esp_event_handler_t event_handler) {
+  if (!client) return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  for (auto it = client->handlers.begin(); it != client->handlers.end();) {
+    if (it->event == event && it->fn == event_handler) {
+      it = client->handlers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return ESP_OK;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client) {
+  if (!client) return 0;
+  std::lock_guard<std::recursive_mutex> lock(client->lock);
+  return static_cast<int>(client->outboxBytes);
+}
+
+} // extern "C"
+
+void mqttHostSetManualStep(bool enable) {
+  s_manualStep = enable;
+}
+
+void mqttHostSetDefaultReconnectMs(uint32_t ms) {
+  s_defaultReconnectMs = ms;
+}
+
+HostTlsConfig mqttHostLastTlsConfig() {
+  std::lock_guard<std::mutex> lock(s_tlsLock);
+  return s_lastTls;
+}
+
+void mqttHostStep(uint32_t timeoutMs) {
+  AllocExempt exempt;
+  std::vector<esp_mqtt_client*> clients;
+  {
+    std::lock_guard<std::mutex> lock(s_steppedLock);
+    clients = s_stepped;
+  }
+  for (esp_mqtt_client* c : clients) {
+    {
+      // Skip clients a handler stopped or destroyed earlier in this step
+      std::lock_guard<std::mutex> lock(s_steppedLock);
+      if (std::find(s_stepped.begin(), s_stepped.end(), c) == s_stepped.end()) continue;
+    }
+    c->loopThread = std::this_thread::get_id();
+    iterate(c, timeoutMs);
+    c->loopThread = std::thread::id();
+    if (c->destroyPending) {
+      unstep(c);
+      closeTransport(c);
+      delete c;
+    }
+  }
+}
+
+uint32_t mqttHostIdleMs() {
+  std::vector<esp_mqtt_client*> clients;
+  {
+    std::lock_guard<std::mutex> lock(s_steppedLock);
+    clients = s_stepped;
+  }
+  uint32_t idle = UINT32_MAX;
+  for (esp_mqtt_client* c : clients) {
+    std::lock_guard<std::recursive_mutex> lock(c->lock);
+    idle = std::min(idle, idleMs(c));
+  }
+  return idle;
+}
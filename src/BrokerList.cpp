@@ -0,0 +1,89 @@
+#include "BrokerList.h"
+#include "UriUtils.h"
+
+void BrokerList::clear() {
+  _brokers.clear();
+  _current = -1;
+  _probeNext = SIZE_MAX;
+}
+
+bool BrokerList::add(const char* uri, uint8_t weight) {
+  UriView parts;
+  if (!uri || !parseMqttUri(uri, parts)) return false;
+
+  BrokerEntry entry;
+  entry.uri = uri;
+  entry.weight = weight ? weight : 1;
+  _brokers.push_back(entry);
+  return true;
+}
+
+bool BrokerList::isHealthy(size_t index, uint32_t nowMs) const {
+  const BrokerEntry &b = _brokers[index];
+  if (b.consecutiveFailures < _failoverThreshold) return true;
+  // Unhealthy brokers get another chance once the holdoff expired
+  return (uint32_t)(nowMs - b.lastFailureMs) >= _retryHoldoffMs;
+}
+
+int BrokerList::select(uint32_t nowMs) {
+  if (_brokers.empty()) return -1;
+
+  int best = -1;
+  uint32_t bestScore = UINT32_MAX;
+  int firstUnmeasured = -1;
+  for (size_t i = 0; i < _brokers.size(); i++) {
+    if (!isHealthy(i, nowMs)) continue;
+    const BrokerEntry &b = _brokers[i];
+    if (!b.measured()) {
+      if (firstUnmeasured < 0) firstUnmeasured = (int)i;
+      continue;
+    }
+    uint32_t score = b.latencyMs / b.weight;
+    if (score < bestScore) {
+      bestScore = score;
+      best = (int)i;
+    }
+  }
+
+  if (best < 0) best = firstUnmeasured;
+  if (best < 0) {
+    // Everything is unhealthy: rotate to the broker that failed longest ago
+    best = 0;
+    for (size_t i = 1; i < _brokers.size(); i++) {
+      if ((uint32_t)(nowMs - _brokers[i].lastFailureMs) > (uint32_t)(nowMs - _brokers[best].lastFailureMs)) {
+        best = (int)i;
+      }
+    }
+  }
+
+  _current = best;
+  return best;
+}
+
+int BrokerList::nextProbe(uint32_t nowMs) {
+  while (_probeNext < _brokers.size()) {
+    size_t i = _probeNext++;
+    if (_brokers[i].measured() || !isHealthy(i, nowMs)) continue;
+    _current = (int)i;
+    return (int)i;
+  }
+  _probeNext = SIZE_MAX;
+  return -1;
+}
+
+void BrokerList::recordSuccess(size_t index, uint32_t latencyMs) {
+  if (index >= _brokers.size()) return;
+  BrokerEntry &b = _brokers[index];
+  if (latencyMs == 0) latencyMs = 1; // 0 means "not measured"
+  // EWMA with alpha = 1/4 to smooth out single slow handshakes
+  b.latencyMs = b.measured() ? (b.latencyMs * 3 + latencyMs) / 4 : latencyMs;
+  b.consecutiveFailures = 0;
+}
+
+bool BrokerList::recordFailure(size_t index, uint32_t nowMs) {
+  if (index >= _brokers.size()) return false;
+  BrokerEntry &b = _brokers[index];
+  if (b.consecutiveFailures < UINT8_MAX) b.consecutiveFailures++;
+  b.lastFailureMs = nowMs;
+  return b.consecutiveFailures >= _failoverThreshold;
+}
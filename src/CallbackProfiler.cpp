@@ -0,0 +1,84 @@
+#include "CallbackProfiler.h"
+
+#include <string.h>
+
+size_t CallbackProfiler::slotFor(const char *key) {
+  for (size_t i = 0; i < _used; i++) {
+    if (strncmp(_stats[i].key, key, sizeof(_stats[i].key) - 1) == 0) return i;
+  }
+
+  size_t slot = _used;
+  if (_used < kCapacity) {
+    _used++;
+  } else {
+    // Recycle the cheapest entry; heavy handlers stay visible
+    slot = 0;
+    for (size_t i = 1; i < kCapacity; i++) {
+      if (_stats[i].totalUs < _stats[slot].totalUs) slot = i;
+    }
+  }
+
+  CallbackStats &s = _stats[slot];
+  memset(&s, 0, sizeof(s));
+  strncpy(s.key, key, sizeof(s.key) - 1);
+  memset(&_warn[slot], 0, sizeof(_warn[slot]));
+  if (++_nextGeneration == 0) _nextGeneration = 1;
+  _generation[slot] = _nextGeneration;
+  return slot;
+}
+
+size_t CallbackProfiler::slotFor(const char *key, CallbackSlotRef &ref) {
+  if (ref.generation && ref.slot < _used && _generation[ref.slot] == ref.generation) return ref.slot;
+  size_t slot = slotFor(key);
+  ref.slot = static_cast<uint8_t>(slot);
+  ref.generation = _generation[slot];
+  return slot;
+}
+
+bool CallbackProfiler::record(size_t slot, uint32_t elapsedUs) {
+  CallbackStats &s = _stats[slot];
+  s.calls++;
+  s.totalUs += elapsedUs;
+  if (elapsedUs > s.maxUs) s.maxUs = elapsedUs;
+  if (_budgetUs && elapsedUs > _budgetUs) {
+    s.overBudget++;
+    return true;
+  }
+  return false;
+}
+
+bool CallbackProfiler::warnDue(size_t slot, uint32_t nowMs, uint32_t &suppressed) {
+  WarnState &w = _warn[slot];
+  if (w.warned && nowMs - w.atMs < kWarnIntervalMs) return false;
+  uint32_t overBudget = _stats[slot].overBudget;
+  suppressed = w.warned ? overBudget - w.overBudget - 1 : 0;
+  w.warned = true;
+  w.atMs = nowMs;
+  w.overBudget = overBudget;
+  return true;
+}
+
+size_t CallbackProfiler::top(CallbackStats *out, size_t max) const {
+  // Insertion sort into the output, the table is small
+  size_t count = 0;
+  for (size_t i = 0; i < _used; i++) {
+    const CallbackStats &s = _stats[i];
+    size_t pos = count;
+    while (pos > 0 && out[pos - 1].totalUs < s.totalUs) {
+      if (pos < max) out[pos] = out[pos - 1];
+      pos--;
+    }
+    if (pos < max) {
+      out[pos] = s;
+      if (count < max) count++;
+    }
+  }
+  return count;
+}
+
+void CallbackProfiler::clear() {
+  memset(_stats, 0, sizeof(_stats));
+  memset(_warn, 0, sizeof(_warn));
+  memset(_generation, 0, sizeof(_generation));
+  _used = 0;
+}
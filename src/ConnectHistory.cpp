@@ -0,0 +1,112 @@
+#include "ConnectHistory.h"
+
+void ConnectHistory::begin(uint32_t nowUs, uint32_t nowMs, int8_t broker, uint8_t protocol, bool fallback,
+                           bool automatic, uint32_t waitUs) {
+  if (pending()) failed(nowUs);
+
+  ConnectAttempt &a = _ring[_head];
+  a = ConnectAttempt();
+  a.startMs = nowMs;
+  a.broker = broker;
+  a.protocol = protocol;
+  a.fallback = fallback;
+  a.automatic = automatic;
+  a.waitUs = waitUs;
+
+  _head = (_head + 1) % kCapacity;
+  if (_count < kCapacity) _count++;
+  _stage = Stage::Init;
+  _stageStartUs = nowUs;
+}
+
+void ConnectHistory::closeStage(uint32_t nowUs) {
+  uint32_t elapsed = nowUs - _stageStartUs;
+  ConnectAttempt &a = current();
+  switch (_stage) {
+    case Stage::Init:
+      a.initUs += elapsed;
+      break;
+    case Stage::Scheduled:
+      a.scheduleUs += elapsed;
+      break;
+    case Stage::Transport:
+      a.transportUs += elapsed;
+      break;
+    case Stage::Connack:
+      a.connackUs += elapsed;
+      break;
+    case Stage::Idle:
+      break;
+  }
+  _stageStartUs = nowUs;
+}
+
+void ConnectHistory::started(uint32_t nowUs) {
+  if (_stage != Stage::Init) return;
+  closeStage(nowUs);
+  _stage = Stage::Scheduled;
+}
+
+void ConnectHistory::beforeConnect(uint32_t nowUs) {
+  if (_stage != Stage::Init && _stage != Stage::Scheduled) return;
+  closeStage(nowUs);
+  _stage = Stage::Transport;
+}
+
+void ConnectHistory::transportUp(uint32_t nowUs) {
+  if (_stage != Stage::Transport) return;
+  closeStage(nowUs);
+  _stage = Stage::Connack;
+}
+
+void ConnectHistory::error(ConnectPhase phase, int code) {
+  if (!pending()) return;
+  ConnectAttempt &a = current();
+  if (a.failedPhase != ConnectPhase::None) return;
+  a.failedPhase = phase;
+  a.errorCode = code;
+}
+
+void ConnectHistory::connected(uint32_t nowUs) {
+  if (!pending()) return;
+  closeStage(nowUs);
+  ConnectAttempt &a = current();
+  a.outcome = ConnectOutcome::Connected;
+  a.failedPhase = ConnectPhase::None;
+  a.errorCode = 0;
+  _stage = Stage::Idle;
+}
+
+ConnectPhase ConnectHistory::failed(uint32_t nowUs) {
+  if (!pending()) return ConnectPhase::None;
+  Stage stage = _stage;
+  closeStage(nowUs);
+  ConnectAttempt &a = current();
+  a.outcome = ConnectOutcome::Failed;
+  if (a.failedPhase == ConnectPhase::None) {
+    // No error event told us more: blame the stage we were in
+    switch (stage) {
+      case Stage::Transport:
+        a.failedPhase = ConnectPhase::Tcp;
+        break;
+      case Stage::Connack:
+        a.failedPhase = ConnectPhase::Connack; // closed before CONNACK
+        break;
+      default:
+        a.failedPhase = ConnectPhase::Init;
+        break;
+    }
+  }
+  _stage = Stage::Idle;
+  return a.failedPhase;
+}
+
+const ConnectAttempt &ConnectHistory::at(size_t index) const {
+  return _ring[(_head + kCapacity - _count + index) % kCapacity];
+}
+
+void ConnectHistory::clear() {
+  _head = 0;
+  _count = 0;
+  _stage = Stage::Idle;
+}
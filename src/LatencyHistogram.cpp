@@ -0,0 +1,131 @@
+#include "LatencyHistogram.h"
+
+#include <stdio.h>
+
+static inline uint8_t highestBit(uint32_t value) {
+  return 31 - __builtin_clz(value);
+}
+
+size_t LatencyHistogram::bucketIndex(uint32_t value) {
+  if (value < kSubBuckets) return value;
+  uint8_t exponent = highestBit(value);
+  if (exponent >= kMaxValueBits) return kBuckets - 1;
+  size_t sub = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+uint32_t LatencyHistogram::bucketLow(size_t index) {
+  if (index < kSubBuckets) return index;
+  size_t exponent = index / kSubBuckets + kSubBucketBits - 1;
+  size_t sub = index % kSubBuckets;
+  return (uint32_t)((kSubBuckets + sub) << (exponent - kSubBucketBits));
+}
+
+uint32_t LatencyHistogram::bucketHigh(size_t index) {
+  if (index + 1 >= kBuckets) return UINT32_MAX;
+  return bucketLow(index + 1) - 1;
+}
+
+LatencyHistogram &LatencyHistogram::operator=(const LatencyHistogram &other) {
+  if (this != &other) {
+    reset();
+    merge(other);
+  }
+  return *this;
+}
+
+void LatencyHistogram::record(uint32_t value) {
+  _counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  addSum(value);
+
+  uint32_t current = _min.load(std::memory_order_relaxed);
+  while (value < current && !_min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+  current = _max.load(std::memory_order_relaxed);
+  while (value > current && !_max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < kBuckets; i++) {
+    uint32_t n = other._counts[i].load(std::memory_order_relaxed);
+    if (n) _counts[i].fetch_add(n, std::memory_order_relaxed);
+  }
+  _count.fetch_add(other._count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  addSum(other.sum());
+
+  uint32_t otherMin = other._min.load(std::memory_order_relaxed);
+  uint32_t current = _min.load(std::memory_order_relaxed);
+  while (otherMin < current && !_min.compare_exchange_weak(current, otherMin, std::memory_order_relaxed)) {
+  }
+  uint32_t otherMax = other._max.load(std::memory_order_relaxed);
+  current = _max.load(std::memory_order_relaxed);
+  while (otherMax > current && !_max.compare_exchange_weak(current, otherMax, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::reset() {
+  for (size_t i = 0; i < kBuckets; i++) {
+    _counts[i].store(0, std::memory_order_relaxed);
+  }
+  _count.store(0, std::memory_order_relaxed);
+  _min.store(UINT32_MAX, std::memory_order_relaxed);
+  _max.store(0, std::memory_order_relaxed);
+  _sum.store(0, std::memory_order_relaxed);
+  _sumWraps.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::addSum(uint64_t value) {
+  uint32_t low = (uint32_t)value;
+  uint32_t before = _sum.fetch_add(low, std::memory_order_relaxed);
+  uint32_t wraps = (uint32_t)(value >> 32) + ((uint32_t)(before + low) < before ? 1 : 0);
+  if (wraps) _sumWraps.fetch_add(wraps, std::memory_order_relaxed);
+}
+
+// A wrap count that changes while the low word is read means a wrap landed in between,
+// so the read is repeated. A reader between a writer's wrap of the low word and its count
+// of that wrap still sees the sum 2^32 short; mean() is a statistic and tolerates that.
+uint64_t LatencyHistogram::sum() const {
+  uint32_t wraps = _sumWraps.load(std::memory_order_relaxed);
+  for (;;) {
+    uint32_t low = _sum.load(std::memory_order_relaxed);
+    uint32_t again = _sumWraps.load(std::memory_order_relaxed);
+    if (again == wraps) return ((uint64_t)wraps << 32) | low;
+    wraps = again;
+  }
+}
+
+uint32_t LatencyHistogram::min() const {
+  return count() ? _min.load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t LatencyHistogram::mean() const {
+  uint32_t n = count();
+  return n ? (uint32_t)(sum() / n) : 0;
+}
+
+uint32_t LatencyHistogram::percentile(double percentile) const {
+  uint32_t n = count();
+  if (n == 0) return 0;
+  if (percentile > 100.0) percentile = 100.0;
+
+  uint64_t target = (uint64_t)(percentile / 100.0 * n + 0.999999);
+  if (target == 0) target = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    seen += _counts[i].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      uint32_t high = bucketHigh(i);
+      uint32_t maxValue = max();
+      return high < maxValue ? high : maxValue;
+    }
+  }
+  return max();
+}
+
+int LatencyHistogram::formatJson(char *buf, size_t len) const {
+  return snprintf(buf, len, "{\"n\":%u,\"min\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}",
+                  (unsigned)count(), (unsigned)min(), (unsigned)percentile(50), (unsigned)percentile(90),
+                  (unsigned)percentile(99), (unsigned)percentile(99.9), (unsigned)max());
+}
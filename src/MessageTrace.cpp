@@ -0,0 +1,130 @@
+#include "MessageTrace.h"
+
+#ifndef ARDUINO
+#include <algorithm>
+#include <vector>
+#endif
+
+static_assert((MQTT_TRACE_CAPACITY & (MQTT_TRACE_CAPACITY - 1)) == 0, "MQTT_TRACE_CAPACITY must be a power of two");
+
+const char *traceStageName(TraceStage stage) {
+  switch (stage) {
+    case TraceStage::Enqueue:
+      return "enqueue";
+    case TraceStage::WireWrite:
+      return "wire-write";
+    case TraceStage::Ack:
+      return "ack";
+    case TraceStage::Receive:
+      return "receive";
+    case TraceStage::Reassembled:
+      return "reassembled";
+    case TraceStage::Dispatch:
+      return "dispatch";
+    case TraceStage::HandlerDone:
+      return "handler-done";
+    default:
+      return "?";
+  }
+}
+
+MessageTrace::MessageTrace() : _head(0), _nextId(0), _sampling(1) {
+  clear();
+}
+
+MessageTrace &MessageTrace::operator=(const MessageTrace &other) {
+  if (this == &other) return *this;
+  for (size_t i = 0; i < kCapacity; i++) {
+    const Slot &from = other._ring[i];
+    Slot &to = _ring[i];
+    to.seq.store(from.seq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    to.timestampUs.store(from.timestampUs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    to.traceId.store(from.traceId.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    to.stage.store(from.stage.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  _nextId.store(other._nextId.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _sampling.store(other._sampling.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _head.store(other._head.load(std::memory_order_relaxed), std::memory_order_release);
+  return *this;
+}
+
+uint32_t MessageTrace::begin() {
+  uint16_t oneIn = _sampling.load(std::memory_order_relaxed);
+  if (!oneIn) return 0;
+  uint32_t n = _nextId.fetch_add(1, std::memory_order_relaxed);
+  if (n % oneIn) return 0;
+  return n + 1;
+}
+
+// Same multi-producer scheme as the deferred log ring (MqttLog.cpp): claim a slot with
+// fetch_add, invalidate it, write the fields and publish it by storing its sequence number
+// last. Readers copy the fields between two sequence checks, a seqlock.
+void MessageTrace::push(uint32_t traceId, TraceStage stage, uint32_t timestampUs) {
+  uint32_t index = _head.fetch_add(1, std::memory_order_relaxed);
+  Slot &s = _ring[index & (kCapacity - 1)];
+  s.seq.store(0, std::memory_order_relaxed); // mark as being written
+  std::atomic_thread_fence(std::memory_order_release);
+  s.timestampUs.store(timestampUs, std::memory_order_relaxed);
+  s.traceId.store(traceId, std::memory_order_relaxed);
+  s.stage.store(static_cast<uint8_t>(stage), std::memory_order_relaxed);
+  s.seq.store(index + 1, std::memory_order_release);
+}
+
+size_t MessageTrace::snapshot(TraceEvent *out, size_t maxEvents) const {
+  uint32_t head = _head.load(std::memory_order_acquire);
+  uint32_t available = head < kCapacity ? head : kCapacity;
+  if (available > maxEvents) available = maxEvents;
+
+  size_t count = 0;
+  for (uint32_t index = head - available; index != head; index++) {
+    const Slot &s = _ring[index & (kCapacity - 1)];
+    if (s.seq.load(std::memory_order_acquire) != index + 1) continue; // being written or reused
+    TraceEvent e;
+    e.timestampUs = s.timestampUs.load(std::memory_order_relaxed);
+    e.traceId = s.traceId.load(std::memory_order_relaxed);
+    e.stage = static_cast<TraceStage>(s.stage.load(std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) != index + 1) continue; // overwritten while copying
+    out[count++] = e;
+  }
+  return count;
+}
+
+void MessageTrace::clear() {
+  for (size_t i = 0; i < kCapacity; i++) {
+    _ring[i].seq.store(0, std::memory_order_relaxed);
+  }
+  _head.store(0, std::memory_order_release);
+}
+
+#ifndef ARDUINO
+bool MessageTrace::writeChromeTrace(FILE *out) const {
+  std::vector<TraceEvent> events(kCapacity);
+  events.resize(snapshot(events.data(), events.size()));
+  // Group per message, stages in pipeline order
+  std::stable_sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b) {
+    if (a.traceId != b.traceId) return a.traceId < b.traceId;
+    return a.stage < b.stage;
+  });
+
+  bool first = true;
+  fputs("{\"traceEvents\":[", out);
+  for (size_t i = 0; i + 1 < events.size(); i++) {
+    const TraceEvent &from = events[i];
+    const TraceEvent &to = events[i + 1];
+    if (from.traceId != to.traceId || traceStageInbound(from.stage) != traceStageInbound(to.stage)) continue;
+
+    const char *cat = traceStageInbound(from.stage) ? "inbound" : "outbound";
+    int tid = traceStageInbound(from.stage) ? 2 : 1;
+    fprintf(out,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":%u,\"pid\":1,\"tid\":%d,\"ts\":%u},"
+            "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":%u,\"pid\":1,\"tid\":%d,\"ts\":%u}",
+            first ? "" : ",", traceStageName(from.stage), cat, (unsigned)from.traceId, tid,
+            (unsigned)from.timestampUs, traceStageName(from.stage), cat, (unsigned)from.traceId, tid,
+            (unsigned)to.timestampUs);
+    first = false;
+  }
+  fputs("],\"displayTimeUnit\":\"ms\"}\n", out);
+  return !ferror(out);
+}
+#endif
@@ -1,8 +1,15 @@
 #include "MqttClient.h"
+#include "MqttLog.h"
 #include <Arduino.h>
 #include <WiFi.h>
 #include <esp_log.h>
 #include <cstring>
+#include <new>
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#endif
 
 #ifdef ESP_IDF_VERSION_MAJOR
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 0, 0)
@@ -14,112 +21,263 @@
 #include "esp_mqtt_client.h"
 #endif
 
-// Define MQTT v5 constant if not available
-#ifndef MQTT_PROTOCOL_V_5
+// esp-mqtt has the MQTT v5 enumerator from ESP-IDF 4.4; older headers get a stand-in value
+#ifdef ESP_IDF_VERSION_MAJOR
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#define MQTT_HAS_PROTOCOL_5 1
+#endif
+#endif
+#if !defined(MQTT_HAS_PROTOCOL_5) && !defined(MQTT_PROTOCOL_V_5)
 #define MQTT_PROTOCOL_V_5 5
 #endif
 
+// Multi-topic SUBSCRIBE is available from esp-mqtt in ESP-IDF 5.1, QoS and retain flags
+// in DATA events and a client-supplied transport from 5.0, outbox size from 4.4, outbox
+// expiry events from 4.3
+#ifdef ESP_IDF_VERSION_MAJOR
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define MQTT_HAS_SUBSCRIBE_MULTIPLE 1
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#define MQTT_HAS_EVENT_QOS 1
+#define MQTT_HAS_CUSTOM_TRANSPORT 1
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#define MQTT_HAS_OUTBOX_SIZE 1
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+#define MQTT_HAS_ENQUEUE 1
+#define MQTT_HAS_EVENT_DELETED 1
+#endif
+#endif
+
+// esp-tls error codes tell which transport phase a connection attempt failed in
+#if defined(ESP_PLATFORM) && defined(__has_include)
+#if __has_include(<esp_tls_errors.h>)
+#include <esp_tls_errors.h>
+#define MQTT_HAS_ESP_TLS_ERRORS 1
+#endif
+#endif
+
+#ifdef MQTT_HAS_CUSTOM_TRANSPORT
+#include "esp_transport.h"
+#include "esp_transport_ssl.h"
+#include "esp_transport_tcp.h"
+#include "esp_transport_ws.h"
+#ifdef MQTT_HAS_ESP_TLS_ERRORS
+#include "esp_tls.h"
+#endif
+#endif
+
+#ifdef MQTT_TRACE
+#define MQTT_TRACE_BEGIN() _trace.begin()
+#define MQTT_TRACE_RECORD(id, stage, ts) _trace.record((id), TraceStage::stage, (ts))
+#else
+#define MQTT_TRACE_BEGIN() 0
+#define MQTT_TRACE_RECORD(id, stage, ts) ((void)(id))
+#endif
+
+static_assert(static_cast<size_t>(MqttLatency::Count) == MqttStatsReport::kLatencyKinds,
+              "stats report must cover every latency histogram");
+
 static const char* TAG = "MqttClient";
 
+// MQTT v5 CONNACK reason codes: 0x80=unspecified, 0x81=malformed, 0x82=protocol, etc.
+static const char* connectReasonString(int code) {
+  switch (code) {
+    case 0x80:
+      return "Unspecified error";
+    case 0x81:
+      return "Malformed packet";
+    case 0x82:
+      return "Protocol error";
+    case 0x83:
+      return "Implementation specific error";
+    case 0x84:
+      return "Unsupported protocol version";
+    case 0x85:
+      return "Client identifier not valid";
+    case 0x86:
+      return "Bad username or password";
+    case 0x87:
+      return "Not authorized";
+    case 0x88:
+      return "Server unavailable";
+    case 0x89:
+      return "Server busy";
+    case 0x8A:
+      return "Banned";
+    default:
+      return "Unknown v5 code";
+  }
+}
+
+static ConnectPhase connectFailurePhase(int errorType, int espTlsError) {
+  if (errorType == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+    return ConnectPhase::Connack;
+  }
+#ifdef MQTT_HAS_ESP_TLS_ERRORS
+  switch (espTlsError) {
+    case ESP_OK:
+      return ConnectPhase::Tcp;
+    case ESP_ERR_ESP_TLS_CANNOT_RESOLVE_HOSTNAME:
+      return ConnectPhase::Dns;
+    case ESP_ERR_ESP_TLS_CANNOT_CREATE_SOCKET:
+    case ESP_ERR_ESP_TLS_UNSUPPORTED_PROTOCOL_FAMILY:
+    case ESP_ERR_ESP_TLS_FAILED_CONNECT_TO_HOST:
+    case ESP_ERR_ESP_TLS_SOCKET_SETOPT_FAILED:
+    case ESP_ERR_ESP_TLS_CONNECTION_TIMEOUT:
+      return ConnectPhase::Tcp;
+    default:
+      return ConnectPhase::Tls;
+  }
+#else
+  (void)espTlsError;
+  return ConnectPhase::Tcp;
+#endif
+}
+
+#ifdef MQTT_HAS_CUSTOM_TRANSPORT
+// esp-mqtt reports nothing between BEFORE_CONNECT and CONNACK, so the client hands it a
+// transport of its own. On each attempt it connects the TCP, TLS or WebSocket transport
+// the current broker needs and records when that is up, then passes the session through.
+// esp-mqtt destroys it with the client handle.
+struct TimedTransport {
+  MqttClient* owner = nullptr;
+  esp_transport_handle_t base = nullptr; // TCP or SSL
+  esp_transport_handle_t ws = nullptr;   // WebSocket over base
+  bool secure = false;
+  bool webSocket = false;
+  bool skipCommonName = false;
+
+  esp_transport_handle_t active() const { return ws ? ws : base; }
+  void release() {
+    // A WebSocket transport leaves its parent to the caller
+    if (ws) esp_transport_destroy(ws);
+    if (base) esp_transport_destroy(base);
+    ws = base = nullptr;
+  }
+};
+
+static TimedTransport* timedTransport(esp_transport_handle_t t) {
+  return static_cast<TimedTransport*>(esp_transport_get_context_data(t));
+}
+
+static int timedConnect(esp_transport_handle_t t, const char* host, int port, int timeoutMs) {
+  TimedTransport* transport = timedTransport(t);
+  return transport->owner->connectTransportInternal(transport, host, port, timeoutMs);
+}
+
+static int timedRead(esp_transport_handle_t t, char* buffer, int len, int timeoutMs) {
+  esp_transport_handle_t active = timedTransport(t)->active();
+  return active ? esp_transport_read(active, buffer, len, timeoutMs) : -1;
+}
+
+static int timedWrite(esp_transport_handle_t t, const char* buffer, int len, int timeoutMs) {
+  esp_transport_handle_t active = timedTransport(t)->active();
+  return active ? esp_transport_write(active, buffer, len, timeoutMs) : -1;
+}
+
+static int timedPollRead(esp_transport_handle_t t, int timeoutMs) {
+  esp_transport_handle_t active = timedTransport(t)->active();
+  return active ? esp_transport_poll_read(active, timeoutMs) : -1;
+}
+
+static int timedPollWrite(esp_transport_handle_t t, int timeoutMs) {
+  esp_transport_handle_t active = timedTransport(t)->active();
+  return active ? esp_transport_poll_write(active, timeoutMs) : -1;
+}
+
+static int timedClose(esp_transport_handle_t t) {
+  esp_transport_handle_t active = timedTransport(t)->active();
+  return active ? esp_transport_close(active) : 0;
+}
+
+static int timedDestroy(esp_transport_handle_t t) {
+  TimedTransport* transport = timedTransport(t);
+  if (transport->owner) transport->owner->onTransportDestroyedInternal(transport);
+  transport->release();
+  delete transport;
+  return 0;
+}
+
+static esp_transport_handle_t createTimedTransport(MqttClient* owner, TimedTransport*& out) {
+  TimedTransport* transport = new (std::nothrow) TimedTransport();
+  if (!transport) return nullptr;
+  esp_transport_handle_t t = esp_transport_init();
+  if (!t) {
+    delete transport;
+    return nullptr;
+  }
+  transport->owner = owner;
+  esp_transport_set_func(t, timedConnect, timedRead, timedWrite, timedClose, timedPollRead, timedPollWrite,
+                         timedDestroy);
+  esp_transport_set_context_data(t, transport);
+  out = transport;
+  return t;
+}
+#endif
+
 // Global event handler function
 void mqtt_event_handler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data) {
   MqttClient* client = static_cast<MqttClient*>(handler_args);
   esp_mqtt_event_handle_t event = static_cast<esp_mqtt_event_handle_t>(event_data);
 
   switch (static_cast<esp_mqtt_event_id_t>(event_id)) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+      client->onBeforeConnectInternal();
+      break;
     case MQTT_EVENT_CONNECTED:
-      Serial.printf("[MQTT] Connected to broker (session_present=%d)\n", event->session_present);
-      client->onConnectedInternal();
+      MQTT_LOGI("Connected to broker (session_present=%d)", event->session_present);
+      client->onConnectedInternal(event->session_present);
       break;
     case MQTT_EVENT_DISCONNECTED:
-      Serial.printf("[MQTT] Disconnected from broker (reason: %s)\n",
-                    event->error_handle ? "error" : "clean disconnect");
       if (event->error_handle) {
-        Serial.printf("[MQTT] Disconnect error type=%d, errno=%d\n",
-                      event->error_handle->error_type,
-                      event->error_handle->esp_transport_sock_errno);
+        MQTT_LOGI("Disconnected from broker (error type=%d, errno=%d)", event->error_handle->error_type,
+                  event->error_handle->esp_transport_sock_errno);
+      } else {
+        MQTT_LOGI("Disconnected from broker (clean disconnect)");
       }
       client->onDisconnectedInternal();
       break;
     case MQTT_EVENT_SUBSCRIBED:
-      Serial.printf("[MQTT] Subscribed, msg_id=%d\n", event->msg_id);
+      MQTT_LOGD_HOT("Subscribed, msg_id=%d", event->msg_id);
       break;
     case MQTT_EVENT_UNSUBSCRIBED:
-      Serial.printf("[MQTT] Unsubscribed, msg_id=%d\n", event->msg_id);
+      MQTT_LOGD_HOT("Unsubscribed, msg_id=%d", event->msg_id);
       break;
     case MQTT_EVENT_PUBLISHED:
-      Serial.printf("[MQTT] Published, msg_id=%d\n", event->msg_id);
+      MQTT_LOGD_HOT("Published, msg_id=%d", event->msg_id);
+      client->onPublishedInternal(event->msg_id);
       break;
-    case MQTT_EVENT_DATA: {
-      char topic[256] = {0};
-      char data[512] = {0};
-
-      if (event->topic_len < sizeof(topic)) {
-        memcpy(topic, event->topic, event->topic_len);
-      }
-      if (event->data_len < sizeof(data)) {
-        memcpy(data, event->data, event->data_len);
-      }
-
-      Serial.printf("[MQTT] Message on %s: %s\n", topic, data);
-      client->onDataInternal(topic, data, event->data_len);
-    } break;
-    case MQTT_EVENT_ERROR:
-      Serial.println("[MQTT][ERROR] Error event details:");
-      if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-        Serial.printf("  TCP transport error=%d, sock_errno=%d\n",
-                      event->error_handle->esp_tls_last_esp_err,
-                      event->error_handle->esp_transport_sock_errno);
-      } else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
-        Serial.printf("  Connection refused, return_code=%d\n", event->error_handle->connect_return_code);
-        // MQTT v5 reason codes: 0x80=unspecified, 0x81=malformed, 0x82=protocol, etc.
-        if (event->error_handle->connect_return_code >= 0x80) {
-          Serial.println("  ^^ MQTT v5 reason code - check broker v5 support");
-          switch (event->error_handle->connect_return_code) {
-            case 0x80:
-              Serial.println("  Reason: Unspecified error");
-              break;
-            case 0x81:
-              Serial.println("  Reason: Malformed packet");
-              break;
-            case 0x82:
-              Serial.println("  Reason: Protocol error");
-              break;
-            case 0x83:
-              Serial.println("  Reason: Implementation specific error");
-              break;
-            case 0x84:
-              Serial.println("  Reason: Unsupported protocol version");
-              break;
-            case 0x85:
-              Serial.println("  Reason: Client identifier not valid");
-              break;
-            case 0x86:
-              Serial.println("  Reason: Bad username or password");
-              break;
-            case 0x87:
-              Serial.println("  Reason: Not authorized");
-              break;
-            case 0x88:
-              Serial.println("  Reason: Server unavailable");
-              break;
-            case 0x89:
-              Serial.println("  Reason: Server busy");
-              break;
-            case 0x8A:
-              Serial.println("  Reason: Banned");
-              break;
-            default:
-              Serial.printf("  Reason: Unknown v5 code 0x%02X\n", event->error_handle->connect_return_code);
-              break;
-          }
+#ifdef MQTT_HAS_EVENT_DELETED
+    case MQTT_EVENT_DELETED:
+      MQTT_LOGW("Outbox expired msg_id=%d", event->msg_id);
+      client->onDeletedInternal(event->msg_id);
+      break;
+#endif
+    case MQTT_EVENT_DATA:
+      client->onDataFragmentInternal(event, micros());
+      break;
+    case MQTT_EVENT_ERROR: {
+      const esp_mqtt_error_codes_t* err = event->error_handle;
+      client->onErrorInternal(err->error_type, err->esp_tls_last_esp_err, err->connect_return_code);
+      if (err->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+        MQTT_LOGE("TCP transport error=%d, sock_errno=%d", err->esp_tls_last_esp_err, err->esp_transport_sock_errno);
+      } else if (err->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+        if (err->connect_return_code >= 0x80) {
+          // v5 reason code - check broker v5 support
+          MQTT_LOGE("Connection refused, reason 0x%02X: %s", err->connect_return_code,
+                    connectReasonString(err->connect_return_code));
+        } else {
+          MQTT_LOGE("Connection refused, return_code=%d", err->connect_return_code);
         }
       } else {
-        Serial.printf("  Unknown error type=%d\n", event->error_handle->error_type);
+        MQTT_LOGE("Unknown error type=%d", err->error_type);
       }
-      break;
+    } break;
     default:
-      Serial.printf("[MQTT] Unknown event id:%d\n", event_id);
+      MQTT_LOGD("Unknown event id:%d", (int)event_id);
       break;
   }
 }
@@ -134,17 +292,64 @@ MqttClient::MqttClient()
   _useWebSocket(false),
   _secure(false),
   _uri(nullptr),
+      _hostCapacity(0),
+      _pathCapacity(0),
+      _uriCapacity(0),
       _username(nullptr),
       _password(nullptr),
       _clientId(nullptr),
       _keepalive(30),
       _connected(false),
-      _caCert(nullptr),
-      _clientCert(nullptr),
-      _clientKey(nullptr),
+      _taskPriority(0),
+      _taskStackSize(0),
+      _bufferSize(0),
       _skipCertVerify(false),
       _enableFallback(false),
-      _usingFallback(false) {
+      _usingFallback(false),
+      _protocol(static_cast<esp_mqtt_protocol_ver_t>(MQTT_PROTOCOL_V_5)),
+      _attemptStartMs(0),
+      _brokerProbing(false),
+      _brokerProbeLeaving(false),
+      _subscribeDeferred(false),
+      _lastErrorType(MQTT_ERROR_TYPE_NONE),
+      _connectStartUs(0),
+      _lastDisconnectUs(0),
+      _timedTransport(nullptr),
+      _statsIntervalMs(0),
+      _statsTopic(nullptr),
+      _statsLastMs(0),
+      _statsSampleMs(0),
+      _outboxPeak(-1),
+      _statsPrev(),
+      _topicAccounting(false),
+      _rxPayload(nullptr),
+      _rxCapacity(0),
+      _maxMessageSize(kDefaultMaxMessageSize),
+      _rxMode(RxMode::Idle),
+      _rxNext(0),
+      _rxTotal(0),
+      _rxSlot(0),
+      _rxReceivedUs(0),
+      _capture(nullptr),
+      _connectHeapBefore(0),
+      _connectHeapMinBefore(0),
+      _stackSampleCount(0),
+      _appStackSampleMs(0),
+      _probeIntervalMs(0),
+      _probeMaxMissed(3),
+      _probeMissed(0),
+      _probeTopic(nullptr),
+      _probeDefaultTopic(false),
+      _probeLastMs(0),
+      _probeSeq(0),
+      _probeSentUs(0),
+      _probeAwaitSeq(0),
+      _probeTimedOut(false) {
+  for (size_t i = 0; i < kAckSlots; i++) {
+    _ackSlots[i].msgId.store(0, std::memory_order_relaxed);
+    _ackSlots[i].startUs.store(0, std::memory_order_relaxed);
+    _ackSlots[i].traceId.store(0, std::memory_order_relaxed);
+  }
 }
 
 MqttClient* MqttClient::getInstance() {
@@ -154,10 +359,27 @@ MqttClient* MqttClient::getInstance() {
   return _instance;
 }
 
+MqttClient::MqttClient(MqttClient&& other) noexcept : MqttClient() {
+  moveFrom(other);
+}
+
+MqttClient& MqttClient::operator=(MqttClient&& other) noexcept {
+  if (this != &other) {
+    release();
+    moveFrom(other);
+  }
+  return *this;
+}
+
 MqttClient::~MqttClient() {
+  release();
+}
+
+void MqttClient::release() {
   if (_client) {
     esp_mqtt_client_stop(static_cast<esp_mqtt_client_handle_t>(_client));
     esp_mqtt_client_destroy(static_cast<esp_mqtt_client_handle_t>(_client));
+    _client = nullptr;
   }
   free(_host);
   free(_path);
@@ -165,22 +387,200 @@ MqttClient::~MqttClient() {
   free(_username);
   free(_password);
   free(_clientId);
-  free(_caCert);
-  free(_clientCert);
-  free(_clientKey);
+  free(_statsTopic);
+  free(_probeTopic);
+  free(_rxPayload);
+  _host = _path = _uri = _username = _password = _clientId = _statsTopic = _probeTopic = _rxPayload = nullptr;
+  _hostCapacity = _pathCapacity = _uriCapacity = _rxCapacity = 0;
+  _rxMode = RxMode::Idle;
+  releaseCert(_caCert);
+  releaseCert(_clientCert);
+  releaseCert(_clientKey);
+  _connected = false;
+}
+
+// Takes over all state of another instance, diagnostics included, and leaves the source
+// inert: no connection, no periodic work in loop(), empty diagnostics. Expects this
+// instance to be released.
+// The esp-mqtt handler argument is rebound so events reach the new owner; moving
+// a client while its event task is delivering callbacks is not supported.
+void MqttClient::moveFrom(MqttClient& other) {
+  _client = other._client;
+  _host = other._host;
+  _port = other._port;
+  _path = other._path;
+  _useWebSocket = other._useWebSocket;
+  _secure = other._secure;
+  _uri = other._uri;
+  _hostCapacity = other._hostCapacity;
+  _pathCapacity = other._pathCapacity;
+  _uriCapacity = other._uriCapacity;
+  _username = other._username;
+  _password = other._password;
+  _clientId = other._clientId;
+  _keepalive = other._keepalive;
+  _connected = other._connected.load();
+  _taskPriority = other._taskPriority;
+  _taskStackSize = other._taskStackSize;
+  _bufferSize = other._bufferSize;
+  _caCert = other._caCert;
+  _clientCert = other._clientCert;
+  _clientKey = other._clientKey;
+  _skipCertVerify = other._skipCertVerify;
+  _enableFallback = other._enableFallback;
+  _usingFallback = other._usingFallback;
+  _protocol = other._protocol;
+  _brokers = std::move(other._brokers);
+  _attemptStartMs = other._attemptStartMs;
+  _brokerProbing.store(other._brokerProbing.load());
+  _brokerProbeLeaving.store(other._brokerProbeLeaving.load());
+  _connectHistory = other._connectHistory;
+  _lastDisconnectUs = other._lastDisconnectUs;
+  _timedTransport = other._timedTransport;
+#ifdef MQTT_HAS_CUSTOM_TRANSPORT
+  if (_timedTransport) _timedTransport->owner = this;
+#endif
+  _subscriptions = std::move(other._subscriptions);
+  _aggregation = other._aggregation;
+  _wireFilters = std::move(other._wireFilters);
+  _wirePending = std::move(other._wirePending);
+  _subscribeDeferred.store(other._subscribeDeferred.load());
+  _lastErrorType = other._lastErrorType;
+  _messageCallback = std::move(other._messageCallback);
+  _chunkCallback = std::move(other._chunkCallback);
+  _connectCallback = std::move(other._connectCallback);
+  _disconnectCallback = std::move(other._disconnectCallback);
+
+  // Diagnostics
+  _profiler = other._profiler;
+  _unmatchedSlot = other._unmatchedSlot;
+  _metrics = other._metrics;
+  for (size_t i = 0; i < static_cast<size_t>(MqttLatency::Count); i++) {
+    _latency[i] = other._latency[i];
+  }
+  _connectStartUs = other._connectStartUs;
+  for (size_t i = 0; i < kAckSlots; i++) {
+    _ackSlots[i].msgId.store(other._ackSlots[i].msgId.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _ackSlots[i].startUs.store(other._ackSlots[i].startUs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _ackSlots[i].traceId.store(other._ackSlots[i].traceId.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+#ifdef MQTT_TRACE
+  _trace = other._trace;
+#endif
+  _statsIntervalMs = other._statsIntervalMs;
+  _statsTopic = other._statsTopic;
+  _statsLastMs = other._statsLastMs;
+  _statsSampleMs = other._statsSampleMs;
+  _outboxPeak = other._outboxPeak;
+  _statsPrev = other._statsPrev;
+  _topicAccounting.store(other._topicAccounting.load());
+  _topicSketches[0] = std::move(other._topicSketches[0]);
+  _topicSketches[1] = std::move(other._topicSketches[1]);
+  _capture.store(other._capture.exchange(nullptr));
+  _connectHeapBefore = other._connectHeapBefore;
+  _connectHeapMinBefore = other._connectHeapMinBefore;
+  _stackSampleCount = other._stackSampleCount;
+  _appStackSampleMs = other._appStackSampleMs;
+
+  // Inbound reassembly, including a message half received
+  memcpy(_rxTopic, other._rxTopic, sizeof(_rxTopic));
+  _rxPayload = other._rxPayload;
+  _rxCapacity = other._rxCapacity;
+  _maxMessageSize = other._maxMessageSize;
+  _rxMode = other._rxMode;
+  _rxNext = other._rxNext;
+  _rxTotal = other._rxTotal;
+  _rxSlot = other._rxSlot;
+  _rxReceivedUs = other._rxReceivedUs;
+
+  _probeIntervalMs = other._probeIntervalMs;
+  _probeMaxMissed = other._probeMaxMissed;
+  _probeMissed = other._probeMissed;
+  _probeTopic = other._probeTopic;
+  _probeDefaultTopic = other._probeDefaultTopic;
+  _probeLastMs = other._probeLastMs;
+  _probeSeq = other._probeSeq;
+  _probeSentUs = other._probeSentUs;
+  _probeAwaitSeq.store(other._probeAwaitSeq.load());
+  _probeTimedOut.store(other._probeTimedOut.load());
+
+  // Ownership moved: leave the source empty so its destructor is a no-op and loop() does nothing
+  other._client = nullptr;
+  other._host = other._path = other._uri = nullptr;
+  other._hostCapacity = other._pathCapacity = other._uriCapacity = 0;
+  other._username = other._password = other._clientId = other._statsTopic = other._probeTopic = nullptr;
+  other._caCert = CertBlob();
+  other._clientCert = CertBlob();
+  other._clientKey = CertBlob();
+  other._connected = false;
+  other._timedTransport = nullptr;
+  other._brokers.clear();
+  other._brokerProbing = false;
+  other._brokerProbeLeaving = false;
+  other._connectHistory.clear();
+  other._subscriptions.clear();
+  other._wireFilters.clear();
+  other._wirePending.clear();
+  other._subscribeDeferred = false;
+  other._messageCallback = nullptr;
+  other._chunkCallback = nullptr;
+  other._connectCallback = nullptr;
+  other._disconnectCallback = nullptr;
+  other._profiler.clear();
+  other._unmatchedSlot = CallbackSlotRef();
+  other._metrics = MqttMetrics();
+  for (size_t i = 0; i < static_cast<size_t>(MqttLatency::Count); i++) {
+    other._latency[i].reset();
+  }
+  other._connectStartUs = 0;
+  for (size_t i = 0; i < kAckSlots; i++) {
+    other._ackSlots[i].msgId.store(0, std::memory_order_relaxed);
+  }
+#ifdef MQTT_TRACE
+  other._trace.clear();
+#endif
+  other._statsIntervalMs = 0;
+  other._topicAccounting = false;
+  other._stackSampleCount = 0;
+  other._rxPayload = nullptr;
+  other._rxCapacity = 0;
+  other._rxMode = RxMode::Idle;
+  other._rxNext = other._rxTotal = 0;
+  other._probeIntervalMs = 0;
+  other._probeDefaultTopic = false;
+  other._probeAwaitSeq = 0;
+  other._probeTimedOut = false;
+
+  if (_client) {
+    esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+    esp_mqtt_client_unregister_event(handle, static_cast<esp_mqtt_event_id_t>(ESP_EVENT_ANY_ID), mqtt_event_handler);
+    esp_mqtt_client_register_event(handle, static_cast<esp_mqtt_event_id_t>(ESP_EVENT_ANY_ID), mqtt_event_handler, this);
+  }
 }
 
+void MqttClient::assignString(char*& dst, size_t& capacity, const char* src, size_t len) {
+  if (len + 1 > capacity) {
+    char* grown = static_cast<char*>(realloc(dst, len + 1));
+    if (!grown) return;
+    dst = grown;
+    capacity = len + 1;
+  }
+  memmove(dst, src, len);
+  dst[len] = '\0';
+}
+
+// Also runs on the esp-mqtt task during failover, so it must not allocate once the
+// buffers have grown to the longest broker
 void MqttClient::parseUriComponents(const char* uri) {
   // Parse scheme, host, port, and optional path for ws/wss
-  UriParts parts;
-  if (!parseMqttUri(std::string(uri), parts)) {
-    Serial.println("[MQTT][ERROR] Invalid broker URI");
+  UriView parts;
+  if (!parseMqttUri(uri, parts)) {
+    MQTT_LOGE("Invalid broker URI");
     return;
   }
 
   // Store host and port
-  _host = static_cast<char*>(realloc(_host, parts.host.size() + 1));
-  memcpy(_host, parts.host.c_str(), parts.host.size() + 1);
+  assignString(_host, _hostCapacity, parts.host, parts.hostLen);
   _port = parts.port;
 
   // Transport flags
@@ -189,18 +589,81 @@ void MqttClient::parseUriComponents(const char* uri) {
 
   // Path for WebSocket
   if (_useWebSocket) {
-    _path = static_cast<char*>(realloc(_path, parts.path.size() + 1));
-    memcpy(_path, parts.path.c_str(), parts.path.size() + 1);
+    assignString(_path, _pathCapacity, parts.path, parts.pathLen);
   }
 }
 
 void MqttClient::begin(const char* brokerUri) {
+  _brokers.clear();
   parseUriComponents(brokerUri);
 }
 
+void MqttClient::begin(const char* const* brokerUris, size_t count) {
+  _brokers.clear();
+  for (size_t i = 0; i < count; i++) {
+    addBroker(brokerUris[i]);
+  }
+}
+
+bool MqttClient::addBroker(const char* brokerUri, uint8_t weight) {
+  if (!_brokers.add(brokerUri, weight)) {
+    MQTT_LOGE("Invalid broker URI: %s", brokerUri ? brokerUri : "(null)");
+    return false;
+  }
+  return true;
+}
+
+void MqttClient::setFailoverThreshold(uint8_t failures) {
+  _brokers.setFailoverThreshold(failures);
+}
+
+void MqttClient::selectBroker() {
+  int index = _brokers.select(millis());
+  if (index < 0) return;
+  const BrokerEntry& broker = _brokers.at(index);
+  MQTT_LOGI("Selected broker %d: %s (latency=%ums)", index, broker.uri.c_str(), (unsigned)broker.latencyMs);
+  parseUriComponents(broker.uri.c_str());
+}
+
+// Runs in the esp-mqtt task: the handle cannot be stopped from here, so the new
+// broker is applied with esp_mqtt_set_config and picked up by the auto-reconnect.
+void MqttClient::failoverBroker() {
+  int previous = _brokers.current();
+  selectBroker();
+  if (_brokers.current() == previous || !_client) return;
+
+  MQTT_LOGW("Failing over from broker %d to broker %d", previous, _brokers.current());
+  applyBrokerConfig();
+}
+
+// Runs in the esp-mqtt task after each attempt of the probe pass: moves on to the next
+// unmeasured broker, or once every one was tried to the fastest. Returns false when the
+// broker just connected to is the fastest and the connection is kept.
+bool MqttClient::advanceBrokerProbe(bool connected) {
+  int probed = _brokers.current();
+  int next = _brokers.nextProbe(millis());
+  if (next >= 0) {
+    MQTT_LOGI("Probing broker %d: %s", next, _brokers.at(next).uri.c_str());
+    parseUriComponents(_brokers.at(next).uri.c_str());
+  } else {
+    _brokerProbing = false;
+    selectBroker();
+    if (connected && _brokers.current() == probed) return false;
+  }
+  applyBrokerConfig();
+  return true;
+}
+
+void MqttClient::applyBrokerConfig() {
+  if (!_client) return;
+  buildUriIfNeeded();
+  esp_mqtt_client_config_t mqtt_cfg;
+  buildConfig(mqtt_cfg, _protocol);
+  esp_mqtt_set_config(static_cast<esp_mqtt_client_handle_t>(_client), &mqtt_cfg);
+}
+
 void MqttClient::setServer(const char* host, uint16_t port) {
-  _host = static_cast<char*>(realloc(_host, strlen(host) + 1));
-  strcpy(_host, host);
+  assignString(_host, _hostCapacity, host, strlen(host));
   _port = port;
 }
 
@@ -210,9 +673,7 @@ void MqttClient::setWebSocket(bool enable) {
 
 void MqttClient::setPath(const char* path) {
   if (!path) return;
-  size_t len = strlen(path);
-  _path = static_cast<char*>(realloc(_path, len + 1));
-  strcpy(_path, path);
+  assignString(_path, _pathCapacity, path, strlen(path));
 }
 
 void MqttClient::setCredentials(const char* username, const char* password) {
@@ -230,91 +691,188 @@ void MqttClient::setKeepalive(uint16_t keepalive) {
   _keepalive = keepalive;
 }
 
+void MqttClient::releaseCert(CertBlob& blob) {
+  if (blob.owned) {
+    free(const_cast<char*>(blob.data));
+  }
+  blob = CertBlob();
+}
+
+void MqttClient::assignCert(CertBlob& blob, const char* data, size_t len, bool copy) {
+  releaseCert(blob);
+  if (!copy) {
+    blob.data = data;
+    blob.len = len;
+    return;
+  }
+  size_t size = strlen(data) + 1;
+  char* buf = static_cast<char*>(malloc(size));
+  if (!buf) {
+    MQTT_LOGE("Out of memory copying certificate");
+    return;
+  }
+  memcpy(buf, data, size);
+  blob.data = buf;
+  blob.owned = true;
+}
+
 void MqttClient::setCACert(const char* ca_cert) {
   if (ca_cert) {
-    size_t len = strlen(ca_cert);
-    _caCert = static_cast<char*>(realloc(_caCert, len + 1));
-    strcpy(_caCert, ca_cert);
-    Serial.println("[MQTT][INFO] CA certificate configured");
+    assignCert(_caCert, ca_cert, 0, true);
+    MQTT_LOGI("CA certificate configured");
   }
 }
 
 void MqttClient::setClientCert(const char* client_cert) {
   if (client_cert) {
-    size_t len = strlen(client_cert);
-    _clientCert = static_cast<char*>(realloc(_clientCert, len + 1));
-    strcpy(_clientCert, client_cert);
-    Serial.println("[MQTT][INFO] Client certificate configured for mTLS");
+    assignCert(_clientCert, client_cert, 0, true);
+    MQTT_LOGI("Client certificate configured for mTLS");
   }
 }
 
 void MqttClient::setClientKey(const char* client_key) {
   if (client_key) {
-    size_t len = strlen(client_key);
-    _clientKey = static_cast<char*>(realloc(_clientKey, len + 1));
-    strcpy(_clientKey, client_key);
-    Serial.println("[MQTT][INFO] Client private key configured for mTLS");
+    assignCert(_clientKey, client_key, 0, true);
+    MQTT_LOGI("Client private key configured for mTLS");
+  }
+}
+
+void MqttClient::setCACertRef(const char* ca_cert) {
+  if (ca_cert) {
+    assignCert(_caCert, ca_cert, 0, false);
+    MQTT_LOGI("CA certificate configured (borrowed)");
+  }
+}
+
+void MqttClient::setClientCertRef(const char* client_cert) {
+  if (client_cert) {
+    assignCert(_clientCert, client_cert, 0, false);
+    MQTT_LOGI("Client certificate configured for mTLS (borrowed)");
+  }
+}
+
+void MqttClient::setClientKeyRef(const char* client_key) {
+  if (client_key) {
+    assignCert(_clientKey, client_key, 0, false);
+    MQTT_LOGI("Client private key configured for mTLS (borrowed)");
+  }
+}
+
+void MqttClient::setCACertDer(const uint8_t* der, size_t len) {
+  if (der && len) {
+    assignCert(_caCert, reinterpret_cast<const char*>(der), len, false);
+    MQTT_LOGI("CA certificate configured (DER)");
+  }
+}
+
+void MqttClient::setClientCertDer(const uint8_t* der, size_t len) {
+  if (der && len) {
+    assignCert(_clientCert, reinterpret_cast<const char*>(der), len, false);
+    MQTT_LOGI("Client certificate configured for mTLS (DER)");
+  }
+}
+
+void MqttClient::setClientKeyDer(const uint8_t* der, size_t len) {
+  if (der && len) {
+    assignCert(_clientKey, reinterpret_cast<const char*>(der), len, false);
+    MQTT_LOGI("Client private key configured for mTLS (DER)");
   }
 }
 
 void MqttClient::setInsecure(bool insecure) {
   _skipCertVerify = insecure;
-  Serial.print("[MQTT][WARNING] Certificate verification ");
-  Serial.println(insecure ? "DISABLED (insecure mode)" : "enabled");
+  MQTT_LOGW("Certificate verification %s", insecure ? "DISABLED (insecure mode)" : "enabled");
+}
+
+void MqttClient::setTaskConfig(uint8_t priority, uint32_t stackSize) {
+  _taskPriority = priority;
+  _taskStackSize = stackSize;
+}
+
+void MqttClient::setBufferSize(int size) {
+  _bufferSize = size;
+}
+
+void MqttClient::setMaxMessageSize(size_t bytes) {
+  _maxMessageSize = bytes;
+  reserveReceiveBuffer();
+}
+
+// On the application task, before esp-mqtt can deliver into the buffer
+void MqttClient::reserveReceiveBuffer() {
+  if (_rxPayload && _rxCapacity == _maxMessageSize) {
+    return;
+  }
+  free(_rxPayload);
+  _rxPayload = static_cast<char*>(malloc(_maxMessageSize + 1));
+  _rxCapacity = _rxPayload ? _maxMessageSize : 0;
+  if (!_rxPayload) {
+    MQTT_LOGE("No memory for a %u byte receive buffer", static_cast<unsigned>(_maxMessageSize));
+  }
 }
 
 void MqttClient::setProtocolFallback(bool enableFallback) {
   _enableFallback = enableFallback;
-  Serial.print("[MQTT][INFO] Protocol fallback ");
-  Serial.println(enableFallback ? "enabled" : "disabled");
+  MQTT_LOGI("Protocol fallback %s", enableFallback ? "enabled" : "disabled");
 }
 
 bool MqttClient::connect(const char* clientId) {
+  _connectStartUs = micros();
   _clientId = static_cast<char*>(realloc(_clientId, strlen(clientId) + 1));
   strcpy(_clientId, clientId);
 
   // Validate client ID is not empty
   if (!clientId || strlen(clientId) == 0) {
-    Serial.println("[MQTT][ERROR] Client ID cannot be empty");
+    MQTT_LOGE("Client ID cannot be empty");
     return false;
   }
 
-  Serial.print("[MQTT][INFO] Attempting connection with client ID: ");
-  Serial.println(clientId);
+  MQTT_LOGI("Attempting connection with client ID: %s", clientId);
+  resolveProbeTopic();
+  reserveReceiveBuffer();
+
+  // With several brokers, each one not measured yet gets a probe attempt first (see
+  // advanceBrokerProbe()); the session is then opened on the fastest
+  _brokerProbing = false;
+  if (_brokers.size() > 1) {
+    _brokers.beginProbe();
+    int probe = _brokers.nextProbe(millis());
+    if (probe >= 0) {
+      _brokerProbing = true;
+      MQTT_LOGI("Probing broker %d: %s", probe, _brokers.at(probe).uri.c_str());
+      parseUriComponents(_brokers.at(probe).uri.c_str());
+    }
+  }
+  if (!_brokers.empty() && !_brokerProbing) {
+    selectBroker();
+  }
 
   // Try MQTT v5 first
-  Serial.println("[MQTT][INFO] Attempting MQTT v5 connection...");
-  if (connectWithProtocol(static_cast<esp_mqtt_protocol_ver_t>(5))) {
+  MQTT_LOGI("Attempting MQTT v5 connection...");
+  if (connectWithProtocol(static_cast<esp_mqtt_protocol_ver_t>(MQTT_PROTOCOL_V_5))) {
     _usingFallback = false;
-    Serial.println("[MQTT][SUCCESS] Connected using MQTT v5");
+    MQTT_LOGI("Connected using MQTT v5");
     return true;
   }
 
   // If v5 fails and fallback is enabled, try v3.1.1
   if (_enableFallback) {
-    Serial.println("[MQTT][INFO] MQTT v5 failed, attempting fallback to v3.1.1...");
-    if (connectWithProtocol(static_cast<esp_mqtt_protocol_ver_t>(4))) {
+    MQTT_LOGI("MQTT v5 failed, attempting fallback to v3.1.1...");
+    if (connectWithProtocol(MQTT_PROTOCOL_V_3_1_1)) {
       _usingFallback = true;
-      Serial.println("[MQTT][SUCCESS] Connected using MQTT v3.1.1 fallback");
+      MQTT_LOGI("Connected using MQTT v3.1.1 fallback");
       return true;
     }
   }
 
-  Serial.println("[MQTT][ERROR] All connection attempts failed");
+  MQTT_LOGE("All connection attempts failed");
   return false;
 }
 
-bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol) {
-  const char* protocolName = (protocol == MQTT_PROTOCOL_V_5) ? "v5" : "v3.1.1";
-  Serial.print("[MQTT][INFO] Configuring for MQTT ");
-  Serial.println(protocolName);
-
-  // Build a URI if using WebSocket or when a path is specified
-  buildUriIfNeeded();
-
+void MqttClient::buildConfig(esp_mqtt_client_config_t& mqtt_cfg, esp_mqtt_protocol_ver_t protocol) {
 #ifdef ESP_IDF_VERSION_MAJOR
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
-  esp_mqtt_client_config_t mqtt_cfg = {
+  esp_mqtt_client_config_t cfg = {
       .broker =
           {
               .address =
@@ -322,23 +880,26 @@ bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol) {
                       // Prefer URI when using WebSocket or when explicitly built
                       .uri = _uri ? _uri : nullptr,
                       .hostname = _uri ? nullptr : _host,
-                      .port = _uri ? 0 : _port,
+                      .port = _uri ? 0u : _port,
                   },
               .verification =
                   {
-                      .certificate = _caCert,
+                      .certificate = _caCert.data,
+                      .certificate_len = _caCert.len,
                       .skip_cert_common_name_check = _skipCertVerify,
                   },
           },
       .credentials =
           {
-              .client_id = _clientId,
               .username = _username,
+              .client_id = _clientId,
               .authentication =
                   {
                       .password = _password,
-                      .certificate = _clientCert,
-                      .key = _clientKey,
+                      .certificate = _clientCert.data,
+                      .certificate_len = _clientCert.len,
+                      .key = _clientKey.data,
+                      .key_len = _clientKey.len,
                   },
           },
       .session =
@@ -346,9 +907,19 @@ bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol) {
               .keepalive = _keepalive,
               .protocol_ver = protocol,
           },
+      .task =
+          {
+              .priority = _taskPriority,
+              .stack_size = static_cast<int>(_taskStackSize),
+          },
+      .buffer =
+          {
+              .size = _bufferSize,
+          },
   };
+  mqtt_cfg = cfg;
 #else
-  esp_mqtt_client_config_t mqtt_cfg = {};
+  mqtt_cfg = esp_mqtt_client_config_t();
   if (_uri) {
     mqtt_cfg.uri = _uri;
   } else {
@@ -360,15 +931,21 @@ bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol) {
   mqtt_cfg.password = _password;
   mqtt_cfg.keepalive = _keepalive;
   mqtt_cfg.protocol_ver = protocol;
+  mqtt_cfg.task_prio = _taskPriority;
+  mqtt_cfg.task_stack = _taskStackSize;
+  mqtt_cfg.buffer_size = _bufferSize;
   
   // TLS/mTLS configuration for IDF < 5.0
-  mqtt_cfg.cert_pem = _caCert;
-  mqtt_cfg.client_cert_pem = _clientCert;
-  mqtt_cfg.client_key_pem = _clientKey;
+  mqtt_cfg.cert_pem = _caCert.data;
+  mqtt_cfg.cert_len = _caCert.len;
+  mqtt_cfg.client_cert_pem = _clientCert.data;
+  mqtt_cfg.client_cert_len = _clientCert.len;
+  mqtt_cfg.client_key_pem = _clientKey.data;
+  mqtt_cfg.client_key_len = _clientKey.len;
   mqtt_cfg.skip_cert_common_name_check = _skipCertVerify;
 #endif
 #else
-  esp_mqtt_client_config_t mqtt_cfg = {};
+  mqtt_cfg = esp_mqtt_client_config_t();
   if (_uri) {
     mqtt_cfg.uri = _uri;
   } else {
@@ -379,24 +956,56 @@ bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol) {
   mqtt_cfg.username = _username;
   mqtt_cfg.password = _password;
   mqtt_cfg.keepalive = _keepalive;
+  mqtt_cfg.task_prio = _taskPriority;
+  mqtt_cfg.task_stack = _taskStackSize;
+  mqtt_cfg.buffer_size = _bufferSize;
   
   // TLS/mTLS configuration for older ESP-IDF
-  mqtt_cfg.cert_pem = _caCert;
-  mqtt_cfg.client_cert_pem = _clientCert;
-  mqtt_cfg.client_key_pem = _clientKey;
+  mqtt_cfg.cert_pem = _caCert.data;
+  mqtt_cfg.cert_len = _caCert.len;
+  mqtt_cfg.client_cert_pem = _clientCert.data;
+  mqtt_cfg.client_cert_len = _clientCert.len;
+  mqtt_cfg.client_key_pem = _clientKey.data;
+  mqtt_cfg.client_key_len = _clientKey.len;
   mqtt_cfg.skip_cert_common_name_check = _skipCertVerify;
   // For older ESP-IDF versions, protocol selection may not be available
 #endif
+}
+
+bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol, uint32_t waitUs) {
+  const char* protocolName = (protocol == MQTT_PROTOCOL_V_5) ? "v5" : "v3.1.1";
+  MQTT_LOGI("Configuring for MQTT %s", protocolName);
+  _protocol = protocol;
+  _metrics.add(MqttCounter::ConnectAttempts);
+  {
+    std::lock_guard<std::mutex> lock(_connectHistoryLock);
+    _connectHistory.begin(micros(), millis(), static_cast<int8_t>(_brokers.current()),
+                          protocol == MQTT_PROTOCOL_V_5 ? 5 : 4, protocol != MQTT_PROTOCOL_V_5, false, waitUs);
+  }
+
+  // Build a URI if using WebSocket or when a path is specified
+  buildUriIfNeeded();
+
+  esp_mqtt_client_config_t mqtt_cfg;
+  buildConfig(mqtt_cfg, protocol);
 
   if (_client) {
     esp_mqtt_client_stop(static_cast<esp_mqtt_client_handle_t>(_client));
     esp_mqtt_client_destroy(static_cast<esp_mqtt_client_handle_t>(_client));
   }
 
+#ifdef MQTT_HAS_CUSTOM_TRANSPORT
+  // Given once per handle: a failover keeps it, and it follows the broker's scheme
+  esp_transport_handle_t transport = createTimedTransport(this, _timedTransport);
+  mqtt_cfg.network.transport = transport;
+#endif
   _client = esp_mqtt_client_init(&mqtt_cfg);
   if (!_client) {
-    Serial.print("[MQTT][ERROR] Failed to initialize client for ");
-    Serial.println(protocolName);
+    MQTT_LOGE("Failed to initialize client for %s", protocolName);
+#ifdef MQTT_HAS_CUSTOM_TRANSPORT
+    if (transport) esp_transport_destroy(transport);
+#endif
+    connectFailed(micros());
     return false;
   }
 
@@ -406,25 +1015,22 @@ bool MqttClient::connectWithProtocol(esp_mqtt_protocol_ver_t protocol) {
                                  this);
 
   if (_uri) {
-    Serial.printf("[MQTT] Connecting to %s as %s (%s)\n", _uri, _clientId, protocolName);
+    MQTT_LOGI("Connecting to %s as %s (%s)", _uri, _clientId, protocolName);
   } else {
-    Serial.printf("[MQTT] Connecting to %s:%d as %s (%s)\n", _host, _port, _clientId, protocolName);
+    MQTT_LOGI("Connecting to %s:%d as %s (%s)", _host, _port, _clientId, protocolName);
   }
-  Serial.printf("[MQTT] Config: keepalive=%ds, username=%s, password=%s\n",
-                _keepalive,
-                _username ? _username : "(none)",
-                _password ? "***" : "(none)");
+  MQTT_LOGD("Config: keepalive=%ds, username=%s, password=%s", _keepalive, _username ? _username : "(none)",
+            _password ? "***" : "(none)");
 
   esp_err_t result = esp_mqtt_client_start(static_cast<esp_mqtt_client_handle_t>(_client));
   if (result == ESP_OK) {
-    Serial.print("[MQTT][INFO] Client started successfully for ");
-    Serial.println(protocolName);
+    MQTT_LOGI("Client started successfully for %s", protocolName);
+    std::lock_guard<std::mutex> lock(_connectHistoryLock);
+    _connectHistory.started(micros());
     return true;
   } else {
-    Serial.print("[MQTT][ERROR] Failed to start client for ");
-    Serial.print(protocolName);
-    Serial.print(", error: ");
-    Serial.println(result);
+    MQTT_LOGE("Failed to start client for %s, error: %d", protocolName, (int)result);
+    connectFailed(micros());
     return false;
   }
 }
@@ -436,34 +1042,251 @@ void MqttClient::disconnect() {
 }
 
 int MqttClient::publish(const char* topic, const char* payload, bool retain) {
-  if (!_client)
+  return publishQos(topic, payload, 1, retain);
+}
+
+int MqttClient::publishQos(const char* topic, const char* payload, int qos, bool retain) {
+  return publishQos(topic, payload, payload ? strlen(payload) : 0, qos, retain);
+}
+
+int MqttClient::publishQos(const char* topic, const void* payload, size_t length, int qos, bool retain) {
+  if (!_client) {
+    _metrics.add(MqttCounter::DropNotConnected);
     return -1;
+  }
+  if (qos < 0 || qos > 2) {
+    MQTT_LOGE("Invalid QoS %d", qos);
+    return -1;
+  }
 
-  int msg_id =
-      esp_mqtt_client_publish(static_cast<esp_mqtt_client_handle_t>(_client), topic, payload, 0, 1, retain ? 1 : 0);
+  uint32_t traceId = MQTT_TRACE_BEGIN();
+  uint32_t startUs = micros();
+  // esp-mqtt reads a length of 0 as "NUL-terminated", so an empty payload goes as nullptr
+  int msg_id = esp_mqtt_client_publish(static_cast<esp_mqtt_client_handle_t>(_client), topic,
+                                       length ? static_cast<const char*>(payload) : nullptr, static_cast<int>(length),
+                                       qos, retain ? 1 : 0);
+  if (msg_id < 0) {
+    _metrics.add(MqttCounter::DropPublishFailed);
+    return msg_id;
+  }
+  MQTT_TRACE_RECORD(traceId, Enqueue, startUs);
+  MQTT_TRACE_RECORD(traceId, WireWrite, micros());
+  if (qos > 0 && msg_id > 0) {
+    AckSlot& slot = _ackSlots[static_cast<unsigned>(msg_id) % kAckSlots];
+    slot.startUs.store(startUs, std::memory_order_relaxed);
+    slot.traceId.store(traceId, std::memory_order_relaxed);
+    slot.msgId.store(msg_id, std::memory_order_release);
+  }
+  uint32_t bytes = static_cast<uint32_t>(length);
+  _metrics.add(MqttCounter::MessagesOut);
+  _metrics.add(MqttCounter::BytesOut, bytes);
+  accountTopic(TopicDirection::Outbound, topic, bytes);
+  if (TrafficCapture* capture = _capture.load(std::memory_order_acquire)) {
+    capture->record(startUs, CaptureEvent::Outbound, topic, strlen(topic), payload, length, qos, retain, msg_id);
+  }
+  _metrics.add(static_cast<MqttCounter>(static_cast<uint8_t>(MqttCounter::PublishQos0) + qos));
+  if (qos > 0) {
+    _metrics.inFlightAdd(1);
+  }
   return msg_id;
 }
 
+void MqttClient::setSubscriptionAggregation(bool enable, uint8_t minSiblings) {
+  std::lock_guard<std::mutex> lock(_subscriptionsLock);
+  _aggregation.enabled = enable;
+  _aggregation.minSiblings = minSiblings;
+}
+
+// Without aggregation every wire filter is a registered filter itself; with it, a wire
+// filter may be a wildcard delivering several of them.
+bool MqttClient::wireServes(const Subscription& wire, const char* filter) const {
+  return _aggregation.enabled ? filterCovers(wire.filter.c_str(), filter) : wire.filter == filter;
+}
+
+bool MqttClient::wireCovers(const char* topic, uint8_t qos) const {
+  for (const auto& wire : _wireFilters) {
+    if (wire.qos >= qos && wireServes(wire, topic))
+      return true;
+  }
+  return false;
+}
+
+bool MqttClient::wireNeeded(const Subscription& wire) const {
+  for (size_t i = 0; i < _subscriptions.size(); i++) {
+    if (wireServes(wire, _subscriptions.at(i).filter.c_str()))
+      return true;
+  }
+  return false;
+}
+
 int MqttClient::subscribe(const char* topic, int qos) {
-  if (!_client)
+  if (qos < 0 || qos > 2) {
+    MQTT_LOGE("Invalid QoS %d", qos);
     return -1;
+  }
+  Subscription wire;
+  {
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    Subscription* sub = _subscriptions.add(topic, static_cast<uint8_t>(qos));
+    if (!sub) {
+      MQTT_LOGE("Invalid topic filter: %s", topic ? topic : "(null)");
+      return -1;
+    }
+    // Already subscribed on this connection, or queued for the restore on connect. That
+    // includes subscriptions made from onConnect, so they are aggregated together.
+    if (sub->active || !isConnected() || _subscribeDeferred)
+      return 0;
+    // A filter on the broker already delivers this one
+    if (wireCovers(topic, sub->qos)) {
+      sub->active = true;
+      return 0;
+    }
+    wire.filter = topic;
+    wire.qos = sub->qos;
+    if (_aggregation.enabled) {
+      // The new filter may complete a group of siblings: subscribe their wildcard instead
+      std::vector<Subscription> aggregated;
+      aggregateFilters(_subscriptions, _aggregation, aggregated);
+      for (const auto& candidate : aggregated) {
+        if (filterCovers(candidate.filter.c_str(), topic)) {
+          wire = candidate;
+          break;
+        }
+      }
+    }
+  }
 
-  int msg_id = esp_mqtt_client_subscribe(static_cast<esp_mqtt_client_handle_t>(_client), topic, qos);
+  esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+  int msg_id = esp_mqtt_client_subscribe(handle, wire.filter.c_str(), wire.qos);
+  if (msg_id < 0)
+    return msg_id; // nothing recorded, so the next subscribe() or connect sends it again
+
+  std::vector<Subscription> redundant;
+  {
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    // Filters the new wildcard covers are unsubscribed once it is in place
+    for (size_t i = 0; _aggregation.enabled && i < _wireFilters.size();) {
+      if (_wireFilters[i].qos <= wire.qos && filterCovers(wire.filter.c_str(), _wireFilters[i].filter.c_str())) {
+        redundant.push_back(std::move(_wireFilters[i]));
+        _wireFilters.erase(_wireFilters.begin() + i);
+      } else {
+        i++;
+      }
+    }
+    for (size_t i = 0; i < _subscriptions.size(); i++) {
+      Subscription& sub = _subscriptions.at(i);
+      if (sub.qos <= wire.qos && wireServes(wire, sub.filter.c_str()))
+        sub.active = true;
+    }
+    _wireFilters.push_back(std::move(wire));
+  }
+  for (const auto& stale : redundant) {
+    esp_mqtt_client_unsubscribe(handle, stale.filter.c_str());
+  }
   return msg_id;
 }
 
 int MqttClient::unsubscribe(const char* topic) {
-  if (!_client)
-    return -1;
+  std::vector<Subscription> stale;
+  {
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    _subscriptions.remove(topic);
+    // While disconnected the broker-side filters are reconciled on the next connect
+    if (!isConnected())
+      return _client ? 0 : -1;
+    // Drop every wire filter that no longer delivers a registered filter; an aggregated
+    // wildcard stays as long as one of its members does
+    for (size_t i = 0; i < _wireFilters.size();) {
+      if (wireNeeded(_wireFilters[i])) {
+        i++;
+        continue;
+      }
+      stale.push_back(std::move(_wireFilters[i]));
+      _wireFilters.erase(_wireFilters.begin() + i);
+    }
+  }
 
-  int msg_id = esp_mqtt_client_unsubscribe(static_cast<esp_mqtt_client_handle_t>(_client), topic);
+  int msg_id = 0;
+  for (const auto& wire : stale) {
+    msg_id = esp_mqtt_client_unsubscribe(static_cast<esp_mqtt_client_handle_t>(_client), wire.filter.c_str());
+  }
   return msg_id;
 }
 
+// Replays the registry after a connect. SUBSCRIBE packets are written back to back
+// without waiting for SUBACKs, batching several filters per packet where esp-mqtt
+// supports it, so the whole restore costs a single round trip. With aggregation enabled
+// the covering wildcard set is sent instead of the individual filters. A resumed session
+// still has the last connection's wire filters: only filters registered since are sent,
+// and wire filters nothing needs anymore are unsubscribed.
+void MqttClient::restoreSubscriptions(bool sessionPresent) {
+  esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+  std::lock_guard<std::mutex> lock(_subscriptionsLock);
+  if (!sessionPresent)
+    _wireFilters.clear();
+  for (size_t i = 0; i < _wireFilters.size();) {
+    if (wireNeeded(_wireFilters[i])) {
+      i++;
+      continue;
+    }
+    esp_mqtt_client_unsubscribe(handle, _wireFilters[i].filter.c_str());
+    _wireFilters.erase(_wireFilters.begin() + i);
+  }
+  if (_subscriptions.empty())
+    return;
+
+  aggregateFilters(_subscriptions, _aggregation, _wirePending);
+  for (size_t i = 0; i < _wirePending.size();) {
+    if (wireCovers(_wirePending[i].filter.c_str(), _wirePending[i].qos)) {
+      _wirePending.erase(_wirePending.begin() + i);
+    } else {
+      _wirePending[i++].active = false; // set once sent
+    }
+  }
+
+#ifdef MQTT_HAS_SUBSCRIBE_MULTIPLE
+  static const size_t kBatchSize = 8;
+  esp_mqtt_topic_t batch[kBatchSize];
+  for (size_t first = 0; first < _wirePending.size(); first += kBatchSize) {
+    size_t count = std::min(kBatchSize, _wirePending.size() - first);
+    for (size_t j = 0; j < count; j++) {
+      batch[j].filter = _wirePending[first + j].filter.c_str();
+      batch[j].qos = _wirePending[first + j].qos;
+    }
+    bool ok = esp_mqtt_client_subscribe_multiple(handle, batch, static_cast<int>(count)) >= 0;
+    for (size_t j = 0; j < count; j++)
+      _wirePending[first + j].active = ok;
+  }
+#else
+  for (auto& wire : _wirePending) {
+    wire.active = esp_mqtt_client_subscribe(handle, wire.filter.c_str(), wire.qos) >= 0;
+  }
+#endif
+
+  // Only filters whose SUBSCRIBE went out count as on the broker
+  size_t sent = 0;
+  for (auto& wire : _wirePending) {
+    if (!wire.active)
+      continue;
+    _wireFilters.push_back(std::move(wire));
+    sent++;
+  }
+  for (size_t i = 0; i < _subscriptions.size(); i++) {
+    Subscription& sub = _subscriptions.at(i);
+    sub.active = wireCovers(sub.filter.c_str(), sub.qos);
+  }
+  MQTT_LOGI("Restored %u subscriptions with %u/%u new filters (%u on the broker)", (unsigned)_subscriptions.size(),
+            (unsigned)sent, (unsigned)_wirePending.size(), (unsigned)_wireFilters.size());
+}
+
 void MqttClient::onMessage(MessageCallback cb) {
   _messageCallback = cb;
 }
 
+void MqttClient::onMessageChunk(MessageChunkCallback cb) {
+  _chunkCallback = cb;
+}
+
 void MqttClient::onConnect(SimpleCallback cb) {
   _connectCallback = cb;
 }
@@ -482,78 +1305,837 @@ void MqttClient::handleMessage(const char* topic, const char* payload) {
   }
 }
 
-void MqttClient::onConnectedInternal() {
+void MqttClient::metrics(MqttMetricsSnapshot& out) const {
+  _metrics.snapshot(out);
+#ifdef ESP_PLATFORM
+  out.heapFreeMin = static_cast<int32_t>(esp_get_minimum_free_heap_size());
+#endif
+#ifdef MQTT_HAS_OUTBOX_SIZE
+  if (_client) {
+    out.outboxBytes = esp_mqtt_client_get_outbox_size(static_cast<esp_mqtt_client_handle_t>(_client));
+  }
+#endif
+}
+
+void MqttClient::resetMetrics() {
+  _metrics.reset();
+}
+
+void MqttClient::invokeCallback(const SimpleCallback& cb, const char* name) {
+  if (!cb) {
+    return;
+  }
+  size_t slot = profilerSlot(name);
+  uint32_t start = micros();
+  cb();
+  finishCallback(slot, micros() - start);
+}
+
+size_t MqttClient::profilerSlot(const char* key) {
+  std::lock_guard<std::mutex> lock(_profilerLock);
+  return _profiler.slotFor(key);
+}
+
+size_t MqttClient::profilerSlot(const char* key, CallbackSlotRef& ref) {
+  std::lock_guard<std::mutex> lock(_profilerLock);
+  return _profiler.slotFor(key, ref);
+}
+
+void MqttClient::finishCallback(size_t slot, uint32_t elapsedUs) {
+  _metrics.recordCallback(elapsedUs);
+
+  char key[sizeof(CallbackStats::key)];
+  uint32_t suppressed = 0;
+  {
+    std::lock_guard<std::mutex> lock(_profilerLock);
+    if (!_profiler.record(slot, elapsedUs)) {
+      return;
+    }
+    _metrics.add(MqttCounter::CallbackOverBudget);
+    // A handler that is always slow would otherwise log on every message; the counter
+    // and slowestCallbacks() keep the full picture
+    if (!_profiler.warnDue(slot, millis(), suppressed)) {
+      return;
+    }
+    memcpy(key, _profiler.at(slot).key, sizeof(key));
+  }
+  MQTT_LOGW("Callback for '%s' took %u us (budget %u us, %u more overruns not logged), delaying keepalive and traffic",
+            key, (unsigned)elapsedUs, (unsigned)_profiler.budget(), (unsigned)suppressed);
+}
+
+void MqttClient::setTopicAccounting(bool enable) {
+  std::lock_guard<std::mutex> lock(_topicLock);
+  for (auto& sketch : _topicSketches) {
+    if (!enable) {
+      sketch.reset();
+    } else if (!sketch) {
+      sketch.reset(new TopicSketch());
+    }
+  }
+  _topicAccounting.store(enable, std::memory_order_release);
+}
+
+void MqttClient::accountTopic(TopicDirection direction, const char* topic, uint32_t bytes) {
+  if (!_topicAccounting.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_topicLock);
+  TopicSketch* sketch = _topicSketches[static_cast<size_t>(direction)].get();
+  if (sketch) {
+    sketch->add(topic, bytes);
+  }
+}
+
+void MqttClient::captureEvent(CaptureEvent event, int msgId) {
+  if (TrafficCapture* capture = _capture.load(std::memory_order_acquire)) {
+    capture->record(micros(), event, nullptr, 0, nullptr, 0, 0, false, msgId);
+  }
+}
+
+size_t MqttClient::topTopics(TopicDirection direction, TopicCount* out, size_t max) const {
+  std::lock_guard<std::mutex> lock(_topicLock);
+  const TopicSketch* sketch = _topicSketches[static_cast<size_t>(direction)].get();
+  return sketch ? sketch->top(out, max) : 0;
+}
+
+void MqttClient::setCallbackBudget(uint32_t budgetUs) {
+  std::lock_guard<std::mutex> lock(_profilerLock);
+  _profiler.setBudget(budgetUs);
+}
+
+size_t MqttClient::slowestCallbacks(CallbackStats* out, size_t max) const {
+  std::lock_guard<std::mutex> lock(_profilerLock);
+  return _profiler.top(out, max);
+}
+
+void MqttClient::onErrorInternal(int errorType, int espTlsError, int connectReturnCode) {
+  _lastErrorType = errorType;
+
+  std::lock_guard<std::mutex> lock(_connectHistoryLock);
+  if (_connectHistory.pending()) {
+    ConnectPhase phase = connectFailurePhase(errorType, espTlsError);
+    _connectHistory.error(phase, phase == ConnectPhase::Connack ? connectReturnCode : espTlsError);
+  }
+}
+
+void MqttClient::connectFailed(uint32_t nowUs) {
+  ConnectPhase phase;
+  {
+    std::lock_guard<std::mutex> lock(_connectHistoryLock);
+    phase = _connectHistory.failed(nowUs);
+  }
+  if (phase != ConnectPhase::None) {
+    _metrics.add(static_cast<MqttCounter>(static_cast<uint8_t>(MqttCounter::ConnectFailInit) +
+                                          static_cast<uint8_t>(phase) - static_cast<uint8_t>(ConnectPhase::Init)));
+  }
+}
+
+size_t MqttClient::connectHistory(ConnectAttempt* out, size_t max) const {
+  std::lock_guard<std::mutex> lock(_connectHistoryLock);
+  size_t n = _connectHistory.size() < max ? _connectHistory.size() : max;
+  size_t first = _connectHistory.size() - n;
+  for (size_t i = 0; i < n; i++) {
+    out[i] = _connectHistory.at(first + i);
+  }
+  return n;
+}
+
+void MqttClient::onPublishedInternal(int msgId) {
+  _metrics.add(MqttCounter::PublishAcked);
+  _metrics.inFlightAdd(-1);
+
+  AckSlot& slot = _ackSlots[static_cast<unsigned>(msgId) % kAckSlots];
+  int expected = msgId;
+  uint32_t startUs = slot.startUs.load(std::memory_order_relaxed);
+  uint32_t traceId = slot.traceId.load(std::memory_order_relaxed);
+  if (msgId > 0 && slot.msgId.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) {
+    uint32_t now = micros();
+    _latency[static_cast<size_t>(MqttLatency::PublishAck)].record(now - startUs);
+    MQTT_TRACE_RECORD(traceId, Ack, now);
+  }
+  captureEvent(CaptureEvent::Acked, msgId);
+}
+
+// esp-mqtt gave up on a message it could not get acknowledged in time. DELETED also covers
+// SUBSCRIBEs, which this client does not track, so an expired one takes a publish off the
+// gauge too; resyncInFlight() sets it right on the next fresh session.
+void MqttClient::onDeletedInternal(int msgId) {
+  _metrics.add(MqttCounter::DropExpired);
+  _metrics.inFlightAdd(-1);
+  AckSlot& slot = _ackSlots[static_cast<unsigned>(msgId) % kAckSlots];
+  int expected = msgId;
+  if (msgId > 0) {
+    slot.msgId.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+  }
+}
+
+// A fresh session (session_present == 0): whatever esp-mqtt dropped from its outbox will
+// never be acknowledged. With the outbox empty nothing is in flight anymore.
+void MqttClient::resyncInFlight() {
+#ifdef MQTT_HAS_OUTBOX_SIZE
+  if (esp_mqtt_client_get_outbox_size(static_cast<esp_mqtt_client_handle_t>(_client)) != 0) {
+    return;
+  }
+  _metrics.inFlightSet(0);
+  for (auto& slot : _ackSlots) {
+    slot.msgId.store(0, std::memory_order_relaxed);
+  }
+#endif
+}
+
+void MqttClient::resetLatency() {
+  for (auto& histogram : _latency) {
+    histogram.reset();
+  }
+}
+
+int MqttClient::publishLatencyReport(const char* topic) {
+  if (!_client || !topic)
+    return -1;
+
+  static const char* const kNames[] = {"connect", "puback", "dispatch", "rtt"};
+  char json[512];
+  size_t len = 0;
+  json[len++] = '{';
+  for (size_t i = 0; i < static_cast<size_t>(MqttLatency::Count); i++) {
+    int n = snprintf(json + len, sizeof(json) - len, "%s\"%s\":", i ? "," : "", kNames[i]);
+    if (n < 0 || (size_t)n >= sizeof(json) - len)
+      return -1;
+    len += n;
+    n = _latency[i].formatJson(json + len, sizeof(json) - len);
+    if (n < 0 || (size_t)n >= sizeof(json) - len)
+      return -1;
+    len += n;
+  }
+  if (len + 1 >= sizeof(json))
+    return -1;
+  json[len++] = '}';
+  json[len] = '\0';
+  return esp_mqtt_client_publish(static_cast<esp_mqtt_client_handle_t>(_client), topic, json, len, 0, 0);
+}
+
+void MqttClient::onDataDroppedInternal() {
+  _metrics.add(MqttCounter::MessagesIn);
+  _metrics.add(MqttCounter::DropOversize);
+}
+
+void MqttClient::sampleEventTaskStack() {
+#ifdef ESP_PLATFORM
+  // Runs on the esp-mqtt task; FreeRTOS tracks the high-water mark over the task's lifetime
+  _metrics.recordEventStackFree(static_cast<int32_t>(uxTaskGetStackHighWaterMark(nullptr)));
+#endif
+}
+
+void MqttClient::finishConnectHeap() {
+#ifdef ESP_PLATFORM
+  if (!_connectHeapBefore) {
+    return;
+  }
+  // The handshake's peak is only visible if it pushed the lifetime minimum down
+  uint32_t low = esp_get_free_heap_size();
+  uint32_t minAfter = esp_get_minimum_free_heap_size();
+  if (minAfter < _connectHeapMinBefore && minAfter < low) {
+    low = minAfter;
+  }
+  int32_t used = low < _connectHeapBefore ? static_cast<int32_t>(_connectHeapBefore - low) : 0;
+  _metrics.recordConnectHeap(static_cast<int32_t>(low), used);
+  _connectHeapBefore = 0;
+#endif
+}
+
+void MqttClient::dumpWatermarks() {
+  MqttMetricsSnapshot m;
+  _metrics.snapshot(m); // not metrics(): no outbox query from inside the event dispatch
+#ifdef ESP_PLATFORM
+  m.heapFreeMin = static_cast<int32_t>(esp_get_minimum_free_heap_size());
+#endif
+  MQTT_LOGI("Watermarks: event task stack %d B free, loop task stack %d B free, heap min %d B, "
+            "connect heap low %d B (peak use %d B)",
+            (int)m.eventStackFree, (int)m.appStackFree, (int)m.heapFreeMin, (int)m.connectHeapLow,
+            (int)m.connectHeapUsed);
+}
+
+#ifdef MQTT_HAS_CUSTOM_TRANSPORT
+// Runs on the esp-mqtt task for every attempt, failovers included, so the transport is
+// rebuilt whenever the broker needs another scheme
+int MqttClient::connectTransportInternal(TimedTransport* transport, const char* host, int port, int timeoutMs) {
+  if (!transport->base || transport->secure != _secure || transport->webSocket != _useWebSocket ||
+      transport->skipCommonName != _skipCertVerify) {
+    transport->release();
+    transport->secure = _secure;
+    transport->webSocket = _useWebSocket;
+    transport->skipCommonName = _skipCertVerify;
+    transport->base = _secure ? esp_transport_ssl_init() : esp_transport_tcp_init();
+    if (transport->base && _useWebSocket) {
+      transport->ws = esp_transport_ws_init(transport->base);
+      if (transport->ws) esp_transport_ws_set_subprotocol(transport->ws, "mqtt");
+    }
+  }
+  if (!transport->base || (_useWebSocket && !transport->ws)) {
+    MQTT_LOGE("Failed to create transport");
+    return -1;
+  }
+  if (_secure) applyTransportTls(transport->base);
+  if (transport->ws) esp_transport_ws_set_path(transport->ws, _path ? _path : "/");
+
+  int result = esp_transport_connect(transport->active(), host, port, timeoutMs);
+  uint32_t now = micros();
+  if (result >= 0) {
+    std::lock_guard<std::mutex> lock(_connectHistoryLock);
+    _connectHistory.transportUp(now);
+    return result;
+  }
+
+  // esp-mqtt cannot see the esp-tls error through the wrapper, so it is taken here
+  int espTlsError = 0;
+#ifdef MQTT_HAS_ESP_TLS_ERRORS
+  int tlsStackError = 0;
+  int certFlags = 0;
+  espTlsError = esp_tls_get_and_clear_last_error(esp_transport_get_error_handle(transport->base), &tlsStackError,
+                                                 &certFlags);
+  MQTT_LOGE("Transport connect failed, esp-tls error=0x%x, stack=0x%x, cert flags=0x%x", espTlsError, tlsStackError,
+            certFlags);
+#endif
+  MQTT_LOGE("Transport connect to %s:%d failed, sock_errno=%d", host, port, esp_transport_get_errno(transport->base));
+  std::lock_guard<std::mutex> lock(_connectHistoryLock);
+  ConnectPhase phase = connectFailurePhase(MQTT_ERROR_TYPE_TCP_TRANSPORT, espTlsError);
+  _connectHistory.error(phase, espTlsError);
+  return result;
+}
+
+// PEM blobs have length 0 and go through the PEM setters, DER blobs through the _der ones
+void MqttClient::applyTransportTls(void* ssl) {
+  esp_transport_handle_t t = static_cast<esp_transport_handle_t>(ssl);
+  if (_caCert.data) {
+    if (_caCert.len) {
+      esp_transport_ssl_set_cert_data_der(t, _caCert.data, static_cast<int>(_caCert.len));
+    } else {
+      esp_transport_ssl_set_cert_data(t, _caCert.data, static_cast<int>(strlen(_caCert.data)));
+    }
+  }
+  if (_clientCert.data) {
+    if (_clientCert.len) {
+      esp_transport_ssl_set_client_cert_data_der(t, _clientCert.data, static_cast<int>(_clientCert.len));
+    } else {
+      esp_transport_ssl_set_client_cert_data(t, _clientCert.data, static_cast<int>(strlen(_clientCert.data)));
+    }
+  }
+  if (_clientKey.data) {
+    if (_clientKey.len) {
+      esp_transport_ssl_set_client_key_data_der(t, _clientKey.data, static_cast<int>(_clientKey.len));
+    } else {
+      esp_transport_ssl_set_client_key_data(t, _clientKey.data, static_cast<int>(strlen(_clientKey.data)));
+    }
+  }
+  if (_skipCertVerify) esp_transport_ssl_skip_common_name_check(t);
+}
+
+void MqttClient::onTransportDestroyedInternal(TimedTransport* transport) {
+  if (_timedTransport == transport) _timedTransport = nullptr;
+}
+#endif
+
+void MqttClient::onBeforeConnectInternal() {
+  _attemptStartMs = millis();
+  _brokerProbeLeaving = false; // in case the probe's disconnect posted no event
+#ifdef ESP_PLATFORM
+  _connectHeapBefore = esp_get_free_heap_size();
+  _connectHeapMinBefore = esp_get_minimum_free_heap_size();
+#endif
+  uint32_t now = micros();
+  if (!_connectStartUs) {
+    _connectStartUs = now; // automatic reconnect
+  }
+
+  std::lock_guard<std::mutex> lock(_connectHistoryLock);
+  if (!_connectHistory.pending()) {
+    // esp-mqtt reconnects on its own after its backoff
+    _metrics.add(MqttCounter::ConnectAttempts);
+    _connectHistory.begin(now, _attemptStartMs, static_cast<int8_t>(_brokers.current()),
+                          _protocol == MQTT_PROTOCOL_V_5 ? 5 : 4, _usingFallback, true, now - _lastDisconnectUs);
+  }
+  _connectHistory.beforeConnect(now);
+}
+
+void MqttClient::onConnectedInternal(bool sessionPresent) {
+  uint32_t now = micros();
+  {
+    std::lock_guard<std::mutex> lock(_connectHistoryLock);
+    _connectHistory.connected(now);
+  }
+  finishConnectHeap();
+  sampleEventTaskStack();
+  if (_brokers.current() >= 0) {
+    _brokers.recordSuccess(_brokers.current(), millis() - _attemptStartMs);
+  }
+  if (_brokerProbing && advanceBrokerProbe(true)) {
+    // Only measured: leave for the next broker before any session traffic
+    esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+    _brokerProbeLeaving = true;
+    esp_mqtt_client_disconnect(handle);
+    esp_mqtt_client_reconnect(handle);
+    return;
+  }
+
   _connected = true;
+  if (_connectStartUs) {
+    _latency[static_cast<size_t>(MqttLatency::Connect)].record(now - _connectStartUs);
+    _connectStartUs = 0;
+  }
   unsigned long connect_time = millis();
-  Serial.printf("[MQTT] Connected at %lu ms - connection state: true\n", connect_time);
-  if (_connectCallback) {
-    _connectCallback();
+  MQTT_LOGD("Connected at %lu ms - connection state: true", connect_time);
+  if (!sessionPresent) {
+    resyncInFlight(); // before the restore adds its SUBSCRIBEs to the outbox
   }
+
+  if (sessionPresent) {
+    // The broker kept our subscriptions. Without a record of them (first connect since
+    // boot) they are taken to be what the registry aggregates to.
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    if (_wireFilters.empty())
+      aggregateFilters(_subscriptions, _aggregation, _wireFilters);
+  }
+  if (_probeIntervalMs && _probeTopic) {
+    esp_mqtt_client_subscribe(static_cast<esp_mqtt_client_handle_t>(_client), _probeTopic, 0);
+  }
+  _metrics.add(MqttCounter::Connects);
+  captureEvent(CaptureEvent::Connected);
+  // subscribe() calls from onConnect only register; the restore sends them in one go
+  _subscribeDeferred = true;
+  invokeCallback(_connectCallback, "onConnect");
+  _subscribeDeferred = false;
+  restoreSubscriptions(sessionPresent);
 }
 
 void MqttClient::onDisconnectedInternal() {
+  if (_brokerProbeLeaving.exchange(false)) {
+    return; // our own disconnect after a probe; the next broker is already configured
+  }
   unsigned long disconnect_time = millis();
-  Serial.printf("[MQTT] Disconnected at %lu ms - connection state: false\n", disconnect_time);
+  MQTT_LOGD("Disconnected at %lu ms - connection state: false", disconnect_time);
+
+  bool wasConnected = _connected.exchange(false);
+  _lastDisconnectUs = micros();
+  connectFailed(_lastDisconnectUs); // no-op unless an attempt was pending
+  finishConnectHeap();
+  sampleEventTaskStack();
+  dumpWatermarks();
+
+  MqttCounter reason = MqttCounter::DisconnectClean;
+  if (_probeTimedOut.exchange(false)) {
+    reason = MqttCounter::DisconnectTimeout;
+  } else if (_lastErrorType == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+    reason = MqttCounter::DisconnectTransport;
+  } else if (_lastErrorType == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+    reason = MqttCounter::DisconnectRefused;
+  }
+  _metrics.add(reason);
+  _lastErrorType = MQTT_ERROR_TYPE_NONE;
+  if (wasConnected) {
+    captureEvent(CaptureEvent::Disconnected);
+  }
+  {
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    _subscriptions.markAllInactive();
+  }
 
-  bool wasConnected = _connected;
-  _connected = false;
+  // A disconnect without CONNACK is a failed attempt against the current broker
+  if (!wasConnected && _brokers.current() >= 0) {
+    bool unhealthy = _brokers.recordFailure(_brokers.current(), millis());
+    if (_brokerProbing) {
+      advanceBrokerProbe(false);
+    } else if (unhealthy) {
+      failoverBroker();
+    }
+  }
 
   // If we were previously connected and fallback is enabled, try fallback
   if (wasConnected && _enableFallback && !_usingFallback) {
-    Serial.println("[MQTT][INFO] Disconnected, attempting fallback to v3.1.1...");
+    MQTT_LOGI("Disconnected, attempting fallback to v3.1.1...");
     reconnectWithFallback();
     return;
   }
 
-  if (_disconnectCallback) {
-    _disconnectCallback();
-  }
+  invokeCallback(_disconnectCallback, "onDisconnect");
 }
 
 void MqttClient::reconnectWithFallback() {
-  Serial.println("[MQTT][INFO] Attempting reconnection with fallback...");
+  MQTT_LOGI("Attempting reconnection with fallback...");
 
   // Small delay before reconnection attempt
   delay(1000);
 
   // Try v3.1.1 fallback
-  if (connectWithProtocol(static_cast<esp_mqtt_protocol_ver_t>(4))) {
+  if (connectWithProtocol(MQTT_PROTOCOL_V_3_1_1, micros() - _lastDisconnectUs)) {
     _usingFallback = true;
-    Serial.println("[MQTT][SUCCESS] Reconnected using MQTT v3.1.1 fallback");
+    MQTT_LOGI("Reconnected using MQTT v3.1.1 fallback");
+  } else {
+    MQTT_LOGE("Fallback reconnection failed");
+    invokeCallback(_disconnectCallback, "onDisconnect");
+  }
+}
+
+// esp-mqtt splits a message into fragments of up to its buffer size; only the first one
+// carries the topic. Fragments of a message arrive in order on the event task, but a
+// reconnect can cut a message short, so a fragment that does not continue the current
+// message is discarded.
+void MqttClient::onDataFragmentInternal(esp_mqtt_event_handle_t event, uint32_t receivedUs) {
+  size_t len = event->data_len > 0 ? static_cast<size_t>(event->data_len) : 0;
+  size_t offset = event->current_data_offset > 0 ? static_cast<size_t>(event->current_data_offset) : 0;
+  size_t total = event->total_data_len > 0 ? static_cast<size_t>(event->total_data_len) : 0;
+  if (total < offset + len) {
+    total = offset + len;
+  }
+  if (offset == 0) {
+    beginMessage(event, total, receivedUs);
+  } else if (_rxMode == RxMode::Idle || offset != _rxNext || total != _rxTotal) {
+    MQTT_LOGW("Discarding fragment at offset %u of a message not in progress", static_cast<unsigned>(offset));
+    _rxMode = RxMode::Idle;
+    return;
+  }
+  _rxNext = offset + len;
+  bool last = _rxNext >= total;
+
+  switch (_rxMode) {
+    case RxMode::Reassemble:
+      if (len) {
+        memcpy(_rxPayload + offset, event->data, len);
+        _metrics.add(MqttCounter::BytesCopied, static_cast<uint32_t>(len));
+      }
+      if (last) {
+        _rxPayload[total] = '\0';
+        MQTT_LOGV_HOT("Message received, msg_id=%d data_len=%u", event->msg_id, static_cast<unsigned>(total));
+        onDataInternal(_rxTopic, _rxPayload, static_cast<int>(total), _rxReceivedUs);
+      }
+      break;
+    case RxMode::Stream:
+      onDataChunkInternal(event->data, len, offset);
+      break;
+    default:
+      break;
+  }
+  if (last) {
+    _rxMode = RxMode::Idle;
+  }
+}
+
+void MqttClient::beginMessage(esp_mqtt_event_handle_t event, size_t total, uint32_t receivedUs) {
+  size_t topicLen = event->topic_len > 0 ? static_cast<size_t>(event->topic_len) : 0;
+  _rxTotal = total;
+  _rxReceivedUs = receivedUs;
+  if (topicLen >= kRxTopicSize) {
+    _rxMode = RxMode::Drop;
+  } else if (_rxPayload && total <= _rxCapacity) {
+    _rxMode = RxMode::Reassemble;
+  } else if (_chunkCallback) {
+    _rxMode = RxMode::Stream;
   } else {
-    Serial.println("[MQTT][ERROR] Fallback reconnection failed");
-    if (_disconnectCallback) {
-      _disconnectCallback();
+    _rxMode = RxMode::Drop;
+  }
+  if (topicLen < kRxTopicSize) {
+    memcpy(_rxTopic, event->topic, topicLen);
+    _rxTopic[topicLen] = '\0';
+  }
+
+  if (TrafficCapture* capture = _capture.load(std::memory_order_acquire)) {
+#ifdef MQTT_HAS_EVENT_QOS
+    int qos = event->qos;
+    bool retain = event->retain;
+#else
+    int qos = 0;
+    bool retain = false;
+#endif
+    size_t head = event->data_len > 0 ? static_cast<size_t>(event->data_len) : 0;
+    capture->recordHead(receivedUs, _rxMode == RxMode::Drop ? CaptureEvent::Dropped : CaptureEvent::Inbound,
+                        event->topic, topicLen, event->data, head, total, qos, retain, event->msg_id);
+  }
+
+  if (_rxMode == RxMode::Drop) {
+    // Does not fit the receive buffers; never hand a truncated payload to the application
+    MQTT_LOGW("Dropping oversize message (topic_len=%u, data_len=%u)", static_cast<unsigned>(topicLen),
+              static_cast<unsigned>(total));
+    onDataDroppedInternal();
+  } else if (_rxMode == RxMode::Stream) {
+    _metrics.add(MqttCounter::MessagesIn);
+    _metrics.add(MqttCounter::BytesIn, static_cast<uint32_t>(total));
+    accountTopic(TopicDirection::Inbound, _rxTopic, static_cast<uint32_t>(total));
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    const Subscription* sub = _subscriptions.match(_rxTopic);
+    if (!sub && _aggregation.enabled) {
+      _metrics.add(MqttCounter::DropFiltered);
+      _rxMode = RxMode::Drop; // the remaining fragments are skipped
+      return;
     }
+    _rxSlot = sub ? profilerSlot(sub->filter.c_str(), sub->callbackSlot) : profilerSlot("(unmatched)", _unmatchedSlot);
   }
 }
 
-void MqttClient::onDataInternal(const char* topic, const char* data, int data_len) {
-  if (_messageCallback) {
-    _messageCallback(topic, data, data_len);
+void MqttClient::onDataChunkInternal(const char* data, size_t len, size_t offset) {
+  uint32_t start = micros();
+  _chunkCallback(_rxTopic, data, len, offset, _rxTotal);
+  uint32_t end = micros();
+  finishCallback(_rxSlot, end - start);
+  if (offset + len >= _rxTotal) {
+    _latency[static_cast<size_t>(MqttLatency::Dispatch)].record(end - _rxReceivedUs);
   }
 }
+
+void MqttClient::onDataInternal(const char* topic, const char* data, int data_len, uint32_t receivedUs) {
+  uint32_t now = micros();
+  if (!receivedUs) {
+    receivedUs = now;
+  }
+  if ((++_stackSampleCount & 63) == 0) {
+    sampleEventTaskStack();
+  }
+  if (_probeIntervalMs && handleProbeEcho(topic, data, data_len)) {
+    return;
+  }
+  uint32_t traceId = MQTT_TRACE_BEGIN();
+  MQTT_TRACE_RECORD(traceId, Receive, receivedUs);
+  MQTT_TRACE_RECORD(traceId, Reassembled, now);
+  _metrics.add(MqttCounter::MessagesIn);
+  _metrics.add(MqttCounter::BytesIn, data_len);
+  accountTopic(TopicDirection::Inbound, topic, data_len);
+  size_t slot;
+  {
+    std::lock_guard<std::mutex> lock(_subscriptionsLock);
+    const Subscription* sub = _subscriptions.match(topic);
+    if (!sub && _aggregation.enabled) {
+      // Wildcards on the wire may deliver more than the application asked for
+      _metrics.add(MqttCounter::DropFiltered);
+      return;
+    }
+    if (!_messageCallback) {
+      return;
+    }
+    // Attribute the callback time to the filter that brought the message in; its entry
+    // remembers the profiler slot, so only the first message looks the filter up
+    slot = sub ? profilerSlot(sub->filter.c_str(), sub->callbackSlot) : profilerSlot("(unmatched)", _unmatchedSlot);
+  }
+  uint32_t start = micros();
+  MQTT_TRACE_RECORD(traceId, Dispatch, start);
+  _messageCallback(topic, data, data_len);
+  uint32_t end = micros();
+  MQTT_TRACE_RECORD(traceId, HandlerDone, end);
+  finishCallback(slot, end - start);
+  _latency[static_cast<size_t>(MqttLatency::Dispatch)].record(end - receivedUs);
+}
 void MqttClient::loop() {
-  // No-op: esp-mqtt is event-driven
+  // esp-mqtt is event-driven; render deferred hot-path log entries off the event task
+  mqttLogFlush();
+  if (TrafficCapture* capture = _capture.load(std::memory_order_acquire)) {
+    capture->flush();
+  }
+#ifdef ESP_PLATFORM
+  uint32_t now = millis();
+  if (now - _appStackSampleMs >= 1000) {
+    _appStackSampleMs = now;
+    _metrics.recordAppStackFree(static_cast<int32_t>(uxTaskGetStackHighWaterMark(nullptr)));
+  }
+#endif
+  if (_statsIntervalMs) {
+    serviceStatsReport(millis());
+  }
+  if (_probeIntervalMs) {
+    serviceLinkProbe(millis());
+  }
+}
+
+void MqttClient::setLinkProbe(uint32_t intervalMs, uint8_t maxMissed, const char* topic) {
+  _probeIntervalMs = intervalMs;
+  _probeMaxMissed = maxMissed ? maxMissed : 1;
+  _probeMissed = 0;
+  _probeAwaitSeq.store(0, std::memory_order_relaxed);
+  free(_probeTopic);
+  _probeTopic = nullptr;
+  _probeDefaultTopic = !topic;
+  if (topic) {
+    _probeTopic = static_cast<char*>(malloc(strlen(topic) + 1));
+    if (_probeTopic) {
+      strcpy(_probeTopic, topic);
+    }
+  }
+  resolveProbeTopic();
+  if (_connected && _probeIntervalMs && _probeTopic) {
+    esp_mqtt_client_subscribe(static_cast<esp_mqtt_client_handle_t>(_client), _probeTopic, 0);
+  }
+}
+
+// The default probe topic depends on the client id; (re)build it on the application task
+// before the event task can compare against it
+void MqttClient::resolveProbeTopic() {
+  if (!_probeDefaultTopic || !_clientId) {
+    return;
+  }
+  int len = snprintf(nullptr, 0, "device/%s/mqtt/probe", _clientId);
+  char* topic = static_cast<char*>(realloc(_probeTopic, len + 1));
+  if (topic) {
+    snprintf(topic, len + 1, "device/%s/mqtt/probe", _clientId);
+    _probeTopic = topic;
+  }
+}
+
+void MqttClient::serviceLinkProbe(uint32_t nowMs) {
+  if (!_connected || !_probeTopic) {
+    _probeMissed = 0;
+    return;
+  }
+  if (nowMs - _probeLastMs < _probeIntervalMs) {
+    return;
+  }
+  _probeLastMs = nowMs;
+
+  if (_probeAwaitSeq.load(std::memory_order_acquire) != 0) {
+    if (++_probeMissed >= _probeMaxMissed) {
+      MQTT_LOGW("No answer to %u link probes, reconnecting", (unsigned)_probeMissed);
+      _probeMissed = 0;
+      _probeAwaitSeq.store(0, std::memory_order_relaxed);
+      _probeTimedOut.store(true);
+      esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+      esp_mqtt_client_disconnect(handle);
+      esp_mqtt_client_reconnect(handle);
+      return;
+    }
+  } else {
+    _probeMissed = 0;
+  }
+
+  char payload[12];
+  if (++_probeSeq == 0) {
+    _probeSeq = 1; // 0 means nothing outstanding
+  }
+  int len = snprintf(payload, sizeof(payload), "%u", (unsigned)_probeSeq);
+  _probeSentUs = micros();
+  _probeAwaitSeq.store(_probeSeq, std::memory_order_release);
+  esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+#ifdef MQTT_HAS_ENQUEUE
+  esp_mqtt_client_enqueue(handle, _probeTopic, payload, len, 0, 0, true);
+#else
+  esp_mqtt_client_publish(handle, _probeTopic, payload, len, 0, 0);
+#endif
+}
+
+// Runs on the event task. Returns true if the message was a probe echo (never dispatched).
+bool MqttClient::handleProbeEcho(const char* topic, const char* data, int data_len) {
+  if (!_probeTopic || strcmp(topic, _probeTopic) != 0) {
+    return false;
+  }
+  uint32_t now = micros();
+  uint32_t seq = data_len > 0 ? static_cast<uint32_t>(strtoul(data, nullptr, 10)) : 0;
+  uint32_t expected = _probeAwaitSeq.load(std::memory_order_acquire);
+  if (!seq || seq != expected) {
+    return true; // stale echo of a probe already given up on
+  }
+  uint32_t sentUs = _probeSentUs;
+  if (_probeAwaitSeq.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) {
+    _latency[static_cast<size_t>(MqttLatency::ProbeRtt)].record(now - sentUs);
+  }
+  return true;
+}
+
+void MqttClient::setStatsReport(uint32_t intervalMs, const char* topic) {
+  _statsIntervalMs = (intervalMs && intervalMs < kStatsMinIntervalMs) ? kStatsMinIntervalMs : intervalMs;
+  free(_statsTopic);
+  _statsTopic = nullptr;
+  if (topic) {
+    _statsTopic = static_cast<char*>(malloc(strlen(topic) + 1));
+    if (_statsTopic) {
+      strcpy(_statsTopic, topic);
+    }
+  }
+  _statsLastMs = millis();
+  _outboxPeak = -1;
+  _metrics.snapshot(_statsPrev);
+}
+
+void MqttClient::serviceStatsReport(uint32_t nowMs) {
+#ifdef MQTT_HAS_OUTBOX_SIZE
+  // Sample the outbox for the watermark at 10 Hz; it takes the esp-mqtt API lock
+  if (_client && nowMs - _statsSampleMs >= 100) {
+    _statsSampleMs = nowMs;
+    int32_t outbox = esp_mqtt_client_get_outbox_size(static_cast<esp_mqtt_client_handle_t>(_client));
+    if (outbox > _outboxPeak) {
+      _outboxPeak = outbox;
+    }
+  }
+#endif
+  if (!_connected || nowMs - _statsLastMs < _statsIntervalMs) {
+    return;
+  }
+  uint32_t intervalMs = nowMs - _statsLastMs;
+  _statsLastMs = nowMs;
+
+  MqttMetricsSnapshot current;
+  metrics(current);
+  if (current.outboxBytes > kStatsMaxBacklogBytes) {
+    // The report must never add to a backlog; try again next interval
+    MQTT_LOGD("Stats report skipped, outbox at %d bytes", (int)current.outboxBytes);
+    return;
+  }
+
+  MqttStatsReport report;
+  report.current = &current;
+  report.previous = &_statsPrev;
+  report.intervalMs = intervalMs;
+  report.uptimeS = millis() / 1000;
+  report.outboxPeak = _outboxPeak;
+#ifdef ESP_PLATFORM
+  report.heapFree = esp_get_free_heap_size();
+  report.heapMin = esp_get_minimum_free_heap_size();
+#endif
+  for (size_t i = 0; i < static_cast<size_t>(MqttLatency::Count); i++) {
+    report.latency[i] = &_latency[i];
+  }
+
+  char json[768];
+  int len = formatStatsReport(report, json, sizeof(json));
+  if (len < 0) {
+    return;
+  }
+
+  char defaultTopic[96];
+  const char* topic = _statsTopic;
+  if (!topic) {
+    snprintf(defaultTopic, sizeof(defaultTopic), "device/%s/mqtt/stats", _clientId ? _clientId : "unknown");
+    topic = defaultTopic;
+  }
+
+  esp_mqtt_client_handle_t handle = static_cast<esp_mqtt_client_handle_t>(_client);
+#ifdef MQTT_HAS_ENQUEUE
+  // QoS 0 through the outbox: sent by the esp-mqtt task, never waits on the network here
+  int msgId = esp_mqtt_client_enqueue(handle, topic, json, len, 0, 0, true);
+#else
+  int msgId = esp_mqtt_client_publish(handle, topic, json, len, 0, 0);
+#endif
+  if (msgId < 0) {
+    MQTT_LOGD("Stats report not queued");
+    return;
+  }
+  _statsPrev = current;
+  _outboxPeak = current.outboxBytes;
 }
 
 void MqttClient::buildUriIfNeeded() {
-  // Free previous URI if any
-  if (_uri) {
+  // The URI carries the scheme, so TLS and WebSocket transports are selected correctly
+  if (!(_useWebSocket || _secure || (_path && *_path))) {
     free(_uri);
     _uri = nullptr;
+    _uriCapacity = 0;
+    return;
   }
 
-  if (_useWebSocket || (_path && *_path)) {
-    // Build scheme
-    UriParts parts;
-    parts.scheme = _secure ? (_useWebSocket ? "wss" : "mqtts") : (_useWebSocket ? "ws" : "mqtt");
-    parts.host = _host ? _host : "";
-    parts.port = _port;
-    parts.path = _useWebSocket ? (_path ? _path : "/") : std::string();
-
-    std::string uri = buildMqttUri(parts);
-    _uri = static_cast<char*>(malloc(uri.size() + 1));
-    strcpy(_uri, uri.c_str());
+  const char* scheme = _secure ? (_useWebSocket ? "wss" : "mqtts") : (_useWebSocket ? "ws" : "mqtt");
+  const char* host = _host ? _host : "";
+  const char* path = _useWebSocket ? (_path ? _path : "/") : nullptr;
+  // Formatted straight into the kept buffer; it only grows for a longer URI
+  int len = formatMqttUri(_uri, _uriCapacity, scheme, host, _port, path);
+  if (len < 0) return;
+  if (static_cast<size_t>(len) + 1 > _uriCapacity) {
+    char* grown = static_cast<char*>(realloc(_uri, len + 1));
+    if (!grown) return;
+    _uri = grown;
+    _uriCapacity = len + 1;
+    formatMqttUri(_uri, _uriCapacity, scheme, host, _port, path);
   }
 }
\ No newline at end of file
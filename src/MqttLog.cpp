@@ -0,0 +1,186 @@
+#include "MqttLog.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static_assert((MQTT_LOG_RING_SIZE & (MQTT_LOG_RING_SIZE - 1)) == 0, "MQTT_LOG_RING_SIZE must be a power of two");
+
+static const char *levelPrefix(uint8_t level) {
+  switch (level) {
+    case MQTT_LOG_LEVEL_ERROR:
+      return "[MQTT][ERROR] ";
+    case MQTT_LOG_LEVEL_WARN:
+      return "[MQTT][WARNING] ";
+    case MQTT_LOG_LEVEL_INFO:
+      return "[MQTT][INFO] ";
+    case MQTT_LOG_LEVEL_DEBUG:
+      return "[MQTT][DEBUG] ";
+    default:
+      return "[MQTT][VERBOSE] ";
+  }
+}
+
+static void defaultSink(uint8_t level, const char *line) {
+#ifdef ARDUINO
+  Serial.print(levelPrefix(level));
+  Serial.println(line);
+#else
+  printf("%s%s\n", levelPrefix(level), line);
+#endif
+}
+
+static MqttLogSink s_sink = defaultSink;
+
+void mqttLogSetSink(MqttLogSink sink) {
+  s_sink = sink ? sink : defaultSink;
+}
+
+void mqttLogPrintf(uint8_t level, const char *fmt, ...) {
+  char line[192];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  s_sink(level, line);
+}
+
+// Multi-producer, multi-consumer ring. A producer claims a slot with fetch_add on s_head
+// and publishes it by storing its sequence number last. Consumers (every client's loop())
+// copy the entry at s_tail, check the sequence number is unchanged and only then claim
+// the entry by advancing s_tail with a CAS, so each entry is rendered once. Slots are
+// overwritten when producers lap the consumers, which the sequence numbers detect. The
+// fields are relaxed atomics bracketed by fences (a seqlock), so a copy racing a
+// producer is discarded rather than undefined. A writer from an earlier lap that
+// finishes last leaves its older sequence number in the slot; once every claimed entry
+// is written (s_done catches up with s_head) such a slot is skipped as lost instead of
+// waiting for an entry that will never appear.
+namespace {
+struct Entry {
+  std::atomic<uint32_t> seq;
+  std::atomic<uint32_t> timestampUs;
+  std::atomic<const char *> fmt;
+  std::atomic<uint32_t> args[3];
+  std::atomic<uint8_t> level;
+};
+
+Entry s_ring[MQTT_LOG_RING_SIZE];
+std::atomic<uint32_t> s_head(0);
+std::atomic<uint32_t> s_tail(0);
+std::atomic<uint32_t> s_done(0); // entries whose writer has finished
+std::atomic<uint32_t> s_lost(0);
+
+uint32_t nowUs() {
+#ifdef ARDUINO
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Skips the entry at `tail` as lost, unless another consumer moved on already
+void skipEntry(uint32_t tail, uint32_t count) {
+  if (s_tail.compare_exchange_strong(tail, tail + count, std::memory_order_acq_rel)) {
+    s_lost.fetch_add(count, std::memory_order_relaxed);
+  }
+}
+} // namespace
+
+void mqttLogDeferred(uint8_t level, const char *fmt, uint32_t a0, uint32_t a1, uint32_t a2) {
+  uint32_t index = s_head.fetch_add(1, std::memory_order_relaxed);
+  Entry &e = s_ring[index & (MQTT_LOG_RING_SIZE - 1)];
+  e.seq.store(0, std::memory_order_relaxed); // mark as being written
+  std::atomic_thread_fence(std::memory_order_release);
+  e.timestampUs.store(nowUs(), std::memory_order_relaxed);
+  e.fmt.store(fmt, std::memory_order_relaxed);
+  e.args[0].store(a0, std::memory_order_relaxed);
+  e.args[1].store(a1, std::memory_order_relaxed);
+  e.args[2].store(a2, std::memory_order_relaxed);
+  e.level.store(level, std::memory_order_relaxed);
+  e.seq.store(index + 1, std::memory_order_release);
+  s_done.fetch_add(1, std::memory_order_release);
+}
+
+// Copies the next complete entry into out and claims it. Returns false when the ring is drained.
+static bool popEntry(MqttLogRecord &out, const char *&fmt) {
+  while (true) {
+    uint32_t tail = s_tail.load(std::memory_order_acquire);
+    uint32_t head = s_head.load(std::memory_order_acquire);
+    if (tail == head) return false;
+    if (head - tail > MQTT_LOG_RING_SIZE) {
+      // Producers lapped the consumers
+      skipEntry(tail, head - tail - MQTT_LOG_RING_SIZE);
+      continue;
+    }
+
+    Entry &e = s_ring[tail & (MQTT_LOG_RING_SIZE - 1)];
+    uint32_t seq = e.seq.load(std::memory_order_acquire);
+    int32_t ahead = (int32_t)(seq - (tail + 1));
+    if (seq == 0 || ahead < 0) {
+      // Claimed but not written yet: retry on the next flush, unless all writers are done
+      if (s_done.load(std::memory_order_acquire) != head) return false;
+      skipEntry(tail, 1);
+      continue;
+    }
+    if (ahead > 0) {
+      // Slot already reused by a newer entry
+      skipEntry(tail, 1);
+      continue;
+    }
+
+    out.timestampUs = e.timestampUs.load(std::memory_order_relaxed);
+    fmt = e.fmt.load(std::memory_order_relaxed);
+    out.fmt = (uint32_t)(uintptr_t)fmt;
+    out.args[0] = e.args[0].load(std::memory_order_relaxed);
+    out.args[1] = e.args[1].load(std::memory_order_relaxed);
+    out.args[2] = e.args[2].load(std::memory_order_relaxed);
+    out.level = e.level.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (e.seq.load(std::memory_order_relaxed) != seq) {
+      // Overwritten while copying
+      skipEntry(tail, 1);
+      continue;
+    }
+    // Another consumer may have taken this entry meanwhile; then try the next one
+    if (s_tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel)) {
+      return true;
+    }
+  }
+}
+
+size_t mqttLogFlush(size_t maxEntries) {
+  MqttLogRecord record;
+  const char *fmt = nullptr;
+  size_t count = 0;
+  while (count < maxEntries && popEntry(record, fmt)) {
+    char line[160];
+    int len = snprintf(line, sizeof(line), "@%u ", (unsigned)record.timestampUs);
+    if (len > 0 && (size_t)len < sizeof(line)) {
+      snprintf(line + len, sizeof(line) - len, fmt, record.args[0], record.args[1], record.args[2]);
+    }
+    s_sink(record.level, line);
+    count++;
+  }
+  return count;
+}
+
+size_t mqttLogExport(MqttLogRecord *out, size_t maxRecords) {
+  const char *fmt = nullptr;
+  size_t count = 0;
+  while (count < maxRecords && popEntry(out[count], fmt)) {
+    count++;
+  }
+  return count;
+}
+
+uint32_t mqttLogLost() {
+  return s_lost.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,93 @@
+#include "MqttMetrics.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#ifndef ESP_PLATFORM
+namespace {
+thread_local size_t s_hostCore = 0;
+}
+
+void MqttMetrics::setHostCore(size_t core) {
+  s_hostCore = core % kCores;
+}
+#endif
+
+size_t MqttMetrics::currentCore() {
+#if defined(ESP_PLATFORM) && !CONFIG_FREERTOS_UNICORE
+  return xPortGetCoreID() % kCores;
+#elif defined(ESP_PLATFORM)
+  return 0;
+#else
+  return s_hostCore;
+#endif
+}
+
+void MqttMetrics::recordCallback(uint32_t elapsedUs) {
+  add(MqttCounter::CallbackCalls);
+  add(MqttCounter::CallbackTimeUs, elapsedUs);
+  uint32_t max = _callbackMaxUs.load(std::memory_order_relaxed);
+  while (elapsedUs > max && !_callbackMaxUs.compare_exchange_weak(max, elapsedUs, std::memory_order_relaxed)) {
+  }
+}
+
+void MqttMetrics::lower(std::atomic<int32_t> &gauge, int32_t value) {
+  int32_t current = gauge.load(std::memory_order_relaxed);
+  while ((current < 0 || value < current) &&
+         !gauge.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+void MqttMetrics::recordConnectHeap(int32_t lowBytes, int32_t usedBytes) {
+  lower(_connectHeapLow, lowBytes);
+  int32_t current = _connectHeapUsed.load(std::memory_order_relaxed);
+  while (usedBytes > current && !_connectHeapUsed.compare_exchange_weak(current, usedBytes, std::memory_order_relaxed)) {
+  }
+}
+
+void MqttMetrics::snapshot(MqttMetricsSnapshot &out) const {
+  for (size_t i = 0; i < static_cast<size_t>(MqttCounter::Count); i++) {
+    uint32_t sum = 0;
+    for (size_t core = 0; core < kCores; core++) {
+      sum += _cores[core].values[i].load(std::memory_order_relaxed);
+    }
+    out.counters[i] = sum;
+  }
+  out.inFlight = _inFlight.load(std::memory_order_relaxed);
+  out.outboxBytes = -1;
+  out.callbackMaxUs = _callbackMaxUs.load(std::memory_order_relaxed);
+  out.eventStackFree = _eventStackFree.load(std::memory_order_relaxed);
+  out.appStackFree = _appStackFree.load(std::memory_order_relaxed);
+  out.heapFreeMin = -1;
+  out.connectHeapLow = _connectHeapLow.load(std::memory_order_relaxed);
+  out.connectHeapUsed = _connectHeapUsed.load(std::memory_order_relaxed);
+}
+
+// Resets counters and the callback maximum; the in-flight gauge tracks live state and is kept
+void MqttMetrics::reset() {
+  for (size_t core = 0; core < kCores; core++) {
+    for (size_t i = 0; i < static_cast<size_t>(MqttCounter::Count); i++) {
+      _cores[core].values[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  _callbackMaxUs.store(0, std::memory_order_relaxed);
+}
+
+MqttMetrics &MqttMetrics::operator=(const MqttMetrics &other) {
+  if (this == &other) return *this;
+  for (size_t core = 0; core < kCores; core++) {
+    for (size_t i = 0; i < static_cast<size_t>(MqttCounter::Count); i++) {
+      _cores[core].values[i].store(other._cores[core].values[i].load(std::memory_order_relaxed),
+                                   std::memory_order_relaxed);
+    }
+  }
+  _inFlight.store(other._inFlight.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _callbackMaxUs.store(other._callbackMaxUs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _eventStackFree.store(other._eventStackFree.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _appStackFree.store(other._appStackFree.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _connectHeapLow.store(other._connectHeapLow.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  _connectHeapUsed.store(other._connectHeapUsed.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  return *this;
+}
@@ -0,0 +1,74 @@
+#include "StatsReport.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace {
+struct Writer {
+  char *buf;
+  size_t len;
+  size_t pos;
+  bool ok;
+
+  void append(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!ok) return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + pos, len - pos, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= len - pos) {
+      ok = false;
+      return;
+    }
+    pos += n;
+  }
+};
+} // namespace
+
+int formatStatsReport(const MqttStatsReport &report, char *buf, size_t len) {
+  if (!report.current || !buf || !len) return -1;
+
+  const MqttMetricsSnapshot &cur = *report.current;
+  auto delta = [&](MqttCounter counter) -> unsigned {
+    uint32_t value = cur.get(counter);
+    return (unsigned)(report.previous ? value - report.previous->get(counter) : value);
+  };
+  auto total = [&](MqttCounter counter) -> unsigned { return (unsigned)cur.get(counter); };
+
+  Writer w = {buf, len, 0, true};
+  w.append("{\"up\":%u,\"dt\":%u", (unsigned)report.uptimeS, (unsigned)report.intervalMs);
+  w.append(",\"in\":%u,\"out\":%u,\"bin\":%u,\"bout\":%u,\"ack\":%u", delta(MqttCounter::MessagesIn),
+           delta(MqttCounter::MessagesOut), delta(MqttCounter::BytesIn), delta(MqttCounter::BytesOut),
+           delta(MqttCounter::PublishAcked));
+  w.append(",\"drop\":{\"nc\":%u,\"pub\":%u,\"flt\":%u,\"big\":%u,\"exp\":%u}", delta(MqttCounter::DropNotConnected),
+           delta(MqttCounter::DropPublishFailed), delta(MqttCounter::DropFiltered), delta(MqttCounter::DropOversize),
+           delta(MqttCounter::DropExpired));
+  w.append(",\"conn\":%u,\"att\":%u,\"disc\":{\"clean\":%u,\"tcp\":%u,\"ref\":%u,\"to\":%u}",
+           total(MqttCounter::Connects), total(MqttCounter::ConnectAttempts), total(MqttCounter::DisconnectClean),
+           total(MqttCounter::DisconnectTransport), total(MqttCounter::DisconnectRefused),
+           total(MqttCounter::DisconnectTimeout));
+  w.append(",\"q\":{\"inflight\":%d,\"outbox\":%d,\"outbox_max\":%d}", (int)cur.inFlight, (int)cur.outboxBytes,
+           (int)report.outboxPeak);
+  if (report.heapFree) {
+    w.append(",\"heap\":%u,\"heap_min\":%u", (unsigned)report.heapFree, (unsigned)report.heapMin);
+  }
+  if (cur.connectHeapLow >= 0) {
+    w.append(",\"heap_conn\":{\"low\":%d,\"used\":%d}", (int)cur.connectHeapLow, (int)cur.connectHeapUsed);
+  }
+  if (cur.eventStackFree >= 0 || cur.appStackFree >= 0) {
+    w.append(",\"stack\":{\"evt\":%d,\"app\":%d}", (int)cur.eventStackFree, (int)cur.appStackFree);
+  }
+
+  static const char *const kNames[MqttStatsReport::kLatencyKinds] = {"connect", "puback", "dispatch", "rtt"};
+  bool first = true;
+  for (size_t i = 0; i < MqttStatsReport::kLatencyKinds; i++) {
+    const LatencyHistogram *h = report.latency[i];
+    if (!h) continue;
+    w.append("%s\"%s\":{\"n\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}", first ? ",\"lat\":{" : ",", kNames[i],
+             (unsigned)h->count(), (unsigned)h->percentile(50), (unsigned)h->percentile(99), (unsigned)h->max());
+    first = false;
+  }
+  if (!first) w.append("}");
+  w.append("}");
+  return w.ok ? (int)w.pos : -1;
+}
@@ -0,0 +1,224 @@
+#include "SubscriptionRegistry.h"
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+bool topicMatchesFilter(const char *filter, const char *topic) {
+  if (!filter || !topic) return false;
+  // Wildcards in the first level never match '$' topics ($SYS, ...)
+  if (*topic == '$' && (*filter == '+' || *filter == '#')) return false;
+
+  while (*filter) {
+    if (*filter == '#') return true; // matches the parent level and everything below
+    if (*filter == '+') {
+      while (*topic && *topic != '/') topic++;
+      filter++;
+    } else {
+      while (*filter && *filter != '/') {
+        if (*filter != *topic) return false;
+        filter++;
+        topic++;
+      }
+      if (*topic && *topic != '/') return false;
+    }
+
+    if (*filter == '/') {
+      if (*topic != '/') {
+        // "a/#" also matches "a"
+        return *topic == '\0' && filter[1] == '#' && filter[2] == '\0';
+      }
+      filter++;
+      topic++;
+    } else {
+      return *topic == '\0';
+    }
+  }
+  return *topic == '\0';
+}
+
+bool filterCovers(const char *general, const char *specific) {
+  if (!general || !specific) return false;
+  // Same rule as topic matching: first-level wildcards do not reach '$' topics
+  if (*specific == '$' && (*general == '+' || *general == '#')) return false;
+
+  while (true) {
+    if (*general == '#') return true;
+    if (*specific == '#') return false; // only '#' covers '#'
+
+    if (*general == '+') {
+      while (*specific && *specific != '/') specific++;
+      general++;
+    } else {
+      while (*general && *general != '/') {
+        if (*general != *specific) return false;
+        general++;
+        specific++;
+      }
+      if (*specific && *specific != '/') return false;
+    }
+
+    if (*general == '\0') return *specific == '\0';
+    // general continues with '/'
+    if (*specific == '\0') {
+      // "a/#" covers "a"
+      return general[1] == '#' && general[2] == '\0';
+    }
+    general++;
+    specific++;
+  }
+}
+
+bool isValidTopicFilter(const char *filter) {
+  if (!filter || !*filter) return false;
+  for (const char *p = filter; *p; p++) {
+    if (*p == '#') {
+      if (p != filter && p[-1] != '/') return false;
+      if (p[1] != '\0') return false;
+    } else if (*p == '+') {
+      if (p != filter && p[-1] != '/') return false;
+      if (p[1] != '\0' && p[1] != '/') return false;
+    }
+  }
+  return true;
+}
+
+Subscription *SubscriptionRegistry::add(const char *filter, uint8_t qos) {
+  if (!isValidTopicFilter(filter)) return nullptr;
+  if (qos > 2) qos = 2;
+
+  Subscription *existing = find(filter);
+  if (existing) {
+    if (existing->qos != qos) {
+      existing->qos = qos;
+      existing->active = false; // needs a new SUBSCRIBE with the new QoS
+    }
+    return existing;
+  }
+
+  Subscription sub;
+  sub.filter = filter;
+  sub.qos = qos;
+  _subs.push_back(sub);
+  return &_subs.back();
+}
+
+bool SubscriptionRegistry::remove(const char *filter) {
+  for (size_t i = 0; i < _subs.size(); i++) {
+    if (_subs[i].filter == filter) {
+      _subs.erase(_subs.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+Subscription *SubscriptionRegistry::find(const char *filter) {
+  if (!filter) return nullptr;
+  for (auto &sub : _subs) {
+    if (sub.filter == filter) return &sub;
+  }
+  return nullptr;
+}
+
+void SubscriptionRegistry::markAllInactive() {
+  for (auto &sub : _subs) sub.active = false;
+}
+
+void SubscriptionRegistry::markAllActive() {
+  for (auto &sub : _subs) sub.active = true;
+}
+
+const Subscription *SubscriptionRegistry::match(const char *topic) const {
+  for (const auto &sub : _subs) {
+    if (topicMatchesFilter(sub.filter.c_str(), topic)) return &sub;
+  }
+  return nullptr;
+}
+
+static void splitLevels(const std::string &filter, std::vector<std::string> &levels) {
+  levels.clear();
+  size_t start = 0;
+  while (true) {
+    size_t pos = filter.find('/', start);
+    levels.push_back(filter.substr(start, pos == std::string::npos ? std::string::npos : pos - start));
+    if (pos == std::string::npos) break;
+    start = pos + 1;
+  }
+}
+
+static bool isWildcardLevel(const std::string &level) { return level == "+" || level == "#"; }
+
+// Drop filters covered by another one, raising the coverer's QoS as needed
+static void removeCovered(std::vector<Subscription> &filters) {
+  for (size_t i = 0; i < filters.size(); i++) {
+    for (size_t j = 0; j < filters.size(); j++) {
+      if (i == j || !filterCovers(filters[i].filter.c_str(), filters[j].filter.c_str())) continue;
+      filters[i].qos = std::max(filters[i].qos, filters[j].qos);
+      filters.erase(filters.begin() + j);
+      if (j < i) i--;
+      j--;
+    }
+  }
+}
+
+// Collapse the largest group of filters differing only in one literal level. Returns false if
+// no group reaches minSiblings.
+static bool collapseLargestGroup(std::vector<Subscription> &filters, uint8_t minSiblings) {
+  std::map<std::string, size_t> groups; // filter with one literal level replaced by '+' -> size
+  std::vector<std::string> levels;
+  std::string key;
+
+  for (const auto &sub : filters) {
+    splitLevels(sub.filter, levels);
+    if (levels[0].size() && levels[0][0] == '$') continue;
+    for (size_t l = 0; l < levels.size(); l++) {
+      if (isWildcardLevel(levels[l])) continue;
+      key.clear();
+      for (size_t k = 0; k < levels.size(); k++) {
+        if (k) key += '/';
+        key += (k == l) ? std::string("+") : levels[k];
+      }
+      groups[key]++;
+    }
+  }
+
+  const std::string *bestKey = nullptr;
+  size_t bestCount = 0;
+  for (const auto &group : groups) {
+    if (group.second > bestCount) {
+      bestCount = group.second;
+      bestKey = &group.first;
+    }
+  }
+  if (!bestKey || bestCount < minSiblings || bestCount < 2) return false;
+
+  Subscription collapsed;
+  collapsed.filter = *bestKey;
+  for (size_t j = 0; j < filters.size(); j++) {
+    if (filterCovers(bestKey->c_str(), filters[j].filter.c_str())) {
+      collapsed.qos = std::max(collapsed.qos, filters[j].qos);
+      filters.erase(filters.begin() + j);
+      j--;
+    }
+  }
+  filters.push_back(collapsed);
+  return true;
+}
+
+void aggregateFilters(const SubscriptionRegistry &registry, const AggregationPolicy &policy,
+                      std::vector<Subscription> &out) {
+  out.clear();
+  for (size_t i = 0; i < registry.size(); i++) {
+    Subscription sub;
+    sub.filter = registry.at(i).filter;
+    sub.qos = registry.at(i).qos;
+    out.push_back(sub);
+  }
+  if (!policy.enabled) return;
+
+  removeCovered(out);
+  while (collapseLargestGroup(out, policy.minSiblings)) {
+    removeCovered(out);
+  }
+}
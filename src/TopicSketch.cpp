@@ -0,0 +1,70 @@
+#include "TopicSketch.h"
+
+#include <string.h>
+
+uint32_t TopicSketch::hash(const char *topic) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  while (*topic) {
+    h ^= (uint8_t)*topic++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void TopicSketch::add(const char *topic, uint32_t bytes) {
+  uint32_t h = hash(topic);
+  for (size_t i = 0; i < _used; i++) {
+    TopicCount &e = _entries[i];
+    if (e.hash == h) {
+      e.messages++;
+      e.bytes += bytes;
+      return;
+    }
+  }
+
+  TopicCount *slot;
+  uint32_t baseMessages = 0;
+  uint32_t baseBytes = 0;
+  if (_used < kCapacity) {
+    slot = &_entries[_used++];
+  } else {
+    // Evict the lightest entry; the newcomer inherits its counts as error
+    slot = &_entries[0];
+    for (size_t i = 1; i < kCapacity; i++) {
+      if (_entries[i].bytes < slot->bytes) slot = &_entries[i];
+    }
+    baseMessages = slot->messages;
+    baseBytes = slot->bytes;
+  }
+
+  strncpy(slot->topic, topic, sizeof(slot->topic) - 1);
+  slot->topic[sizeof(slot->topic) - 1] = '\0';
+  slot->hash = h;
+  slot->messages = baseMessages + 1;
+  slot->bytes = baseBytes + bytes;
+  slot->errorBytes = baseBytes;
+  slot->errorMessages = baseMessages;
+}
+
+size_t TopicSketch::top(TopicCount *out, size_t max) const {
+  size_t count = 0;
+  for (size_t i = 0; i < _used; i++) {
+    const TopicCount &e = _entries[i];
+    size_t pos = count;
+    while (pos > 0 && out[pos - 1].bytes < e.bytes) {
+      if (pos < max) out[pos] = out[pos - 1];
+      pos--;
+    }
+    if (pos < max) {
+      out[pos] = e;
+      if (count < max) count++;
+    }
+  }
+  return count;
+}
+
+void TopicSketch::clear() {
+  memset(_entries, 0, sizeof(_entries));
+  _used = 0;
+}
@@ -0,0 +1,200 @@
+#include "TrafficCapture.h"
+
+#include <string.h>
+
+static const uint8_t kMagic[4] = {'M', 'Q', 'T', 'C'};
+static const uint8_t kFlagRetain = 0x10;
+static const uint8_t kFlagTruncated = 0x20;
+static const size_t kMaxRecordHeader = 1 + 4 * 10; // event byte and four varints
+
+const char* captureEventName(CaptureEvent event) {
+  switch (event) {
+    case CaptureEvent::Inbound:
+      return "inbound";
+    case CaptureEvent::Outbound:
+      return "outbound";
+    case CaptureEvent::Acked:
+      return "acked";
+    case CaptureEvent::Connected:
+      return "connected";
+    case CaptureEvent::Disconnected:
+      return "disconnected";
+    case CaptureEvent::Dropped:
+      return "dropped";
+    default:
+      return "unknown";
+  }
+}
+
+static size_t putVarint(uint8_t* out, uint64_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(value);
+  return n;
+}
+
+TrafficCapture::TrafficCapture(size_t bufferSize)
+    : _ring(new uint8_t[bufferSize]),
+      _size(bufferSize),
+      _head(0),
+      _used(0),
+      _maxPayload(256),
+      _active(false),
+      _lastUs(0),
+      _lost(0) {}
+
+TrafficCapture::~TrafficCapture() {
+  delete[] _ring;
+}
+
+void TrafficCapture::start(uint32_t nowUs) {
+  std::lock_guard<std::mutex> lock(_lock);
+  _head = 0;
+  _used = 0;
+  _lastUs = nowUs;
+  _lost.store(0, std::memory_order_relaxed);
+  uint8_t header[kHeaderSize] = {kMagic[0], kMagic[1], kMagic[2], kMagic[3], kVersion, 0, 0, 0};
+  if (_size >= sizeof(header)) {
+    put(header, sizeof(header));
+    _active.store(true, std::memory_order_relaxed);
+  }
+}
+
+void TrafficCapture::stop() {
+  _active.store(false, std::memory_order_relaxed);
+}
+
+void TrafficCapture::put(const uint8_t* data, size_t len) {
+  while (len) {
+    size_t n = _size - _head;
+    if (n > len) n = len;
+    memcpy(_ring + _head, data, n);
+    _head = (_head + n) % _size;
+    _used += n;
+    data += n;
+    len -= n;
+  }
+}
+
+void TrafficCapture::record(uint32_t nowUs, CaptureEvent event, const char* topic, size_t topicLen,
+                            const void* payload, size_t length, int qos, bool retain, int msgId) {
+  recordHead(nowUs, event, topic, topicLen, payload, length, length, qos, retain, msgId);
+}
+
+void TrafficCapture::recordHead(uint32_t nowUs, CaptureEvent event, const char* topic, size_t topicLen,
+                                const void* head, size_t headLen, size_t length, int qos, bool retain,
+                                int msgId) {
+  if (!active()) return;
+  if (!topic) topicLen = 0;
+  size_t stored = head ? (headLen < length ? headLen : length) : 0;
+  if (stored > _maxPayload) stored = _maxPayload;
+  bool truncated = stored < length;
+
+  std::lock_guard<std::mutex> lock(_lock);
+  // Another task may have stamped its event earlier but taken the lock later
+  int32_t delta = static_cast<int32_t>(nowUs - _lastUs);
+  if (delta < 0) delta = 0;
+
+  uint8_t header[kMaxRecordHeader];
+  size_t n = 0;
+  header[n++] = static_cast<uint8_t>(event) | (retain ? kFlagRetain : 0) | (truncated ? kFlagTruncated : 0) |
+                static_cast<uint8_t>((qos & 3) << 6);
+  n += putVarint(header + n, static_cast<uint32_t>(delta));
+  n += putVarint(header + n, static_cast<uint32_t>(msgId > 0 ? msgId : 0));
+  n += putVarint(header + n, topicLen);
+  n += putVarint(header + n, length);
+  if (truncated) n += putVarint(header + n, stored);
+
+  if (n + topicLen + stored > _size - _used) {
+    _lost.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  _lastUs += static_cast<uint32_t>(delta);
+  put(header, n);
+  put(reinterpret_cast<const uint8_t*>(topic), topicLen);
+  put(static_cast<const uint8_t*>(head), stored);
+}
+
+size_t TrafficCapture::flush() {
+  if (!_sink) return 0;
+  size_t written = 0;
+  uint8_t chunk[256];
+  for (;;) {
+    size_t n;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      if (!_used) break;
+      size_t tail = (_head + _size - _used) % _size;
+      n = _size - tail;
+      if (n > _used) n = _used;
+      if (n > sizeof(chunk)) n = sizeof(chunk);
+      memcpy(chunk, _ring + tail, n);
+      _used -= n;
+    }
+    // Outside the lock: the sink may block on flash or a UART
+    _sink(chunk, n);
+    written += n;
+  }
+  return written;
+}
+
+size_t TrafficCapture::pending() const {
+  std::lock_guard<std::mutex> lock(_lock);
+  return _used;
+}
+
+CaptureReader::CaptureReader(const uint8_t* data, size_t len)
+    : _data(data), _len(len), _pos(0), _timeUs(0), _valid(false) {
+  if (len >= TrafficCapture::kHeaderSize && memcmp(data, kMagic, sizeof(kMagic)) == 0 &&
+      data[4] == TrafficCapture::kVersion) {
+    _valid = true;
+    _pos = TrafficCapture::kHeaderSize;
+  } else {
+    _pos = len;
+  }
+}
+
+bool CaptureReader::readVarint(uint64_t& out) {
+  out = 0;
+  for (unsigned shift = 0; shift < 64 && _pos < _len; shift += 7) {
+    uint8_t byte = _data[_pos++];
+    out |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+bool CaptureReader::next(CaptureRecord& out) {
+  if (_pos >= _len) return false;
+  size_t start = _pos;
+  uint8_t flags = _data[_pos++];
+  uint64_t delta, msgId, topicLen, length, stored;
+  bool ok = readVarint(delta) && readVarint(msgId) && readVarint(topicLen) && readVarint(length);
+  bool truncated = flags & kFlagTruncated;
+  stored = length;
+  if (ok && truncated) ok = readVarint(stored);
+  if (!ok || (flags & 0x0F) >= static_cast<uint8_t>(CaptureEvent::Count) || stored > length ||
+      topicLen > _len - _pos || stored > _len - _pos - topicLen) {
+    _pos = start; // leave corrupt() true
+    return false;
+  }
+
+  _timeUs += delta;
+  out.event = static_cast<CaptureEvent>(flags & 0x0F);
+  out.qos = flags >> 6;
+  out.retain = flags & kFlagRetain;
+  out.truncated = truncated;
+  out.timeUs = _timeUs;
+  out.msgId = static_cast<int>(msgId);
+  out.topic = reinterpret_cast<const char*>(_data + _pos);
+  out.topicLen = static_cast<size_t>(topicLen);
+  _pos += out.topicLen;
+  out.payload = _data + _pos;
+  out.storedLen = static_cast<size_t>(stored);
+  out.payloadLen = static_cast<size_t>(length);
+  _pos += out.storedLen;
+  return true;
+}
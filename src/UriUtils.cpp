@@ -1,76 +1,107 @@
 #include "UriUtils.h"
 
-#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
 
-static inline std::string toLower(std::string s) {
-  std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char)tolower(c); });
-  return s;
+static bool schemeIs(const char *scheme, size_t len, const char *name) {
+  return len == strlen(name) && strncasecmp(scheme, name, len) == 0;
 }
 
-static uint16_t defaultPortForScheme(const std::string &scheme) {
-  if (scheme == "mqtt") return 1883;
-  if (scheme == "mqtts") return 8883;
-  if (scheme == "ws") return 80;
-  if (scheme == "wss") return 443;
+static uint16_t defaultPortForScheme(const char *scheme, size_t len) {
+  if (schemeIs(scheme, len, "mqtt")) return 1883;
+  if (schemeIs(scheme, len, "mqtts")) return 8883;
+  if (schemeIs(scheme, len, "ws")) return 80;
+  if (schemeIs(scheme, len, "wss")) return 443;
   return 0;
 }
 
-bool parseMqttUri(const std::string &uri, UriParts &out) {
-  // Expect scheme://host[:port][/path]
-  auto posScheme = uri.find("://");
-  if (posScheme == std::string::npos) return false;
+bool UriView::isWebSocket() const {
+  return schemeIs(scheme, schemeLen, "ws") || schemeIs(scheme, schemeLen, "wss");
+}
 
-  out.scheme = toLower(uri.substr(0, posScheme));
+bool UriView::isSecure() const {
+  return schemeIs(scheme, schemeLen, "mqtts") || schemeIs(scheme, schemeLen, "wss");
+}
 
-  std::string rest = uri.substr(posScheme + 3);
+bool parseMqttUri(const char *uri, UriView &out) {
+  out = UriView();
+  if (!uri) return false;
+  // Expect scheme://host[:port][/path]
+  const char *sep = strstr(uri, "://");
+  if (!sep) return false;
+  out.scheme = uri;
+  out.schemeLen = sep - uri;
 
-  // Find path start
-  auto posSlash = rest.find('/');
-  std::string authority = posSlash == std::string::npos ? rest : rest.substr(0, posSlash);
-  out.path = posSlash == std::string::npos ? std::string() : rest.substr(posSlash);
+  const char *authority = sep + 3;
+  const char *slash = strchr(authority, '/');
+  const char *authorityEnd = slash ? slash : authority + strlen(authority);
 
   // Split host:port
-  auto posColon = authority.rfind(':');
-  if (posColon != std::string::npos) {
-    out.host = authority.substr(0, posColon);
-    std::string portStr = authority.substr(posColon + 1);
-    out.port = (uint16_t)std::max(0, std::stoi(portStr));
-  } else {
-    out.host = authority;
-    out.port = 0; // will set default later
+  const char *colon = nullptr;
+  for (const char *p = authority; p < authorityEnd; p++) {
+    if (*p == ':') colon = p;
+  }
+  out.host = authority;
+  out.hostLen = (colon ? colon : authorityEnd) - authority;
+  if (colon) {
+    uint32_t port = 0;
+    for (const char *p = colon + 1; p < authorityEnd; p++) {
+      if (*p < '0' || *p > '9') return false;
+      port = port * 10 + (*p - '0');
+      if (port > 65535) return false;
+    }
+    out.port = static_cast<uint16_t>(port);
   }
-
   if (out.port == 0) {
-    out.port = defaultPortForScheme(out.scheme);
+    out.port = defaultPortForScheme(out.scheme, out.schemeLen);
   }
 
-  // Normalize empty path
-  if (!out.isWebSocket()) {
-    out.path.clear();
-  } else {
-    if (out.path.empty()) out.path = "/"; // WebSocket path defaults to "/"
+  // Only WebSocket transports carry a path, which defaults to "/"
+  if (out.isWebSocket()) {
+    if (slash) {
+      out.path = slash;
+      out.pathLen = strlen(slash);
+    } else {
+      out.path = "/";
+      out.pathLen = 1;
+    }
   }
 
-  return !out.scheme.empty() && !out.host.empty();
+  return out.schemeLen > 0 && out.hostLen > 0;
 }
 
-std::string buildMqttUri(const UriParts &parts) {
-  std::string uri;
-  uri.reserve(32 + parts.host.size() + parts.path.size());
-  uri += parts.scheme;
-  uri += "://";
-  uri += parts.host;
-  if (parts.port != 0 && parts.port != defaultPortForScheme(parts.scheme)) {
-    uri += ":";
-    uri += std::to_string(parts.port);
+bool parseMqttUri(const std::string &uri, UriParts &out) {
+  UriView view;
+  if (!parseMqttUri(uri.c_str(), view)) return false;
+  out.scheme.assign(view.scheme, view.schemeLen);
+  for (char &c : out.scheme) c = (char)tolower((unsigned char)c);
+  out.host.assign(view.host, view.hostLen);
+  out.port = view.port;
+  out.path.assign(view.path ? view.path : "", view.pathLen);
+  return true;
+}
+
+int formatMqttUri(char *buf, size_t len, const char *scheme, const char *host, uint16_t port, const char *path) {
+  char portText[8] = "";
+  if (port != 0 && port != defaultPortForScheme(scheme, strlen(scheme))) {
+    snprintf(portText, sizeof(portText), ":%u", (unsigned)port);
   }
-  if (parts.isWebSocket()) {
-    if (!parts.path.empty()) {
-      if (parts.path[0] != '/') uri += "/"; // ensure leading slash
-      uri += parts.path;
-    } else {
-      uri += "/";
-    }
+  const char *pathText = "";
+  const char *slash = "";
+  if (schemeIs(scheme, strlen(scheme), "ws") || schemeIs(scheme, strlen(scheme), "wss")) {
+    pathText = path ? path : "";
+    if (pathText[0] != '/') slash = "/"; // ensure leading slash
+  }
+  return snprintf(buf, len, "%s://%s%s%s%s", scheme, host, portText, slash, pathText);
+}
+
+std::string buildMqttUri(const UriParts &parts) {
+  int len = formatMqttUri(nullptr, 0, parts.scheme.c_str(), parts.host.c_str(), parts.port, parts.path.c_str());
+  std::string uri(len > 0 ? len : 0, '\0');
+  if (len > 0) {
+    formatMqttUri(&uri[0], uri.size() + 1, parts.scheme.c_str(), parts.host.c_str(), parts.port, parts.path.c_str());
   }
   return uri;
 }
@@ -43,11 +43,43 @@ void test_build_ws_uri() {
   TEST_ASSERT_EQUAL_STRING("ws://broker.example.com:8080/mqtt", uri.c_str());
 }
 
+void test_parse_view_without_allocation() {
+  const char *uri = "WSS://iot.example.com:8884/mqtt";
+  UriView view;
+  TEST_ASSERT_TRUE(parseMqttUri(uri, view));
+  TEST_ASSERT_TRUE(view.isWebSocket());
+  TEST_ASSERT_TRUE(view.isSecure());
+  TEST_ASSERT_TRUE(view.host == uri + 6); // points into the input
+  TEST_ASSERT_EQUAL_UINT(15, view.hostLen);
+  TEST_ASSERT_EQUAL_UINT16(8884, view.port);
+  TEST_ASSERT_EQUAL_UINT(5, view.pathLen);
+  TEST_ASSERT_EQUAL_MEMORY("/mqtt", view.path, 5);
+
+  TEST_ASSERT_FALSE(parseMqttUri("mqtt://host:http", view));
+  TEST_ASSERT_FALSE(parseMqttUri("mqtt://host:70000", view));
+  TEST_ASSERT_FALSE(parseMqttUri("mqtt://:1883", view));
+  TEST_ASSERT_TRUE(parseMqttUri("mqtt://host:", view));
+  TEST_ASSERT_EQUAL_UINT16(1883, view.port);
+}
+
+void test_format_uri_into_buffer() {
+  char buf[64];
+  TEST_ASSERT_EQUAL_INT(26, formatMqttUri(buf, sizeof(buf), "wss", "iot.example.com", 443, "mqtt"));
+  TEST_ASSERT_EQUAL_STRING("wss://iot.example.com/mqtt", buf);
+  TEST_ASSERT_EQUAL_INT(19, formatMqttUri(buf, sizeof(buf), "mqtts", "broker", 8884, "/ignored"));
+  TEST_ASSERT_EQUAL_STRING("mqtts://broker:8884", buf);
+  // Truncated output still reports the full length
+  TEST_ASSERT_EQUAL_INT(18, formatMqttUri(buf, 8, "mqtt", "broker", 1884, nullptr));
+  TEST_ASSERT_EQUAL_STRING("mqtt://", buf);
+}
+
 int main(int argc, char **argv) {
   UNITY_BEGIN();
   RUN_TEST(test_parse_ws_with_path);
   RUN_TEST(test_parse_wss_default_port_and_path_default);
   RUN_TEST(test_parse_mqtt_no_path);
   RUN_TEST(test_build_ws_uri);
+  RUN_TEST(test_parse_view_without_allocation);
+  RUN_TEST(test_format_uri_into_buffer);
   return UNITY_END();
 }
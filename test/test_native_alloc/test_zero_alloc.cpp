@@ -0,0 +1,187 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Arduino.h>
+#include "AllocCounter.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "MqttHost.h"
+
+// Steady-state allocation guarantee: once connected and warmed up, publishing, receiving
+// and loop() (stats report, link probe, topic accounting) make no heap allocations.
+// The client is stepped on the test thread, so the thread's counts cover MqttClient; the
+// esp-mqtt stand-in exempts its own work (see AllocCounter.h).
+
+void setUp() {
+  mqttHostSetManualStep(true);
+}
+
+void tearDown() {
+  mqttHostSetManualStep(false);
+  mqttHostSetDefaultReconnectMs(0);
+}
+
+void test_hooks_count_this_thread() {
+  if (!allocHooksActive()) {
+    TEST_IGNORE_MESSAGE("allocation hooks are off in this build");
+  }
+  AllocCounts before = allocThreadCounts();
+  void* p = malloc(40);
+  free(p);
+  {
+    AllocExempt exempt;
+    free(malloc(40));
+    AllocCounted counted;
+    delete new int(1);
+  }
+  AllocCounts after = allocThreadCounts();
+  TEST_ASSERT_EQUAL_UINT64(2, after.allocs - before.allocs);
+  TEST_ASSERT_GREATER_OR_EQUAL(40 + sizeof(int), after.bytes - before.bytes);
+}
+
+struct Traffic {
+  MqttClient& client;
+  uint32_t received = 0;
+  uint32_t sent = 0;
+
+  // One round: QoS 0 and QoS 1 publishes to a topic the client subscribes itself, so the
+  // receive path (including the QoS 1 PUBACK) runs as well
+  void pump(uint32_t ms) {
+    static const char payload[] = "{\"t\":21.5,\"h\":40,\"seq\":12345}";
+    uint32_t start = millis();
+    while (millis() - start < ms) {
+      TEST_ASSERT_TRUE(client.publishQos("alloc/telemetry", payload, static_cast<int>((sent / 2) & 1)) >= 0);
+      const uint8_t blob[4] = {1, 2, 3, 4};
+      TEST_ASSERT_TRUE(client.publishQos("alloc/blob", blob, sizeof(blob), 0) >= 0);
+      sent += 2;
+      mqttHostStep(1);
+      client.loop();
+    }
+  }
+};
+
+void test_steady_state_publish_and_receive_do_not_allocate() {
+  if (!allocHooksActive()) {
+    TEST_IGNORE_MESSAGE("allocation hooks are off in this build");
+  }
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("alloc-broker"));
+  MqttClient client;
+  client.setServer("alloc-broker", 1883);
+  client.setTopicAccounting(true);
+  client.setStatsReport(1000);
+  client.setLinkProbe(1000);
+  Traffic traffic{client};
+  client.onMessage([&](const char* topic, const char* payload, size_t length) {
+    if (topic[0] == 'a' && payload && length) traffic.received++;
+  });
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("alloc/#", 1));
+  TEST_ASSERT_TRUE(client.connect("alloc-client"));
+  for (int i = 0; i < 200 && !client.isConnected(); i++) mqttHostStep(5);
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  // Warm-up: lazily created state (profiler slots, sketch entries, histogram buckets)
+  // and at least one stats report and link probe
+  traffic.pump(1200);
+  TEST_ASSERT_GREATER_THAN(100, traffic.received);
+
+  uint32_t receivedBefore = traffic.received;
+  MqttMetricsSnapshot before;
+  client.metrics(before);
+  AllocCounts start = allocThreadCounts();
+  traffic.pump(1500); // spans another stats report and probe
+  AllocCounts end = allocThreadCounts();
+
+  MqttMetricsSnapshot after;
+  client.metrics(after);
+  TEST_ASSERT_GREATER_THAN(100, traffic.received - receivedBefore);
+  TEST_ASSERT_GREATER_THAN(before.counters[static_cast<size_t>(MqttCounter::PublishAcked)],
+                           after.counters[static_cast<size_t>(MqttCounter::PublishAcked)]);
+  char message[96];
+  snprintf(message, sizeof(message), "%llu allocations (%llu bytes) in the steady state",
+           static_cast<unsigned long long>(end.allocs - start.allocs),
+           static_cast<unsigned long long>(end.bytes - start.bytes));
+  TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, end.allocs - start.allocs, message);
+  client.disconnect();
+  mqttHostStep(1);
+}
+
+void test_reconnect_does_not_allocate() {
+  if (!allocHooksActive()) {
+    TEST_IGNORE_MESSAGE("allocation hooks are off in this build");
+  }
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("alloc-broker"));
+  mqttHostSetDefaultReconnectMs(50);
+  MqttClient client;
+  client.setServer("alloc-broker", 1883);
+  client.setStatsReport(1000);
+  client.setLinkProbe(1000);
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("alloc/#", 1));
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("cmd/+/set", 0));
+  TEST_ASSERT_TRUE(client.connect("alloc-client"));
+  for (int i = 0; i < 200 && !client.isConnected(); i++) mqttHostStep(5);
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  // Connection drops and esp-mqtt reconnects on its own; subscriptions are restored
+  for (int cycle = 0; cycle < 4; cycle++) {
+    AllocCounts start = allocThreadCounts();
+    broker.dropConnections("alloc-client");
+    for (int i = 0; i < 200 && client.isConnected(); i++) mqttHostStep(5);
+    TEST_ASSERT_FALSE(client.isConnected());
+    for (int i = 0; i < 400 && !client.isConnected(); i++) {
+      mqttHostStep(5);
+      client.loop();
+    }
+    TEST_ASSERT_TRUE(client.isConnected());
+    AllocCounts end = allocThreadCounts();
+    TEST_ASSERT_EQUAL_UINT64(0, end.allocs - start.allocs);
+  }
+}
+
+void test_broker_failover_does_not_allocate() {
+  if (!allocHooksActive()) {
+    TEST_IGNORE_MESSAGE("allocation hooks are off in this build");
+  }
+  // Two brokers with host names of different length, each refusing in turn, so the
+  // client keeps failing over between them and rebuilding its host and URI
+  LoopbackBroker a;
+  LoopbackBroker b;
+  TEST_ASSERT_TRUE(a.listenPipe("alloc-a"));
+  TEST_ASSERT_TRUE(b.listenPipe("alloc-broker-b"));
+  mqttHostSetDefaultReconnectMs(20);
+  MqttClient client;
+  const char* brokers[] = {"mqtt://alloc-a:1883", "mqtt://alloc-broker-b:1883"};
+  client.begin(brokers, 2);
+  client.setFailoverThreshold(1);
+  TEST_ASSERT_TRUE(client.connect("alloc-client"));
+  for (int i = 0; i < 200 && !client.isConnected(); i++) mqttHostStep(5);
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  LoopbackBroker* brokerOf[] = {&a, &b};
+  for (int cycle = 0; cycle < 6; cycle++) {
+    int from = client.brokers().current();
+    TEST_ASSERT_TRUE(from == 0 || from == 1);
+    AllocCounts start = allocThreadCounts();
+    brokerOf[from]->setConnackCode(3);
+    brokerOf[1 - from]->setConnackCode(0);
+    brokerOf[from]->dropConnections();
+    for (int i = 0; i < 400 && (client.brokers().current() == from || !client.isConnected()); i++) mqttHostStep(5);
+    TEST_ASSERT_TRUE(client.isConnected());
+    TEST_ASSERT_EQUAL_INT(1 - from, client.brokers().current());
+    AllocCounts end = allocThreadCounts();
+    // The first switch to the longer host name may grow the buffers once
+    if (cycle >= 2) {
+      TEST_ASSERT_EQUAL_UINT64(0, end.allocs - start.allocs);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_hooks_count_this_thread);
+  RUN_TEST(test_steady_state_publish_and_receive_do_not_allocate);
+  RUN_TEST(test_reconnect_does_not_allocate);
+  RUN_TEST(test_broker_failover_does_not_allocate);
+  return UNITY_END();
+}
@@ -0,0 +1,278 @@
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <Arduino.h>
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+
+// Raw protocol client for driving the broker packet by packet
+struct RawClient {
+  std::unique_ptr<HostTransport> link;
+  MqttFrameReader reader;
+  uint8_t level = kMqttLevel311;
+
+  bool open(const char* uri, MqttConnectOptions options, bool* sessionPresent = nullptr) {
+    HostEndpoint endpoint;
+    hostParseUri(uri, endpoint);
+    link = mqttHostDefaultTransport(endpoint);
+    if (!link || !link->connect(endpoint, 1000)) return false;
+    level = options.protocolLevel;
+    std::vector<uint8_t> out;
+    mqttEncodeConnect(out, options);
+    send(out);
+    MqttPacket connack;
+    if (!expect(MqttPacketType::Connack, connack) || connack.reasonCode != 0) return false;
+    if (sessionPresent) *sessionPresent = connack.sessionPresent;
+    return true;
+  }
+
+  bool expect(MqttPacketType type, MqttPacket& packet, int waitMs = 500) {
+    for (int waited = 0; waited <= waitMs; waited += 10) {
+      MqttFrameReader::Result r = reader.next(packet, level);
+      if (r == MqttFrameReader::Result::Packet) return packet.type == type;
+      if (r == MqttFrameReader::Result::Malformed) return false;
+      uint8_t buf[512];
+      int n = link->read(buf, sizeof(buf), 10);
+      if (n < 0) return false;
+      reader.feed(buf, static_cast<size_t>(n));
+    }
+    return false;
+  }
+
+  bool subscribe(const char* filter, uint8_t qos, uint8_t* granted = nullptr) {
+    std::vector<uint8_t> out;
+    mqttEncodeSubscribe(out, level, 1, {{filter, qos}});
+    send(out);
+    MqttPacket suback;
+    if (!expect(MqttPacketType::Suback, suback) || suback.codes.size() != 1) return false;
+    if (granted) *granted = suback.codes[0];
+    return true;
+  }
+
+  void publish(const char* topic, const char* payload, uint8_t qos, bool retain = false, uint16_t id = 1) {
+    std::vector<uint8_t> out;
+    mqttEncodePublish(out, level, topic, payload, strlen(payload), qos, retain, false, id);
+    send(out);
+  }
+
+  void send(const std::vector<uint8_t>& bytes) { link->write(bytes.data(), bytes.size()); }
+};
+
+static MqttConnectOptions options(const char* clientId, uint8_t level = kMqttLevel311) {
+  MqttConnectOptions o;
+  o.clientId = clientId;
+  o.protocolLevel = level;
+  return o;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_qos2_flow_between_v5_and_v311_clients() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("broker"));
+  RawClient sub, pub;
+  TEST_ASSERT_TRUE(sub.open("mem://broker", options("sub", kMqttLevel5)));
+  TEST_ASSERT_TRUE(pub.open("mem://broker", options("pub")));
+  uint8_t granted = 0xFF;
+  TEST_ASSERT_TRUE(sub.subscribe("sensors/+/temp", 2, &granted));
+  TEST_ASSERT_EQUAL_INT(2, granted);
+
+  pub.publish("sensors/kitchen/temp", "21.5", 2, false, 9);
+  MqttPacket p;
+  TEST_ASSERT_TRUE(pub.expect(MqttPacketType::Pubrec, p));
+  TEST_ASSERT_EQUAL_INT(9, p.packetId);
+  // A redelivery before PUBREL is not routed twice
+  pub.publish("sensors/kitchen/temp", "21.5", 2, false, 9);
+  TEST_ASSERT_TRUE(pub.expect(MqttPacketType::Pubrec, p));
+  std::vector<uint8_t> out;
+  mqttEncodeAck(out, MqttPacketType::Pubrel, kMqttLevel311, 9);
+  pub.send(out);
+  TEST_ASSERT_TRUE(pub.expect(MqttPacketType::Pubcomp, p));
+
+  TEST_ASSERT_TRUE(sub.expect(MqttPacketType::Publish, p));
+  TEST_ASSERT_EQUAL_STRING("sensors/kitchen/temp", p.topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("21.5", p.payload.c_str());
+  TEST_ASSERT_EQUAL_INT(2, p.qos);
+  TEST_ASSERT_FALSE(sub.expect(MqttPacketType::Publish, p, 50));
+  TEST_ASSERT_EQUAL_UINT32(1, broker.stats().publishesIn);
+}
+
+void test_retained_messages_and_wildcards() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("broker"));
+  RawClient pub, sub;
+  TEST_ASSERT_TRUE(pub.open("mem://broker", options("pub")));
+  pub.publish("cfg/a", "1", 0, true);
+  pub.publish("cfg", "root", 0, true);
+  pub.publish("$SYS/uptime", "5", 0, true);
+  for (int i = 0; i < 50 && broker.retainedCount() < 3; i++) delay(10);
+  TEST_ASSERT_EQUAL_UINT32(3, broker.retainedCount());
+
+  TEST_ASSERT_TRUE(sub.open("mem://broker", options("sub")));
+  TEST_ASSERT_TRUE(sub.subscribe("cfg/#", 1)); // matches "cfg" and "cfg/a", not "$SYS/uptime"
+  MqttPacket p;
+  int retained = 0;
+  while (sub.expect(MqttPacketType::Publish, p, 100)) {
+    TEST_ASSERT_TRUE(p.retain);
+    TEST_ASSERT_EQUAL_INT(0, p.qos);
+    retained++;
+  }
+  TEST_ASSERT_EQUAL_INT(2, retained);
+
+  RawClient all;
+  TEST_ASSERT_TRUE(all.open("mem://broker", options("all")));
+  TEST_ASSERT_TRUE(all.subscribe("#", 0));
+  retained = 0;
+  while (all.expect(MqttPacketType::Publish, p, 100)) retained++;
+  TEST_ASSERT_EQUAL_INT(2, retained);
+
+  // An empty retained payload clears the topic
+  pub.publish("cfg/a", "", 0, true);
+  TEST_ASSERT_TRUE(sub.expect(MqttPacketType::Publish, p));
+  for (int i = 0; i < 50 && broker.retainedCount() > 2; i++) delay(10);
+  TEST_ASSERT_EQUAL_UINT32(2, broker.retainedCount());
+}
+
+void test_persistent_session_and_last_will() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("broker"));
+  MqttConnectOptions o = options("device");
+  o.cleanSession = false;
+  o.willTopic = "status/device";
+  o.willPayload = "offline";
+  RawClient dev, watcher;
+  TEST_ASSERT_TRUE(watcher.open("mem://broker", options("watcher")));
+  TEST_ASSERT_TRUE(watcher.subscribe("status/#", 0));
+  bool present = true;
+  TEST_ASSERT_TRUE(dev.open("mem://broker", o, &present));
+  TEST_ASSERT_FALSE(present);
+  TEST_ASSERT_TRUE(dev.subscribe("cmd/device", 1));
+
+  // The network fails: the will goes out, the session stays
+  broker.dropConnections("device");
+  MqttPacket p;
+  TEST_ASSERT_TRUE(watcher.expect(MqttPacketType::Publish, p, 1000));
+  TEST_ASSERT_EQUAL_STRING("offline", p.payload.c_str());
+
+  RawClient again;
+  TEST_ASSERT_TRUE(again.open("mem://broker", o, &present));
+  TEST_ASSERT_TRUE(present);
+  watcher.publish("cmd/device", "reboot", 1);
+  TEST_ASSERT_TRUE(again.expect(MqttPacketType::Publish, p));
+  TEST_ASSERT_EQUAL_STRING("reboot", p.payload.c_str());
+}
+
+void test_refused_connect() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("broker"));
+  broker.setConnackCode(5);
+  RawClient c;
+  TEST_ASSERT_FALSE(c.open("mem://broker", options("c")));
+  TEST_ASSERT_EQUAL_UINT32(1, broker.stats().refused);
+  TEST_ASSERT_EQUAL_UINT32(0, broker.connectionCount());
+}
+
+// Full MqttClient connection cycles through the shim, over a pipe and over TCP
+static void roundTrip(MqttClient& client) {
+  std::mutex lock; // the callback runs on the client thread
+  std::string received;
+  client.onMessage([&](const char*, const char* p, size_t len) {
+    std::lock_guard<std::mutex> guard(lock);
+    received.assign(p, len);
+  });
+  TEST_ASSERT_TRUE(client.connect("loop-client"));
+  for (int i = 0; i < 100 && !client.isConnected(); i++) delay(10);
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  TEST_ASSERT_TRUE(client.subscribe("echo/#", 1) > 0);
+  delay(20); // let the SUBACK land before publishing to ourselves
+  TEST_ASSERT_TRUE(client.publish("echo/1", "ping") > 0);
+  std::string got;
+  for (int i = 0; i < 100 && got.empty(); i++) {
+    delay(10);
+    std::lock_guard<std::mutex> guard(lock);
+    got = received;
+  }
+  TEST_ASSERT_EQUAL_STRING("ping", got.c_str());
+
+  MqttMetricsSnapshot m;
+  for (int i = 0; i < 100; i++) {
+    client.metrics(m);
+    if (m.counters[static_cast<size_t>(MqttCounter::PublishAcked)]) break;
+    delay(10);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, m.counters[static_cast<size_t>(MqttCounter::PublishAcked)]);
+  TEST_ASSERT_EQUAL_UINT32(1, m.counters[static_cast<size_t>(MqttCounter::MessagesIn)]);
+}
+
+void test_mqtt_client_over_pipe() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("broker"));
+  MqttClient client;
+  client.setServer("broker", 1883);
+  roundTrip(client);
+}
+
+void test_mqtt_client_over_tcp() {
+  LoopbackBroker broker;
+  uint16_t port = broker.listenTcp(0);
+  TEST_ASSERT_TRUE(port != 0);
+  MqttClient client;
+  client.setServer("127.0.0.1", port);
+  roundTrip(client);
+}
+
+void test_mqtt_client_publish_qos_and_binary() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("broker"));
+  RawClient watcher;
+  TEST_ASSERT_TRUE(watcher.open("mem://broker", options("watcher")));
+  TEST_ASSERT_TRUE(watcher.subscribe("bin/#", 2));
+
+  MqttClient client;
+  client.setServer("broker", 1883);
+  TEST_ASSERT_TRUE(client.connect("publisher"));
+  for (int i = 0; i < 100 && !client.isConnected(); i++) delay(10);
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  const uint8_t blob[] = {0x00, 0xFF, 0x00, 0x7F};
+  TEST_ASSERT_TRUE(client.publishQos("bin/2", blob, sizeof(blob), 2) > 0);
+  MqttPacket p;
+  TEST_ASSERT_TRUE(watcher.expect(MqttPacketType::Publish, p));
+  TEST_ASSERT_EQUAL_UINT8(2, p.qos);
+  TEST_ASSERT_EQUAL(sizeof(blob), p.payload.size());
+  TEST_ASSERT_EQUAL_MEMORY(blob, p.payload.data(), sizeof(blob));
+
+  TEST_ASSERT_EQUAL(0, client.publishQos("bin/0", "text", 0));
+  TEST_ASSERT_TRUE(watcher.expect(MqttPacketType::Publish, p));
+  TEST_ASSERT_EQUAL_UINT8(0, p.qos);
+  TEST_ASSERT_EQUAL_STRING("text", p.payload.c_str());
+  TEST_ASSERT_EQUAL(-1, client.publishQos("bin/3", "text", 3));
+
+  // The pre-QoS form still reads a literal third argument as retain, at QoS 1
+  TEST_ASSERT_TRUE(client.publish("bin/r", "text", 1) > 0);
+  TEST_ASSERT_TRUE(watcher.expect(MqttPacketType::Publish, p));
+  TEST_ASSERT_EQUAL_UINT8(1, p.qos);
+  for (int i = 0; i < 50 && broker.retainedCount() < 1; i++) delay(10);
+  TEST_ASSERT_EQUAL_UINT32(1, broker.retainedCount());
+
+  MqttMetricsSnapshot m;
+  client.metrics(m);
+  TEST_ASSERT_EQUAL_UINT32(1, m.counters[static_cast<size_t>(MqttCounter::PublishQos0)]);
+  TEST_ASSERT_EQUAL_UINT32(1, m.counters[static_cast<size_t>(MqttCounter::PublishQos1)]);
+  TEST_ASSERT_EQUAL_UINT32(1, m.counters[static_cast<size_t>(MqttCounter::PublishQos2)]);
+  TEST_ASSERT_EQUAL_UINT32(12, m.counters[static_cast<size_t>(MqttCounter::BytesOut)]);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_qos2_flow_between_v5_and_v311_clients);
+  RUN_TEST(test_retained_messages_and_wildcards);
+  RUN_TEST(test_persistent_session_and_last_will);
+  RUN_TEST(test_refused_connect);
+  RUN_TEST(test_mqtt_client_over_pipe);
+  RUN_TEST(test_mqtt_client_over_tcp);
+  RUN_TEST(test_mqtt_client_publish_qos_and_binary);
+  return UNITY_END();
+}
@@ -0,0 +1,84 @@
+#include <unity.h>
+#include "BrokerList.h"
+
+void test_rejects_invalid_uri() {
+  BrokerList list;
+  TEST_ASSERT_FALSE(list.add("not-a-uri"));
+  TEST_ASSERT_TRUE(list.add("mqtt://a.example.com"));
+  TEST_ASSERT_EQUAL_UINT32(1, list.size());
+}
+
+void test_probe_pass_measures_every_broker() {
+  BrokerList list;
+  list.add("mqtt://a.example.com");
+  list.add("mqtt://b.example.com");
+  list.add("mqtt://c.example.com");
+  list.add("mqtt://d.example.com");
+  list.recordSuccess(3, 200); // already measured: not probed again
+  list.beginProbe();
+  TEST_ASSERT_EQUAL_INT(0, list.nextProbe(0));
+  TEST_ASSERT_EQUAL_INT(0, list.current());
+  list.recordSuccess(0, 80);
+  TEST_ASSERT_EQUAL_INT(1, list.nextProbe(0));
+  list.recordFailure(1, 0);
+  TEST_ASSERT_EQUAL_INT(2, list.nextProbe(0));
+  list.recordSuccess(2, 30);
+  TEST_ASSERT_EQUAL_INT(-1, list.nextProbe(0));
+  // The fastest measured broker wins, not the first in the list
+  TEST_ASSERT_EQUAL_INT(2, list.select(0));
+  TEST_ASSERT_EQUAL_INT(-1, list.nextProbe(0)); // the pass is over
+}
+
+void test_unmeasured_brokers_used_only_while_none_is_measured() {
+  BrokerList list;
+  list.add("mqtt://a.example.com");
+  list.add("mqtt://b.example.com");
+  TEST_ASSERT_EQUAL_INT(0, list.select(0));
+  list.recordSuccess(1, 500);
+  TEST_ASSERT_EQUAL_INT(1, list.select(0));
+}
+
+void test_selects_fastest_weighted_broker() {
+  BrokerList list;
+  list.add("mqtt://a.example.com");
+  list.add("mqtt://b.example.com", 4);
+  list.recordSuccess(0, 100);
+  list.recordSuccess(1, 300); // 300 / 4 = 75 beats 100
+  TEST_ASSERT_EQUAL_INT(1, list.select(0));
+}
+
+void test_fails_over_after_threshold() {
+  BrokerList list;
+  list.setFailoverThreshold(2);
+  list.add("mqtt://a.example.com");
+  list.add("mqtt://b.example.com");
+  list.select(0);
+  TEST_ASSERT_FALSE(list.recordFailure(0, 10));
+  TEST_ASSERT_TRUE(list.recordFailure(0, 20));
+  TEST_ASSERT_FALSE(list.isHealthy(0, 30));
+  TEST_ASSERT_EQUAL_INT(1, list.select(30));
+}
+
+void test_unhealthy_broker_retried_after_holdoff() {
+  BrokerList list;
+  list.setFailoverThreshold(1);
+  list.setRetryHoldoff(1000);
+  list.add("mqtt://a.example.com");
+  list.add("mqtt://b.example.com");
+  list.recordSuccess(0, 10);
+  list.recordSuccess(1, 50);
+  list.recordFailure(0, 100);
+  TEST_ASSERT_EQUAL_INT(1, list.select(500));
+  TEST_ASSERT_EQUAL_INT(0, list.select(1100));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_rejects_invalid_uri);
+  RUN_TEST(test_probe_pass_measures_every_broker);
+  RUN_TEST(test_unmeasured_brokers_used_only_while_none_is_measured);
+  RUN_TEST(test_selects_fastest_weighted_broker);
+  RUN_TEST(test_fails_over_after_threshold);
+  RUN_TEST(test_unhealthy_broker_retried_after_holdoff);
+  return UNITY_END();
+}
@@ -0,0 +1,120 @@
+#include <unity.h>
+#include <string.h>
+#include <stdio.h>
+#include "CallbackProfiler.h"
+
+void test_accounts_per_key() {
+  CallbackProfiler p;
+  size_t a = p.slotFor("sensors/+/temp");
+  size_t b = p.slotFor("onConnect");
+  TEST_ASSERT_EQUAL_UINT32(a, p.slotFor("sensors/+/temp"));
+  p.record(a, 100);
+  p.record(a, 300);
+  p.record(b, 50);
+  TEST_ASSERT_EQUAL_UINT32(2, p.at(a).calls);
+  TEST_ASSERT_EQUAL_UINT32(400, p.at(a).totalUs);
+  TEST_ASSERT_EQUAL_UINT32(300, p.at(a).maxUs);
+}
+
+void test_budget_overrun() {
+  CallbackProfiler p;
+  p.setBudget(1000);
+  size_t s = p.slotFor("slow/#");
+  TEST_ASSERT_FALSE(p.record(s, 1000));
+  TEST_ASSERT_TRUE(p.record(s, 200000));
+  TEST_ASSERT_EQUAL_UINT32(1, p.at(s).overBudget);
+
+  p.setBudget(0);
+  TEST_ASSERT_FALSE(p.record(s, 200000));
+}
+
+void test_overrun_warnings_are_rate_limited() {
+  CallbackProfiler p;
+  p.setBudget(1000);
+  size_t s = p.slotFor("slow/#");
+  uint32_t suppressed = 99;
+  TEST_ASSERT_TRUE(p.record(s, 5000));
+  TEST_ASSERT_TRUE(p.warnDue(s, 100, suppressed)); // the first overrun is always logged
+  TEST_ASSERT_EQUAL_UINT32(0, suppressed);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(p.record(s, 5000));
+    TEST_ASSERT_FALSE(p.warnDue(s, 200 + i, suppressed));
+  }
+  TEST_ASSERT_TRUE(p.record(s, 5000));
+  TEST_ASSERT_TRUE(p.warnDue(s, 100 + CallbackProfiler::kWarnIntervalMs, suppressed));
+  TEST_ASSERT_EQUAL_UINT32(3, suppressed);
+  TEST_ASSERT_EQUAL_UINT32(5, p.at(s).overBudget);
+
+  // Other handlers have their own interval
+  size_t other = p.slotFor("other");
+  TEST_ASSERT_TRUE(p.record(other, 5000));
+  TEST_ASSERT_TRUE(p.warnDue(other, 300, suppressed));
+}
+
+void test_top_offenders_sorted() {
+  CallbackProfiler p;
+  p.record(p.slotFor("a"), 10);
+  p.record(p.slotFor("b"), 500);
+  p.record(p.slotFor("c"), 70);
+  CallbackStats out[2];
+  TEST_ASSERT_EQUAL_UINT32(2, p.top(out, 2));
+  TEST_ASSERT_EQUAL_STRING("b", out[0].key);
+  TEST_ASSERT_EQUAL_STRING("c", out[1].key);
+}
+
+void test_full_table_recycles_cheapest() {
+  CallbackProfiler p;
+  char key[8];
+  for (size_t i = 0; i < CallbackProfiler::kCapacity; i++) {
+    snprintf(key, sizeof(key), "k%u", (unsigned)i);
+    p.record(p.slotFor(key), 100 + i);
+  }
+  size_t slot = p.slotFor("new");
+  TEST_ASSERT_EQUAL_STRING("new", p.at(slot).key);
+  TEST_ASSERT_EQUAL_UINT32(0, p.at(slot).calls);
+  CallbackStats out[CallbackProfiler::kCapacity];
+  size_t n = p.top(out, CallbackProfiler::kCapacity);
+  for (size_t i = 0; i < n; i++) {
+    TEST_ASSERT_TRUE(strcmp(out[i].key, "k0") != 0);
+  }
+}
+
+void test_slot_ref_follows_its_key() {
+  CallbackProfiler p;
+  CallbackSlotRef ref;
+  size_t a = p.slotFor("a/#", ref);
+  TEST_ASSERT_EQUAL_STRING("a/#", p.at(a).key);
+  TEST_ASSERT_EQUAL_UINT32(a, p.slotFor("a/#", ref));
+  p.record(a, 1);
+
+  // The slot is recycled for another key: the ref resolves the key again
+  char key[8];
+  for (size_t i = 0; i < CallbackProfiler::kCapacity; i++) {
+    snprintf(key, sizeof(key), "k%u", (unsigned)i);
+    p.record(p.slotFor(key), 100 + i);
+  }
+  TEST_ASSERT_TRUE(strcmp(p.at(a).key, "a/#") != 0);
+  size_t again = p.slotFor("a/#", ref);
+  TEST_ASSERT_EQUAL_STRING("a/#", p.at(again).key);
+  TEST_ASSERT_EQUAL_UINT32(0, p.at(again).calls);
+
+  // clear() invalidates it, also once its index holds another key
+  p.clear();
+  TEST_ASSERT_EQUAL_UINT32(0, p.slotFor("a/#", ref));
+  p.clear();
+  TEST_ASSERT_EQUAL_UINT32(0, p.slotFor("b"));
+  TEST_ASSERT_EQUAL_UINT32(1, p.slotFor("a/#", ref));
+  TEST_ASSERT_EQUAL_STRING("a/#", p.at(1).key);
+  TEST_ASSERT_EQUAL_STRING("b", p.at(0).key);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_accounts_per_key);
+  RUN_TEST(test_budget_overrun);
+  RUN_TEST(test_overrun_warnings_are_rate_limited);
+  RUN_TEST(test_top_offenders_sorted);
+  RUN_TEST(test_full_table_recycles_cheapest);
+  RUN_TEST(test_slot_ref_follows_its_key);
+  return UNITY_END();
+}
@@ -0,0 +1,188 @@
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "MqttHost.h"
+#include "TrafficCapture.h"
+
+void setUp() {}
+void tearDown() {}
+
+static std::vector<uint8_t> captureInto(TrafficCapture& capture) {
+  std::vector<uint8_t> out;
+  capture.setSink([&](const uint8_t* data, size_t len) { out.insert(out.end(), data, data + len); });
+  capture.flush();
+  capture.setSink(nullptr);
+  return out;
+}
+
+void test_records_round_trip() {
+  TrafficCapture capture(1024);
+  capture.record(0, CaptureEvent::Inbound, "a", 1, "x", 1); // not started: ignored
+  capture.start(1000);
+  capture.record(1500, CaptureEvent::Connected, nullptr, 0, nullptr, 0);
+  capture.record(2000, CaptureEvent::Outbound, "sensors/t", 9, "21.5", 4, 1, true, 42);
+  capture.record(1900, CaptureEvent::Inbound, "cmd/x", 5, "on", 2, 2, false, 7); // stamped before the lock
+  capture.record(302000, CaptureEvent::Acked, nullptr, 0, nullptr, 0, 0, false, 42);
+  std::vector<uint8_t> stream = captureInto(capture);
+  TEST_ASSERT_EQUAL_UINT(0, capture.pending());
+
+  CaptureReader reader(stream.data(), stream.size());
+  TEST_ASSERT_TRUE(reader.valid());
+  CaptureRecord r;
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(CaptureEvent::Connected), static_cast<int>(r.event));
+  TEST_ASSERT_EQUAL_UINT64(500, r.timeUs);
+
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(CaptureEvent::Outbound), static_cast<int>(r.event));
+  TEST_ASSERT_EQUAL_UINT64(1000, r.timeUs);
+  TEST_ASSERT_EQUAL_UINT8(1, r.qos);
+  TEST_ASSERT_TRUE(r.retain);
+  TEST_ASSERT_EQUAL_INT(42, r.msgId);
+  TEST_ASSERT_EQUAL_UINT(9, r.topicLen);
+  TEST_ASSERT_EQUAL_MEMORY("sensors/t", r.topic, 9);
+  TEST_ASSERT_EQUAL_UINT(4, r.payloadLen);
+  TEST_ASSERT_EQUAL_MEMORY("21.5", r.payload, 4);
+
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(CaptureEvent::Inbound), static_cast<int>(r.event));
+  TEST_ASSERT_EQUAL_UINT64(1000, r.timeUs); // never goes backwards
+  TEST_ASSERT_EQUAL_UINT8(2, r.qos);
+  TEST_ASSERT_FALSE(r.retain);
+
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(CaptureEvent::Acked), static_cast<int>(r.event));
+  TEST_ASSERT_EQUAL_UINT64(301000, r.timeUs);
+  TEST_ASSERT_EQUAL_INT(42, r.msgId);
+
+  TEST_ASSERT_FALSE(reader.next(r));
+  TEST_ASSERT_FALSE(reader.corrupt());
+}
+
+void test_truncation_and_full_ring() {
+  TrafficCapture capture(96);
+  capture.setMaxPayload(8);
+  capture.start(0);
+  char payload[40];
+  memset(payload, 'p', sizeof(payload));
+  capture.record(10, CaptureEvent::Inbound, "big", 3, payload, sizeof(payload));
+  size_t records = 1;
+  while (capture.lost() == 0) {
+    capture.record(20, CaptureEvent::Outbound, "t", 1, payload, 4);
+    records++;
+  }
+  records--; // the last one was dropped
+  std::vector<uint8_t> stream = captureInto(capture);
+  TEST_ASSERT_TRUE(stream.size() <= 96);
+
+  CaptureReader reader(stream.data(), stream.size());
+  CaptureRecord r;
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_TRUE(r.truncated);
+  TEST_ASSERT_EQUAL_UINT(8, r.storedLen);
+  TEST_ASSERT_EQUAL_UINT(sizeof(payload), r.payloadLen);
+  size_t decoded = 1;
+  while (reader.next(r)) decoded++;
+  TEST_ASSERT_FALSE(reader.corrupt());
+  TEST_ASSERT_EQUAL_UINT(records, decoded);
+
+  // The ring drained, so recording continues; a cut-off stream decodes up to the cut
+  capture.record(30, CaptureEvent::Outbound, "t", 1, payload, 4);
+  TEST_ASSERT_EQUAL_UINT32(1, capture.lost());
+  std::vector<uint8_t> tail = captureInto(capture);
+  stream.insert(stream.end(), tail.begin(), tail.end() - 2);
+  CaptureReader cut(stream.data(), stream.size());
+  decoded = 0;
+  while (cut.next(r)) decoded++;
+  TEST_ASSERT_EQUAL_UINT(records, decoded);
+  TEST_ASSERT_TRUE(cut.corrupt());
+
+  uint8_t junk[12] = {'M', 'Q', 'T', 'X'};
+  TEST_ASSERT_FALSE(CaptureReader(junk, sizeof(junk)).valid());
+}
+
+void test_client_capture_replays_deterministically() {
+  mqttHostSetManualStep(true);
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("capture-broker"));
+  TrafficCapture capture(8192);
+  std::vector<uint8_t> stream;
+  capture.setSink([&](const uint8_t* data, size_t len) { stream.insert(stream.end(), data, data + len); });
+
+  std::vector<std::string> live;
+  {
+    MqttClient client;
+    client.setServer("capture-broker", 1883);
+    client.setCapture(&capture);
+    client.onMessage([&](const char* topic, const char* payload, size_t length) {
+      live.push_back(std::string(topic) + "=" + std::string(payload, length));
+    });
+    TEST_ASSERT_EQUAL_INT(0, client.subscribe("cap/#", 1));
+    capture.start(micros());
+    TEST_ASSERT_TRUE(client.connect("capture-client"));
+    for (int i = 0; i < 200 && !client.isConnected(); i++) mqttHostStep(5);
+    TEST_ASSERT_TRUE(client.isConnected());
+
+    char payload[16];
+    for (int i = 0; i < 10; i++) {
+      int n = snprintf(payload, sizeof(payload), "m%d", i);
+      const char* topic = i % 2 ? "cap/odd" : "cap/even";
+      TEST_ASSERT_TRUE(client.publishQos(topic, static_cast<const void*>(payload), n, i % 2) >= 0);
+      mqttHostStep(2);
+    }
+    // The broker thread can deliver the last echo before the last PUBACK
+    MqttMetricsSnapshot m;
+    for (int i = 0; i < 100; i++) {
+      client.metrics(m);
+      if (live.size() == 10 && m.get(MqttCounter::PublishAcked) == 5) break;
+      mqttHostStep(5);
+    }
+    client.loop();
+    client.setCapture(nullptr);
+    client.disconnect();
+    mqttHostStep(1);
+  }
+  mqttHostSetManualStep(false);
+  TEST_ASSERT_EQUAL_UINT(10, live.size());
+
+  CaptureReader reader(stream.data(), stream.size());
+  TEST_ASSERT_TRUE(reader.valid());
+  size_t counts[static_cast<size_t>(CaptureEvent::Count)] = {};
+  uint64_t lastUs = 0;
+  std::vector<std::string> replayed;
+  MqttClient replay; // not connected: onDataInternal() runs the receive path only
+  replay.onMessage([&](const char* topic, const char* payload, size_t length) {
+    replayed.push_back(std::string(topic) + "=" + std::string(payload, length));
+  });
+  CaptureRecord r;
+  while (reader.next(r)) {
+    counts[static_cast<size_t>(r.event)]++;
+    TEST_ASSERT_TRUE(r.timeUs >= lastUs);
+    lastUs = r.timeUs;
+    if (r.event == CaptureEvent::Inbound) {
+      std::string topic(r.topic, r.topicLen);
+      replay.onDataInternal(topic.c_str(), reinterpret_cast<const char*>(r.payload), static_cast<int>(r.storedLen));
+    }
+  }
+  TEST_ASSERT_FALSE(reader.corrupt());
+  TEST_ASSERT_EQUAL_UINT(1, counts[static_cast<size_t>(CaptureEvent::Connected)]);
+  TEST_ASSERT_EQUAL_UINT(10, counts[static_cast<size_t>(CaptureEvent::Outbound)]);
+  TEST_ASSERT_EQUAL_UINT(10, counts[static_cast<size_t>(CaptureEvent::Inbound)]);
+  TEST_ASSERT_EQUAL_UINT(5, counts[static_cast<size_t>(CaptureEvent::Acked)]);
+  TEST_ASSERT_EQUAL_UINT(live.size(), replayed.size());
+  for (size_t i = 0; i < live.size(); i++) {
+    TEST_ASSERT_EQUAL_STRING(live[i].c_str(), replayed[i].c_str());
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_round_trip);
+  RUN_TEST(test_truncation_and_full_ring);
+  RUN_TEST(test_client_capture_replays_deterministically);
+  return UNITY_END();
+}
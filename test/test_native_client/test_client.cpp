@@ -0,0 +1,400 @@
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <Arduino.h>
+#include "MqttClient.h"
+#include "MqttCodec.h"
+#include "MqttHost.h"
+
+// The real MqttClient against the esp-mqtt shim, stepped by hand. The test plays the
+// broker on the other end of an in-memory pipe.
+
+struct Peer {
+  std::unique_ptr<HostTransport> link;
+  MqttFrameReader reader;
+  uint8_t level = kMqttLevel311; // taken from the client's CONNECT
+
+  bool expect(MqttPacketType type, MqttPacket& packet) {
+    for (int i = 0; i < 50; i++) {
+      MqttFrameReader::Result r = reader.next(packet, level);
+      if (r == MqttFrameReader::Result::Packet) return packet.type == type;
+      if (r == MqttFrameReader::Result::Malformed) return false;
+      uint8_t buf[512];
+      int n = link->read(buf, sizeof(buf), 10);
+      if (n < 0) return false;
+      reader.feed(buf, static_cast<size_t>(n));
+    }
+    return false;
+  }
+
+  void send(const std::vector<uint8_t>& bytes) { link->write(bytes.data(), bytes.size()); }
+};
+
+static uint32_t counter(const MqttClient& client, MqttCounter c) {
+  MqttMetricsSnapshot m;
+  client.metrics(m);
+  return m.counters[static_cast<size_t>(c)];
+}
+
+// Connects `client` to a listener named "broker" and answers its CONNECT
+static void connectClient(MqttClient& client, HostPipeListener& listener, Peer& peer, uint8_t connackCode = 0) {
+  client.setServer("broker", 1883);
+  TEST_ASSERT_TRUE(client.connect("host-test"));
+  mqttHostStep(0);
+  peer.link = listener.accept(100);
+  TEST_ASSERT_NOT_NULL(peer.link.get());
+
+  MqttPacket connect;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Connect, connect));
+  TEST_ASSERT_EQUAL_STRING("host-test", connect.clientId.c_str());
+  TEST_ASSERT_EQUAL_INT(kMqttLevel5, connect.protocolLevel); // v5 is tried first
+  peer.level = connect.protocolLevel;
+  std::vector<uint8_t> out;
+  mqttEncodeConnack(out, peer.level, false, connackCode);
+  peer.send(out);
+  mqttHostStep(10);
+}
+
+void setUp() {
+  mqttHostSetManualStep(true);
+}
+
+void tearDown() {}
+
+void test_connect_dispatches_on_connect() {
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  int connects = 0;
+  client.onConnect([&] { connects++; });
+
+  connectClient(client, listener, peer);
+  TEST_ASSERT_TRUE(client.isConnected());
+  TEST_ASSERT_EQUAL_INT(1, connects);
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::Connects));
+  TEST_ASSERT_EQUAL_UINT32(1, client.latency(MqttLatency::Connect).count());
+}
+
+void test_qos1_publish_is_acknowledged() {
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  connectClient(client, listener, peer);
+
+  int msgId = client.publish("host/out", "hello");
+  TEST_ASSERT_TRUE(msgId > 0);
+  MqttPacket publish;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Publish, publish));
+  TEST_ASSERT_EQUAL_STRING("host/out", publish.topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("hello", publish.payload.c_str());
+  TEST_ASSERT_EQUAL_INT(1, publish.qos);
+  TEST_ASSERT_EQUAL_INT(msgId, publish.packetId);
+
+  std::vector<uint8_t> out;
+  mqttEncodeAck(out, MqttPacketType::Puback, peer.level, publish.packetId);
+  peer.send(out);
+  mqttHostStep(10);
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::PublishAcked));
+  TEST_ASSERT_EQUAL_UINT32(1, client.latency(MqttLatency::PublishAck).count());
+
+  // A message esp-mqtt expires from its outbox leaves the in-flight gauge as well
+  MqttMetricsSnapshot m;
+  msgId = client.publish("host/out", "expires");
+  client.metrics(m);
+  TEST_ASSERT_EQUAL_INT32(1, m.inFlight);
+  client.onDeletedInternal(msgId); // MQTT_EVENT_DELETED
+  client.metrics(m);
+  TEST_ASSERT_EQUAL_INT32(0, m.inFlight);
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::DropExpired));
+}
+
+void test_inbound_message_reaches_callback() {
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  std::string topic, payload;
+  client.onMessage([&](const char* t, const char* p, size_t len) {
+    topic = t;
+    payload.assign(p, len);
+  });
+  connectClient(client, listener, peer);
+
+  TEST_ASSERT_EQUAL_INT(-1, client.subscribe("sensors/+", 3)); // rejected like publish()
+  TEST_ASSERT_EQUAL_UINT(0, client.subscriptions().size());
+  TEST_ASSERT_TRUE(client.subscribe("sensors/+", 1) > 0);
+  MqttPacket subscribe;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, subscribe));
+  TEST_ASSERT_EQUAL_STRING("sensors/+", subscribe.filters[0].first.c_str());
+  std::vector<uint8_t> out;
+  mqttEncodeSuback(out, peer.level, subscribe.packetId, std::vector<uint8_t>(1, 1));
+  mqttEncodePublish(out, peer.level, "sensors/temp", "21.5", 4, 1, false, false, 7);
+  peer.send(out);
+  mqttHostStep(10);
+
+  TEST_ASSERT_EQUAL_STRING("sensors/temp", topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("21.5", payload.c_str());
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::MessagesIn));
+  MqttPacket puback;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Puback, puback));
+  TEST_ASSERT_EQUAL_INT(7, puback.packetId);
+}
+
+void test_refused_connect_counts_as_connack_failure() {
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  connectClient(client, listener, peer, 5); // not authorized
+
+  TEST_ASSERT_FALSE(client.isConnected());
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::DisconnectRefused));
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::ConnectFailConnack));
+  ConnectAttempt attempt;
+  TEST_ASSERT_EQUAL_UINT32(1, client.connectHistory(&attempt, 1));
+  TEST_ASSERT_TRUE(attempt.outcome == ConnectOutcome::Failed);
+  TEST_ASSERT_EQUAL_INT(5, attempt.errorCode);
+}
+
+void test_borrowed_and_der_certificates_reach_the_config_uncopied() {
+  static const char kCaPem[] = "-----BEGIN CERTIFICATE-----\nca\n-----END CERTIFICATE-----\n";
+  static const uint8_t kCertDer[] = {0x30, 0x82, 0x01, 0x0a, 0x00, 0x02};
+  static const uint8_t kKeyDer[] = {0x30, 0x81, 0x00, 0x02, 0x01};
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  client.setCACertRef(kCaPem);
+  client.setClientCertDer(kCertDer, sizeof(kCertDer));
+  client.setClientKeyDer(kKeyDer, sizeof(kKeyDer));
+  connectClient(client, listener, peer);
+
+  HostTlsConfig tls = mqttHostLastTlsConfig();
+  TEST_ASSERT_TRUE(tls.caCert == kCaPem);
+  TEST_ASSERT_EQUAL_UINT32(0, tls.caCertLen); // NUL-terminated PEM
+  TEST_ASSERT_TRUE(tls.clientCert == reinterpret_cast<const char*>(kCertDer));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(kCertDer), tls.clientCertLen);
+  TEST_ASSERT_TRUE(tls.clientKey == reinterpret_cast<const char*>(kKeyDer));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(kKeyDer), tls.clientKeyLen);
+  TEST_ASSERT_FALSE(tls.skipCommonNameCheck);
+
+  // The copying setter hands over a heap copy instead
+  MqttClient copying;
+  copying.setCACert(kCaPem);
+  HostPipeListener other("broker2");
+  copying.setServer("broker2", 1883);
+  TEST_ASSERT_TRUE(copying.connect("host-copy"));
+  tls = mqttHostLastTlsConfig();
+  TEST_ASSERT_NOT_NULL(tls.caCert);
+  TEST_ASSERT_TRUE(tls.caCert != kCaPem);
+  TEST_ASSERT_EQUAL_STRING(kCaPem, tls.caCert);
+  TEST_ASSERT_NULL(tls.clientCert);
+  TEST_ASSERT_NULL(tls.clientKey);
+}
+
+void test_client_thread_connects_and_shuts_down() {
+  mqttHostSetManualStep(false);
+  HostPipeListener listener("broker");
+  Peer peer;
+  {
+    MqttClient client;
+    client.setServer("broker", 1883);
+    TEST_ASSERT_TRUE(client.connect("host-thread"));
+    peer.link = listener.accept(1000);
+    TEST_ASSERT_NOT_NULL(peer.link.get());
+    MqttPacket connect;
+    TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Connect, connect));
+    peer.level = connect.protocolLevel;
+    std::vector<uint8_t> out;
+    mqttEncodeConnack(out, peer.level, false, 0);
+    peer.send(out);
+    for (int i = 0; i < 100 && !client.isConnected(); i++) delay(10);
+    TEST_ASSERT_TRUE(client.isConnected());
+  }
+  // Destroying the client stops its thread and sends DISCONNECT
+  MqttPacket disconnect;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Disconnect, disconnect));
+}
+
+void test_aggregated_subscriptions_follow_live_changes() {
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  client.setSubscriptionAggregation(true, 3);
+  client.onConnect([&] {
+    client.subscribe("dev/a/cmd", 1);
+    client.subscribe("dev/b/cmd", 1);
+    client.subscribe("dev/c/cmd", 0);
+  });
+  connectClient(client, listener, peer);
+
+  // onConnect's subscriptions go out together, as their covering wildcard
+  MqttPacket packet;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, packet));
+  TEST_ASSERT_EQUAL_UINT(1, packet.filters.size());
+  TEST_ASSERT_EQUAL_STRING("dev/+/cmd", packet.filters[0].first.c_str());
+  TEST_ASSERT_EQUAL_INT(1, packet.filters[0].second);
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("dev/d/cmd", 1)); // already delivered
+
+  // Live subscriptions complete a group too; the filters it covers are dropped after it
+  TEST_ASSERT_TRUE(client.subscribe("room/1/temp", 0) > 0);
+  TEST_ASSERT_TRUE(client.subscribe("room/2/temp", 0) > 0);
+  TEST_ASSERT_TRUE(client.subscribe("room/3/temp", 0) > 0);
+  mqttHostStep(0);
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, packet));
+  TEST_ASSERT_EQUAL_STRING("room/1/temp", packet.filters[0].first.c_str());
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, packet));
+  TEST_ASSERT_EQUAL_STRING("room/2/temp", packet.filters[0].first.c_str());
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, packet));
+  TEST_ASSERT_EQUAL_STRING("room/+/temp", packet.filters[0].first.c_str());
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Unsubscribe, packet));
+  TEST_ASSERT_EQUAL_STRING("room/1/temp", packet.filters[0].first.c_str());
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Unsubscribe, packet));
+  TEST_ASSERT_EQUAL_STRING("room/2/temp", packet.filters[0].first.c_str());
+
+  // The wildcard stays while any member is subscribed, and goes with the last one
+  TEST_ASSERT_EQUAL_INT(0, client.unsubscribe("dev/a/cmd"));
+  TEST_ASSERT_EQUAL_INT(0, client.unsubscribe("dev/b/cmd"));
+  TEST_ASSERT_EQUAL_INT(0, client.unsubscribe("dev/c/cmd"));
+  TEST_ASSERT_TRUE(client.unsubscribe("dev/d/cmd") > 0);
+  mqttHostStep(0);
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Unsubscribe, packet));
+  TEST_ASSERT_EQUAL_STRING("dev/+/cmd", packet.filters[0].first.c_str());
+}
+
+// Moving a connected client hands over the connection, callbacks and diagnostics; the
+// moved-from client is left with nothing to do
+void test_moved_client_keeps_connection_and_diagnostics() {
+  HostPipeListener listener("broker");
+  Peer peer;
+  MqttClient client;
+  int messages = 0;
+  client.onMessage([&](const char*, const char*, size_t) { messages++; });
+  connectClient(client, listener, peer);
+  TEST_ASSERT_TRUE(client.subscribe("sensors/+", 1) > 0);
+  MqttPacket packet;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, packet));
+  std::vector<uint8_t> out;
+  mqttEncodeSuback(out, peer.level, packet.packetId, std::vector<uint8_t>(1, 1));
+  mqttEncodePublish(out, peer.level, "sensors/temp", "21.5", 4, 0, false, false, 0);
+  peer.send(out);
+  mqttHostStep(10);
+  client.setStatsReport(1000);
+  client.setLinkProbe(1000);
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Subscribe, packet)); // the probe topic
+  out.clear();
+  mqttEncodeSuback(out, peer.level, packet.packetId, std::vector<uint8_t>(1, 0));
+  peer.send(out);
+  mqttHostStep(10);
+  int msgId = client.publish("host/out", "before the move");
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Publish, packet));
+
+  MqttClient moved(std::move(client));
+  TEST_ASSERT_TRUE(moved.isConnected());
+
+  // The PUBACK of a publish sent before the move is timed by the new owner
+  out.clear();
+  mqttEncodeAck(out, MqttPacketType::Puback, peer.level, static_cast<uint16_t>(msgId));
+  mqttEncodePublish(out, peer.level, "sensors/hum", "40", 2, 0, false, false, 0);
+  peer.send(out);
+  mqttHostStep(10);
+  TEST_ASSERT_EQUAL_INT(2, messages);
+  TEST_ASSERT_EQUAL_UINT32(2, counter(moved, MqttCounter::MessagesIn));
+  TEST_ASSERT_EQUAL_UINT32(1, counter(moved, MqttCounter::PublishAcked));
+  TEST_ASSERT_EQUAL_UINT32(1, moved.latency(MqttLatency::PublishAck).count());
+  TEST_ASSERT_EQUAL_UINT32(2, moved.latency(MqttLatency::Dispatch).count());
+  CallbackStats stats[4];
+  TEST_ASSERT_EQUAL_UINT(1, moved.slowestCallbacks(stats, 4));
+  TEST_ASSERT_EQUAL_STRING("sensors/+", stats[0].key);
+  TEST_ASSERT_EQUAL_UINT32(2, stats[0].calls);
+
+  // The source holds nothing and its loop() publishes nothing
+  TEST_ASSERT_FALSE(client.isConnected());
+  TEST_ASSERT_EQUAL_UINT(0, client.subscriptions().size());
+  TEST_ASSERT_EQUAL_UINT32(0, counter(client, MqttCounter::MessagesIn));
+  TEST_ASSERT_EQUAL_UINT32(0, client.latency(MqttLatency::Connect).count());
+  TEST_ASSERT_EQUAL_UINT(0, client.slowestCallbacks(stats, 4));
+  ConnectAttempt attempt;
+  TEST_ASSERT_EQUAL_UINT(0, client.connectHistory(&attempt, 1));
+  delay(1100);
+  client.loop();
+  TEST_ASSERT_EQUAL_INT(-1, client.publish("host/out", "after the move"));
+
+  // Move assignment replaces the target's own diagnostics
+  MqttClient target;
+  TEST_ASSERT_EQUAL_INT(-1, target.publish("host/out", "not connected"));
+  target = std::move(moved);
+  TEST_ASSERT_EQUAL_UINT32(0, counter(target, MqttCounter::DropNotConnected));
+  TEST_ASSERT_EQUAL_UINT32(2, counter(target, MqttCounter::MessagesIn));
+  out.clear();
+  mqttEncodePublish(out, peer.level, "sensors/co2", "410", 3, 0, false, false, 0);
+  peer.send(out);
+  mqttHostStep(10);
+  TEST_ASSERT_EQUAL_INT(3, messages);
+  target.loop(); // the stats report and probe carried over
+  mqttHostStep(10);
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Publish, packet));
+}
+
+// Answers the CONNECT on `listener` after `delayMs`
+static void answerConnect(HostPipeListener& listener, Peer& peer, uint32_t delayMs) {
+  for (int i = 0; i < 50 && !peer.link; i++) {
+    mqttHostStep(0);
+    peer.link = listener.accept(10);
+  }
+  TEST_ASSERT_NOT_NULL(peer.link.get());
+  MqttPacket connect;
+  TEST_ASSERT_TRUE(peer.expect(MqttPacketType::Connect, connect));
+  peer.level = connect.protocolLevel;
+  delay(delayMs);
+  std::vector<uint8_t> out;
+  mqttEncodeConnack(out, peer.level, false, 0);
+  peer.send(out);
+  mqttHostStep(10);
+}
+
+void test_brokers_are_probed_before_the_fastest_is_used() {
+  HostPipeListener slow("broker-slow");
+  HostPipeListener fast("broker-fast");
+  Peer slowPeer, fastPeer;
+  MqttClient client;
+  const char* brokers[] = {"mqtt://broker-slow:1883", "mqtt://broker-fast:1883"};
+  client.begin(brokers, 2);
+  int connects = 0;
+  client.onConnect([&] { connects++; });
+  TEST_ASSERT_TRUE(client.connect("host-probe"));
+
+  // The first broker in the list is only measured, then left for the next one
+  answerConnect(slow, slowPeer, 80);
+  TEST_ASSERT_FALSE(client.isConnected());
+  mqttHostStep(0);
+  MqttPacket disconnect;
+  TEST_ASSERT_TRUE(slowPeer.expect(MqttPacketType::Disconnect, disconnect));
+  answerConnect(fast, fastPeer, 0);
+
+  TEST_ASSERT_TRUE(client.isConnected());
+  TEST_ASSERT_EQUAL_INT(1, client.brokers().current());
+  TEST_ASSERT_TRUE(client.brokers().at(0).latencyMs >= 80);
+  TEST_ASSERT_TRUE(client.brokers().at(1).measured());
+  TEST_ASSERT_TRUE(client.brokers().at(1).latencyMs < client.brokers().at(0).latencyMs);
+  // The slow broker's delay is in its CONNACK phase, not in the transport connect
+  ConnectAttempt attempts[2];
+  TEST_ASSERT_EQUAL_UINT32(2, client.connectHistory(attempts, 2));
+  TEST_ASSERT_TRUE(attempts[0].outcome == ConnectOutcome::Connected);
+  TEST_ASSERT_TRUE(attempts[0].connackUs >= 80000);
+  TEST_ASSERT_TRUE(attempts[0].transportUs < 80000);
+  TEST_ASSERT_TRUE(attempts[1].connackUs < attempts[0].connackUs);
+  TEST_ASSERT_EQUAL_INT(1, connects);
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::Connects));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_dispatches_on_connect);
+  RUN_TEST(test_qos1_publish_is_acknowledged);
+  RUN_TEST(test_inbound_message_reaches_callback);
+  RUN_TEST(test_refused_connect_counts_as_connack_failure);
+  RUN_TEST(test_borrowed_and_der_certificates_reach_the_config_uncopied);
+  RUN_TEST(test_client_thread_connects_and_shuts_down);
+  RUN_TEST(test_aggregated_subscriptions_follow_live_changes);
+  RUN_TEST(test_moved_client_keeps_connection_and_diagnostics);
+  RUN_TEST(test_brokers_are_probed_before_the_fastest_is_used);
+  return UNITY_END();
+}
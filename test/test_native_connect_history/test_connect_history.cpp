@@ -0,0 +1,88 @@
+#include <unity.h>
+#include "ConnectHistory.h"
+
+void test_phases_of_successful_attempt() {
+  ConnectHistory h;
+  h.begin(1000, 1, 0, 5, false, false);
+  h.started(1300);
+  h.beforeConnect(2000);
+  h.transportUp(6500);
+  h.connected(9000);
+  TEST_ASSERT_FALSE(h.pending());
+  TEST_ASSERT_EQUAL_UINT32(1, h.size());
+  const ConnectAttempt &a = *h.last();
+  TEST_ASSERT_TRUE(a.outcome == ConnectOutcome::Connected);
+  TEST_ASSERT_EQUAL_UINT32(300, a.initUs);
+  TEST_ASSERT_EQUAL_UINT32(700, a.scheduleUs);
+  TEST_ASSERT_EQUAL_UINT32(4500, a.transportUs);
+  TEST_ASSERT_EQUAL_UINT32(2500, a.connackUs);
+  TEST_ASSERT_EQUAL_UINT32(7000, a.handshakeUs());
+  TEST_ASSERT_EQUAL_UINT32(8000, a.totalUs());
+
+  // Without the transport hook the whole handshake counts as transport
+  h.begin(10000, 10, 0, 5, false, true);
+  h.beforeConnect(10000);
+  h.connected(12000);
+  TEST_ASSERT_EQUAL_UINT32(2000, h.last()->transportUs);
+  TEST_ASSERT_EQUAL_UINT32(0, h.last()->connackUs);
+}
+
+void test_failure_keeps_reported_phase() {
+  ConnectHistory h;
+  h.begin(0, 0, -1, 5, false, false);
+  h.started(10);
+  h.beforeConnect(20);
+  h.error(ConnectPhase::Tls, -0x7780);
+  h.error(ConnectPhase::Tcp, -1); // esp-mqtt's later, vaguer report
+  TEST_ASSERT_TRUE(h.failed(520) == ConnectPhase::Tls);
+  TEST_ASSERT_EQUAL_UINT32(500, h.last()->transportUs);
+  TEST_ASSERT_EQUAL_INT(-0x7780, h.last()->errorCode);
+
+  // Without an error event the transport stage is blamed on TCP
+  h.begin(1000, 1, -1, 4, true, false, 1000000);
+  h.beforeConnect(1100);
+  TEST_ASSERT_TRUE(h.failed(1200) == ConnectPhase::Tcp);
+  TEST_ASSERT_TRUE(h.last()->fallback);
+  TEST_ASSERT_EQUAL_UINT32(1000200, h.last()->totalUs());
+
+  // and a connection lost after the transport came up on the CONNACK
+  h.begin(2000, 2, -1, 5, false, false);
+  h.beforeConnect(2000);
+  h.transportUp(2300);
+  TEST_ASSERT_TRUE(h.failed(2400) == ConnectPhase::Connack);
+  TEST_ASSERT_EQUAL_UINT32(300, h.last()->transportUs);
+  TEST_ASSERT_EQUAL_UINT32(100, h.last()->connackUs);
+}
+
+void test_new_attempt_closes_pending_one() {
+  ConnectHistory h;
+  h.begin(0, 0, -1, 5, false, false);
+  h.begin(50, 0, -1, 5, false, true);
+  TEST_ASSERT_EQUAL_UINT32(2, h.size());
+  TEST_ASSERT_TRUE(h.at(0).outcome == ConnectOutcome::Failed);
+  TEST_ASSERT_TRUE(h.at(0).failedPhase == ConnectPhase::Init);
+  TEST_ASSERT_TRUE(h.at(1).automatic);
+  TEST_ASSERT_TRUE(h.pending());
+}
+
+void test_ring_keeps_newest_records() {
+  ConnectHistory h;
+  for (uint32_t i = 0; i < ConnectHistory::kCapacity + 3; i++) {
+    h.begin(i * 100, i, -1, 5, false, false);
+    h.beforeConnect(i * 100);
+    h.transportUp(i * 100);
+    h.connected(i * 100 + i);
+  }
+  TEST_ASSERT_EQUAL_UINT32(ConnectHistory::kCapacity, h.size());
+  TEST_ASSERT_EQUAL_UINT32(3, h.at(0).startMs);
+  TEST_ASSERT_EQUAL_UINT32(ConnectHistory::kCapacity + 2, h.last()->connackUs);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_phases_of_successful_attempt);
+  RUN_TEST(test_failure_keeps_reported_phase);
+  RUN_TEST(test_new_attempt_closes_pending_one);
+  RUN_TEST(test_ring_keeps_newest_records);
+  return UNITY_END();
+}
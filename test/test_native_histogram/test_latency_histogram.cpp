@@ -0,0 +1,66 @@
+#include <unity.h>
+#include "LatencyHistogram.h"
+
+void test_bucket_bounds_roundtrip() {
+  const uint32_t values[] = {0, 7, 8, 15, 16, 17, 1000, 123456, 1u << 27};
+  for (uint32_t v : values) {
+    size_t index = LatencyHistogram::bucketIndex(v);
+    TEST_ASSERT_LESS_OR_EQUAL(v, LatencyHistogram::bucketLow(index));
+    TEST_ASSERT_GREATER_OR_EQUAL(v, LatencyHistogram::bucketHigh(index));
+  }
+  TEST_ASSERT_EQUAL_UINT32(LatencyHistogram::kBuckets - 1, LatencyHistogram::bucketIndex(UINT32_MAX));
+}
+
+void test_percentiles_within_precision() {
+  LatencyHistogram h;
+  for (uint32_t v = 1; v <= 10000; v++) h.record(v);
+  TEST_ASSERT_EQUAL_UINT32(10000, h.count());
+  TEST_ASSERT_EQUAL_UINT32(1, h.min());
+  TEST_ASSERT_EQUAL_UINT32(10000, h.max());
+  TEST_ASSERT_UINT32_WITHIN(5000 / 8, 5000, h.percentile(50));
+  TEST_ASSERT_UINT32_WITHIN(9900 / 8, 9900, h.percentile(99));
+  TEST_ASSERT_EQUAL_UINT32(10000, h.percentile(100));
+}
+
+void test_merge_and_reset() {
+  LatencyHistogram a;
+  LatencyHistogram b;
+  a.record(10);
+  b.record(1000);
+  b.record(2000);
+  a.merge(b);
+  TEST_ASSERT_EQUAL_UINT32(3, a.count());
+  TEST_ASSERT_EQUAL_UINT32(10, a.min());
+  TEST_ASSERT_EQUAL_UINT32(2000, a.max());
+  a.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, a.count());
+  TEST_ASSERT_EQUAL_UINT32(0, a.percentile(99));
+}
+
+void test_mean_widens_the_sum_past_32_bits() {
+  LatencyHistogram a;
+  for (int i = 0; i < 3; i++) a.record(0xF0000000u); // the sum wraps twice
+  TEST_ASSERT_EQUAL_UINT32(0xF0000000u, a.mean());
+
+  LatencyHistogram b;
+  b.record(0x90000000u);
+  b.record(0x10000000u); // the sum is 2^31, the low word never wraps
+  a.merge(b);
+  TEST_ASSERT_EQUAL_UINT32(5, a.count());
+  TEST_ASSERT_EQUAL_UINT32((3ull * 0xF0000000u + 0xA0000000u) / 5, a.mean());
+  LatencyHistogram copy(a);
+  TEST_ASSERT_EQUAL_UINT32(a.mean(), copy.mean());
+
+  a.reset();
+  a.record(10);
+  TEST_ASSERT_EQUAL_UINT32(10, a.mean());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_bucket_bounds_roundtrip);
+  RUN_TEST(test_percentiles_within_precision);
+  RUN_TEST(test_merge_and_reset);
+  RUN_TEST(test_mean_widens_the_sum_past_32_bits);
+  return UNITY_END();
+}
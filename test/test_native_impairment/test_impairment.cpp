@@ -0,0 +1,242 @@
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <set>
+#include <string>
+#include <Arduino.h>
+#include "ImpairedTransport.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "MqttHost.h"
+
+void setUp() {}
+
+void tearDown() {
+  mqttHostSetDefaultReconnectMs(0);
+}
+
+// Reads `want` bytes from `far`, driving the impaired end meanwhile: the impairment only
+// moves data while its own end is being read or written
+static size_t pumpUntil(HostTransport& impaired, HostTransport& far, uint8_t* out, size_t want, uint32_t timeoutMs,
+                        uint32_t* firstMs = nullptr) {
+  uint32_t start = millis();
+  size_t got = 0;
+  uint8_t scratch[16];
+  while (got < want && millis() - start < timeoutMs) {
+    impaired.read(scratch, sizeof(scratch), 1);
+    int n = far.read(out + got, want - got, 0);
+    if (n > 0) {
+      if (!got && firstMs) *firstMs = millis() - start;
+      got += static_cast<size_t>(n);
+    }
+  }
+  return got;
+}
+
+void test_parse_impairment() {
+  ImpairmentProfile p;
+  TEST_ASSERT_TRUE(parseImpairment("latency=80,jitter=20,loss=15,bandwidth=64000", p));
+  TEST_ASSERT_EQUAL_UINT32(80, p.latencyMs);
+  TEST_ASSERT_EQUAL_UINT32(20, p.jitterMs);
+  TEST_ASSERT_EQUAL_UINT16(15, p.lossPermille);
+  TEST_ASSERT_EQUAL_UINT32(64000, p.bandwidthBps);
+  TEST_ASSERT_EQUAL_UINT32(0, p.resetEveryMs);
+
+  TEST_ASSERT_TRUE(parseImpairment("cellular,reset_every=0", p));
+  TEST_ASSERT_EQUAL_UINT32(150, p.latencyMs);
+  TEST_ASSERT_EQUAL_UINT32(0, p.resetEveryMs);
+  TEST_ASSERT_EQUAL_UINT32(30000, p.stallEveryMs);
+
+  TEST_ASSERT_FALSE(parseImpairment("latency", p));
+  TEST_ASSERT_FALSE(parseImpairment("latency=x", p));
+  TEST_ASSERT_FALSE(parseImpairment("loss=2000", p));
+  TEST_ASSERT_FALSE(parseImpairment("speed=3", p));
+}
+
+void test_latency_jitter_keep_stream_order() {
+  ImpairmentProfile profile;
+  profile.latencyMs = 30;
+  profile.jitterMs = 20;
+  profile.lossPermille = 200;
+  profile.retransmitMs = 40;
+  ImpairedNetwork network(profile);
+  std::unique_ptr<HostTransport> near, far;
+  hostPipePair(near, far);
+  std::unique_ptr<HostTransport> link = network.wrap(std::move(near));
+
+  for (uint8_t i = 0; i < 50; i++) {
+    TEST_ASSERT_EQUAL_INT(1, link->write(&i, 1));
+  }
+  uint8_t got[50];
+  uint32_t firstMs = 0;
+  TEST_ASSERT_EQUAL_UINT(50, pumpUntil(*link, *far, got, sizeof(got), 2000, &firstMs));
+  TEST_ASSERT_GREATER_OR_EQUAL(29, firstMs);
+  for (uint8_t i = 0; i < 50; i++) {
+    TEST_ASSERT_EQUAL_UINT8(i, got[i]);
+  }
+  TEST_ASSERT_GREATER_THAN(0, network.stats().losses);
+  TEST_ASSERT_EQUAL_UINT64(50, network.stats().bytesUp);
+
+  // Downstream is delayed the same way
+  uint8_t pong[3] = {7, 8, 9};
+  far->write(pong, sizeof(pong));
+  uint32_t start = millis();
+  uint8_t back[3];
+  size_t n = 0;
+  while (n < sizeof(back) && millis() - start < 1000) {
+    int r = link->read(back + n, sizeof(back) - n, 10);
+    if (r > 0) n += static_cast<size_t>(r);
+  }
+  TEST_ASSERT_EQUAL_UINT(3, n);
+  TEST_ASSERT_GREATER_OR_EQUAL(29, millis() - start);
+  TEST_ASSERT_EQUAL_MEMORY(pong, back, 3);
+}
+
+// Manually stepped clients poll with a zero timeout: data already due comes through
+void test_zero_timeout_read_polls_the_stream() {
+  ImpairedNetwork network;
+  std::unique_ptr<HostTransport> near, far;
+  hostPipePair(near, far);
+  std::unique_ptr<HostTransport> link = network.wrap(std::move(near));
+  const uint8_t hello[] = {'h', 'i'};
+  TEST_ASSERT_EQUAL_INT(2, far->write(hello, sizeof(hello)));
+  uint8_t buf[8];
+  TEST_ASSERT_EQUAL_INT(2, link->read(buf, sizeof(buf), 0));
+  TEST_ASSERT_EQUAL_MEMORY(hello, buf, sizeof(hello));
+  TEST_ASSERT_EQUAL_INT(0, link->read(buf, sizeof(buf), 0));
+}
+
+void test_bandwidth_cap_and_reset() {
+  ImpairmentProfile profile;
+  profile.bandwidthBps = 50000;
+  ImpairedNetwork network(profile);
+  std::unique_ptr<HostTransport> near, far;
+  hostPipePair(near, far);
+  std::unique_ptr<HostTransport> link = network.wrap(std::move(near));
+
+  static uint8_t block[10000];
+  uint32_t start = millis();
+  for (size_t off = 0; off < sizeof(block); off += 1000) {
+    TEST_ASSERT_EQUAL_INT(1000, link->write(block + off, 1000));
+  }
+  static uint8_t got[sizeof(block)];
+  TEST_ASSERT_EQUAL_UINT(sizeof(block), pumpUntil(*link, *far, got, sizeof(got), 2000));
+  uint32_t elapsed = millis() - start;
+  TEST_ASSERT_GREATER_OR_EQUAL(190, elapsed); // 10 KB at 50 KB/s
+  TEST_ASSERT_LESS_THAN(600, elapsed);
+
+  network.resetConnections();
+  uint8_t byte = 1;
+  TEST_ASSERT_EQUAL_INT(-1, link->write(&byte, 1));
+  TEST_ASSERT_EQUAL_INT(-1, far->read(got, 1, 100)); // the broker side sees the close
+  TEST_ASSERT_EQUAL_UINT32(1, network.stats().resets);
+}
+
+struct Inbox {
+  std::atomic<uint32_t> received{0};
+  std::mutex lock;
+  std::set<std::string> unique;
+
+  void add(const char* payload, size_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    unique.insert(std::string(payload, length));
+    received++;
+  }
+  size_t count() {
+    std::lock_guard<std::mutex> guard(lock);
+    return unique.size();
+  }
+};
+
+static bool waitFor(std::function<bool()> cond, uint32_t timeoutMs) {
+  for (uint32_t waited = 0; waited < timeoutMs; waited += 10) {
+    if (cond()) return true;
+    delay(10);
+  }
+  return cond();
+}
+
+void test_client_over_lossy_link() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("impaired-broker"));
+  ImpairmentProfile profile;
+  profile.latencyMs = 20;
+  profile.jitterMs = 10;
+  profile.lossPermille = 50;
+  profile.retransmitMs = 100;
+  profile.stallEveryMs = 150;
+  profile.stallMs = 50;
+  ImpairedNetwork network(profile);
+  network.install();
+
+  Inbox inbox;
+  MqttClient client;
+  client.setServer("impaired-broker", 1883);
+  client.onMessage([&](const char*, const char* payload, size_t length) { inbox.add(payload, length); });
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("lossy/#", 1));
+  TEST_ASSERT_TRUE(client.connect("impaired-client"));
+  TEST_ASSERT_TRUE(waitFor([&] { return client.isConnected(); }, 3000));
+  delay(100); // SUBACK
+
+  char payload[16];
+  for (int i = 0; i < 30; i++) {
+    snprintf(payload, sizeof(payload), "m%d", i);
+    TEST_ASSERT_TRUE(client.publishQos("lossy/data", payload, 1) > 0);
+  }
+  TEST_ASSERT_TRUE(waitFor([&] { return inbox.count() == 30; }, 10000));
+  // Only the last kAckSlots (16) of the 30 publishes in flight keep their start time
+  TEST_ASSERT_TRUE(waitFor([&] { return client.latency(MqttLatency::PublishAck).count() >= 10; }, 3000));
+  // At least a round trip on every ack
+  TEST_ASSERT_GREATER_OR_EQUAL(40000, client.latency(MqttLatency::PublishAck).min());
+  TEST_ASSERT_GREATER_THAN(0, network.stats().losses);
+  TEST_ASSERT_TRUE(waitFor([&] { return network.stats().stalls > 0; }, 2000));
+  client.disconnect();
+  delay(50);
+  network.uninstall();
+}
+
+void test_outbox_survives_connection_reset() {
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("impaired-broker"));
+  ImpairmentProfile profile;
+  profile.latencyMs = 5;
+  ImpairedNetwork network(profile);
+  network.install();
+  mqttHostSetDefaultReconnectMs(100);
+
+  Inbox inbox;
+  MqttClient client;
+  client.setServer("impaired-broker", 1883);
+  client.onMessage([&](const char*, const char* payload, size_t length) { inbox.add(payload, length); });
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("reset/#", 1));
+  TEST_ASSERT_TRUE(client.connect("impaired-client"));
+  TEST_ASSERT_TRUE(waitFor([&] { return client.isConnected(); }, 3000));
+  delay(50);
+
+  // QoS 1 publishes around a reset end up in the outbox and go out after the reconnect
+  network.resetConnections();
+  char payload[16];
+  for (int i = 0; i < 10; i++) {
+    snprintf(payload, sizeof(payload), "r%d", i);
+    client.publishQos("reset/data", payload, 1);
+  }
+  TEST_ASSERT_TRUE(waitFor([&] { return inbox.count() == 10; }, 5000));
+  MqttMetricsSnapshot snap;
+  client.metrics(snap);
+  TEST_ASSERT_GREATER_OR_EQUAL(2, snap.counters[static_cast<size_t>(MqttCounter::Connects)]);
+  TEST_ASSERT_GREATER_OR_EQUAL(1, network.stats().resets);
+  client.disconnect();
+  delay(50);
+  network.uninstall();
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_impairment);
+  RUN_TEST(test_latency_jitter_keep_stream_order);
+  RUN_TEST(test_zero_timeout_read_polls_the_stream);
+  RUN_TEST(test_bandwidth_cap_and_reset);
+  RUN_TEST(test_client_over_lossy_link);
+  RUN_TEST(test_outbox_survives_connection_reset);
+  return UNITY_END();
+}
@@ -0,0 +1,101 @@
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "MqttLog.h"
+
+static char lastLine[192];
+static int lines = 0;
+
+static void captureSink(uint8_t level, const char *line) {
+  strncpy(lastLine, line, sizeof(lastLine) - 1);
+  lines++;
+}
+
+void setUp() {
+  mqttLogSetSink(captureSink);
+  mqttLogFlush();
+  lines = 0;
+  lastLine[0] = '\0';
+}
+
+void tearDown() {}
+
+void test_deferred_entries_render_on_flush() {
+  mqttLogDeferred(MQTT_LOG_LEVEL_DEBUG, "Published, msg_id=%d", 42, 0, 0);
+  TEST_ASSERT_EQUAL_INT(0, lines);
+  TEST_ASSERT_EQUAL_UINT32(1, mqttLogFlush());
+  TEST_ASSERT_EQUAL_INT(1, lines);
+  TEST_ASSERT_NOT_NULL(strstr(lastLine, "Published, msg_id=42"));
+}
+
+void test_overrun_counts_lost_entries() {
+  uint32_t lostBefore = mqttLogLost();
+  for (int i = 0; i < MQTT_LOG_RING_SIZE + 10; i++) {
+    mqttLogDeferred(MQTT_LOG_LEVEL_DEBUG, "n=%d", i, 0, 0);
+  }
+  TEST_ASSERT_EQUAL_UINT32(MQTT_LOG_RING_SIZE, mqttLogFlush());
+  TEST_ASSERT_EQUAL_UINT32(10, mqttLogLost() - lostBefore);
+  TEST_ASSERT_NOT_NULL(strstr(lastLine, "n=73"));
+}
+
+void test_export_returns_raw_records() {
+  static const char *fmt = "a=%u b=%u c=%u";
+  mqttLogDeferred(MQTT_LOG_LEVEL_VERBOSE, fmt, 1, 2, 3);
+  MqttLogRecord records[4];
+  TEST_ASSERT_EQUAL_UINT32(1, mqttLogExport(records, 4));
+  TEST_ASSERT_EQUAL_UINT32(3, records[0].args[2]);
+  TEST_ASSERT_EQUAL_UINT8(MQTT_LOG_LEVEL_VERBOSE, records[0].level);
+  TEST_ASSERT_EQUAL_UINT32(0, mqttLogFlush());
+}
+
+// Several clients' loop() drain the ring while others keep logging: every entry is
+// either exported once or counted as lost, never both and never twice
+void test_concurrent_consumers_take_each_entry_once() {
+  const uint32_t kProducers = 3;
+  const uint32_t kPerProducer = 20000;
+  std::vector<std::atomic<uint8_t>> seen(kProducers * kPerProducer);
+  std::atomic<uint32_t> exported(0);
+  std::atomic<uint32_t> duplicates(0);
+  std::atomic<bool> producing(true);
+  uint32_t lostBefore = mqttLogLost();
+
+  auto consume = [&] {
+    MqttLogRecord records[8];
+    bool more = true;
+    while (producing.load() || more) {
+      size_t n = mqttLogExport(records, 8);
+      more = n > 0;
+      for (size_t i = 0; i < n; i++) {
+        if (seen[records[i].args[0] * kPerProducer + records[i].args[1]].fetch_add(1) != 0) duplicates++;
+      }
+      exported += static_cast<uint32_t>(n);
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.emplace_back(consume);
+  threads.emplace_back(consume);
+  std::vector<std::thread> producers;
+  for (uint32_t p = 0; p < kProducers; p++) {
+    producers.emplace_back([p] {
+      for (uint32_t i = 0; i < kPerProducer; i++) mqttLogDeferred(MQTT_LOG_LEVEL_DEBUG, "p=%u i=%u", p, i, 0);
+    });
+  }
+  for (auto &t : producers) t.join();
+  producing = false;
+  for (auto &t : threads) t.join();
+  consume(); // whatever the consumers left after their last empty export
+
+  TEST_ASSERT_EQUAL_UINT32(0, duplicates.load());
+  TEST_ASSERT_EQUAL_UINT32(kProducers * kPerProducer, exported.load() + (mqttLogLost() - lostBefore));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_deferred_entries_render_on_flush);
+  RUN_TEST(test_overrun_counts_lost_entries);
+  RUN_TEST(test_export_returns_raw_records);
+  RUN_TEST(test_concurrent_consumers_take_each_entry_once);
+  return UNITY_END();
+}
@@ -0,0 +1,108 @@
+#include <unity.h>
+#include <thread>
+#include "MqttMetrics.h"
+
+// MqttMetrics on its own: the per-core slots, their sum in a snapshot and the 32-bit
+// wraparound consumers handle by working with deltas.
+
+static uint32_t snap(const MqttMetrics &m, MqttCounter c) {
+  MqttMetricsSnapshot s;
+  m.snapshot(s);
+  return s.get(c);
+}
+
+void setUp() {
+  MqttMetrics::setHostCore(0);
+}
+
+void tearDown() {}
+
+void test_snapshot_sums_the_core_slots() {
+  MqttMetrics m;
+  m.add(MqttCounter::MessagesIn, 3);
+  MqttMetrics::setHostCore(1);
+  m.add(MqttCounter::MessagesIn, 4);
+  m.add(MqttCounter::BytesIn, 100);
+  TEST_ASSERT_EQUAL_UINT32(7, snap(m, MqttCounter::MessagesIn));
+  TEST_ASSERT_EQUAL_UINT32(100, snap(m, MqttCounter::BytesIn));
+  TEST_ASSERT_EQUAL_UINT32(0, snap(m, MqttCounter::MessagesOut));
+
+  m.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, snap(m, MqttCounter::MessagesIn));
+  TEST_ASSERT_EQUAL_UINT32(0, snap(m, MqttCounter::BytesIn));
+}
+
+void test_concurrent_adds_on_both_cores_are_all_counted() {
+  const uint32_t kAdds = 100000;
+  MqttMetrics m;
+  auto task = [&](size_t core) {
+    MqttMetrics::setHostCore(core);
+    for (uint32_t i = 0; i < kAdds; i++) m.add(MqttCounter::MessagesOut);
+  };
+  // Two tasks per core: adds into one slot race like unpinned tasks do
+  std::thread a(task, 0), b(task, 1), c(task, 0), d(task, 1);
+  a.join();
+  b.join();
+  c.join();
+  d.join();
+  TEST_ASSERT_EQUAL_UINT32(4 * kAdds, snap(m, MqttCounter::MessagesOut));
+}
+
+void test_snapshot_delta_survives_wraparound() {
+  MqttMetrics m;
+  // One slot wraps
+  m.add(MqttCounter::BytesOut, UINT32_MAX - 9);
+  uint32_t prev = snap(m, MqttCounter::BytesOut);
+  m.add(MqttCounter::BytesOut, 25);
+  uint32_t cur = snap(m, MqttCounter::BytesOut);
+  TEST_ASSERT_TRUE(cur < prev);
+  TEST_ASSERT_EQUAL_UINT32(25, cur - prev);
+
+  // Neither slot wraps, their sum does
+  MqttMetrics n;
+  n.add(MqttCounter::BytesIn, 0xF0000000u);
+  MqttMetrics::setHostCore(1);
+  n.add(MqttCounter::BytesIn, 0x0FFFFFF0u);
+  prev = snap(n, MqttCounter::BytesIn);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFF0u, prev);
+  n.add(MqttCounter::BytesIn, 0x20);
+  cur = snap(n, MqttCounter::BytesIn);
+  TEST_ASSERT_EQUAL_UINT32(0x10, cur);
+  TEST_ASSERT_EQUAL_UINT32(0x20, cur - prev);
+}
+
+void test_gauges_and_watermarks() {
+  MqttMetrics m;
+  m.inFlightAdd(3);
+  m.inFlightAdd(-1);
+  m.recordCallback(50);
+  m.recordCallback(20);
+  m.recordEventStackFree(4000);
+  m.recordEventStackFree(3000);
+  m.recordEventStackFree(3500);
+
+  MqttMetricsSnapshot s;
+  m.snapshot(s);
+  TEST_ASSERT_EQUAL_INT32(2, s.inFlight);
+  TEST_ASSERT_EQUAL_UINT32(50, s.callbackMaxUs);
+  TEST_ASSERT_EQUAL_UINT32(2, s.get(MqttCounter::CallbackCalls));
+  TEST_ASSERT_EQUAL_UINT32(70, s.get(MqttCounter::CallbackTimeUs));
+  TEST_ASSERT_EQUAL_INT32(3000, s.eventStackFree);
+  TEST_ASSERT_EQUAL_INT32(-1, s.appStackFree);
+
+  // reset() keeps the in-flight gauge and the watermarks
+  m.reset();
+  m.snapshot(s);
+  TEST_ASSERT_EQUAL_INT32(2, s.inFlight);
+  TEST_ASSERT_EQUAL_UINT32(0, s.callbackMaxUs);
+  TEST_ASSERT_EQUAL_INT32(3000, s.eventStackFree);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_snapshot_sums_the_core_slots);
+  RUN_TEST(test_concurrent_adds_on_both_cores_are_all_counted);
+  RUN_TEST(test_snapshot_delta_survives_wraparound);
+  RUN_TEST(test_gauges_and_watermarks);
+  return UNITY_END();
+}
@@ -0,0 +1,233 @@
+#include <unity.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include "AllocCounter.h"
+#include "LoopbackBroker.h"
+#include "MqttClient.h"
+#include "MqttHost.h"
+#include "TrafficCapture.h"
+
+// Large payloads: esp-mqtt hands over a message in fragments of its buffer size. Messages
+// up to the max message size are reassembled for onMessage(), larger ones streamed to
+// onMessageChunk(); either way the client's memory does not grow with the payload.
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t counter(const MqttClient& client, MqttCounter c) {
+  MqttMetricsSnapshot m;
+  client.metrics(m);
+  return m.counters[static_cast<size_t>(c)];
+}
+
+// Byte i of a test payload of `size` bytes; checked on the fly, without a second buffer
+static uint8_t patternByte(size_t size, size_t i) {
+  return static_cast<uint8_t>((i * 131 + size + (i >> 12)) & 0xFF);
+}
+
+static std::vector<char> pattern(size_t size) {
+  std::vector<char> out(size);
+  for (size_t i = 0; i < size; i++) out[i] = static_cast<char>(patternByte(size, i));
+  return out;
+}
+
+// An MQTT_EVENT_DATA as esp-mqtt posts it; only the first fragment carries the topic
+static void fragment(MqttClient& client, const char* topic, const std::vector<char>& payload, size_t offset,
+                     size_t len, int msgId = 1) {
+  esp_mqtt_event_t event = {};
+  event.event_id = MQTT_EVENT_DATA;
+  event.msg_id = msgId;
+  if (offset == 0) {
+    event.topic = const_cast<char*>(topic);
+    event.topic_len = static_cast<int>(strlen(topic));
+  }
+  event.data = const_cast<char*>(payload.data() + offset);
+  event.data_len = static_cast<int>(len);
+  event.total_data_len = static_cast<int>(payload.size());
+  event.current_data_offset = static_cast<int>(offset);
+  client.onDataFragmentInternal(&event, micros());
+}
+
+static void fragments(MqttClient& client, const char* topic, const std::vector<char>& payload, size_t chunk) {
+  size_t offset = 0;
+  do {
+    size_t len = std::min(chunk, payload.size() - offset);
+    fragment(client, topic, payload, offset, len);
+    offset += len;
+  } while (offset < payload.size());
+}
+
+void test_fragments_are_reassembled() {
+  MqttClient client; // not connected: fragments go straight into the receive path
+  client.setMaxMessageSize(4096);
+  std::vector<std::string> messages;
+  client.onMessage([&](const char* topic, const char* payload, size_t length) {
+    TEST_ASSERT_EQUAL_INT(0, payload[length]);
+    messages.push_back(std::string(topic) + "=" + std::string(payload, length));
+  });
+
+  std::vector<char> whole = pattern(4096);
+  fragments(client, "ota/image", whole, 1000);
+  TEST_ASSERT_EQUAL_UINT(1, messages.size());
+  TEST_ASSERT_EQUAL_STRING("ota/image", messages[0].substr(0, 9).c_str());
+  TEST_ASSERT_EQUAL_MEMORY(whole.data(), messages[0].data() + 10, whole.size());
+  TEST_ASSERT_EQUAL_UINT32(4096, counter(client, MqttCounter::BytesCopied));
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::MessagesIn));
+
+  // A message cut short by a reconnect is never delivered; the next one is
+  std::vector<char> cut = pattern(3000);
+  fragment(client, "logs/a", cut, 0, 1000, 2);
+  std::vector<char> next = pattern(10);
+  fragments(client, "logs/b", next, 1000);
+  // and neither are fragments of a message whose start was lost
+  fragment(client, "logs/a", cut, 2000, 1000, 2);
+  TEST_ASSERT_EQUAL_UINT(2, messages.size());
+  TEST_ASSERT_EQUAL_STRING("logs/b", messages[1].substr(0, 6).c_str());
+
+  // Empty payloads are messages too
+  fragments(client, "logs/empty", std::vector<char>(), 1000);
+  TEST_ASSERT_EQUAL_UINT(3, messages.size());
+  TEST_ASSERT_EQUAL_STRING("logs/empty=", messages[2].c_str());
+}
+
+void test_oversize_messages_are_streamed_or_dropped() {
+  MqttClient client;
+  client.setMaxMessageSize(1024);
+  uint32_t whole = 0;
+  client.onMessage([&](const char*, const char*, size_t) { whole++; });
+  TrafficCapture capture(4096);
+  capture.start(micros());
+  client.setCapture(&capture);
+
+  // Without a chunk callback: dropped once, however many fragments it came in
+  std::vector<char> big = pattern(5000);
+  fragments(client, "ota/image", big, 1024);
+  TEST_ASSERT_EQUAL_UINT32(0, whole);
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::DropOversize));
+
+  // With one: every fragment in order, straight from esp-mqtt's buffer
+  size_t expected = 0;
+  uint32_t chunks = 0;
+  client.onMessageChunk([&](const char* topic, const char* chunk, size_t length, size_t offset, size_t total) {
+    TEST_ASSERT_EQUAL_STRING("ota/image", topic);
+    TEST_ASSERT_EQUAL_UINT(expected, offset);
+    TEST_ASSERT_EQUAL_UINT(big.size(), total);
+    TEST_ASSERT_TRUE(chunk == big.data() + offset);
+    expected += length;
+    chunks++;
+  });
+  fragments(client, "ota/image", big, 1024);
+  TEST_ASSERT_EQUAL_UINT(big.size(), expected);
+  TEST_ASSERT_EQUAL_UINT32(5, chunks);
+  TEST_ASSERT_EQUAL_UINT32(0, whole);
+  TEST_ASSERT_EQUAL_UINT32(0, counter(client, MqttCounter::BytesCopied));
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::DropOversize));
+  TEST_ASSERT_EQUAL_UINT32(5000, counter(client, MqttCounter::BytesIn));
+
+  // Messages that fit still arrive whole
+  std::vector<char> small = pattern(1024);
+  fragments(client, "cmd/reboot", small, 512);
+  TEST_ASSERT_EQUAL_UINT32(1, whole);
+  TEST_ASSERT_EQUAL_UINT32(5, chunks);
+
+  // The capture keeps each message's full length, with the payload it could see
+  std::vector<uint8_t> stream;
+  capture.setSink([&](const uint8_t* data, size_t len) { stream.insert(stream.end(), data, data + len); });
+  capture.flush();
+  client.setCapture(nullptr);
+  CaptureReader reader(stream.data(), stream.size());
+  CaptureRecord r;
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(CaptureEvent::Dropped), static_cast<int>(r.event));
+  TEST_ASSERT_EQUAL_UINT(5000, r.payloadLen);
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_INT(static_cast<int>(CaptureEvent::Inbound), static_cast<int>(r.event));
+  TEST_ASSERT_EQUAL_UINT(5000, r.payloadLen);
+  TEST_ASSERT_TRUE(r.truncated);
+  TEST_ASSERT_EQUAL_MEMORY(big.data(), r.payload, r.storedLen);
+  TEST_ASSERT_TRUE(reader.next(r));
+  TEST_ASSERT_EQUAL_UINT(1024, r.payloadLen);
+  TEST_ASSERT_FALSE(reader.next(r));
+}
+
+// Round trips through the broker, 1 KB to 16 MB: the client publishes and receives its
+// own messages, whole up to 64 KB and streamed above. Once warmed up it allocates
+// nothing for any of them, so its memory is its fixed receive buffer whatever the size.
+void test_payloads_up_to_16mb_in_bounded_memory() {
+  const size_t kBufferSize = 4096;
+  const size_t kMaxMessage = 64 * 1024;
+  mqttHostSetManualStep(true);
+  LoopbackBroker broker;
+  TEST_ASSERT_TRUE(broker.listenPipe("payload-broker"));
+  MqttClient client;
+  client.setServer("payload-broker", 1883);
+  client.setBufferSize(static_cast<int>(kBufferSize));
+  client.setMaxMessageSize(kMaxMessage);
+
+  size_t size = 0;
+  size_t received = 0; // bytes of the current message checked so far
+  size_t maxChunk = 0;
+  bool intact = true;
+  uint32_t messages = 0;
+  client.onMessage([&](const char*, const char* payload, size_t length) {
+    for (size_t i = 0; i < length; i++) intact &= static_cast<uint8_t>(payload[i]) == patternByte(size, i);
+    received = length;
+    messages++;
+  });
+  client.onMessageChunk([&](const char*, const char* chunk, size_t length, size_t offset, size_t total) {
+    intact &= offset == received && total == size;
+    for (size_t i = 0; i < length; i++) intact &= static_cast<uint8_t>(chunk[i]) == patternByte(size, offset + i);
+    received += length;
+    if (length > maxChunk) maxChunk = length;
+    if (received == total) messages++;
+  });
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("bulk/#", 0));
+  TEST_ASSERT_TRUE(client.connect("payload-client"));
+  for (int i = 0; i < 200 && !client.isConnected(); i++) mqttHostStep(5);
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  // Publishes `bytes` and steps until they are back; returns the allocations it took
+  auto roundTrip = [&](size_t bytes) -> uint64_t {
+    std::vector<char> payload = pattern(bytes);
+    size = bytes;
+    received = 0;
+    uint32_t before = messages;
+    AllocCounts start = allocThreadCounts();
+    if (client.publishQos("bulk/data", static_cast<const void*>(payload.data()), payload.size(), 0) < 0) return ~0ull;
+    for (int i = 0; i < 100000 && messages == before; i++) mqttHostStep(1);
+    AllocCounts end = allocThreadCounts();
+    return messages == before + 1 && received == bytes ? end.allocs - start.allocs : ~0ull;
+  };
+  // Warm-up: the profiler slot of the filter and the dispatch histogram buckets
+  TEST_ASSERT_TRUE(roundTrip(1024) != ~0ull);
+  TEST_ASSERT_TRUE(roundTrip(kMaxMessage * 2) != ~0ull);
+
+  for (size_t bytes = 1024; bytes <= 16 * 1024 * 1024; bytes *= 4) {
+    uint32_t copiedBefore = counter(client, MqttCounter::BytesCopied);
+    uint64_t allocs = roundTrip(bytes);
+    TEST_ASSERT_TRUE_MESSAGE(allocs != ~0ull, std::to_string(bytes).c_str());
+    if (allocHooksActive()) {
+      TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, allocs, std::to_string(bytes).c_str());
+    }
+    uint32_t copied = counter(client, MqttCounter::BytesCopied) - copiedBefore;
+    // One copy into the receive buffer for whole messages, none when streamed
+    TEST_ASSERT_EQUAL_UINT32(bytes <= kMaxMessage ? bytes : 0, copied);
+  }
+  TEST_ASSERT_TRUE(intact);
+  TEST_ASSERT_LESS_OR_EQUAL(kBufferSize, maxChunk);
+  TEST_ASSERT_EQUAL_UINT32(0, counter(client, MqttCounter::DropOversize));
+  client.disconnect();
+  mqttHostStep(1);
+  mqttHostSetManualStep(false);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fragments_are_reassembled);
+  RUN_TEST(test_oversize_messages_are_streamed_or_dropped);
+  RUN_TEST(test_payloads_up_to_16mb_in_bounded_memory);
+  return UNITY_END();
+}
@@ -0,0 +1,311 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <Arduino.h>
+#include "AllocCounter.h"
+#include "HostClock.h"
+#include "ImpairedTransport.h"
+#include "MqttClient.h"
+#include "MqttHost.h"
+#include "Simulation.h"
+
+// Connects, drops and reconnects on virtual time: every timer in the client and the
+// esp-mqtt stand-in runs off the simulation's clock, so timing is asserted exactly and
+// simulated hours take milliseconds.
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t counter(const MqttClient& client, MqttCounter c) {
+  MqttMetricsSnapshot m;
+  client.metrics(m);
+  return m.counters[static_cast<size_t>(c)];
+}
+
+static uint64_t wallMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Timestamps of connects and disconnects, in simulated ms
+struct Timeline {
+  std::vector<uint64_t> connects;
+  std::vector<uint64_t> disconnects;
+
+  void attach(MqttClient& client, Simulation& sim) {
+    client.onConnect([this, &sim] { connects.push_back(sim.nowMs()); });
+    client.onDisconnect([this, &sim] { disconnects.push_back(sim.nowMs()); });
+  }
+};
+
+void test_virtual_clock_drives_host_time() {
+  VirtualClock clock(5000000);
+  mqttHostSetClock(&clock);
+  TEST_ASSERT_EQUAL_UINT32(5000, millis());
+  TEST_ASSERT_EQUAL_UINT32(5000000, micros());
+  uint64_t start = wallMs();
+  delay(60000);
+  TEST_ASSERT_EQUAL_UINT32(65000, millis());
+
+  // An idle pipe read or accept returns at once, with the clock moved on by its timeout
+  std::unique_ptr<HostTransport> a, b;
+  hostPipePair(a, b);
+  uint8_t byte;
+  TEST_ASSERT_EQUAL_INT(0, a->read(&byte, 1, 30000));
+  TEST_ASSERT_EQUAL_UINT32(95000, millis());
+  HostPipeListener listener("clock-test");
+  TEST_ASSERT_NULL(listener.accept(5000).get());
+  TEST_ASSERT_EQUAL_UINT32(100000, millis());
+  b->write(&byte, 1);
+  TEST_ASSERT_EQUAL_INT(1, a->read(&byte, 1, 30000));
+  TEST_ASSERT_EQUAL_UINT32(100000, millis());
+  TEST_ASSERT_TRUE(wallMs() - start < 1000);
+
+  // millis() and micros() wrap at 32 bits like on the ESP32
+  VirtualClock late((1ull << 32) * 1000 - 500);
+  mqttHostSetClock(&late);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFu, millis());
+  delay(1);
+  TEST_ASSERT_EQUAL_UINT32(0, millis());
+  mqttHostSetClock(nullptr);
+  TEST_ASSERT_TRUE(millis() < 3600u * 1000);
+}
+
+void test_reconnect_waits_exactly_the_reconnect_delay() {
+  Simulation sim;
+  MqttClient client;
+  Timeline timeline;
+  timeline.attach(client, sim);
+  client.setServer("sim-broker", 1883);
+  TEST_ASSERT_TRUE(client.connect("sim-client"));
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 1000, 10));
+
+  for (int i = 0; i < 3; i++) {
+    sim.run(60000, 10);
+    sim.broker().dropConnections("sim-client");
+    TEST_ASSERT_TRUE(sim.runUntil([&] { return !client.isConnected(); }, 1000, 10));
+    TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 20000, 10));
+  }
+  TEST_ASSERT_EQUAL_UINT(4, timeline.connects.size());
+  TEST_ASSERT_EQUAL_UINT(3, timeline.disconnects.size());
+  for (size_t i = 0; i < timeline.disconnects.size(); i++) {
+    // esp-mqtt's default reconnect_timeout_ms, to the millisecond
+    TEST_ASSERT_EQUAL_UINT64(10000, timeline.connects[i + 1] - timeline.disconnects[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(4, counter(client, MqttCounter::Connects));
+}
+
+void test_keepalive_holds_an_idle_link() {
+  Simulation sim;
+  MqttClient client;
+  client.setServer("sim-broker", 1883);
+  client.setKeepalive(60);
+  TEST_ASSERT_TRUE(client.connect("idle-client"));
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 1000, 10));
+
+  // The broker closes a link after 1.5 keepalive periods of silence, so only PINGREQs
+  // every 30 s keep this one up for a simulated day
+  sim.run(24ull * 3600 * 1000, 1000);
+  TEST_ASSERT_TRUE(client.isConnected());
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::Connects));
+  TEST_ASSERT_EQUAL_UINT(1, sim.broker().connectionCount());
+}
+
+void test_fallback_reconnects_after_one_second() {
+  Simulation sim;
+  MqttClient client;
+  Timeline timeline;
+  client.onConnect([&] { timeline.connects.push_back(sim.nowMs()); });
+  uint64_t droppedMs = 0;
+  client.setServer("sim-broker", 1883);
+  client.setProtocolFallback(true);
+  TEST_ASSERT_TRUE(client.connect("fallback-client"));
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 1000, 10));
+
+  sim.run(5000, 10);
+  droppedMs = sim.nowMs();
+  sim.broker().dropConnections();
+  uint64_t start = wallMs();
+  // reconnectWithFallback() sleeps 1 s in the event handler, then starts a v3.1.1 client
+  // instead of waiting for esp-mqtt's 10 s reconnect
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return timeline.connects.size() == 2; }, 20000, 10));
+  TEST_ASSERT_TRUE(wallMs() - start < 1000);
+  TEST_ASSERT_GREATER_OR_EQUAL(1000, timeline.connects[1] - droppedMs);
+  TEST_ASSERT_LESS_OR_EQUAL(1020, timeline.connects[1] - droppedMs);
+  TEST_ASSERT_TRUE(client.isConnected());
+}
+
+// Probes through a healthy link are answered and timed; a half-open link (bytes go out,
+// nothing comes back within the hour) is declared dead after maxMissed probes, long
+// before keepalive would notice
+void test_link_probe_detects_a_dead_link() {
+  Simulation sim;
+  ImpairedNetwork network;
+  network.install();
+  MqttClient client;
+  Timeline timeline;
+  timeline.attach(client, sim);
+  uint32_t delivered = 0;
+  client.onMessage([&](const char*, const char*, size_t) { delivered++; });
+  sim.onTick([&] { client.loop(); });
+  client.setServer("sim-broker", 1883);
+  client.setKeepalive(120);
+  client.setLinkProbe(5000, 3);
+  TEST_ASSERT_TRUE(client.connect("probe-client"));
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 1000, 10));
+
+  sim.run(30000, 10);
+  const LatencyHistogram& rtt = client.latency(MqttLatency::ProbeRtt);
+  TEST_ASSERT_GREATER_OR_EQUAL(5, rtt.count());
+  TEST_ASSERT_EQUAL_UINT32(0, delivered); // echoes never reach the application
+
+  ImpairmentProfile halfOpen;
+  halfOpen.latencyMs = 3600 * 1000;
+  network.setProfile(halfOpen);
+  uint64_t stalledMs = sim.nowMs();
+  uint32_t answered = rtt.count();
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return !timeline.disconnects.empty(); }, 60000, 10));
+  // Three probe intervals, plus up to one for the probe in flight when the link went quiet
+  TEST_ASSERT_GREATER_OR_EQUAL(15000, timeline.disconnects[0] - stalledMs);
+  TEST_ASSERT_LESS_OR_EQUAL(20010, timeline.disconnects[0] - stalledMs);
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::DisconnectTimeout));
+  TEST_ASSERT_EQUAL_UINT32(answered, rtt.count());
+
+  // Once the network is back the client reconnects and probes the new link
+  network.setProfile(ImpairmentProfile());
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 20000, 10));
+  TEST_ASSERT_EQUAL_UINT(2, timeline.connects.size());
+  sim.run(30000, 10);
+  TEST_ASSERT_GREATER_OR_EQUAL(answered + 5, rtt.count());
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::DisconnectTimeout));
+  TEST_ASSERT_EQUAL_UINT32(2, counter(client, MqttCounter::Connects));
+  TEST_ASSERT_EQUAL_UINT32(0, delivered);
+}
+
+// A probe answered after one miss resets the count: spells of latency longer than the
+// probe interval, each costing one probe, never add up to maxMissed
+void test_link_probe_answer_resets_missed_count() {
+  Simulation sim;
+  ImpairedNetwork network;
+  network.install();
+  MqttClient client;
+  sim.onTick([&] { client.loop(); });
+  client.setServer("sim-broker", 1883);
+  client.setKeepalive(120);
+  client.setLinkProbe(5000, 2);
+  TEST_ASSERT_TRUE(client.connect("probe-client"));
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 1000, 10));
+
+  ImpairmentProfile slow;
+  slow.latencyMs = 6000; // one way already takes longer than the 5 s probe interval
+  const LatencyHistogram& rtt = client.latency(MqttLatency::ProbeRtt);
+  for (int i = 0; i < 4; i++) {
+    sim.run(20000, 10);
+    uint32_t answered = rtt.count();
+    network.setProfile(slow);
+    sim.run(5000, 10);
+    network.setProfile(ImpairmentProfile());
+    sim.run(10000, 10);
+    TEST_ASSERT_GREATER_THAN(answered, rtt.count());
+  }
+  TEST_ASSERT_TRUE(client.isConnected());
+  TEST_ASSERT_EQUAL_UINT32(0, counter(client, MqttCounter::DisconnectTimeout));
+  TEST_ASSERT_EQUAL_UINT32(1, counter(client, MqttCounter::Connects));
+}
+
+// A thousand simulated hours of random drops and steady QoS 1 traffic, across a millis()
+// wrap (every 49.7 days) and hundreds of micros() wraps
+void test_thousand_hours_of_drops() {
+  const uint64_t kHourMs = 3600ull * 1000;
+  const uint64_t kStartUs = ((1ull << 32) - kHourMs) * 1000; // millis() wraps an hour in
+  Simulation sim("sim-broker", kStartUs);
+  MqttClient client;
+  Timeline timeline;
+  timeline.attach(client, sim);
+  // Sized up front so the test's own bookkeeping does not show up as heap growth
+  timeline.connects.reserve(4096);
+  timeline.disconnects.reserve(4096);
+  std::vector<uint8_t> seen(16384);
+  uint32_t deliveries = 0;
+  client.onMessage([&](const char*, const char* payload, size_t length) {
+    deliveries++;
+    seen[strtoul(std::string(payload + 1, length - 1).c_str(), nullptr, 10)]++;
+  });
+  sim.onTick([&] { client.loop(); });
+  client.setServer("sim-broker", 1883);
+  client.setKeepalive(60);
+  TEST_ASSERT_EQUAL_INT(0, client.subscribe("soak/#", 1));
+  TEST_ASSERT_TRUE(client.connect("soak-client"));
+  TEST_ASSERT_TRUE(sim.runUntil([&] { return client.isConnected(); }, 1000, 100));
+
+  std::mt19937 rng(42);
+  std::exponential_distribution<double> dropGap(1.0 / (30 * 60 * 1000)); // a drop every 30 min on average
+  const uint64_t endMs = sim.nowMs() + 1000 * kHourMs;
+  uint64_t nextDropMs = sim.nowMs() + static_cast<uint64_t>(dropGap(rng));
+  uint64_t nextPublishMs = sim.nowMs();
+  uint32_t published = 0;
+  uint32_t drops = 0;
+  int64_t liveAfterWarmup = 0;
+  uint64_t start = wallMs();
+  char payload[16];
+  while (sim.nowMs() < endMs) {
+    uint64_t now = sim.nowMs();
+    if (now >= nextDropMs && client.isConnected()) {
+      sim.broker().dropConnections("soak-client");
+      drops++;
+      nextDropMs = now + 1000 + static_cast<uint64_t>(dropGap(rng));
+    }
+    if (now >= nextPublishMs) {
+      snprintf(payload, sizeof(payload), "m%u", static_cast<unsigned>(published));
+      TEST_ASSERT_TRUE(client.publishQos("soak/data", payload, 1) > 0); // queued while disconnected
+      published++;
+      nextPublishMs = now + 5 * 60 * 1000;
+    }
+    if (published == 12 && !liveAfterWarmup) liveAfterWarmup = allocLiveBytes();
+    // Jump to the next timer, drop or publish
+    sim.tick(static_cast<uint32_t>(std::min(std::min(nextDropMs, nextPublishMs), endMs) - now));
+  }
+  sim.run(20000, 1000); // the last reconnect and its backlog
+  uint64_t wallElapsedMs = wallMs() - start;
+
+  TEST_ASSERT_TRUE(client.isConnected());
+  TEST_ASSERT_GREATER_THAN(1500, drops);
+  TEST_ASSERT_EQUAL_UINT(drops + 1, timeline.connects.size());
+  TEST_ASSERT_EQUAL_UINT(drops, timeline.disconnects.size());
+  TEST_ASSERT_EQUAL_UINT32(drops + 1, counter(client, MqttCounter::Connects));
+  for (size_t i = 0; i < timeline.disconnects.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT64(10000, timeline.connects[i + 1] - timeline.disconnects[i]);
+  }
+  // Every message arrives once, subscriptions were restored after every reconnect
+  TEST_ASSERT_EQUAL_UINT32(published, deliveries);
+  for (uint32_t i = 0; i < published; i++) {
+    TEST_ASSERT_EQUAL_UINT8(1, seen[i]);
+  }
+  MqttMetricsSnapshot snap;
+  client.metrics(snap);
+  TEST_ASSERT_EQUAL_INT(0, snap.inFlight);
+  // Reconnecting does not leak
+  if (allocHooksActive()) {
+    TEST_ASSERT_LESS_THAN(16 * 1024, allocLiveBytes() - liveAfterWarmup);
+  }
+  TEST_ASSERT_LESS_THAN(60000, wallElapsedMs);
+  printf("1000 simulated hours, %u drops, %u messages in %llu ms\n", static_cast<unsigned>(drops),
+         static_cast<unsigned>(published), static_cast<unsigned long long>(wallElapsedMs));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_virtual_clock_drives_host_time);
+  RUN_TEST(test_reconnect_waits_exactly_the_reconnect_delay);
+  RUN_TEST(test_keepalive_holds_an_idle_link);
+  RUN_TEST(test_fallback_reconnects_after_one_second);
+  RUN_TEST(test_link_probe_detects_a_dead_link);
+  RUN_TEST(test_link_probe_answer_resets_missed_count);
+  RUN_TEST(test_thousand_hours_of_drops);
+  return UNITY_END();
+}
+
@@ -0,0 +1,72 @@
+#include <unity.h>
+#include <string.h>
+#include "StatsReport.h"
+
+static void fill(MqttMetricsSnapshot &s, uint32_t in, uint32_t connects) {
+  memset(&s, 0, sizeof(s));
+  s.counters[static_cast<size_t>(MqttCounter::MessagesIn)] = in;
+  s.counters[static_cast<size_t>(MqttCounter::Connects)] = connects;
+  s.outboxBytes = -1;
+  s.eventStackFree = s.appStackFree = s.heapFreeMin = -1;
+  s.connectHeapLow = s.connectHeapUsed = -1;
+}
+
+void test_traffic_is_delta_connections_are_totals() {
+  MqttMetricsSnapshot prev, cur;
+  fill(prev, 100, 2);
+  fill(cur, 130, 3);
+  prev.counters[static_cast<size_t>(MqttCounter::DropExpired)] = 5;
+  cur.counters[static_cast<size_t>(MqttCounter::DropExpired)] = 9;
+  MqttStatsReport r;
+  r.current = &cur;
+  r.previous = &prev;
+  r.intervalMs = 10000;
+
+  char buf[512];
+  int n = formatStatsReport(r, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(n > 0);
+  TEST_ASSERT_EQUAL_INT((int)strlen(buf), n);
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"dt\":10000,\"in\":30,"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"drop\":{\"nc\":0,\"pub\":0,\"flt\":0,\"big\":0,\"exp\":4}"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"conn\":3,"));
+  TEST_ASSERT_NULL(strstr(buf, "\"heap\""));
+  TEST_ASSERT_NULL(strstr(buf, "\"lat\""));
+  TEST_ASSERT_EQUAL_INT('}', buf[n - 1]);
+}
+
+void test_latency_and_heap_sections() {
+  MqttMetricsSnapshot cur;
+  fill(cur, 1, 1);
+  LatencyHistogram ack;
+  ack.record(1000);
+  MqttStatsReport r;
+  r.current = &cur;
+  r.heapFree = 120000;
+  r.heapMin = 90000;
+  r.latency[1] = &ack;
+  cur.eventStackFree = 1200;
+
+  char buf[512];
+  TEST_ASSERT_TRUE(formatStatsReport(r, buf, sizeof(buf)) > 0);
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"heap\":120000,\"heap_min\":90000"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, ",\"lat\":{\"puback\":{\"n\":1,"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"stack\":{\"evt\":1200,\"app\":-1}"));
+  TEST_ASSERT_NULL(strstr(buf, "heap_conn"));
+}
+
+void test_rejects_small_buffer() {
+  MqttMetricsSnapshot cur;
+  fill(cur, 1, 1);
+  MqttStatsReport r;
+  r.current = &cur;
+  char buf[32];
+  TEST_ASSERT_EQUAL_INT(-1, formatStatsReport(r, buf, sizeof(buf)));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_traffic_is_delta_connections_are_totals);
+  RUN_TEST(test_latency_and_heap_sections);
+  RUN_TEST(test_rejects_small_buffer);
+  return UNITY_END();
+}
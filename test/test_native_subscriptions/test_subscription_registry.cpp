@@ -0,0 +1,114 @@
+#include <unity.h>
+#include "SubscriptionRegistry.h"
+
+void test_topic_matching() {
+  TEST_ASSERT_TRUE(topicMatchesFilter("a/b/c", "a/b/c"));
+  TEST_ASSERT_FALSE(topicMatchesFilter("a/b/c", "a/b/cd"));
+  TEST_ASSERT_FALSE(topicMatchesFilter("a/b", "a/b/c"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("a/+/c", "a/b/c"));
+  TEST_ASSERT_FALSE(topicMatchesFilter("a/+", "a/b/c"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("a/+", "a/"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("a/#", "a/b/c"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("a/#", "a"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("#", "a/b"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("+/+", "/x"));
+  TEST_ASSERT_FALSE(topicMatchesFilter("#", "$SYS/uptime"));
+  TEST_ASSERT_TRUE(topicMatchesFilter("$SYS/#", "$SYS/uptime"));
+}
+
+void test_filter_validation() {
+  TEST_ASSERT_TRUE(isValidTopicFilter("a/+/c"));
+  TEST_ASSERT_TRUE(isValidTopicFilter("#"));
+  TEST_ASSERT_FALSE(isValidTopicFilter("a/#/c"));
+  TEST_ASSERT_FALSE(isValidTopicFilter("a/b+"));
+  TEST_ASSERT_FALSE(isValidTopicFilter(""));
+}
+
+void test_registry_add_updates_qos() {
+  SubscriptionRegistry reg;
+  Subscription *sub = reg.add("sensor/+", 0);
+  TEST_ASSERT_NOT_NULL(sub);
+  sub->active = true;
+  TEST_ASSERT_TRUE(reg.add("sensor/+", 0)->active);
+  TEST_ASSERT_FALSE(reg.add("sensor/+", 1)->active);
+  TEST_ASSERT_EQUAL_UINT8(1, reg.find("sensor/+")->qos);
+  TEST_ASSERT_EQUAL_UINT32(1, reg.size());
+  TEST_ASSERT_NULL(reg.add("bad/#/filter", 0));
+}
+
+void test_registry_reconnect_state() {
+  SubscriptionRegistry reg;
+  reg.add("a", 0);
+  reg.add("b/#", 1);
+  reg.markAllActive();
+  reg.markAllInactive();
+  TEST_ASSERT_FALSE(reg.at(0).active);
+  TEST_ASSERT_TRUE(reg.matches("b/x"));
+  TEST_ASSERT_TRUE(reg.remove("b/#"));
+  TEST_ASSERT_FALSE(reg.matches("b/x"));
+}
+
+void test_filter_covers() {
+  TEST_ASSERT_TRUE(filterCovers("a/+", "a/b"));
+  TEST_ASSERT_TRUE(filterCovers("a/#", "a/+/c"));
+  TEST_ASSERT_TRUE(filterCovers("a/#", "a"));
+  TEST_ASSERT_FALSE(filterCovers("a/+", "a/#"));
+  TEST_ASSERT_FALSE(filterCovers("a/+", "a/b/c"));
+  TEST_ASSERT_FALSE(filterCovers("#", "$SYS/x"));
+}
+
+void test_aggregation_collapses_siblings() {
+  SubscriptionRegistry reg;
+  reg.add("a/b/1", 0);
+  reg.add("a/b/2", 1);
+  reg.add("a/b/3", 0);
+  reg.add("a/b/4", 0);
+  reg.add("c/d", 0);
+
+  AggregationPolicy policy;
+  policy.enabled = true;
+  policy.minSiblings = 4;
+  std::vector<Subscription> wire;
+  aggregateFilters(reg, policy, wire);
+
+  TEST_ASSERT_EQUAL_UINT32(2, wire.size());
+  bool found = false;
+  for (const auto &w : wire) {
+    if (w.filter == "a/b/+") {
+      found = true;
+      TEST_ASSERT_EQUAL_UINT8(1, w.qos);
+    }
+  }
+  TEST_ASSERT_TRUE(found);
+}
+
+void test_aggregation_respects_policy() {
+  SubscriptionRegistry reg;
+  reg.add("a/1", 0);
+  reg.add("a/2", 0);
+  reg.add("a/#", 0);
+  reg.add("x/1", 0);
+  reg.add("x/2", 0);
+
+  AggregationPolicy policy;
+  std::vector<Subscription> wire;
+  aggregateFilters(reg, policy, wire);
+  TEST_ASSERT_EQUAL_UINT32(5, wire.size()); // disabled: one wire filter per subscription
+
+  policy.enabled = true;
+  policy.minSiblings = 3;
+  aggregateFilters(reg, policy, wire);
+  TEST_ASSERT_EQUAL_UINT32(3, wire.size()); // a/# absorbs a/1, a/2; x/* below threshold
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_topic_matching);
+  RUN_TEST(test_filter_validation);
+  RUN_TEST(test_registry_add_updates_qos);
+  RUN_TEST(test_registry_reconnect_state);
+  RUN_TEST(test_filter_covers);
+  RUN_TEST(test_aggregation_collapses_siblings);
+  RUN_TEST(test_aggregation_respects_policy);
+  return UNITY_END();
+}
@@ -0,0 +1,63 @@
+#include <unity.h>
+#include <stdio.h>
+#include "TopicSketch.h"
+
+void test_exact_below_capacity() {
+  TopicSketch s;
+  s.add("a/1", 100);
+  s.add("a/2", 10);
+  s.add("a/1", 50);
+  TopicCount out[4];
+  TEST_ASSERT_EQUAL_UINT32(2, s.top(out, 4));
+  TEST_ASSERT_EQUAL_STRING("a/1", out[0].topic);
+  TEST_ASSERT_EQUAL_UINT32(2, out[0].messages);
+  TEST_ASSERT_EQUAL_UINT32(150, out[0].bytes);
+  TEST_ASSERT_EQUAL_UINT32(0, out[0].errorBytes);
+}
+
+void test_heavy_hitter_survives_high_cardinality() {
+  TopicSketch s;
+  char topic[32];
+  for (int i = 0; i < 2000; i++) {
+    s.add("video/stream", 1000);
+    snprintf(topic, sizeof(topic), "sensor/%d", i);
+    s.add(topic, 20);
+  }
+  TEST_ASSERT_EQUAL_UINT32(TopicSketch::kCapacity, s.size());
+  TopicCount out[1];
+  TEST_ASSERT_EQUAL_UINT32(1, s.top(out, 1));
+  TEST_ASSERT_EQUAL_STRING("video/stream", out[0].topic);
+  TEST_ASSERT_EQUAL_UINT32(2000000, out[0].bytes);
+  TEST_ASSERT_EQUAL_UINT32(2000, out[0].messages);
+}
+
+void test_replacement_inherits_error() {
+  TopicSketch s;
+  char topic[32];
+  for (size_t i = 0; i < TopicSketch::kCapacity; i++) {
+    snprintf(topic, sizeof(topic), "t/%u", (unsigned)i);
+    s.add(topic, 100 + (uint32_t)i);
+  }
+  s.add("new", 5);
+  TopicCount out[TopicSketch::kCapacity];
+  size_t n = s.top(out, TopicSketch::kCapacity);
+  bool found = false;
+  for (size_t i = 0; i < n; i++) {
+    if (TopicSketch::hash("new") == out[i].hash) {
+      found = true;
+      TEST_ASSERT_EQUAL_UINT32(105, out[i].bytes); // replaced "t/0" with 100 bytes
+      TEST_ASSERT_EQUAL_UINT32(100, out[i].errorBytes);
+      TEST_ASSERT_EQUAL_UINT32(1, out[i].errorMessages);
+      TEST_ASSERT_EQUAL_UINT32(2, out[i].messages);
+    }
+  }
+  TEST_ASSERT_TRUE(found);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_exact_below_capacity);
+  RUN_TEST(test_heavy_hitter_survives_high_cardinality);
+  RUN_TEST(test_replacement_inherits_error);
+  return UNITY_END();
+}
@@ -0,0 +1,96 @@
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "MessageTrace.h"
+
+void test_sampling_ratio() {
+  MessageTrace trace;
+  trace.setSampling(4);
+  int sampled = 0;
+  for (int i = 0; i < 100; i++) {
+    if (trace.begin()) sampled++;
+  }
+  TEST_ASSERT_EQUAL_INT(25, sampled);
+
+  trace.setSampling(0);
+  TEST_ASSERT_EQUAL_UINT32(0, trace.begin());
+}
+
+void test_unsampled_messages_record_nothing() {
+  MessageTrace trace;
+  trace.record(0, TraceStage::Enqueue, 10);
+  TraceEvent events[4];
+  TEST_ASSERT_EQUAL_UINT32(0, trace.snapshot(events, 4));
+}
+
+void test_ring_keeps_newest_events() {
+  MessageTrace trace;
+  uint32_t id = trace.begin();
+  for (uint32_t i = 0; i < MessageTrace::kCapacity + 5; i++) {
+    trace.record(id, TraceStage::Receive, i);
+  }
+  static TraceEvent events[MessageTrace::kCapacity];
+  TEST_ASSERT_EQUAL_UINT32(MessageTrace::kCapacity, trace.snapshot(events, MessageTrace::kCapacity));
+  TEST_ASSERT_EQUAL_UINT32(5, events[0].timestampUs);
+  TEST_ASSERT_EQUAL_UINT32(MessageTrace::kCapacity + 4, events[MessageTrace::kCapacity - 1].timestampUs);
+}
+
+void test_chrome_export_pairs_stages() {
+  MessageTrace trace;
+  uint32_t out = trace.begin();
+  uint32_t in = trace.begin();
+  trace.record(out, TraceStage::Enqueue, 100);
+  trace.record(in, TraceStage::Receive, 150);
+  trace.record(out, TraceStage::WireWrite, 120);
+  trace.record(in, TraceStage::Dispatch, 160);
+  trace.record(out, TraceStage::Ack, 900);
+  trace.record(in, TraceStage::HandlerDone, 400);
+
+  char buf[2048] = {0};
+  FILE *f = fmemopen(buf, sizeof(buf) - 1, "w");
+  TEST_ASSERT_TRUE(trace.writeChromeTrace(f));
+  fclose(f);
+
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"name\":\"wire-write\",\"cat\":\"outbound\",\"ph\":\"e\",\"id\":1,\"pid\":1,\"tid\":1,\"ts\":900"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "\"name\":\"dispatch\",\"cat\":\"inbound\",\"ph\":\"b\",\"id\":2,\"pid\":1,\"tid\":2,\"ts\":160"));
+  TEST_ASSERT_NULL(strstr(buf, "handler-done")); // last stage opens no interval
+}
+
+// The esp-mqtt task records while the application takes a snapshot: a copy racing the
+// writer is dropped, never returned half old and half new
+void test_snapshot_racing_writer_never_tears() {
+  static MessageTrace trace;
+  std::atomic<bool> writing(true);
+  std::thread writer([&] {
+    for (uint32_t id = 1; id <= 200000; id++) {
+      trace.record(id, static_cast<TraceStage>(id % static_cast<uint32_t>(TraceStage::Count)), id * 7);
+    }
+    writing = false;
+  });
+  static TraceEvent events[MessageTrace::kCapacity];
+  uint32_t torn = 0;
+  while (writing.load()) {
+    size_t n = trace.snapshot(events, MessageTrace::kCapacity);
+    for (size_t i = 0; i < n; i++) {
+      const TraceEvent &e = events[i];
+      if (e.timestampUs != e.traceId * 7 ||
+          static_cast<uint32_t>(e.stage) != e.traceId % static_cast<uint32_t>(TraceStage::Count)) {
+        torn++;
+      }
+    }
+  }
+  writer.join();
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_EQUAL_UINT32(MessageTrace::kCapacity, trace.snapshot(events, MessageTrace::kCapacity));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_sampling_ratio);
+  RUN_TEST(test_unsampled_messages_record_nothing);
+  RUN_TEST(test_ring_keeps_newest_events);
+  RUN_TEST(test_chrome_export_pairs_stages);
+  RUN_TEST(test_snapshot_racing_writer_never_tears);
+  return UNITY_END();
+}